@@ -0,0 +1,350 @@
+/**
+ * @file bench_pubsub.c
+ * @brief Generador de carga y medidor de latencia para un broker en marcha (TCP o UDP).
+ *
+ * Abre S suscriptores y P publicadores sobre T tópicos (`bench/t0` ..
+ * `bench/t<T-1>`), cada uno en su hilo. El suscriptor i sigue el tópico i % T
+ * y cada publicador recorre los T tópicos en orden, enviando `PUB` tan rápido
+ * como puede (o a la tasa total fijada con -r) durante D segundos. Al final
+ * informa:
+ *
+ *  - **publicados/s**: PUB enviados por todos los publicadores;
+ *  - **entregados/s**: MSG recibidos sumando todos los suscriptores (un PUB
+ *    cuenta una vez por suscriptor de su tópico);
+ *  - **perdidos**: entregas esperadas que no llegaron (suscriptores del
+ *    tópico de cada PUB menos lo recibido; en TCP solo por desborde de colas);
+ *  - **latencia** p50 / p99 / p99.9 / máx de extremo a extremo: cada payload
+ *    empieza con el instante de envío (reloj monotónico, mismo equipo) y cada
+ *    suscriptor lo resta al recibirlo. Las muestras van a un histograma HDR
+ *    por suscriptor (bench/hdr_hist.h, 3 dígitos significativos) que se suman
+ *    al terminar.
+ *
+ * A máxima velocidad la latencia mide sobre todo colas llenas; con -r se fija
+ * la tasa total de PUBs y la latencia refleja el camino del broker.
+ *
+ * Para comparar corridas:
+ *  - -j imprime el resultado como una línea JSON (en lugar del texto);
+ *  - -h <archivo> guarda la distribución completa de latencias (µs) en el
+ *    formato .hgrm de HdrHistogram.
+ * bench/compare.sh corre la misma carga contra ambos brokers y junta las
+ * líneas JSON; bench/scaling.sh la repite con 1, 2, 4 y 8 workers.
+ *
+ * Con -u se mide el broker UDP (cada PUB es un datagrama; lo que se pierda en
+ * los buffers del kernel cuenta como perdido). Los suscriptores mandan PING
+ * cada 15 s, como subscriber_udp, para que el lease del broker (-l) no los
+ * dé de baja en corridas largas.
+ *
+ * **Compilación** (desde la raíz del repositorio, solo POSIX):
+ * @code
+ *   gcc -O2 -pthread bench/bench_pubsub.c -o bench/output/bench_pubsub -lm
+ * @endcode
+ *
+ * **Uso:**
+ * @code
+ *   bench_pubsub [-u] [-p publicadores] [-s suscriptores] [-T tópicos] [-d segundos]
+ *                [-n bytes] [-r PUBs/s] [-j] [-h archivo.hgrm] [host]
+ * @endcode
+ */
+
+#include "../common/threads.h"
+#include "hdr_hist.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#define TCP_PORT   8080
+#define UDP_PORT   8081
+#define TOPIC_PREFIX "bench/t"
+#define MAX_THREADS 256
+#define MAX_TOPICS  1000
+#define LINES_PER_SEND 64   // PUBs por send() en TCP
+#define STAMP_LEN  16       // instante de envío en hexadecimal al inicio del payload
+#define PING_NS    (15LL * 1000000000LL)  // PING de los suscriptores UDP (lease del broker)
+
+/* Rango de los histogramas: hasta 60 s en ns, 3 dígitos significativos. */
+#define LAT_HIGHEST  (60LL * 1000000000LL)
+#define LAT_DIGITS   3
+
+static int   udp;                 // 1 = broker UDP
+static int   payload_len = 16;    // -n
+static double rate;               // -r: PUBs/s en total (0 = sin límite)
+static int   npub = 8, nsub = 8;  // -p / -s
+static int   ntopics = 1;         // -T
+static struct sockaddr_in broker;
+static atomic_int publishing = 1;  // los publicadores paran al terminar la medición
+static atomic_int running = 1;     // los suscriptores, tras recibir lo que estaba en vuelo
+
+/* Espera tras la medición para que llegue lo que aún estaba en colas. */
+#define DRAIN_NS  500000000
+
+/* Contadores por hilo (cada uno escribe solo el suyo). */
+static long        published[MAX_THREADS];
+static long       *pub_topic[MAX_THREADS];   // PUBs por tópico de cada publicador
+static atomic_long delivered[MAX_THREADS];   // atómico: main lo lee al cortar
+static hdr_hist_t  latency[MAX_THREADS];
+
+/* Reloj monotónico en nanosegundos. */
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+/* Reloj monotónico en segundos. */
+static double now_s(void) {
+    return now_ns() / 1e9;
+}
+
+/* Registra la latencia del payload que empieza en p (STAMP_LEN dígitos hex). */
+static void record(long idx, const char *p, uint64_t now) {
+    uint64_t t = 0;
+    for (int i = 0; i < STAMP_LEN; i++) {
+        char c = p[i];
+        t = (t << 4) | (uint64_t)(c <= '9' ? c - '0' : c - 'a' + 10);
+    }
+    hdr_record(&latency[idx], now > t ? (int64_t)(now - t) : 0);
+    atomic_fetch_add_explicit(&delivered[idx], 1, memory_order_relaxed);
+}
+
+/* Registra un "MSG <topic> <payload>" de len bytes (sin '\n'); ignora lo demás. */
+static void record_msg(long idx, const char *line, int len, uint64_t now) {
+    if (len < 4 || memcmp(line, "MSG ", 4) != 0) return;
+    const char *sp = (const char*)memchr(line + 4, ' ', len - 4);
+    if (sp && line + len - (sp + 1) >= STAMP_LEN) record(idx, sp + 1, now);
+}
+
+/* Abre un socket hacia el broker (TCP conectado o UDP con destino fijo). */
+static int open_broker(void) {
+    int s = socket(AF_INET, udp ? SOCK_DGRAM : SOCK_STREAM, 0);
+    if (s < 0 || connect(s, (struct sockaddr*)&broker, sizeof(broker)) != 0) {
+        perror("connect");
+        exit(1);
+    }
+    if (!udp) {
+        int one = 1;
+        setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    // Un recv() bloqueado vuelve cada 200 ms para ver si la medición terminó.
+    struct timeval tv = { 0, 200000 };
+    setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    return s;
+}
+
+/* Línea "PUB bench/t<topic> <stamp><relleno>\n" con payload de payload_len bytes. */
+static int format_pub(char *out, int topic, uint64_t t) {
+    static const char hex[] = "0123456789abcdef";
+    int n = sprintf(out, "PUB " TOPIC_PREFIX "%d ", topic);
+    for (int i = STAMP_LEN - 1; i >= 0; i--, t >>= 4) out[n + i] = hex[t & 15];
+    memset(out + n + STAMP_LEN, 'x', payload_len - STAMP_LEN);
+    out[n + payload_len] = '\n';
+    return n + payload_len + 1;
+}
+
+static void *subscriber(void *arg) {
+    long idx = (long)arg;
+    int s = open_broker();
+    char buf[65536 + 256];
+    int have = 0;  // bytes de una línea incompleta al inicio de buf
+
+    char sub[64];
+    int n = snprintf(sub, sizeof(sub), "SUB " TOPIC_PREFIX "%ld\n", idx % ntopics);
+    send(s, sub, n, 0);
+    uint64_t next_ping = now_ns() + PING_NS;
+
+    while (atomic_load(&running)) {
+        ssize_t r = recv(s, buf + have, sizeof(buf) - have - 1, 0);
+        uint64_t now = now_ns();
+        if (udp && now >= next_ping) {  // el PONG no empieza con MSG: record_msg() lo ignora
+            send(s, "PING\n", 5, 0);
+            next_ping = now + PING_NS;
+        }
+        if (r <= 0) continue;
+        if (udp) {
+            record_msg(idx, buf, (int)r, now);
+            continue;
+        }
+
+        // TCP: separar líneas; la última puede llegar partida entre dos recv()
+        char *p = buf, *end = buf + have + r;
+        char *nl;
+        while ((nl = (char*)memchr(p, '\n', end - p)) != NULL) {
+            record_msg(idx, p, (int)(nl - p), now);
+            p = nl + 1;
+        }
+        have = (int)(end - p);
+        if (have >= 256) have = 0;  // línea absurda: descartarla
+        memmove(buf, p, have);
+    }
+    close(s);
+    return NULL;
+}
+
+/* Espera hasta el instante t (ns) para respetar -r. */
+static void pace(uint64_t t) {
+    uint64_t now = now_ns();
+    if (t <= now) return;
+    struct timespec ts = { (time_t)((t - now) / 1000000000u), (long)((t - now) % 1000000000u) };
+    nanosleep(&ts, NULL);
+}
+
+static void *publisher(void *arg) {
+    long idx = (long)arg;
+    int s = open_broker();
+    int burst = udp ? 1 : LINES_PER_SEND;
+    char *block = (char*)malloc((size_t)burst * 256);
+    long *per_topic = pub_topic[idx];
+    int topic = (int)(idx % ntopics);  // cada publicador arranca en otro tópico
+
+    // Con -r cada publicador envía rate/npub PUBs por segundo, en ráfagas de burst
+    double gap_ns = rate > 0 ? 1e9 * burst * npub / rate : 0;
+    uint64_t next = now_ns();
+
+    while (atomic_load(&publishing)) {
+        if (gap_ns > 0) { pace(next); next += (uint64_t)gap_ns; }
+        uint64_t t = now_ns();
+        int len = 0, first = topic;
+        for (int i = 0; i < burst; i++) {
+            len += format_pub(block + len, topic, t);
+            if (++topic == ntopics) topic = 0;
+        }
+        if (send(s, block, (size_t)len, 0) < 0) {
+            topic = first;
+            if (udp) continue;  // buffer lleno: se pierde el datagrama
+            break;
+        }
+        published[idx] += burst;
+        for (int i = 0; i < burst; i++) {
+            per_topic[first]++;
+            if (++first == ntopics) first = 0;
+        }
+    }
+    free(block);
+    close(s);
+    return NULL;
+}
+
+int main(int argc, char **argv) {
+    double secs = 5;
+    const char *host = "127.0.0.1";
+    const char *hgrm = NULL;
+    int json = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if      (strcmp(argv[i], "-u") == 0) udp = 1;
+        else if (strcmp(argv[i], "-j") == 0) json = 1;
+        else if (strcmp(argv[i], "-p") == 0 && i+1 < argc) npub = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-s") == 0 && i+1 < argc) nsub = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-T") == 0 && i+1 < argc) ntopics = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-d") == 0 && i+1 < argc) secs = atof(argv[++i]);
+        else if (strcmp(argv[i], "-n") == 0 && i+1 < argc) payload_len = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-r") == 0 && i+1 < argc) rate = atof(argv[++i]);
+        else if (strcmp(argv[i], "-h") == 0 && i+1 < argc) hgrm = argv[++i];
+        else if (argv[i][0] != '-') host = argv[i];
+        else {
+            fprintf(stderr, "Uso: %s [-u] [-p publicadores] [-s suscriptores] [-T tópicos] "
+                            "[-d segundos] [-n bytes] [-r PUBs/s] [-j] [-h archivo.hgrm] [host]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+    if (npub < 1 || nsub < 1 || npub + nsub > MAX_THREADS || ntopics < 1 || ntopics > MAX_TOPICS ||
+        payload_len < STAMP_LEN || payload_len > 200) {
+        fprintf(stderr, "parámetros fuera de rango\n");
+        return 1;
+    }
+
+    memset(&broker, 0, sizeof(broker));
+    broker.sin_family = AF_INET;
+    broker.sin_port   = htons(udp ? UDP_PORT : TCP_PORT);
+    if (inet_pton(AF_INET, host, &broker.sin_addr) != 1) {
+        fprintf(stderr, "host inválido: %s\n", host);
+        return 1;
+    }
+
+    for (int i = 0; i < nsub; i++) {
+        if (hdr_init(&latency[i], LAT_HIGHEST, LAT_DIGITS) != 0) { perror("hdr_init"); return 1; }
+    }
+    for (int i = nsub; i < nsub + npub; i++) {
+        if (!(pub_topic[i] = (long*)calloc(ntopics, sizeof(long)))) { perror("calloc"); return 1; }
+    }
+
+    thread_t th[MAX_THREADS];
+    for (long i = 0; i < nsub; i++) thread_start(&th[i], subscriber, (void*)i);
+
+    // Dar tiempo a que los SUB lleguen antes de publicar
+    struct timespec pause = { 0, 300000000 };
+    nanosleep(&pause, NULL);
+
+    double t0 = now_s();
+    for (long i = 0; i < npub; i++) thread_start(&th[nsub + i], publisher, (void*)(nsub + i));
+    while (now_s() - t0 < secs) nanosleep(&pause, NULL);
+    atomic_store(&publishing, 0);
+    double elapsed = now_s() - t0;
+
+    // Entregas dentro de la ventana (para la tasa); luego se deja drenar lo
+    // que estaba en vuelo para no contarlo como perdido.
+    long in_window = 0;
+    for (int i = 0; i < nsub; i++) in_window += atomic_load(&delivered[i]);
+    struct timespec drain = { 0, DRAIN_NS };
+    nanosleep(&drain, NULL);
+    atomic_store(&running, 0);
+
+    for (int i = 0; i < nsub + npub; i++) thread_join(th[i]);
+
+    // Totales: entregas esperadas = PUBs de cada tópico x suscriptores del tópico
+    long pubs = 0, msgs = 0, expected = 0;
+    hdr_hist_t all;
+    if (hdr_init(&all, LAT_HIGHEST, LAT_DIGITS) != 0) { perror("hdr_init"); return 1; }
+    for (int i = 0; i < nsub; i++) {
+        msgs += atomic_load(&delivered[i]);
+        hdr_add(&all, &latency[i]);
+    }
+    for (int i = nsub; i < nsub + npub; i++) {
+        pubs += published[i];
+        for (int t = 0; t < ntopics; t++) {
+            long subs_t = nsub / ntopics + (t < nsub % ntopics);
+            expected += pub_topic[i][t] * subs_t;
+        }
+    }
+    long lost = expected > msgs ? expected - msgs : 0;
+    double lost_pct = expected ? 100.0 * lost / expected : 0;
+
+    double p50 = hdr_percentile(&all, 50) / 1e3, p99 = hdr_percentile(&all, 99) / 1e3;
+    double p999 = hdr_percentile(&all, 99.9) / 1e3, max = all.max / 1e3;
+    if (!all.total) max = 0;
+
+    if (json) {
+        printf("{\"proto\":\"%s\",\"pub\":%d,\"sub\":%d,\"topics\":%d,\"payload\":%d,"
+               "\"rate\":%.0f,\"seconds\":%.3f,\"published\":%ld,\"delivered\":%ld,"
+               "\"expected\":%ld,\"published_per_s\":%.0f,\"delivered_per_s\":%.0f,"
+               "\"lost_pct\":%.3f,\"latency_us\":{\"p50\":%.1f,\"p99\":%.1f,\"p99_9\":%.1f,"
+               "\"max\":%.1f,\"mean\":%.1f}}\n",
+               udp ? "udp" : "tcp", npub, nsub, ntopics, payload_len, rate, elapsed,
+               pubs, msgs, expected, pubs / elapsed, in_window / elapsed, lost_pct,
+               p50, p99, p999, max, hdr_mean(&all) / 1e3);
+    } else {
+        printf("%s  pub=%d sub=%d topics=%d payload=%dB  publicados/s=%.0f  entregados/s=%.0f  "
+               "perdidos=%.2f%%  p50=%.1fus p99=%.1fus p99.9=%.1fus max=%.1fus\n",
+               udp ? "udp" : "tcp", npub, nsub, ntopics, payload_len, pubs / elapsed, in_window / elapsed,
+               lost_pct, p50, p99, p999, max);
+    }
+
+    if (hgrm) {
+        FILE *f = fopen(hgrm, "w");
+        if (!f) { perror(hgrm); return 1; }
+        hdr_print_hgrm(&all, f, 1e3);
+        fclose(f);
+    }
+
+    hdr_free(&all);
+    for (int i = 0; i < nsub; i++) hdr_free(&latency[i]);
+    for (int i = nsub; i < nsub + npub; i++) free(pub_topic[i]);
+    return 0;
+}
@@ -0,0 +1,218 @@
+/**
+ * @file bench_snapshot.c
+ * @brief Tiempo de arranque del broker UDP con un snapshot de N suscripciones (-P).
+ *
+ * Escribe un snapshot con el formato de broker_udp.c (ver "Snapshot de la
+ * tabla de suscriptores") y N suscripciones repartidas en tópicos
+ * `liga<L>/partido<P>/<evento>` (T tópicos, 100.000 por defecto: unas diez
+ * suscripciones por tópico): cada dirección (10.x.y.z, puerto propio)
+ * sigue K tópicos al azar, uno de cada cuatro confiable y la mitad en binario, como
+ * una tabla real. Después arranca el broker con `-P <archivo>` R veces, lee
+ * la línea que imprime al terminar la carga
+ * (`snapshot ...: <n> suscripciones en <ms> ms`) y lo detiene.
+ *
+ * Lo que se mide es exactamente snap_load() del broker: internar los
+ * tópicos, dar de alta las direcciones en su tabla hash y cada suscripción en
+ * el índice, con el archivo ya mapeado. Se reporta el mínimo, la mediana y el
+ * máximo, y suscripciones por segundo. La documentación del broker dice que
+ * 1M de suscripciones cargan en unos 55 ms; esta es la forma de comprobarlo.
+ *
+ * El broker escucha en su puerto de siempre (8081): no debe haber otro
+ * corriendo. Los leases quedan desactivados (-l 0) para que no venza nada
+ * durante la medición.
+ *
+ * **Compilación** (desde la raíz del repositorio, solo POSIX):
+ * @code
+ *   gcc -O2 -pthread udp/broker_udp.c udp/udp_utils.c common/topic_index.c common/topic_registry.c common/msg_log.c common/stats.c -o bench/output/broker_udp
+ *   gcc -O2 bench/bench_snapshot.c -o bench/output/bench_snapshot
+ * @endcode
+ *
+ * **Uso:**
+ * @code
+ *   bench_snapshot [-n suscripciones] [-T tópicos] [-k tópicos por dirección]
+ *                  [-r repeticiones] [-b broker_udp] [-o archivo]
+ * @endcode
+ */
+
+#ifndef _POSIX_C_SOURCE
+  #define _POSIX_C_SOURCE 200809L  // fdopen(), kill() también con -std=c11
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#define PARTIDOS  1000
+#define EVENTOS   4
+
+/* Formato del snapshot (el mismo que SNAP_* en udp/broker_udp.c). */
+#define SNAP_MAGIC    "PSUBSNP1"
+#define SNAP_HDR      20
+#define SNAP_SUB      12
+#define SNAP_BINARY   1
+#define SNAP_RELIABLE 2
+
+#define RUNS_MAX 64
+
+static const char *eventos[EVENTOS] = { "goles", "tarjetas", "cambios", "var" };
+
+/* Generador pseudoaleatorio xorshift (reproducible, sin depender de rand()). */
+static uint32_t rng = 2463534242u;
+static uint32_t next_rand(void) {
+    rng ^= rng << 13; rng ^= rng >> 17; rng ^= rng << 5;
+    return rng;
+}
+
+static void put16(unsigned char *p, uint16_t v) { p[0] = (unsigned char)(v >> 8); p[1] = (unsigned char)v; }
+static void put32(unsigned char *p, uint32_t v) {
+    p[0] = (unsigned char)(v >> 24); p[1] = (unsigned char)(v >> 16);
+    p[2] = (unsigned char)(v >> 8);  p[3] = (unsigned char)v;
+}
+
+/*
+ * Escribe el snapshot: ntopics tópicos liga/partido/evento y nsubs
+ * suscripciones, k por dirección.
+ * Devuelve 0 si ok, -1 si no se pudo escribir.
+ */
+static int write_snapshot(const char *path, uint32_t nsubs, uint32_t ntopics, uint32_t k) {
+    size_t cap = (size_t)ntopics * 48;
+    unsigned char *topics = (unsigned char*)malloc(cap);
+    unsigned char *subs = (unsigned char*)malloc((size_t)nsubs * SNAP_SUB);
+    if (!topics || !subs) { free(topics); free(subs); return -1; }
+
+    size_t tlen = 0;
+    for (uint32_t i = 0; i < ntopics; i++) {
+        unsigned char *t = topics + tlen;
+        int n = snprintf((char*)t + 10, 38, "liga%u/partido%u/%s", i / (PARTIDOS * EVENTOS),
+                         i / EVENTOS % PARTIDOS, eventos[i % EVENTOS]);
+        // Uno de cada 400 numera (historial o confiables): pocos, dentro del
+        // máximo de tópicos retenidos del broker (-N).
+        put32(t, i % 400 == 0 ? 1 + next_rand() % 5000 : 0);
+        put32(t + 4, 0);  // publicados en el último período
+        put16(t + 8, (uint16_t)n);
+        size_t sz = (10 + (size_t)n + 3) & ~(size_t)3;
+        memset(t + 10 + n, 0, sz - 10 - n);
+        tlen += sz;
+    }
+
+    for (uint32_t i = 0; i < nsubs; i++) {
+        unsigned char *q = subs + (size_t)i * SNAP_SUB;
+        uint32_t peer = i / k;  // k suscripciones seguidas por dirección
+        put32(q, next_rand() % ntopics);
+        q[4] = 10;
+        q[5] = (unsigned char)(peer >> 16);
+        q[6] = (unsigned char)(peer >> 8);
+        q[7] = (unsigned char)peer;
+        put16(q + 8, (uint16_t)(20000 + (peer >> 24)));
+        q[10] = (unsigned char)((i % 2 ? SNAP_BINARY : 0) | (i % 4 == 0 ? SNAP_RELIABLE : 0));
+        q[11] = 0;
+    }
+
+    unsigned char h[SNAP_HDR];
+    memcpy(h, SNAP_MAGIC, 8);
+    put32(h + 8, ntopics);
+    put32(h + 12, nsubs);
+    put32(h + 16, (uint32_t)tlen);
+
+    FILE *f = fopen(path, "wb");
+    int ok = f && fwrite(h, 1, SNAP_HDR, f) == SNAP_HDR && fwrite(topics, 1, tlen, f) == tlen &&
+             fwrite(subs, SNAP_SUB, nsubs, f) == nsubs;
+    if (f && fclose(f) != 0) ok = 0;
+    free(topics);
+    free(subs);
+    if (!ok) perror(path);
+    return ok ? 0 : -1;
+}
+
+/*
+ * Arranca el broker con el snapshot, espera la línea de la carga y lo detiene.
+ * Devuelve los ms que informó, o -1 si no la imprimió.
+ */
+static double run_broker(const char *broker, const char *path, long *loaded) {
+    int fds[2];
+    if (pipe(fds) != 0) { perror("pipe"); return -1; }
+    fflush(stdout);  // que el hijo no repita lo que quedó en el buffer
+    pid_t pid = fork();
+    if (pid < 0) { perror("fork"); return -1; }
+    if (pid == 0) {
+        dup2(fds[1], STDERR_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+        if (!freopen("/dev/null", "w", stdout)) _exit(127);
+        execl(broker, broker, "-P", path, "-l", "0", "-t", "1", (char*)NULL);
+        perror(broker);
+        _exit(127);
+    }
+    close(fds[1]);
+    FILE *in = fdopen(fds[0], "r");
+    char line[512];
+    double ms = -1;
+    while (in && fgets(line, sizeof(line), in)) {
+        const char *p = strstr(line, "snapshot ");
+        if (p && (p = strchr(p, ':')) && sscanf(p + 1, "%ld suscripciones en %lf ms", loaded, &ms) == 2)
+            break;
+        fputs(line, stderr);  // errores del broker (puerto ocupado, snapshot inválido...)
+    }
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+    if (in) fclose(in);
+    return ms;
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return x < y ? -1 : x > y;
+}
+
+int main(int argc, char **argv) {
+    uint32_t nsubs = 1000000, ntopics = 100000, k = 4;
+    int runs = 5;
+    const char *broker = "bench/output/broker_udp";
+    const char *path = "bench/output/bench.snap";
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-n") == 0 && i+1 < argc && atol(argv[i+1]) > 0) {
+            nsubs = (uint32_t)atol(argv[++i]);
+        } else if (strcmp(argv[i], "-T") == 0 && i+1 < argc && atol(argv[i+1]) > 0) {
+            ntopics = (uint32_t)atol(argv[++i]);
+        } else if (strcmp(argv[i], "-k") == 0 && i+1 < argc && atoi(argv[i+1]) > 0) {
+            k = (uint32_t)atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-r") == 0 && i+1 < argc && atoi(argv[i+1]) > 0
+                   && atoi(argv[i+1]) <= RUNS_MAX) {
+            runs = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-b") == 0 && i+1 < argc) {
+            broker = argv[++i];
+        } else if (strcmp(argv[i], "-o") == 0 && i+1 < argc) {
+            path = argv[++i];
+        } else {
+            fprintf(stderr, "Uso: %s [-n suscripciones] [-T tópicos] [-k tópicos por dirección] "
+                            "[-r repeticiones(1..%d)] [-b broker_udp] [-o archivo]\n",
+                    argv[0], RUNS_MAX);
+            return 1;
+        }
+    }
+
+    if (write_snapshot(path, nsubs, ntopics, k) != 0) return 1;
+    printf("snapshot %s: %u suscripciones, %u direcciones, %u tópicos\n",
+           path, nsubs, (nsubs + k - 1) / k, ntopics);
+
+    double ms[RUNS_MAX];
+    long loaded = 0;
+    for (int r = 0; r < runs; r++) {
+        if ((ms[r] = run_broker(broker, path, &loaded)) < 0) {
+            fprintf(stderr, "%s no informó la carga del snapshot\n", broker);
+            return 1;
+        }
+        printf("  corrida %d: %ld suscripciones en %.1f ms\n", r + 1, loaded, ms[r]);
+    }
+    qsort(ms, runs, sizeof(ms[0]), cmp_double);
+    printf("%-10s %10s %10s %10s %14s\n", "subs", "min ms", "mediana", "max ms", "Msubs/s");
+    printf("%-10ld %10.1f %10.1f %10.1f %14.2f\n", loaded, ms[0], ms[runs / 2], ms[runs - 1],
+           ms[runs / 2] > 0 ? loaded / ms[runs / 2] / 1000.0 : 0.0);
+    remove(path);
+    return 0;
+}
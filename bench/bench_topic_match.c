@@ -0,0 +1,194 @@
+/**
+ * @file bench_topic_match.c
+ * @brief Microbenchmark del registro de tópicos: coincidencia exacta vs. patrones.
+ *
+ * Construye un registro con tópicos jerárquicos del estilo
+ * `liga<L>/partido<P>/<evento>` y mide el coste por publicación de:
+ *
+ *  - **exacto**: topic_lookup() + recorrido de la lista del tópico, sin
+ *    ningún patrón registrado (el camino de siempre del broker);
+ *  - **trie**: lo mismo más topic_match() con N suscripciones con comodines
+ *    (`liga<L>/partido<P>/+`, `liga<L>/+/<evento>`, `liga<L>/#`), para N
+ *    hasta 1.000.000;
+ *  - **lineal** (referencia): comparar el tópico contra cada patrón, que es
+ *    lo que costaría sin trie. Solo se mide hasta 100.000 patrones.
+ *
+ * Se reportan dos tiempos: solo la búsqueda (lookup + trie, contando
+ * patrones coincidentes) y la publicación completa (recorriendo además las
+ * listas de suscriptores). La búsqueda debe mantenerse casi plana al crecer
+ * N, porque depende de la profundidad del tópico y no de la cantidad de
+ * patrones; la publicación completa crece solo con las entregas.
+ *
+ * **Compilación** (desde la raíz del repositorio):
+ * @code
+ *   gcc -O2 bench/bench_topic_match.c common/topic_index.c -o bench/output/bench_topic_match
+ * @endcode
+ *
+ * **Uso:**
+ * @code
+ *   bench_topic_match [publicaciones]
+ * @endcode
+ */
+
+#include "../common/topic_index.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define LIGAS     100
+#define PARTIDOS  1000
+#define EVENTOS   4
+
+static const char *eventos[EVENTOS] = { "goles", "tarjetas", "cambios", "var" };
+
+/* Reloj monotónico en nanosegundos (C11, disponible en MinGW y glibc). */
+static double now_ns(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* Generador pseudoaleatorio xorshift (reproducible, sin depender de rand()). */
+static uint32_t rng = 2463534242u;
+static uint32_t next_rand(void) {
+    rng ^= rng << 13; rng ^= rng >> 17; rng ^= rng << 5;
+    return rng;
+}
+
+/* Acumulador de entregas: evita que el compilador elimine el trabajo medido. */
+typedef struct {
+    const topic_index_t *ix;
+    uint64_t delivered;
+} sink_t;
+
+static void count_match(topic_id_t id, void *arg) {
+    (void)id;
+    ((sink_t*)arg)->delivered++;
+}
+
+static void count_subs(topic_id_t id, void *arg) {
+    sink_t *k = (sink_t*)arg;
+    uint32_t n;
+    topic_sub_t **subs = topic_subscribers(k->ix, id, &n);
+    for (uint32_t i = 0; i < n; i++) k->delivered += (uintptr_t)subs[i]->owner & 1;
+}
+
+/* Coincidencia lineal de un patrón contra un tópico (referencia sin trie). */
+static int naive_match(const char *pat, const char *topic) {
+    while (*pat) {
+        if (pat[0] == '#') return 1;
+        if (pat[0] == '+') {
+            while (*topic && *topic != '/') topic++;
+            pat++;
+        } else {
+            while (*pat && *pat != '/') {
+                if (*pat != *topic) return 0;
+                pat++; topic++;
+            }
+            if (*topic && *topic != '/') return 0;
+        }
+        if (*pat == '/') {
+            if (*topic != '/') return pat[1] == '#' && *topic == '\0';
+            pat++; topic++;
+        }
+    }
+    return *topic == '\0';
+}
+
+/* Tópicos a publicar: mezcla aleatoria de liga/partido/evento. */
+#define MAX_NAME_PUB 48
+static char (*make_pubs(int npubs))[MAX_NAME_PUB] {
+    char (*t)[MAX_NAME_PUB] = malloc((size_t)npubs * MAX_NAME_PUB);
+    for (int i = 0; i < npubs; i++)
+        snprintf(t[i], MAX_NAME_PUB, "liga%u/partido%u/%s", next_rand() % LIGAS,
+                 next_rand() % PARTIDOS, eventos[next_rand() % EVENTOS]);
+    return t;
+}
+
+/* Registra un tópico exacto con un suscriptor por cada liga/partido/evento. */
+static void add_exact(topic_index_t *ix) {
+    char name[64];
+    for (int l = 0; l < LIGAS; l++)
+        for (int p = 0; p < PARTIDOS; p++)
+            for (int e = 0; e < EVENTOS; e++) {
+                int n = snprintf(name, sizeof(name), "liga%d/partido%d/%s", l, p, eventos[e]);
+                topic_subscribe(ix, topic_intern(ix, name, n), (void*)(uintptr_t)1);
+            }
+}
+
+/* Agrega nsubs suscripciones con comodines repartidas entre los tres tipos de patrón. */
+static void add_patterns(topic_index_t *ix, int nsubs, char (**pats)[64], int *npats) {
+    char name[64];
+    *pats  = malloc((size_t)nsubs * 64);
+    *npats = 0;
+    for (int i = 0; i < nsubs; i++) {
+        int n, kind = i % 8;
+        if (kind < 6)       n = snprintf(name, sizeof(name), "liga%u/partido%u/+", next_rand() % LIGAS, next_rand() % PARTIDOS);
+        else if (kind == 6) n = snprintf(name, sizeof(name), "liga%u/+/%s", next_rand() % LIGAS, eventos[next_rand() % EVENTOS]);
+        else                n = snprintf(name, sizeof(name), "liga%u/#", next_rand() % LIGAS);
+        topic_id_t id = topic_intern(ix, name, n);
+        if (ix->topics[id].nsubs == 0) memcpy((*pats)[(*npats)++], name, n + 1);
+        topic_subscribe(ix, id, (void*)(uintptr_t)1);
+    }
+}
+
+static double run_trie(topic_index_t *ix, char (*pubs)[MAX_NAME_PUB], int npubs,
+                       topic_match_fn fn, uint64_t *delivered) {
+    sink_t k = { ix, 0 };
+    double t0 = now_ns();
+    for (int i = 0; i < npubs; i++) {
+        int len = (int)strlen(pubs[i]);
+        topic_id_t id = topic_lookup(ix, pubs[i], len);
+        if (id != TOPIC_NONE) fn(id, &k);
+        topic_match(ix, pubs[i], len, fn, &k);
+    }
+    *delivered = k.delivered;
+    return (now_ns() - t0) / npubs;
+}
+
+static double run_naive(char (*pats)[64], int npats, char (*pubs)[MAX_NAME_PUB], int npubs) {
+    volatile uint64_t hits = 0;
+    double t0 = now_ns();
+    for (int i = 0; i < npubs; i++)
+        for (int p = 0; p < npats; p++)
+            hits += naive_match(pats[p], pubs[i]);
+    return (now_ns() - t0) / npubs;
+}
+
+int main(int argc, char **argv) {
+    int npubs = argc > 1 ? atoi(argv[1]) : 200000;
+    if (npubs <= 0) npubs = 200000;
+    char (*pubs)[MAX_NAME_PUB] = make_pubs(npubs);
+
+    printf("%-10s %10s %10s %12s %12s %14s %14s\n", "subs_wild", "patrones", "exactos",
+           "ns/busqueda", "ns/pub", "entregas/pub", "ns/lineal");
+
+    static const int sizes[] = { 0, 1000, 10000, 100000, 1000000 };
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        topic_index_t ix;
+        topic_index_init(&ix);
+        add_exact(&ix);
+
+        char (*pats)[64] = NULL;
+        int npats = 0;
+        if (sizes[s]) add_patterns(&ix, sizes[s], &pats, &npats);
+
+        uint64_t matched, delivered;
+        double ns_match = run_trie(&ix, pubs, npubs, count_match, &matched);
+        double ns_pub   = run_trie(&ix, pubs, npubs, count_subs, &delivered);
+
+        char lineal[32] = "-";
+        if (npats && npats <= 100000) {
+            int n = npubs < 2000 ? npubs : 2000;  // la referencia lineal es lenta
+            snprintf(lineal, sizeof(lineal), "%.0f", run_naive(pats, npats, pubs, n));
+        }
+        printf("%-10d %10d %10u %12.1f %12.1f %14.2f %14s\n", sizes[s], npats,
+               ix.ntopics - (uint32_t)npats, ns_match, ns_pub, (double)delivered / npubs, lineal);
+
+        free(pats);
+        topic_index_free(&ix);
+    }
+    free(pubs);
+    return 0;
+}
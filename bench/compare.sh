@@ -0,0 +1,39 @@
+#!/bin/sh
+# Misma carga contra el broker TCP y el UDP, con resultados comparables (Linux).
+#
+# Compila ambos brokers y bench_pubsub en bench/output/, levanta cada broker,
+# lo mide con bench_pubsub -j y lo detiene. Cada corrida agrega una línea JSON
+# a bench/output/results.jsonl (con la fecha y el commit) y deja la
+# distribución de latencias en bench/output/<proto>-<fecha>.hgrm.
+# Argumentos extra se pasan a bench_pubsub (p.ej. -p 4 -s 16 -T 8 -r 50000);
+# BROKER_ARGS se pasa a ambos brokers (p.ej. BROKER_ARGS="-t 4").
+#
+# Uso (desde cualquier carpeta):
+#   sh bench/compare.sh [opciones de bench_pubsub]
+
+set -e
+cd "$(dirname "$0")/.."
+mkdir -p bench/output
+
+gcc -O2 -pthread tcp/broker_tcp.c tcp/tcp_utils.c common/topic_index.c common/topic_registry.c common/msg_log.c common/stats.c \
+    -o bench/output/broker_tcp
+gcc -O2 -pthread udp/broker_udp.c udp/udp_utils.c common/topic_index.c common/topic_registry.c common/msg_log.c common/stats.c \
+    -o bench/output/broker_udp
+gcc -O2 -pthread bench/bench_pubsub.c -o bench/output/bench_pubsub -lm
+
+stamp=$(date +%Y%m%d-%H%M%S)
+commit=$(git rev-parse --short HEAD 2>/dev/null || echo "?")
+for proto in tcp udp; do
+    flag=""
+    [ "$proto" = udp ] && flag="-u"
+    ./bench/output/broker_$proto $BROKER_ARGS > /dev/null &
+    pid=$!
+    sleep 0.3
+    line=$(./bench/output/bench_pubsub $flag -j -h "bench/output/$proto-$stamp.hgrm" "$@")
+    kill $pid
+    wait $pid 2>/dev/null || true
+    # Anteponer fecha, commit y argumentos del broker al objeto JSON
+    line="{\"date\":\"$stamp\",\"commit\":\"$commit\",\"broker_args\":\"$BROKER_ARGS\",${line#\{}"
+    echo "$line"
+    echo "$line" >> bench/output/results.jsonl
+done
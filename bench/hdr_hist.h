@@ -0,0 +1,177 @@
+/**
+ * @file hdr_hist.h
+ * @brief Histograma de rango dinámico alto (estilo HdrHistogram) para latencias.
+ *
+ * Registra valores enteros (nanosegundos en bench_pubsub) con una precisión
+ * relativa fija en todo el rango: con 3 dígitos significativos el error es
+ * menor a 0,1% tanto en 2 µs como en 2 s. Cada potencia de 2 se divide en el
+ * mismo número de sub-buckets, así que registrar es O(1) (un clz y un
+ * desplazamiento) y la memoria crece con el logaritmo del rango, no con él.
+ *
+ *  - hdr_init(): rango [0, highest] y dígitos significativos (1 a 5).
+ *  - hdr_record(): suma un valor; lo que supera highest cuenta en highest.
+ *  - hdr_add(): acumula otro histograma de la misma configuración (uno por
+ *    hilo, sumados al final).
+ *  - hdr_percentile(): valor en el percentil p (0..100).
+ *  - hdr_print_hgrm(): distribución de percentiles en el formato de texto de
+ *    HdrHistogram (.hgrm), que leen sus herramientas de gráficos.
+ *
+ * Módulo solo de cabecera (enlazar con -lm por sqrt()).
+ */
+
+#ifndef HDR_HIST_H
+#define HDR_HIST_H
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef struct {
+    int      sub_bits;  ///< log2 de la mitad de sub-buckets por potencia de 2.
+    int      len;       ///< Cantidad de contadores.
+    int64_t  highest;   ///< Mayor valor registrable.
+    int64_t *counts;
+    int64_t  total;     ///< Valores registrados.
+    int64_t  min, max;  ///< Extremos exactos.
+} hdr_hist_t;
+
+/* log2 entero (v > 0). */
+static inline int hdr_log2(uint64_t v) {
+    return 63 - __builtin_clzll(v);
+}
+
+/* Índice del contador de v. */
+static inline int hdr_index(const hdr_hist_t *h, int64_t v) {
+    int s = h->sub_bits;
+    if (v < ((int64_t)2 << s)) return (int)v;
+    int shift = hdr_log2((uint64_t)v) - s;
+    return (2 << s) + (shift - 1) * (1 << s) + (int)((v >> shift) - (1 << s));
+}
+
+/* Mayor valor que cae en el contador i. */
+static inline int64_t hdr_value_at(const hdr_hist_t *h, int i) {
+    int s = h->sub_bits;
+    if (i < (2 << s)) return i;
+    int shift = (i - (2 << s)) / (1 << s) + 1;
+    int64_t top = (i - (2 << s)) % (1 << s) + (1 << s);
+    return ((top + 1) << shift) - 1;
+}
+
+/**
+ * @brief Prepara un histograma vacío.
+ * @param highest Mayor valor a distinguir (>= 2).
+ * @param digits  Dígitos significativos (1..5).
+ * @return 0 si ok, -1 si los parámetros no son válidos o no hay memoria.
+ */
+static inline int hdr_init(hdr_hist_t *h, int64_t highest, int digits) {
+    if (digits < 1 || digits > 5 || highest < 2) return -1;
+    int64_t need = 2;
+    for (int i = 0; i < digits; i++) need *= 10;     // 2 * 10^digits sub-buckets
+    int bits = hdr_log2((uint64_t)(need - 1)) + 1;   // ceil(log2(need))
+    h->sub_bits = bits - 1;
+    h->highest  = highest;
+    h->len      = hdr_index(h, highest) + 1;
+    h->counts   = (int64_t*)calloc((size_t)h->len, sizeof(int64_t));
+    h->total    = 0;
+    h->min      = INT64_MAX;
+    h->max      = 0;
+    return h->counts ? 0 : -1;
+}
+
+/** @brief Libera los contadores. */
+static inline void hdr_free(hdr_hist_t *h) {
+    free(h->counts);
+    h->counts = NULL;
+}
+
+/** @brief Registra un valor (negativos cuentan como 0, mayores que highest como highest). */
+static inline void hdr_record(hdr_hist_t *h, int64_t v) {
+    if (v < 0) v = 0;
+    if (v < h->min) h->min = v;
+    if (v > h->max) h->max = v;
+    if (v > h->highest) v = h->highest;
+    h->counts[hdr_index(h, v)]++;
+    h->total++;
+}
+
+/** @brief Suma src en dst (misma configuración). */
+static inline void hdr_add(hdr_hist_t *dst, const hdr_hist_t *src) {
+    for (int i = 0; i < dst->len; i++) dst->counts[i] += src->counts[i];
+    dst->total += src->total;
+    if (src->min < dst->min) dst->min = src->min;
+    if (src->max > dst->max) dst->max = src->max;
+}
+
+/**
+ * @brief Valor en el percentil p (0..100): el menor v tal que al menos p% de
+ *        los valores registrados son <= v (con la precisión del histograma).
+ * @return El valor, o 0 si el histograma está vacío.
+ */
+static inline int64_t hdr_percentile(const hdr_hist_t *h, double p) {
+    if (h->total == 0) return 0;
+    if (p >= 100.0) return h->max;
+    int64_t need = (int64_t)(p / 100.0 * (double)h->total + 0.5);
+    if (need < 1) need = 1;
+    int64_t acc = 0;
+    for (int i = 0; i < h->len; i++) {
+        acc += h->counts[i];
+        if (acc >= need) {
+            int64_t v = hdr_value_at(h, i);
+            return v < h->max ? v : h->max;
+        }
+    }
+    return h->max;
+}
+
+/** @brief Media (con la precisión del histograma). */
+static inline double hdr_mean(const hdr_hist_t *h) {
+    if (h->total == 0) return 0;
+    double sum = 0;
+    for (int i = 0; i < h->len; i++)
+        if (h->counts[i]) sum += (double)h->counts[i] * (double)hdr_value_at(h, i);
+    return sum / (double)h->total;
+}
+
+/** @brief Desviación estándar (con la precisión del histograma). */
+static inline double hdr_stddev(const hdr_hist_t *h) {
+    if (h->total == 0) return 0;
+    double mean = hdr_mean(h), sum = 0;
+    for (int i = 0; i < h->len; i++) {
+        if (!h->counts[i]) continue;
+        double d = (double)hdr_value_at(h, i) - mean;
+        sum += (double)h->counts[i] * d * d;
+    }
+    return sqrt(sum / (double)h->total);
+}
+
+/**
+ * @brief Escribe la distribución de percentiles en formato .hgrm.
+ * @param scale Divisor de los valores al imprimir (p.ej. 1000 para ns -> µs).
+ */
+static inline void hdr_print_hgrm(const hdr_hist_t *h, FILE *out, double scale) {
+    fprintf(out, "%12s %14s %10s %14s\n\n", "Value", "Percentile", "TotalCount", "1/(1-Percentile)");
+    if (h->total == 0) return;
+
+    // Como HdrHistogram: 5 puntos por cada mitad de lo que falta hasta 100%.
+    int64_t acc = 0;
+    int i = 0;
+    for (double step = 50.0, p = 0.0; ; ) {
+        int64_t need = (int64_t)(p / 100.0 * (double)h->total + 0.5);
+        if (need < 1) need = 1;
+        while (acc < need && i < h->len) acc += h->counts[i++];
+        int64_t v = hdr_value_at(h, i > 0 ? i - 1 : 0);
+        if (v > h->max) v = h->max;
+        double q = (double)acc / (double)h->total;
+        if (q >= 1.0) break;
+        fprintf(out, "%12.3f %14.12f %10lld %14.2f\n", v / scale, q, (long long)acc, 1.0 / (1.0 - q));
+        p += step / 5.0;
+        if (p >= 100.0 - step + 1e-9) step /= 2.0;
+        if (step < 1e-6) break;
+    }
+    fprintf(out, "%12.3f %14.12f %10lld %14s\n", h->max / scale, 1.0, (long long)h->total, "inf");
+    fprintf(out, "#[Mean    = %12.3f, StdDeviation   = %12.3f]\n", hdr_mean(h) / scale, hdr_stddev(h) / scale);
+    fprintf(out, "#[Max     = %12.3f, Total count    = %12lld]\n", h->max / scale, (long long)h->total);
+}
+
+#endif /* HDR_HIST_H */
@@ -0,0 +1,34 @@
+#!/bin/sh
+# Escalado de los brokers con 1, 2, 4 y 8 workers (Linux).
+#
+# Compila ambos brokers y bench_pubsub en bench/output/, y para cada
+# protocolo y cantidad de workers levanta el broker, mide con bench_pubsub
+# y lo detiene. Argumentos extra se pasan a bench_pubsub (p.ej. -d 10 -p 16).
+#
+# Uso (desde cualquier carpeta):
+#   sh bench/scaling.sh [opciones de bench_pubsub]
+
+set -e
+cd "$(dirname "$0")/.."
+mkdir -p bench/output
+
+gcc -O2 -pthread tcp/broker_tcp.c tcp/tcp_utils.c common/topic_index.c common/topic_registry.c common/msg_log.c common/stats.c \
+    -o bench/output/broker_tcp
+gcc -O2 -pthread udp/broker_udp.c udp/udp_utils.c common/topic_index.c common/topic_registry.c common/msg_log.c common/stats.c \
+    -o bench/output/broker_udp
+gcc -O2 -pthread bench/bench_pubsub.c -o bench/output/bench_pubsub -lm
+
+echo "núcleos: $(nproc)"
+for proto in tcp udp; do
+    flag=""
+    [ "$proto" = udp ] && flag="-u"
+    for t in 1 2 4 8; do
+        ./bench/output/broker_$proto -t $t > /dev/null &
+        pid=$!
+        sleep 0.3
+        printf "workers=%d  " "$t"
+        ./bench/output/bench_pubsub $flag "$@"
+        kill $pid
+        wait $pid 2>/dev/null || true
+    done
+done
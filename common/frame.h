@@ -0,0 +1,227 @@
+/**
+ * @file frame.h
+ * @brief Formato binario de tramas compartido por brokers y clientes TCP/UDP.
+ *
+ * Alternativa al protocolo textual ("SUB/PUB/MSG ...\n"): cada trama lleva una
+ * cabecera fija de FRAME_HDR bytes seguida de los bytes crudos del nombre del
+ * tópico y del payload, sin escapes ni límite de MAX_LINE. El payload puede
+ * contener '\n', '\0' o cualquier otro byte.
+ *
+ * Cabecera (enteros en orden de red):
+ * @code
+ *   0      1      2          4               8               12
+ *   +------+------+----------+---------------+---------------+
+ *   | 0xB5 |  op  | name_len |   topic id    |  payload len  |  name...  payload...
+ *   +------+------+----------+---------------+---------------+
+ * @endcode
+ *
+ *  - El primer byte (FRAME_MAGIC) no es ASCII, así que una trama nunca se
+ *    confunde con una línea de texto.
+ *  - topic id es el identificador interno del broker (topic_id_t). Las
+ *    respuestas OK a SUB y TOPIC lo informan; a partir de ahí un PUB puede
+ *    omitir el nombre (name_len = 0) y el broker no vuelve a buscarlo.
+ *    FRAME_NO_TOPIC indica "sin id, usar el nombre".
+ *  - Un id vale mientras el cliente lo retenga: lo retiene su suscripción
+ *    al tópico, o un TOPIC hasta que se cierre la conexión (TCP) o venza el
+ *    lease de la dirección (UDP). Un tópico que nadie retiene se libera y su
+ *    id puede pasar a otro; un id inexistente se rechaza como tópico inválido.
+ *
+ * Publicación con confirmación (FRAME_SPUB / FRAME_ACK): los primeros
+ * FRAME_SEQ_LEN bytes del payload son un número de secuencia de 32 bits (orden
+ * de red) elegido por el publicador; el resto es el payload publicado. El
+ * broker confirma con FRAME_ACK (payload = el número) de forma acumulativa:
+ * un ACK de n cubre todos los SPUB anteriores de esa conexión o dirección.
+ * En UDP el broker confirma el mayor número hasta el que llegaron todos (un
+ * hueco detiene el ACK) y no vuelve a publicar un número repetido, así que el
+ * publicador puede retransmitir lo no confirmado.
+ * Es el equivalente de "SPUB <seq> <topic> <mensaje>" / "ACK <seq>" en texto.
+ *
+ * Entrega confiable en UDP (FRAME_RSUB / FRAME_RMSG / FRAME_NACK / FRAME_LOST):
+ * un suscriptor confiable recibe FRAME_RMSG, cuyo payload empieza con el
+ * número de secuencia del mensaje dentro de su tópico. Si detecta un hueco
+ * pide el rango con FRAME_NACK (payload = desde y hasta, FRAME_SEQ_LEN bytes
+ * cada uno; hasta = 0 significa "hasta el último") y el broker retransmite lo
+ * que todavía retiene; lo que ya descartó lo informa con FRAME_LOST (mismo
+ * payload que NACK). En texto: "RSUB", "RMSG <seq> ...", "NACK", "LOST".
+ *
+ * Historial (FRAME_SUB / FRAME_RSUB con payload, FRAME_REPLAY): si el broker
+ * retiene los últimos mensajes de cada tópico, al suscribirse se reenvían
+ * como FRAME_MSG (o FRAME_RMSG) antes de los nuevos. Un SUB cuyo payload trae
+ * un número (FRAME_SEQ_LEN bytes) pide solo los retenidos desde ese número,
+ * como "SUB <topic> FROM <seq>" en texto. Al terminar el reenvío el broker
+ * manda FRAME_REPLAY con el número del próximo mensaje del tópico
+ * ("REPLAY <topic> <seq>" en texto).
+ *
+ * Leases en UDP (FRAME_PING / FRAME_PONG): el broker olvida una dirección
+ * que pasa un tiempo sin SUB ni PING. El suscriptor manda FRAME_PING cada
+ * tanto y el broker responde FRAME_PONG con la cantidad de suscripciones que
+ * le conoce (FRAME_SEQ_LEN bytes); 0 significa que hay que volver a
+ * suscribirse. En texto: "PING" / "PONG <n>".
+ *
+ * Heartbeat en TCP: cualquier cliente puede mandar FRAME_PING y recibe el
+ * mismo FRAME_PONG. El broker manda FRAME_PING (sin payload) a un suscriptor
+ * sin tráfico; el cliente puede responder FRAME_PONG sin payload.
+ *
+ * Métricas (FRAME_STATS): el cliente la manda sin payload y el broker
+ * responde con el texto de sus métricas, una por línea
+ * ("<métrica>{etiquetas} <valor>", ver common/stats.h). En TCP llega en una
+ * sola trama; en UDP, en tramas del tamaño de un datagrama y una última sin
+ * payload. En texto: "STATS", respondido con líneas "STAT ..." y "END".
+ *
+ * Traza (FRAME_TRACE, sin payload): en un broker compilado con PUBSUB_TRACE
+ * pide volcar los anillos de traza a un archivo (common/trace.h) y recibe
+ * FRAME_OK; sin traza, FRAME_ERR. En texto: "TRACE" / "OK TRACE".
+ *
+ * Negociación:
+ *  - TCP: la conexión empieza en modo texto; el cliente envía "BIN\n", el
+ *    broker responde "OK BIN\n" y desde ahí ambos lados hablan solo tramas.
+ *  - UDP: cada datagrama es una trama completa o una línea de texto; el broker
+ *    distingue por el primer byte y responde en el mismo formato.
+ *
+ * Clientes de texto y binarios conviven en el mismo broker: cada mensaje se
+ * codifica en el formato de cada suscriptor.
+ *
+ * Módulo solo de cabecera (funciones inline): no requiere cambiar la línea de
+ * compilación de los clientes.
+ */
+
+#ifndef FRAME_H
+#define FRAME_H
+
+#include <stdint.h>
+#include <string.h>
+
+/** Primer byte de toda trama binaria. */
+#define FRAME_MAGIC       0xB5
+/** Tamaño de la cabecera fija. */
+#define FRAME_HDR         12
+/** topic id "ausente": la trama identifica el tópico por nombre. */
+#define FRAME_NO_TOPIC    0xFFFFFFFFu
+/** Payload máximo aceptado (protege al broker de longitudes absurdas). */
+#define FRAME_MAX_PAYLOAD (16u * 1024 * 1024)
+
+/** Operaciones de una trama. */
+typedef enum {
+    FRAME_SUB   = 1,  ///< cliente -> broker: suscribir al nombre.
+    FRAME_UNSUB = 2,  ///< cliente -> broker: dar de baja el nombre o el id.
+    FRAME_PUB   = 3,  ///< cliente -> broker: publicar payload en el nombre o el id.
+    FRAME_MSG   = 4,  ///< broker -> suscriptor: mensaje publicado (id, nombre y payload).
+    FRAME_OK    = 5,  ///< broker -> cliente: confirmación (id y nombre del tópico).
+    FRAME_ERR   = 6,  ///< broker -> cliente: error (payload = motivo en texto).
+    FRAME_TOPIC = 7,  ///< cliente -> broker: resolver nombre -> id sin suscribirse.
+    FRAME_SPUB  = 8,  ///< cliente -> broker: PUB con número de secuencia (al inicio del payload).
+    FRAME_ACK   = 9,  ///< broker -> publicador: SPUB procesados hasta el número del payload.
+    FRAME_RSUB  = 10, ///< cliente -> broker (UDP): suscripción confiable al nombre.
+    FRAME_RMSG  = 11, ///< broker -> suscriptor confiable: número de secuencia + payload.
+    FRAME_NACK  = 12, ///< suscriptor -> broker: retransmitir el rango [desde, hasta].
+    FRAME_LOST  = 13, ///< broker -> suscriptor: el rango [desde, hasta] ya no está retenido.
+    FRAME_REPLAY = 14,///< broker -> suscriptor: fin del historial; payload = número del próximo mensaje.
+    FRAME_PING  = 15, ///< cliente -> broker: renovar el lease (UDP) / broker -> suscriptor: heartbeat (TCP).
+    FRAME_PONG  = 16, ///< respuesta a FRAME_PING: payload = suscripciones (vacío si la manda un cliente TCP).
+    FRAME_STATS = 17, ///< cliente -> broker: pedir métricas / broker -> cliente: texto de las métricas.
+    FRAME_TRACE = 18  ///< cliente -> broker: volcar la traza (common/trace.h); respuesta FRAME_OK o FRAME_ERR.
+} frame_op_t;
+
+/** Bytes de cada número de secuencia en el payload de SPUB, ACK, RMSG, NACK, LOST, REPLAY y PONG. */
+#define FRAME_SEQ_LEN     4
+
+/**
+ * @brief Trama decodificada. name y payload apuntan dentro del buffer original.
+ */
+typedef struct {
+    uint8_t     op;
+    uint32_t    topic;     ///< id del tópico o FRAME_NO_TOPIC.
+    const char *name;      ///< Nombre del tópico (no terminado en '\0').
+    uint16_t    name_len;
+    const char *payload;
+    uint32_t    len;       ///< Longitud del payload.
+} frame_t;
+
+static inline void frame_put16(unsigned char *p, uint16_t v) {
+    p[0] = (unsigned char)(v >> 8); p[1] = (unsigned char)v;
+}
+
+static inline void frame_put32(unsigned char *p, uint32_t v) {
+    p[0] = (unsigned char)(v >> 24); p[1] = (unsigned char)(v >> 16);
+    p[2] = (unsigned char)(v >> 8);  p[3] = (unsigned char)v;
+}
+
+static inline uint16_t frame_get16(const unsigned char *p) {
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static inline uint32_t frame_get32(const unsigned char *p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+/**
+ * @brief 1 si el número de secuencia a es posterior a b (aritmética modular:
+ *        la numeración puede dar la vuelta).
+ */
+static inline int seq_after(uint32_t a, uint32_t b) {
+    return (int32_t)(a - b) > 0;
+}
+
+/** @brief Tamaño total en bytes de una trama con ese nombre y payload. */
+static inline uint32_t frame_size(uint32_t name_len, uint32_t len) {
+    return FRAME_HDR + name_len + len;
+}
+
+/**
+ * @brief Escribe la cabecera y el nombre en out (el payload lo copia quien llama).
+ * @param out Al menos FRAME_HDR + name_len bytes.
+ * @return Bytes escritos (FRAME_HDR + name_len).
+ */
+static inline int frame_encode_head(char *out, int op, uint32_t topic,
+                                    const char *name, int name_len, uint32_t len) {
+    unsigned char *p = (unsigned char*)out;
+    p[0] = FRAME_MAGIC;
+    p[1] = (unsigned char)op;
+    frame_put16(p + 2, (uint16_t)name_len);
+    frame_put32(p + 4, topic);
+    frame_put32(p + 8, len);
+    if (name_len > 0) memcpy(out + FRAME_HDR, name, name_len);
+    return FRAME_HDR + name_len;
+}
+
+/**
+ * @brief Codifica una trama completa en out.
+ * @param out Al menos frame_size(name_len, len) bytes.
+ * @return Bytes escritos.
+ */
+static inline int frame_encode(char *out, int op, uint32_t topic, const char *name,
+                               int name_len, const char *payload, uint32_t len) {
+    int n = frame_encode_head(out, op, topic, name, name_len, len);
+    if (len > 0) memcpy(out + n, payload, len);
+    return n + (int)len;
+}
+
+/**
+ * @brief Decodifica la trama al inicio de buf.
+ *
+ * @param avail Bytes disponibles en buf.
+ * @return Tamaño total de la trama (puede ser mayor que avail: faltan datos y
+ *         f queda sin completar), 0 si aún no está la cabecera completa, o -1
+ *         si los bytes no son una trama válida.
+ */
+static inline long frame_decode(const char *buf, long avail, frame_t *f) {
+    const unsigned char *p = (const unsigned char*)buf;
+    if (avail < 1) return 0;
+    if (p[0] != FRAME_MAGIC) return -1;
+    if (avail < FRAME_HDR) return 0;
+
+    f->op       = p[1];
+    f->name_len = frame_get16(p + 2);
+    f->topic    = frame_get32(p + 4);
+    f->len      = frame_get32(p + 8);
+    if (f->len > FRAME_MAX_PAYLOAD) return -1;
+
+    long total = (long)frame_size(f->name_len, f->len);
+    if (avail >= total) {
+        f->name    = buf + FRAME_HDR;
+        f->payload = buf + FRAME_HDR + f->name_len;
+    }
+    return total;
+}
+
+#endif /* FRAME_H */
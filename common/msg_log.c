@@ -0,0 +1,520 @@
+/**
+ * @file msg_log.c
+ * @brief Log de mensajes de un tópico en segmentos mapeados (ver msg_log.h).
+ *
+ * Notas:
+ *  - Cada segmento guarda, además del mapa, la posición de cada uno de sus
+ *    registros: buscar un número es una búsqueda binaria entre segmentos y un
+ *    acceso directo dentro del segmento.
+ *  - Un registro se escribe de atrás hacia adelante (trama, seq, longitud):
+ *    si el proceso muere a mitad de camino, la longitud sigue en 0 y la
+ *    recuperación se detiene justo antes.
+ *  - La recuperación acepta registros mientras la numeración sea consecutiva
+ *    y las longitudes tengan sentido. Lo que sigue a un registro inválido se
+ *    pone en cero para que los nuevos no queden mezclados con basura.
+ *  - Cada segmento tiene su propia reserva (los punteros a él son estables) y
+ *    un contador de referencias: una del log mientras está en la lista y una
+ *    por cada msg_log_hold(). Al salir de la retención (log_trim()) el
+ *    archivo se borra enseguida, pero el mapa vive hasta la última
+ *    referencia: un envío en curso nunca lee memoria desmapeada.
+ */
+
+#include "msg_log.h"
+#include "frame.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if MSG_LOG_SUPPORTED
+
+#include <dirent.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/** Cabecera de cada registro: longitud total y número de secuencia. */
+#define REC_HDR 8
+
+/* Un archivo de segmento, mapeado completo. */
+struct msg_log_seg {
+    atomic_int refs;    // la del log mientras está en segs, más los msg_log_hold()
+    char     *base;
+    size_t    size;     // bytes del archivo (y del mapa)
+    size_t    used;     // bytes ocupados por registros
+    size_t    synced;   // hasta dónde se llevó a disco
+    uint32_t  first;    // número del primer registro
+    uint32_t  count;    // registros en el segmento
+    uint32_t *offs;     // posición de cada registro
+    uint32_t  offs_cap;
+};
+typedef struct msg_log_seg segment_t;
+
+struct msg_log {
+    char          *path;       // <dir>/<tópico escapado>
+    char          *name;       // nombre del tópico (para las tramas)
+    int            name_len;
+    size_t         seg_bytes;
+    size_t         keep_bytes; // retención: bytes de segmentos (0 = sin límite)
+    msg_log_sync_t sync;
+    segment_t    **segs;
+    uint32_t       nsegs, segs_cap;
+    uint32_t       first, next;
+    uint32_t       unsynced;   // mensajes agregados desde el último msync
+};
+
+static size_t align8(size_t n) { return (n + 7) & ~(size_t)7; }
+
+static size_t page_size(void) {
+    static size_t pg;
+    if (!pg) pg = (size_t)sysconf(_SC_PAGESIZE);
+    return pg;
+}
+
+/* Nombre de directorio para el tópico: todo lo que no es alfanumérico, '-' o
+ * '_' va como %XX ('/' y '.' incluidos, así nunca sale "..", ni subcarpetas). */
+static char *escape_topic(const char *topic, int tlen) {
+    static const char hex[] = "0123456789ABCDEF";
+    char *out = (char*)malloc((size_t)tlen * 3 + 1);
+    if (!out) return NULL;
+    char *p = out;
+    for (int i = 0; i < tlen; i++) {
+        unsigned char c = (unsigned char)topic[i];
+        if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+            c == '-' || c == '_') {
+            *p++ = (char)c;
+        } else {
+            *p++ = '%';
+            *p++ = hex[c >> 4];
+            *p++ = hex[c & 15];
+        }
+    }
+    *p = '\0';
+    return out;
+}
+
+static int hex_digit(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return -1;
+}
+
+/* Inversa de escape_topic() (en el mismo buffer). Devuelve la longitud, o -1. */
+static int unescape_topic(char *s) {
+    char *out = s;
+    for (const char *p = s; *p; p++) {
+        if (*p != '%') { *out++ = *p; continue; }
+        int hi = hex_digit(p[1]), lo = hi < 0 ? -1 : hex_digit(p[2]);
+        if (lo < 0) return -1;
+        *out++ = (char)(hi << 4 | lo);
+        p += 2;
+    }
+    *out = '\0';
+    return (int)(out - s);
+}
+
+static int ensure_dir(const char *path) {
+    if (mkdir(path, 0755) == 0 || errno == EEXIST) return 0;
+    perror(path);
+    return -1;
+}
+
+/* Hace durable la entrada de un archivo nuevo en el directorio. */
+static void sync_dir(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return;
+    fsync(fd);
+    close(fd);
+}
+
+static int seg_add_offset(segment_t *sg, size_t off) {
+    if (sg->count == sg->offs_cap) {
+        uint32_t cap = sg->offs_cap ? sg->offs_cap * 2 : 1024;
+        uint32_t *o = (uint32_t*)realloc(sg->offs, cap * sizeof(*o));
+        if (!o) return -1;
+        sg->offs     = o;
+        sg->offs_cap = cap;
+    }
+    sg->offs[sg->count++] = (uint32_t)off;
+    return 0;
+}
+
+/* Reserva un segmento vacío y su lugar al final de segs (lo ocupa quien
+ * incrementa nsegs). */
+static segment_t *log_push_segment(msg_log_t *log) {
+    if (log->nsegs == log->segs_cap) {
+        uint32_t cap = log->segs_cap ? log->segs_cap * 2 : 8;
+        segment_t **s = (segment_t**)realloc(log->segs, cap * sizeof(*s));
+        if (!s) return NULL;
+        log->segs     = s;
+        log->segs_cap = cap;
+    }
+    segment_t *sg = (segment_t*)calloc(1, sizeof(*sg));
+    if (!sg) return NULL;
+    atomic_init(&sg->refs, 1);
+    log->segs[log->nsegs] = sg;
+    return sg;
+}
+
+/* Suelta una referencia; la última desmapea y libera el segmento. */
+static void seg_unref(segment_t *sg) {
+    if (atomic_fetch_sub_explicit(&sg->refs, 1, memory_order_acq_rel) != 1) return;
+    if (sg->base) munmap(sg->base, sg->size);
+    free(sg->offs);
+    free(sg);
+}
+
+/* Aplica la retención: mientras los segmentos ocupen más de keep_bytes, borra
+ * el más viejo (nunca el último, donde se escribe) y first avanza. */
+static void log_trim(msg_log_t *log) {
+    if (!log->keep_bytes) return;
+    size_t total = 0;
+    for (uint32_t i = 0; i < log->nsegs; i++) total += log->segs[i]->size;
+    uint32_t drop = 0;
+    while (drop + 1 < log->nsegs && total > log->keep_bytes) {
+        segment_t *sg = log->segs[drop++];
+        char file[4096];
+        snprintf(file, sizeof file, "%s/%010u.seg", log->path, sg->first);
+        if (unlink(file) != 0) perror(file);
+        total -= sg->size;
+        seg_unref(sg);  // el mapa sigue mientras alguien lo tenga retenido
+    }
+    if (!drop) return;
+    memmove(log->segs, log->segs + drop, (log->nsegs - drop) * sizeof(*log->segs));
+    log->nsegs -= drop;
+    log->first  = log->segs[0]->first;
+}
+
+/* Mapea un archivo de segmento ya abierto (lectura y escritura). */
+static char *map_file(int fd, size_t size) {
+    void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    return p == MAP_FAILED ? NULL : (char*)p;
+}
+
+/* Crea el segmento que empieza en el número first, con lugar para al menos need bytes. */
+static segment_t *log_new_segment(msg_log_t *log, uint32_t first, size_t need) {
+    char file[4096];
+    size_t size = log->seg_bytes;
+    if (size < need) size = align8(need);
+    snprintf(file, sizeof file, "%s/%010u.seg", log->path, first);
+
+    segment_t *sg = log_push_segment(log);
+    if (!sg) return NULL;
+    int fd = open(file, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || ftruncate(fd, (off_t)size) != 0 || !(sg->base = map_file(fd, size))) {
+        perror(file);
+        if (fd >= 0) close(fd);
+        seg_unref(sg);
+        return NULL;
+    }
+    close(fd);
+    sg->size  = size;
+    sg->first = first;
+    if (log->sync.every_msgs || log->sync.every_ms) sync_dir(log->path);
+    log->nsegs++;
+    log_trim(log);
+    return sg;
+}
+
+/* Recorre los registros de un segmento recién mapeado desde el número expected.
+ * Devuelve 1 si el segmento terminó limpio (longitud 0 o fin del archivo). */
+static int seg_scan(segment_t *sg, uint32_t expected) {
+    size_t off = 0;
+    while (off + REC_HDR <= sg->size) {
+        const unsigned char *p = (const unsigned char*)sg->base + off;
+        uint32_t rec_len = frame_get32(p);
+        if (rec_len == 0) break;
+        uint32_t seq = frame_get32(p + 4);
+        if (rec_len < REC_HDR + FRAME_HDR || rec_len > sg->size - off ||
+            seq != expected || p[REC_HDR] != FRAME_MAGIC ||
+            frame_size(frame_get16(p + REC_HDR + 2), frame_get32(p + REC_HDR + 8))
+                != rec_len - REC_HDR) {
+            sg->used = sg->synced = off;
+            return 0;
+        }
+        if (seg_add_offset(sg, off) != 0) break;
+        expected++;
+        off += align8(rec_len);
+    }
+    sg->used = sg->synced = off < sg->size ? off : sg->size;
+    return 1;
+}
+
+static int cmp_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+/* Vuelve a mapear los segmentos que ya había en el directorio del tópico. */
+static int log_recover(msg_log_t *log) {
+    DIR *d = opendir(log->path);
+    if (!d) { perror(log->path); return -1; }
+    uint32_t *firsts = NULL, n = 0, cap = 0;
+    struct dirent *e;
+    while ((e = readdir(d)) != NULL) {
+        unsigned first;
+        char tail[8];
+        if (sscanf(e->d_name, "%10u.%4s", &first, tail) != 2 || strcmp(tail, "seg") != 0) continue;
+        if (n == cap) {
+            cap = cap ? cap * 2 : 16;
+            uint32_t *f = (uint32_t*)realloc(firsts, cap * sizeof(*f));
+            if (!f) break;
+            firsts = f;
+        }
+        firsts[n++] = first;
+    }
+    closedir(d);
+    if (n == 0) { free(firsts); return 0; }
+    qsort(firsts, n, sizeof(*firsts), cmp_u32);
+
+    log->first = log->next = firsts[0];
+    uint32_t i = 0;
+    for (; i < n; i++) {
+        char file[4096];
+        snprintf(file, sizeof file, "%s/%010u.seg", log->path, firsts[i]);
+        if (firsts[i] != log->next) break;  // hueco: lo que sigue no se puede usar
+        int fd = open(file, O_RDWR);
+        struct stat stt;
+        if (fd < 0 || fstat(fd, &stt) != 0 || stt.st_size < REC_HDR) {
+            if (fd >= 0) close(fd);
+            break;
+        }
+        segment_t *sg = log_push_segment(log);
+        if (!sg) { close(fd); break; }
+        sg->size = (size_t)stt.st_size;
+        sg->base = map_file(fd, sg->size);
+        close(fd);
+        if (!sg->base) { perror(file); seg_unref(sg); break; }
+        sg->first = firsts[i];
+        log->nsegs++;
+        int clean = seg_scan(sg, log->next);
+        log->next += sg->count;
+        if (!clean) {
+            fprintf(stderr, "[LOG] %s: registro inválido tras el %u, se trunca\n",
+                    file, log->next - 1);
+            memset(sg->base + sg->used, 0, sg->size - sg->used);
+            i++;
+            break;
+        }
+    }
+    // Lo que quedó después de un hueco o de un registro inválido no se puede
+    // encadenar: se borra para que no reaparezca en el próximo arranque.
+    for (; i < n; i++) {
+        char file[4096];
+        snprintf(file, sizeof file, "%s/%010u.seg", log->path, firsts[i]);
+        fprintf(stderr, "[LOG] %s: descartado (se esperaba el %u)\n", file, log->next);
+        unlink(file);
+    }
+    free(firsts);
+    log_trim(log);  // la retención pudo achicarse desde el último arranque
+    return 0;
+}
+
+msg_log_t *msg_log_open(const char *dir, const char *topic, int tlen, size_t seg_bytes,
+                        size_t keep_bytes, const msg_log_sync_t *sync) {
+    msg_log_t *log = (msg_log_t*)calloc(1, sizeof(*log));
+    if (!log) return NULL;
+    char *esc = escape_topic(topic, tlen);
+    log->path = esc ? (char*)malloc(strlen(dir) + strlen(esc) + 2) : NULL;
+    log->name = (char*)malloc((size_t)tlen + 1);
+    if (!log->path || !log->name) {
+        free(esc);
+        msg_log_close(log);
+        return NULL;
+    }
+    sprintf(log->path, "%s/%s", dir, esc);
+    free(esc);
+    memcpy(log->name, topic, tlen);
+    log->name[tlen] = '\0';
+    log->name_len  = tlen;
+    log->seg_bytes = seg_bytes ? seg_bytes : MSG_LOG_SEGMENT;
+    log->keep_bytes = keep_bytes;
+    if (sync) log->sync = *sync;
+    log->first = log->next = 1;
+
+    if (ensure_dir(dir) != 0 || ensure_dir(log->path) != 0 || log_recover(log) != 0) {
+        msg_log_close(log);
+        return NULL;
+    }
+    return log;
+}
+
+int msg_log_topics(const char *dir, void (*fn)(void *arg, const char *topic, int tlen), void *arg) {
+    DIR *d = opendir(dir);
+    if (!d) return 0;
+    int n = 0;
+    struct dirent *e;
+    while ((e = readdir(d)) != NULL) {
+        char name[256];
+        if (e->d_name[0] == '.') continue;  // escape_topic() nunca genera '.'
+        snprintf(name, sizeof name, "%s", e->d_name);
+        int len = unescape_topic(name);
+        if (len <= 0) continue;
+        fn(arg, name, len);
+        n++;
+    }
+    closedir(d);
+    return n;
+}
+
+void msg_log_close(msg_log_t *log) {
+    if (!log) return;
+    for (uint32_t i = 0; i < log->nsegs; i++) {
+        segment_t *sg = log->segs[i];
+        if (sg->used > sg->synced) msync(sg->base, sg->used, MS_SYNC);
+        seg_unref(sg);
+    }
+    free(log->segs);
+    free(log->path);
+    free(log->name);
+    free(log);
+}
+
+uint32_t msg_log_first(const msg_log_t *log) { return log->first; }
+
+uint32_t msg_log_next(const msg_log_t *log) { return log->next; }
+
+/* msync del tramo [synced, used) del segmento, redondeado a página. */
+static void seg_sync(segment_t *sg) {
+    msg_log_range_t r;
+    size_t from = sg->synced & ~(page_size() - 1);
+    r.base = sg->base + from;
+    r.len  = sg->used - from;
+    r.seg  = NULL;  // con el lock: el segmento no puede irse
+    sg->synced = sg->used;
+    if (r.len) msg_log_sync_range(&r);
+}
+
+uint32_t msg_log_append(msg_log_t *log, const char *payload, uint32_t len) {
+    uint32_t frame_len = frame_size((uint32_t)log->name_len, len);
+    size_t   need      = align8(REC_HDR + (size_t)frame_len);
+    if ((size_t)REC_HDR + frame_len > UINT32_MAX) return 0;
+
+    segment_t *sg = log->nsegs ? log->segs[log->nsegs - 1] : NULL;
+    if (!sg || sg->used + need > sg->size) {
+        if (sg && sg->count == 0 && sg->size >= need) {
+            // segmento vacío (recuperado o recién creado): sirve tal cual
+        } else {
+            if (sg && (log->sync.every_msgs || log->sync.every_ms)) seg_sync(sg);
+            if (sg && sg->count == 0) {  // vacío pero chico: se reemplaza
+                log->nsegs--;
+                seg_unref(sg);
+            }
+            sg = log_new_segment(log, log->next, need);
+            if (!sg) return 0;
+        }
+    }
+    if (seg_add_offset(sg, sg->used) != 0) return 0;
+
+    unsigned char *p = (unsigned char*)sg->base + sg->used;
+    int h = frame_encode_head((char*)p + REC_HDR, FRAME_MSG, FRAME_NO_TOPIC,
+                              log->name, log->name_len, len);
+    if (len) memcpy(p + REC_HDR + h, payload, len);
+    uint32_t seq = log->next++;
+    frame_put32(p + 4, seq);
+    __atomic_thread_fence(__ATOMIC_RELEASE);  // la longitud, última: marca el registro completo
+    frame_put32(p, REC_HDR + frame_len);
+    sg->used += need;
+
+    if (log->sync.every_msgs && ++log->unsynced >= log->sync.every_msgs) {
+        log->unsynced = 0;
+        seg_sync(sg);
+    }
+    return seq;
+}
+
+int msg_log_get(const msg_log_t *log, uint32_t seq, msg_log_rec_t *rec) {
+    if (seq - log->first >= log->next - log->first) return -1;  // fuera de [first, next)
+    uint32_t d = seq - log->first, lo = 0, hi = log->nsegs;
+    while (hi - lo > 1) {  // último segmento que empieza antes o en seq
+        uint32_t mid = (lo + hi) / 2;
+        if (log->segs[mid]->first - log->first <= d) lo = mid; else hi = mid;
+    }
+    segment_t *sg = log->segs[lo];
+    uint32_t i = seq - sg->first;
+    if (i >= sg->count) return -1;
+    const unsigned char *p = (const unsigned char*)sg->base + sg->offs[i];
+    uint16_t nlen = frame_get16(p + REC_HDR + 2);
+    rec->frame     = (const char*)p + REC_HDR;
+    rec->frame_len = frame_get32(p) - REC_HDR;
+    rec->payload   = rec->frame + FRAME_HDR + nlen;
+    rec->len       = frame_get32(p + REC_HDR + 8);
+    rec->seg       = sg;
+    return 0;
+}
+
+void msg_log_hold(msg_log_seg_t *seg) {
+    if (seg) atomic_fetch_add_explicit(&seg->refs, 1, memory_order_relaxed);
+}
+
+void msg_log_release(msg_log_seg_t *seg) {
+    if (seg) seg_unref(seg);
+}
+
+void msg_log_sync_begin(msg_log_t *log, msg_log_range_t *r) {
+    r->base = NULL;
+    r->len  = 0;
+    r->seg  = NULL;
+    if (!log->nsegs) return;
+    segment_t *sg = log->segs[log->nsegs - 1];
+    if (sg->used == sg->synced) return;
+    size_t from = sg->synced & ~(page_size() - 1);
+    r->base = sg->base + from;
+    r->len  = sg->used - from;
+    r->seg  = sg;
+    msg_log_hold(sg);  // la retención podría sacarlo antes del msync
+    sg->synced = sg->used;
+    log->unsynced = 0;
+}
+
+int msg_log_sync_range(const msg_log_range_t *r) {
+    if (!r->len) return 0;
+    int rc = msync(r->base, r->len, MS_SYNC);
+    if (rc != 0) perror("msync");
+    msg_log_release(r->seg);
+    return rc != 0 ? -1 : 0;
+}
+
+#else  /* !MSG_LOG_SUPPORTED */
+
+msg_log_t *msg_log_open(const char *dir, const char *topic, int tlen, size_t seg_bytes,
+                        size_t keep_bytes, const msg_log_sync_t *sync) {
+    (void)dir; (void)topic; (void)tlen; (void)seg_bytes; (void)keep_bytes; (void)sync;
+    return NULL;
+}
+
+int msg_log_topics(const char *dir, void (*fn)(void *arg, const char *topic, int tlen), void *arg) {
+    (void)dir; (void)fn; (void)arg;
+    return 0;
+}
+
+void     msg_log_close(msg_log_t *log)            { (void)log; }
+uint32_t msg_log_first(const msg_log_t *log)      { (void)log; return 1; }
+uint32_t msg_log_next(const msg_log_t *log)       { (void)log; return 1; }
+
+uint32_t msg_log_append(msg_log_t *log, const char *payload, uint32_t len) {
+    (void)log; (void)payload; (void)len;
+    return 0;
+}
+
+int msg_log_get(const msg_log_t *log, uint32_t seq, msg_log_rec_t *rec) {
+    (void)log; (void)seq; (void)rec;
+    return -1;
+}
+
+void msg_log_hold(msg_log_seg_t *seg)    { (void)seg; }
+void msg_log_release(msg_log_seg_t *seg) { (void)seg; }
+
+void msg_log_sync_begin(msg_log_t *log, msg_log_range_t *r) {
+    (void)log;
+    r->base = NULL;
+    r->len  = 0;
+    r->seg  = NULL;
+}
+
+int msg_log_sync_range(const msg_log_range_t *r) { (void)r; return 0; }
+
+#endif /* MSG_LOG_SUPPORTED */
@@ -0,0 +1,149 @@
+/**
+ * @file msg_log.h
+ * @brief Log de mensajes de un tópico: solo se agrega, en segmentos mapeados en memoria.
+ *
+ * Modo durable de los brokers (-D): cada tópico escribe sus mensajes en
+ * <dir>/<tópico>/, un archivo por segmento con el nombre del número del primer
+ * mensaje que guarda (%010u.seg). Al reiniciar, el log se vuelve a abrir y la
+ * numeración sigue donde quedó.
+ *
+ *  - Cada segmento se crea de MSG_LOG_SEGMENT bytes (o más, si un mensaje no
+ *    entra) y se mapea completo: agregar es copiar al mapa, sin write().
+ *  - Registro: [longitud total u32][seq u32][trama FRAME_MSG], alineado a 8.
+ *    La trama lleva el nombre del tópico y topic id FRAME_NO_TOPIC, así que
+ *    se envía tal cual está en el mapa a un suscriptor binario (sin copia).
+ *    Una longitud 0 marca el final (el resto del archivo está en ceros).
+ *  - Durabilidad: lo agregado está en el page cache apenas se copia (sobrevive
+ *    a la caída del broker); msync() lo lleva a disco. La política la elige
+ *    quien abre el log: cada N mensajes (dentro de msg_log_append()) y/o cada
+ *    T ms (un hilo que llama a msg_log_sync_begin()/msg_log_sync_range()).
+ *  - Retención: con keep_bytes, al crear un segmento se borran los más viejos
+ *    mientras el log ocupe más que eso (siempre queda el segmento en curso) y
+ *    msg_log_first() avanza. Así un tópico no llena el disco.
+ *  - Los punteros de msg_log_get() valen mientras se tenga el lock. Para
+ *    usarlos sin él (enviar directo desde el mapa), msg_log_hold() retiene el
+ *    segmento: aunque la retención lo borre, sigue mapeado hasta el
+ *    msg_log_release() correspondiente.
+ *
+ * No es seguro entre hilos: quien lo comparte lo protege con un lock (ver
+ * common/retained.h). Solo POSIX (mmap/msync): en Windows msg_log_open()
+ * devuelve NULL y MSG_LOG_SUPPORTED vale 0.
+ *
+ * Compilación: añadir ../common/msg_log.c a la línea de gcc del broker.
+ */
+
+#ifndef MSG_LOG_H
+#define MSG_LOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef _WIN32
+  #define MSG_LOG_SUPPORTED 0
+#else
+  #define MSG_LOG_SUPPORTED 1
+#endif
+
+/** Tamaño por defecto de cada segmento. */
+#define MSG_LOG_SEGMENT (64u * 1024 * 1024)
+
+/** Retención por defecto de cada tópico: cuatro segmentos. */
+#define MSG_LOG_KEEP ((size_t)4 * MSG_LOG_SEGMENT)
+
+/**
+ * @brief Cuándo llevar a disco lo agregado (0 en ambos = lo decide el sistema).
+ */
+typedef struct {
+    uint32_t every_msgs;  ///< msync() cada N mensajes, al agregar (0 = no por cantidad).
+    uint32_t every_ms;    ///< msync() cada T ms desde un hilo aparte (0 = no por tiempo).
+} msg_log_sync_t;
+
+/** Log de un tópico (opaco). */
+typedef struct msg_log msg_log_t;
+
+/** Segmento de un log (opaco; ver msg_log_hold()). */
+typedef struct msg_log_seg msg_log_seg_t;
+
+/**
+ * @brief Un mensaje leído del log: apunta dentro del segmento mapeado.
+ */
+typedef struct {
+    const char *frame;      ///< Trama FRAME_MSG completa (NULL si el mensaje no viene de un log).
+    uint32_t    frame_len;
+    const char *payload;    ///< Payload publicado (dentro de frame).
+    uint32_t    len;
+    msg_log_seg_t *seg;     ///< Segmento que lo contiene (NULL si no viene de un log).
+} msg_log_rec_t;
+
+/**
+ * @brief Rango sucio de un segmento, tomado con el lock y sincronizado sin él.
+ */
+typedef struct {
+    char  *base;            ///< Inicio (alineado a página) del rango a sincronizar.
+    size_t len;             ///< 0 = nada pendiente.
+    msg_log_seg_t *seg;     ///< Segmento retenido hasta msg_log_sync_range().
+} msg_log_range_t;
+
+/**
+ * @brief Abre (o crea) el log del tópico bajo dir y recupera lo que ya tenía.
+ *
+ * @param seg_bytes  Tamaño de cada segmento nuevo (0 = MSG_LOG_SEGMENT).
+ * @param keep_bytes Bytes de segmentos que se conservan (0 = todos, ver retención).
+ * @return El log, o NULL si no se pudo crear el directorio o mapear un segmento.
+ */
+msg_log_t *msg_log_open(const char *dir, const char *topic, int tlen, size_t seg_bytes,
+                        size_t keep_bytes, const msg_log_sync_t *sync);
+
+/**
+ * @brief Llama a fn con el nombre de cada tópico que tiene log bajo dir.
+ * @return Tópicos encontrados (0 si dir no existe todavía).
+ */
+int msg_log_topics(const char *dir, void (*fn)(void *arg, const char *topic, int tlen), void *arg);
+
+/** @brief Sincroniza lo pendiente, suelta los segmentos (los retenidos siguen
+ *         mapeados hasta su msg_log_release()) y libera el log. */
+void msg_log_close(msg_log_t *log);
+
+/** @brief Número del mensaje más viejo del log. */
+uint32_t msg_log_first(const msg_log_t *log);
+
+/** @brief Número que recibirá el próximo mensaje. */
+uint32_t msg_log_next(const msg_log_t *log);
+
+/**
+ * @brief Agrega un mensaje al final del log (y sincroniza si tocó por cantidad).
+ * @return Número asignado, o 0 si no se pudo escribir (disco lleno, sin memoria).
+ */
+uint32_t msg_log_append(msg_log_t *log, const char *payload, uint32_t len);
+
+/**
+ * @brief Mensaje número seq.
+ * @return 0 si está en el log, -1 si no.
+ */
+int msg_log_get(const msg_log_t *log, uint32_t seq, msg_log_rec_t *rec);
+
+/**
+ * @brief Retiene el segmento de un registro recién leído (con el lock), para
+ *        usar sus punteros después de soltarlo. NULL no hace nada.
+ */
+void msg_log_hold(msg_log_seg_t *seg);
+
+/**
+ * @brief Suelta un msg_log_hold() (desde cualquier hilo, sin el lock). El
+ *        último desmapea un segmento que la retención ya sacó del log.
+ */
+void msg_log_release(msg_log_seg_t *seg);
+
+/**
+ * @brief Toma el rango aún no sincronizado y lo da por sincronizado (con el lock).
+ */
+void msg_log_sync_begin(msg_log_t *log, msg_log_range_t *r);
+
+/**
+ * @brief Lleva a disco el rango tomado con msg_log_sync_begin() (sin el lock)
+ *        y suelta su segmento.
+ * @return 0 si ok, -1 si msync() falló.
+ */
+int msg_log_sync_range(const msg_log_range_t *r);
+
+#endif /* MSG_LOG_H */
@@ -0,0 +1,124 @@
+/**
+ * @file msg_ring.h
+ * @brief Anillo acotado de los últimos mensajes de un tópico, por número de secuencia.
+ *
+ * Cada mensaje que entra recibe el siguiente número de secuencia del tópico
+ * (desde 1) y queda retenido hasta que lo desplazan los nuevos. Sirve para
+ * retransmitir a quien pide un número que no le llegó.
+ *
+ *  - Doble límite: a lo sumo nslots mensajes y max_bytes bytes de payload;
+ *    al pasarse cualquiera de los dos se descartan los más viejos. Un mensaje
+ *    más grande que max_bytes recibe su número pero no se retiene.
+ *  - Los números retenidos son siempre consecutivos [first, next): el mensaje
+ *    seq vive en la posición seq % nslots y se encuentra en O(1).
+ *  - Cada posición conserva su buffer entre usos (solo crece con realloc):
+ *    en régimen estable agregar un mensaje es una copia, sin malloc.
+ *
+ * No es seguro entre hilos: quien lo comparte lo protege con un lock.
+ *
+ * Módulo solo de cabecera (funciones inline).
+ */
+
+#ifndef MSG_RING_H
+#define MSG_RING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/** Posición del anillo: buffer propio reutilizable. */
+typedef struct {
+    char     *data;
+    uint32_t  len;   ///< Bytes del mensaje retenido.
+    uint32_t  cap;   ///< Capacidad de data.
+} msg_ring_slot_t;
+
+typedef struct {
+    msg_ring_slot_t *slots;
+    uint32_t  nslots;
+    uint32_t  first;      ///< Número del mensaje retenido más viejo.
+    uint32_t  next;       ///< Número que recibirá el próximo mensaje.
+    size_t    bytes;      ///< Bytes de payload retenidos.
+    size_t    max_bytes;  ///< Límite de bytes retenidos.
+} msg_ring_t;
+
+/**
+ * @brief Prepara un anillo vacío (el primer mensaje será el número 1).
+ * @return 0 si ok, -1 si no hay memoria o nslots es 0.
+ */
+static inline int msg_ring_init(msg_ring_t *r, uint32_t nslots, size_t max_bytes) {
+    if (nslots == 0) return -1;
+    r->slots = (msg_ring_slot_t*)calloc(nslots, sizeof(msg_ring_slot_t));
+    if (!r->slots) return -1;
+    r->nslots    = nslots;
+    r->first     = 1;
+    r->next      = 1;
+    r->bytes     = 0;
+    r->max_bytes = max_bytes;
+    return 0;
+}
+
+/** @brief Libera los buffers del anillo. */
+static inline void msg_ring_free(msg_ring_t *r) {
+    if (!r->slots) return;
+    for (uint32_t i = 0; i < r->nslots; i++) free(r->slots[i].data);
+    free(r->slots);
+    r->slots = NULL;
+}
+
+/** @brief Mensajes retenidos. */
+static inline uint32_t msg_ring_count(const msg_ring_t *r) {
+    return r->next - r->first;
+}
+
+/* Descarta el mensaje retenido más viejo. */
+static inline void msg_ring_evict(msg_ring_t *r) {
+    r->bytes -= r->slots[r->first % r->nslots].len;
+    r->first++;
+}
+
+/**
+ * @brief Agrega un mensaje y le asigna el siguiente número.
+ * @return Número asignado. Si no hay memoria para retenerlo el número se
+ *         consume igual y el anillo queda vacío: quien lo pida lo verá perdido.
+ */
+static inline uint32_t msg_ring_push(msg_ring_t *r, const char *data, uint32_t len) {
+    uint32_t seq = r->next++;
+    if (len > r->max_bytes) {  // no entra nunca: vacía el anillo y no se retiene
+        while (r->first != seq) msg_ring_evict(r);
+        r->first = r->next;
+        return seq;
+    }
+    if (seq - r->first >= r->nslots) msg_ring_evict(r);
+    while (r->bytes + len > r->max_bytes && r->first != seq) msg_ring_evict(r);
+
+    msg_ring_slot_t *sl = &r->slots[seq % r->nslots];
+    if (len > sl->cap) {
+        char *d = (char*)realloc(sl->data, len);
+        if (!d) {
+            while (r->first != seq) msg_ring_evict(r);
+            r->first = r->next;
+            return seq;
+        }
+        sl->data = d;
+        sl->cap  = len;
+    }
+    if (len) memcpy(sl->data, data, len);
+    sl->len   = len;
+    r->bytes += len;
+    return seq;
+}
+
+/**
+ * @brief Mensaje número seq, si sigue retenido.
+ * @return Puntero al payload (válido hasta el próximo msg_ring_push), o NULL.
+ */
+static inline const char *msg_ring_get(const msg_ring_t *r, uint32_t seq, uint32_t *len) {
+    if (seq - r->first >= r->next - r->first) return NULL;  // fuera de [first, next)
+    const msg_ring_slot_t *sl = &r->slots[seq % r->nslots];
+    *len = sl->len;
+    return sl->data ? sl->data : "";
+}
+
+#endif /* MSG_RING_H */
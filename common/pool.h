@@ -0,0 +1,178 @@
+/**
+ * @file pool.h
+ * @brief Pools de objetos de tamaño fijo sobre slabs, con clases de tamaño.
+ *
+ * Los objetos que el broker crea y destruye sin parar (conexiones,
+ * suscripciones, mensajes y nodos de las colas de salida) salen de un pool en
+ * lugar de malloc/free:
+ *
+ *  - Un pool reparte objetos de un único tamaño cortados de slabs (bloques
+ *    grandes pedidos a malloc de una vez). Un objeto liberado vuelve a la
+ *    lista de libres del pool y el siguiente pedido lo reutiliza: en régimen
+ *    estable no hay llamadas a malloc/free y la memoria no se fragmenta.
+ *  - Los slabs no se devuelven hasta pool_destroy(): la memoria del proceso
+ *    queda acotada por el pico de objetos vivos, no crece con el recambio.
+ *  - Un pool pertenece a un hilo (o a una estructura protegida por un lock):
+ *    reservar y liberar desde ese hilo no usa atómicos. Otro hilo puede
+ *    devolverle un objeto con pool_put_remote(); esos objetos esperan en una
+ *    pila atómica que el dueño recoge entera cuando se le acaba la suya.
+ *  - pool_sizes_t agrupa pools por clases de tamaño (potencias de 2 desde
+ *    POOL_MIN_SIZE) para buffers de longitud variable; lo que supera la clase
+ *    mayor queda a cargo del llamador (malloc).
+ *
+ * Módulo solo de cabecera (funciones inline), C11 <stdatomic.h>.
+ */
+
+#ifndef POOL_H
+#define POOL_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+/** Bytes de cada slab (se redondea para que entre al menos un objeto). */
+#define POOL_SLAB_BYTES  (64 * 1024)
+
+/** Clase de tamaño más chica (bytes). */
+#define POOL_MIN_SIZE    64
+/** Cantidad de clases: 64 B, 128 B, ..., 8 KB. */
+#define POOL_CLASSES     8
+
+/** Objeto libre: el enlace ocupa sus primeros bytes. */
+typedef struct pool_obj {
+    struct pool_obj *next;
+} pool_obj_t;
+
+/** Cabecera de cada slab (los objetos van detrás). */
+typedef struct pool_slab {
+    struct pool_slab *next;
+    void             *align;  // deja los objetos alineados a 16 bytes
+} pool_slab_t;
+
+/**
+ * @brief Pool de objetos de un tamaño.
+ */
+typedef struct {
+    size_t                size;      ///< Tamaño de cada objeto (múltiplo de 16).
+    unsigned              per_slab;  ///< Objetos por slab.
+    pool_obj_t           *free;      ///< Libres del dueño.
+    _Atomic(pool_obj_t*)  remote;    ///< Devueltos por otros hilos (pila atómica).
+    pool_slab_t          *slabs;     ///< Slabs reservados.
+    size_t                nslabs;
+} pool_t;
+
+/**
+ * @brief Pools por clase de tamaño.
+ */
+typedef struct {
+    pool_t cls[POOL_CLASSES];
+} pool_sizes_t;
+
+/** @brief Prepara un pool vacío de objetos de size bytes (aún no reserva nada). */
+static inline void pool_init(pool_t *p, size_t size) {
+    if (size < sizeof(pool_obj_t)) size = sizeof(pool_obj_t);
+    p->size     = (size + 15) & ~(size_t)15;
+    p->per_slab = (unsigned)(POOL_SLAB_BYTES / p->size);
+    if (p->per_slab == 0) p->per_slab = 1;
+    p->free     = NULL;
+    atomic_init(&p->remote, NULL);
+    p->slabs    = NULL;
+    p->nslabs   = 0;
+}
+
+/** @brief 1 si el pool ya fue inicializado (para inicializarlo en el primer uso). */
+static inline int pool_ready(const pool_t *p) {
+    return p->size != 0;
+}
+
+/* Reserva un slab nuevo y encadena sus objetos en la lista de libres. */
+static inline int pool_grow(pool_t *p) {
+    pool_slab_t *s = (pool_slab_t*)malloc(sizeof(*s) + p->size * p->per_slab);
+    if (!s) return -1;
+    s->next  = p->slabs;
+    p->slabs = s;
+    p->nslabs++;
+
+    char *obj = (char*)(s + 1);
+    for (unsigned i = 0; i < p->per_slab; i++, obj += p->size) {
+        pool_obj_t *o = (pool_obj_t*)obj;
+        o->next = p->free;
+        p->free = o;
+    }
+    return 0;
+}
+
+/**
+ * @brief Reserva un objeto (solo el hilo dueño).
+ * @return Objeto sin inicializar, o NULL si no hay memoria.
+ */
+static inline void *pool_alloc(pool_t *p) {
+    if (!p->free) {
+        // Primero lo que devolvieron otros hilos, luego un slab nuevo.
+        p->free = atomic_exchange_explicit(&p->remote, NULL, memory_order_acquire);
+        if (!p->free && pool_grow(p) != 0) return NULL;
+    }
+    pool_obj_t *o = p->free;
+    p->free = o->next;
+    return o;
+}
+
+/** @brief Devuelve un objeto al pool (solo el hilo dueño). */
+static inline void pool_put(pool_t *p, void *obj) {
+    pool_obj_t *o = (pool_obj_t*)obj;
+    o->next = p->free;
+    p->free = o;
+}
+
+/**
+ * @brief Devuelve un objeto desde un hilo que no es el dueño del pool.
+ *
+ * Solo empuja: el dueño retira la pila completa con un exchange, así que no
+ * hay problema ABA.
+ */
+static inline void pool_put_remote(pool_t *p, void *obj) {
+    pool_obj_t *o = (pool_obj_t*)obj;
+    pool_obj_t *head = atomic_load_explicit(&p->remote, memory_order_relaxed);
+    do {
+        o->next = head;
+    } while (!atomic_compare_exchange_weak_explicit(&p->remote, &head, o,
+                                                    memory_order_release, memory_order_relaxed));
+}
+
+/** @brief Libera todos los slabs (los objetos que sigan en uso quedan inválidos). */
+static inline void pool_destroy(pool_t *p) {
+    while (p->slabs) {
+        pool_slab_t *s = p->slabs;
+        p->slabs = s->next;
+        free(s);
+    }
+    p->free   = NULL;
+    atomic_store_explicit(&p->remote, NULL, memory_order_relaxed);
+    p->nslabs = 0;
+}
+
+/** @brief Prepara las clases de tamaño (POOL_MIN_SIZE << i). */
+static inline void pool_sizes_init(pool_sizes_t *ps) {
+    for (int i = 0; i < POOL_CLASSES; i++) pool_init(&ps->cls[i], (size_t)POOL_MIN_SIZE << i);
+}
+
+/** @brief Libera los slabs de todas las clases. */
+static inline void pool_sizes_destroy(pool_sizes_t *ps) {
+    for (int i = 0; i < POOL_CLASSES; i++) pool_destroy(&ps->cls[i]);
+}
+
+/**
+ * @brief Clase de tamaño para n bytes.
+ * @return Índice en pool_sizes_t::cls, o -1 si n supera la clase mayor.
+ */
+static inline int pool_class(size_t n) {
+    int c = 0;
+    size_t sz = POOL_MIN_SIZE;
+    while (sz < n) {
+        if (++c == POOL_CLASSES) return -1;
+        sz <<= 1;
+    }
+    return c;
+}
+
+#endif /* POOL_H */
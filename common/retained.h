@@ -0,0 +1,331 @@
+/**
+ * @file retained.h
+ * @brief Historial de los últimos mensajes de cada tópico, compartido entre workers.
+ *
+ * Un anillo (common/msg_ring.h) por nombre de tópico, creado con el primer
+ * mensaje que se retiene. Lo usan los brokers para reenviar lo publicado a un
+ * suscriptor que llega tarde ("SUB <topic> [FROM <seq>]") y, en UDP, para
+ * retransmitir lo que pide un NACK.
+ *
+ *  - Se busca por nombre y no por topic_id_t: los ids son de cada índice (cada
+ *    worker TCP tiene el suyo) y un tópico puede retenerse aunque nadie lo
+ *    haya internado todavía (publicado sin suscriptores).
+ *  - Tabla hash con lock de lectura/escritura: buscar (cada PUB) toma el de
+ *    lectura; solo crear un tópico toma el de escritura.
+ *  - Cada tópico tiene su propio mutex: los PUB de tópicos distintos no
+ *    compiten entre sí, y quien reenvía toma el lock un mensaje a la vez.
+ *  - Los tópicos no se borran hasta retained_free(): los punteros que
+ *    devuelven retained_find()/retained_get() son estables.
+ *  - Como el historial se crea con cualquier PUB, la cantidad de tópicos
+ *    está acotada (retained_set_max(), RETAINED_TOPICS_DEFAULT): pasado el
+ *    máximo, retained_get() no crea más y cuenta el rechazo en refused.
+ *  - Modo durable (retained_set_log()): cada tópico guarda todo en su log
+ *    mapeado (common/msg_log.h) en lugar del anillo. retained_load() reabre
+ *    los tópicos que ya estaban en disco y la numeración sigue desde ahí.
+ *
+ * Módulo solo de cabecera (funciones inline); usa topic_hash() de
+ * common/topic_index.c y common/msg_log.c.
+ */
+
+#ifndef RETAINED_H
+#define RETAINED_H
+
+#include "msg_ring.h"
+#include "msg_log.h"
+#include "topic_index.h"
+#include "threads.h"
+#include <stdatomic.h>
+#include <stdio.h>
+
+#define RETAINED_TOPICS_DEFAULT 1024  ///< Tópicos retenidos como máximo por defecto.
+
+/**
+ * @brief Historial de un tópico: su anillo y el lock que lo protege.
+ */
+typedef struct retained_topic {
+    struct retained_topic *next;  ///< Siguiente en la cadena del bucket.
+    mutex_t    lock;              ///< Protege ring (PUBs y reenvíos de varios hilos).
+    msg_ring_t ring;              ///< Últimos mensajes por número de secuencia.
+    msg_log_t *log;               ///< Log durable (NULL = solo el anillo).
+    uint32_t   snap_next;         ///< Próximo número al escribir el último snapshot (broker UDP, -P).
+    uint32_t   hash;
+    int        len;
+    char       name[];            ///< Nombre del tópico (terminado en '\0').
+} retained_topic_t;
+
+/**
+ * @brief Conjunto de historiales, indexado por nombre de tópico.
+ */
+typedef struct {
+    rwlock_t           lock;      ///< Lectura para buscar, escritura para crear o crecer.
+    retained_topic_t **buckets;
+    uint32_t           nbuckets;  ///< Potencia de 2.
+    atomic_uint        count;     ///< Tópicos retenidos (se lee sin lock).
+    uint32_t           max_topics;///< Tópicos como máximo (0 = sin límite).
+    atomic_ulong       refused;   ///< Tópicos que no se crearon por max_topics.
+    uint32_t           slots;     ///< Mensajes retenidos por tópico.
+    size_t             bytes;     ///< Bytes de payload retenidos por tópico.
+    const char        *log_dir;   ///< Directorio de los logs (NULL = sin modo durable).
+    size_t             seg_bytes; ///< Tamaño de cada segmento del log.
+    size_t             keep_bytes;///< Retención de cada log (0 = todo).
+    msg_log_sync_t     sync;      ///< Cuándo llevar los logs a disco.
+} retained_t;
+
+/**
+ * @brief Prepara un conjunto vacío cuyos tópicos retendrán hasta slots
+ *        mensajes y bytes bytes cada uno.
+ * @return 0 si ok, -1 si no hay memoria o slots es 0.
+ */
+static inline int retained_init(retained_t *st, uint32_t slots, size_t bytes) {
+    if (slots == 0) return -1;
+    st->nbuckets = 64;
+    st->buckets  = (retained_topic_t**)calloc(st->nbuckets, sizeof(*st->buckets));
+    if (!st->buckets) return -1;
+    rwlock_init(&st->lock);
+    atomic_init(&st->count, 0);
+    atomic_init(&st->refused, 0);
+    st->max_topics = RETAINED_TOPICS_DEFAULT;
+    st->slots   = slots;
+    st->bytes   = bytes;
+    st->log_dir = NULL;
+    st->keep_bytes = 0;
+    return 0;
+}
+
+/**
+ * @brief Activa el modo durable: los tópicos que se creen desde ahora guardan
+ *        sus mensajes en un log bajo dir que conserva hasta keep_bytes (ver
+ *        common/msg_log.h).
+ */
+static inline void retained_set_log(retained_t *st, const char *dir, size_t seg_bytes,
+                                    size_t keep_bytes, const msg_log_sync_t *sync) {
+    st->log_dir    = dir;
+    st->seg_bytes  = seg_bytes;
+    st->keep_bytes = keep_bytes;
+    st->sync       = *sync;
+}
+
+/** @brief Fija cuántos tópicos se retienen como máximo (0 = sin límite). */
+static inline void retained_set_max(retained_t *st, uint32_t max_topics) {
+    st->max_topics = max_topics;
+}
+
+/** @brief 1 si ya no se crean tópicos nuevos (se lee sin lock). */
+static inline int retained_full(retained_t *st) {
+    return st->max_topics &&
+           atomic_load_explicit(&st->count, memory_order_relaxed) >= st->max_topics;
+}
+
+/** @brief Libera todos los tópicos (nadie más debe estar usándolos). */
+static inline void retained_free(retained_t *st) {
+    if (!st->buckets) return;
+    for (uint32_t b = 0; b < st->nbuckets; b++) {
+        retained_topic_t *t = st->buckets[b];
+        while (t) {
+            retained_topic_t *next = t->next;
+            msg_ring_free(&t->ring);
+            msg_log_close(t->log);
+            mutex_destroy(&t->lock);
+            free(t);
+            t = next;
+        }
+    }
+    free(st->buckets);
+    st->buckets = NULL;
+    rwlock_destroy(&st->lock);
+}
+
+/* Busca en la cadena de su bucket (con el lock tomado en cualquier modo). */
+static inline retained_topic_t *retained_lookup(const retained_t *st, const char *name,
+                                                int len, uint32_t h) {
+    for (retained_topic_t *t = st->buckets[h & (st->nbuckets - 1)]; t; t = t->next)
+        if (t->hash == h && t->len == len && memcmp(t->name, name, len) == 0) return t;
+    return NULL;
+}
+
+/* Duplica la tabla (con el lock de escritura). Si no hay memoria sigue con la actual. */
+static inline void retained_grow(retained_t *st) {
+    uint32_t n = st->nbuckets * 2;
+    retained_topic_t **b = (retained_topic_t**)calloc(n, sizeof(*b));
+    if (!b) return;
+    for (uint32_t i = 0; i < st->nbuckets; i++) {
+        retained_topic_t *t = st->buckets[i];
+        while (t) {
+            retained_topic_t *next = t->next;
+            t->next = b[t->hash & (n - 1)];
+            b[t->hash & (n - 1)] = t;
+            t = next;
+        }
+    }
+    free(st->buckets);
+    st->buckets  = b;
+    st->nbuckets = n;
+}
+
+/**
+ * @brief Historial del tópico, o NULL si nunca se retuvo nada en él.
+ *
+ * Con el conjunto vacío no toma ningún lock.
+ */
+static inline retained_topic_t *retained_find(retained_t *st, const char *name, int len) {
+    if (atomic_load_explicit(&st->count, memory_order_acquire) == 0) return NULL;
+    uint32_t h = topic_hash(name, len);
+    rwlock_rdlock(&st->lock);
+    retained_topic_t *t = retained_lookup(st, name, len, h);
+    rwlock_rdunlock(&st->lock);
+    return t;
+}
+
+/**
+ * @brief Historial del tópico, creándolo vacío si no existe.
+ * @return El tópico, o NULL si no hay memoria o ya hay max_topics
+ *         (retained_full()).
+ */
+static inline retained_topic_t *retained_get(retained_t *st, const char *name, int len) {
+    uint32_t h = topic_hash(name, len);
+    rwlock_rdlock(&st->lock);
+    retained_topic_t *t = retained_lookup(st, name, len, h);
+    rwlock_rdunlock(&st->lock);
+    if (t) return t;
+    if (retained_full(st)) {  // sin el lock de escritura: un PUB por tópico nuevo no frena a los demás
+        atomic_fetch_add_explicit(&st->refused, 1, memory_order_relaxed);
+        return NULL;
+    }
+
+    rwlock_wrlock(&st->lock);
+    t = retained_lookup(st, name, len, h);  // otro hilo pudo crearlo entre los dos locks
+    if (!t && retained_full(st)) {
+        atomic_fetch_add_explicit(&st->refused, 1, memory_order_relaxed);
+    } else if (!t && (t = (retained_topic_t*)malloc(sizeof(*t) + len + 1)) != NULL) {
+        if (msg_ring_init(&t->ring, st->slots, st->bytes) != 0) {
+            free(t);
+            t = NULL;
+        } else {
+            mutex_init(&t->lock);
+            t->hash = h;
+            t->len  = len;
+            memcpy(t->name, name, len);
+            t->name[len] = '\0';
+            t->log = NULL;
+            t->snap_next = 0;
+            if (st->log_dir &&
+                !(t->log = msg_log_open(st->log_dir, name, len, st->seg_bytes,
+                                         st->keep_bytes, &st->sync)))
+                fprintf(stderr, "[LOG] %s: sin log, solo en memoria\n", t->name);
+            uint32_t n = atomic_load_explicit(&st->count, memory_order_relaxed) + 1;
+            if (n > st->nbuckets) retained_grow(st);
+            t->next = st->buckets[h & (st->nbuckets - 1)];
+            st->buckets[h & (st->nbuckets - 1)] = t;
+            atomic_store_explicit(&st->count, n, memory_order_release);
+        }
+    }
+    rwlock_wrunlock(&st->lock);
+    return t;
+}
+
+/* Callback de retained_load(). */
+static inline void retained_load_one(void *arg, const char *topic, int tlen) {
+    retained_t *st = (retained_t*)arg;
+    if (!retained_get(st, topic, tlen) && retained_full(st))
+        fprintf(stderr, "[LOG] %.*s: supera el máximo de tópicos, no se carga\n", tlen, topic);
+}
+
+/**
+ * @brief Reabre los logs que ya existen en el directorio del modo durable.
+ * @return Tópicos recuperados.
+ */
+static inline int retained_load(retained_t *st) {
+    return st->log_dir ? msg_log_topics(st->log_dir, retained_load_one, st) : 0;
+}
+
+/**
+ * @brief Retiene un mensaje en el historial del tópico.
+ * @return Número de secuencia asignado (desde 1, por tópico; 0 si el log no
+ *         pudo escribirlo).
+ */
+static inline uint32_t retained_push(retained_topic_t *t, const char *data, uint32_t len) {
+    mutex_lock(&t->lock);
+    uint32_t seq = t->log ? msg_log_append(t->log, data, len)
+                          : msg_ring_push(&t->ring, data, len);
+    mutex_unlock(&t->lock);
+    return seq;
+}
+
+/** @brief Número del mensaje retenido más viejo (con t->lock tomado). */
+static inline uint32_t retained_first_locked(const retained_topic_t *t) {
+    return t->log ? msg_log_first(t->log) : t->ring.first;
+}
+
+/** @brief Número que recibirá el próximo mensaje (con t->lock tomado). */
+static inline uint32_t retained_next_locked(const retained_topic_t *t) {
+    return t->log ? msg_log_next(t->log) : t->ring.next;
+}
+
+/**
+ * @brief Mensaje número seq, si sigue retenido (con t->lock tomado).
+ *
+ * Desde un log, rec->frame es la trama FRAME_MSG tal como está en el segmento
+ * mapeado; para usarla al soltar el lock hay que retener rec->seg con
+ * msg_log_hold() (la retención del log podría borrarlo). Desde el anillo
+ * rec->frame y rec->seg son NULL y el payload vale solo hasta el próximo
+ * retained_push().
+ * @return 0 si está, -1 si no.
+ */
+static inline int retained_at(const retained_topic_t *t, uint32_t seq, msg_log_rec_t *rec) {
+    if (t->log) return msg_log_get(t->log, seq, rec);
+    rec->frame     = NULL;
+    rec->frame_len = 0;
+    rec->seg       = NULL;
+    rec->payload   = msg_ring_get(&t->ring, seq, &rec->len);
+    return rec->payload ? 0 : -1;
+}
+
+/**
+ * @brief Hace que la numeración del tópico siga desde next (al recuperar el
+ *        estado tras reiniciar). Solo cambia un historial en memoria vacío:
+ *        un log ya trae su propia numeración.
+ */
+static inline void retained_resume(retained_topic_t *t, uint32_t next) {
+    mutex_lock(&t->lock);
+    if (!t->log && msg_ring_count(&t->ring) == 0) t->ring.first = t->ring.next = next;
+    mutex_unlock(&t->lock);
+}
+
+/**
+ * @brief Número que recibirá el próximo mensaje del tópico.
+ */
+static inline uint32_t retained_next(retained_topic_t *t) {
+    mutex_lock(&t->lock);
+    uint32_t next = retained_next_locked(t);
+    mutex_unlock(&t->lock);
+    return next;
+}
+
+/**
+ * @brief Lleva a disco lo agregado a todos los logs (para la política por tiempo).
+ *
+ * Toma el lock de cada tópico solo para anotar el tramo pendiente: el msync()
+ * corre sin él, así que los PUB no esperan al disco.
+ */
+static inline void retained_sync_all(retained_t *st) {
+    uint32_t n = atomic_load_explicit(&st->count, memory_order_acquire), k = 0;
+    if (n == 0) return;
+    retained_topic_t **v = (retained_topic_t**)malloc(n * sizeof(*v));
+    if (!v) return;
+    rwlock_rdlock(&st->lock);
+    for (uint32_t b = 0; b < st->nbuckets; b++)
+        for (retained_topic_t *t = st->buckets[b]; t && k < n; t = t->next)
+            if (t->log) v[k++] = t;
+    rwlock_rdunlock(&st->lock);
+
+    for (uint32_t i = 0; i < k; i++) {
+        msg_log_range_t r;
+        mutex_lock(&v[i]->lock);
+        msg_log_sync_begin(v[i]->log, &r);
+        mutex_unlock(&v[i]->lock);
+        msg_log_sync_range(&r);
+    }
+    free(v);
+}
+
+#endif /* RETAINED_H */
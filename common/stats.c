@@ -0,0 +1,369 @@
+/**
+ * @file stats.c
+ * @brief Texto de las métricas y listener HTTP (ver stats.h).
+ *
+ * Notas:
+ *  - Todo se lee con cargas relajadas mientras los workers siguen contando:
+ *    cada valor es exacto en sí, pero dos valores del mismo texto pueden ser
+ *    de instantes apenas distintos.
+ *  - Los tópicos de todos los workers se juntan en un arreglo, se ordenan
+ *    por nombre y se suman los repetidos: O(t log t) por pedido, sin tocar
+ *    nada de los workers.
+ *  - El listener HTTP atiende una conexión a la vez con sockets
+ *    bloqueantes y un timeout de lectura: está pensado para un scraper cada
+ *    algunos segundos, no para tráfico.
+ */
+
+#include "threads.h"
+#include "stats.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef _WIN32
+  typedef SOCKET stats_sock_t;
+  #define STATS_BAD_SOCK INVALID_SOCKET
+  #define stats_sock_close closesocket
+#else
+  #include <arpa/inet.h>
+  #include <netinet/in.h>
+  #include <sys/socket.h>
+  #include <sys/time.h>
+  typedef int stats_sock_t;
+  #define STATS_BAD_SOCK (-1)
+  #define stats_sock_close close
+#endif
+
+#ifndef MSG_NOSIGNAL
+  #define MSG_NOSIGNAL 0
+#endif
+
+/** Timeout de lectura del pedido HTTP, en ms. */
+#define STATS_HTTP_TIMEOUT_MS 2000
+
+/* Nombre, tipo y ayuda de cada contador de stats_id_t. */
+static const struct {
+    const char *name, *type, *help;
+} stats_names[STATS_COUNT] = {
+    { "pub_total",         "counter", "PUB recibidos." },
+    { "pub_bytes_total",   "counter", "Bytes de payload de los PUB recibidos." },
+    { "delivered_total",   "counter", "Mensajes entregados a suscriptores." },
+    { "sent_bytes_total",  "counter", "Bytes escritos hacia los clientes." },
+    { "dropped_total",     "counter", "Mensajes descartados (cola llena o demasiado grandes)." },
+    { "slow_closed_total", "counter", "Clientes desconectados por lentos o inactivos." },
+    { "connections",       "gauge",   "Conexiones abiertas." },
+    { "accepted_total",    "counter", "Conexiones aceptadas." },
+    { "queue_high_water",  "gauge",   "Máximo de la cola de salida de un cliente (bytes, TCP) "
+                                      "o de un lote de recepción (datagramas, UDP)." },
+};
+
+void stats_buf_init(stats_buf_t *b, int format) {
+    b->data   = NULL;
+    b->len    = 0;
+    b->cap    = 0;
+    b->format = format;
+    b->oom    = 0;
+}
+
+void stats_buf_free(stats_buf_t *b) {
+    free(b->data);
+    b->data = NULL;
+    b->len = b->cap = 0;
+}
+
+void stats_printf(stats_buf_t *b, const char *fmt, ...) {
+    if (b->oom) return;
+    for (;;) {
+        va_list ap;
+        va_start(ap, fmt);
+        size_t room = b->cap - b->len;
+        int n = vsnprintf(b->data ? b->data + b->len : NULL, room, fmt, ap);
+        va_end(ap);
+        if (n < 0) { b->oom = 1; return; }
+        if ((size_t)n < room) { b->len += (size_t)n; return; }
+
+        size_t ncap = b->cap ? b->cap * 2 : 4096;
+        while (ncap - b->len <= (size_t)n) ncap *= 2;
+        char *d = (char*)realloc(b->data, ncap);
+        if (!d) { b->oom = 1; return; }
+        b->data = d;
+        b->cap  = ncap;
+    }
+}
+
+/* Comentarios de una familia (solo en STATS_PROM). */
+static void stats_head(stats_buf_t *b, const char *prefix, const char *name, const char *type,
+                       const char *help) {
+    if (b->format != STATS_PROM) return;
+    stats_printf(b, "# HELP %s_%s %s\n# TYPE %s_%s %s\n", prefix, name, help, prefix, name, type);
+}
+
+/* Una muestra: "[STAT ]<nombre>[{etiquetas}] <valor>". */
+static void stats_sample(stats_buf_t *b, const char *name, const char *labels, uint64_t v) {
+    stats_printf(b, "%s%s%s%s%s %llu\n", b->format == STATS_LINES ? "STAT " : "", name,
+                 labels ? "{" : "", labels ? labels : "", labels ? "}" : "", (unsigned long long)v);
+}
+
+void stats_put(stats_buf_t *b, const char *name, const char *type, const char *help,
+               const char *labels, uint64_t value) {
+    if (b->format == STATS_PROM) stats_printf(b, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+    stats_sample(b, name, labels, value);
+}
+
+/* Cota superior en µs del balde k (el último no tiene). */
+static uint64_t stats_bucket_top(int k) {
+    return (uint64_t)1 << k;
+}
+
+/* Valor (cota superior del balde, en µs) en el percentil p de los conteos. */
+static uint64_t stats_quantile(const uint64_t *cnt, uint64_t total, double p) {
+    uint64_t want = (uint64_t)(p * (double)total + 0.5), acc = 0;
+    if (want == 0) want = 1;
+    for (int k = 0; k < STATS_HIST_BUCKETS; k++) {
+        acc += cnt[k];
+        if (acc >= want) return stats_bucket_top(k);
+    }
+    return stats_bucket_top(STATS_HIST_BUCKETS - 1);
+}
+
+/* Histograma h (offset dentro de stats_worker_t) de cada worker. Con STATS_PROM
+ * en segundos y baldes acumulados; si no, percentiles en µs. */
+static void stats_hist(stats_buf_t *b, const char *prefix, const char *name, const char *help,
+                       stats_worker_t *ws, int n, size_t off) {
+    uint64_t any = 0;
+    for (int w = 0; w < n; w++) {
+        const stats_hist_t *h = (const stats_hist_t*)((const char*)&ws[w] + off);
+        for (int k = 0; k < STATS_HIST_BUCKETS; k++) any += stats_get(&h->bucket[k]);
+    }
+    if (!any) return;  // nunca se usó (p. ej. xpub con un solo worker)
+
+    if (b->format == STATS_PROM)
+        stats_printf(b, "# HELP %s_%s_seconds %s\n# TYPE %s_%s_seconds histogram\n",
+                     prefix, name, help, prefix, name);
+    for (int w = 0; w < n; w++) {
+        const stats_hist_t *h = (const stats_hist_t*)((const char*)&ws[w] + off);
+        uint64_t cnt[STATS_HIST_BUCKETS], total = 0;
+        for (int k = 0; k < STATS_HIST_BUCKETS; k++) total += cnt[k] = stats_get(&h->bucket[k]);
+        uint64_t sum = stats_get(&h->sum);
+
+        if (b->format == STATS_PROM) {
+            uint64_t acc = 0;
+            for (int k = 0; k < STATS_HIST_BUCKETS - 1; k++) {
+                acc += cnt[k];
+                stats_printf(b, "%s_%s_seconds_bucket{worker=\"%d\",le=\"%.6f\"} %llu\n", prefix, name,
+                             w, (double)stats_bucket_top(k) / 1e6, (unsigned long long)acc);
+            }
+            stats_printf(b, "%s_%s_seconds_bucket{worker=\"%d\",le=\"+Inf\"} %llu\n", prefix, name,
+                         w, (unsigned long long)total);
+            stats_printf(b, "%s_%s_seconds_sum{worker=\"%d\"} %.6f\n", prefix, name, w, (double)sum / 1e6);
+            stats_printf(b, "%s_%s_seconds_count{worker=\"%d\"} %llu\n", prefix, name, w,
+                         (unsigned long long)total);
+            continue;
+        }
+        static const double qs[] = { 0.5, 0.99, 0.999 };
+        char full[128], labels[64];
+        snprintf(full, sizeof(full), "%s_%s_us", prefix, name);
+        for (size_t q = 0; q < sizeof(qs) / sizeof(qs[0]); q++) {
+            snprintf(labels, sizeof(labels), "worker=\"%d\",quantile=\"%g\"", w, qs[q]);
+            stats_sample(b, full, labels, total ? stats_quantile(cnt, total, qs[q]) : 0);
+        }
+        snprintf(full, sizeof(full), "%s_%s_us_count", prefix, name);
+        snprintf(labels, sizeof(labels), "worker=\"%d\"", w);
+        stats_sample(b, full, labels, total);
+    }
+}
+
+/* Tópico sumado entre workers. */
+typedef struct {
+    const char *name;
+    uint64_t    pubs, bytes, out, rate;
+} stats_row_t;
+
+static int stats_row_cmp(const void *a, const void *b) {
+    return strcmp(((const stats_row_t*)a)->name, ((const stats_row_t*)b)->name);
+}
+
+/* Etiqueta topic="..." con \ y " escapados (un topic no trae '\n'). */
+static void stats_topic_label(char *out, size_t cap, const char *name) {
+    size_t j = 0;
+    j += (size_t)snprintf(out, cap, "topic=\"");
+    for (const char *p = name; *p && j + 3 < cap; p++) {
+        if (*p == '\\' || *p == '"') out[j++] = '\\';
+        out[j++] = *p;
+    }
+    out[j++] = '"';
+    out[j] = '\0';
+}
+
+/* Contadores por tópico, sumados entre los n workers. */
+static void stats_topics(stats_buf_t *b, const char *prefix, stats_worker_t *ws, int n, uint64_t now_s) {
+    stats_row_t *rows = (stats_row_t*)malloc((size_t)n * STATS_TOPICS * sizeof(*rows));
+    if (!rows) { b->oom = 1; return; }
+    size_t nrows = 0;
+    uint64_t overflow = 0;
+    for (int w = 0; w < n; w++) {
+        overflow += stats_get(&ws[w].topics_full);
+        for (int i = 0; i < STATS_TOPICS; i++) {
+            const stats_topic_t *t = &ws[w].topics[i];
+            if (!atomic_load_explicit((atomic_int*)&t->used, memory_order_acquire)) continue;
+            stats_row_t *r = &rows[nrows++];
+            r->name  = t->name;
+            r->pubs  = stats_get(&t->pubs);
+            r->bytes = stats_get(&t->bytes);
+            r->out   = stats_get(&t->out);
+            r->rate  = stats_topic_rate(t, now_s);
+        }
+    }
+    qsort(rows, nrows, sizeof(*rows), stats_row_cmp);
+    size_t m = 0;
+    for (size_t i = 0; i < nrows; i++) {
+        if (m > 0 && strcmp(rows[m - 1].name, rows[i].name) == 0) {
+            rows[m - 1].pubs  += rows[i].pubs;
+            rows[m - 1].bytes += rows[i].bytes;
+            rows[m - 1].out   += rows[i].out;
+            rows[m - 1].rate  += rows[i].rate;
+        } else {
+            rows[m++] = rows[i];
+        }
+    }
+
+    static const struct { const char *name, *type, *help; size_t off; } cols[] = {
+        { "topic_pub_total",       "counter", "PUB recibidos por tópico.",
+          offsetof(stats_row_t, pubs) },
+        { "topic_pub_bytes_total", "counter", "Bytes de payload publicados por tópico.",
+          offsetof(stats_row_t, bytes) },
+        { "topic_delivered_total", "counter", "Entregas a suscriptores por tópico.",
+          offsetof(stats_row_t, out) },
+        { "topic_pub_rate",        "gauge",   "PUB por segundo del tópico (último segundo completo).",
+          offsetof(stats_row_t, rate) },
+    };
+    char full[128], label[2 * STATS_TOPIC_NAME + 16];
+    for (size_t c = 0; c < sizeof(cols) / sizeof(cols[0]) && m > 0; c++) {
+        stats_head(b, prefix, cols[c].name, cols[c].type, cols[c].help);
+        snprintf(full, sizeof(full), "%s_%s", prefix, cols[c].name);
+        for (size_t i = 0; i < m; i++) {
+            stats_topic_label(label, sizeof(label), rows[i].name);
+            stats_sample(b, full, label, *(const uint64_t*)((const char*)&rows[i] + cols[c].off));
+        }
+    }
+    free(rows);
+
+    stats_head(b, prefix, "topic_overflow_total", "counter",
+               "PUB a tópicos que no entraron en la tabla de algún worker.");
+    snprintf(full, sizeof(full), "%s_topic_overflow_total", prefix);
+    stats_sample(b, full, NULL, overflow);
+}
+
+void stats_render(stats_buf_t *b, const char *prefix, stats_worker_t *ws, int n, uint64_t now_s) {
+    char full[128], labels[32];
+    for (int i = 0; i < STATS_COUNT; i++) {
+        stats_head(b, prefix, stats_names[i].name, stats_names[i].type, stats_names[i].help);
+        snprintf(full, sizeof(full), "%s_%s", prefix, stats_names[i].name);
+        for (int w = 0; w < n; w++) {
+            snprintf(labels, sizeof(labels), "worker=\"%d\"", w);
+            stats_sample(b, full, labels, stats_get(&ws[w].c[i]));
+        }
+    }
+    stats_hist(b, prefix, "batch", "Tiempo de atender un lote de eventos o datagramas.",
+               ws, n, offsetof(stats_worker_t, batch_us));
+    stats_hist(b, prefix, "xpub", "Espera de un PUB en la cola hacia otro worker.",
+               ws, n, offsetof(stats_worker_t, xpub_us));
+    stats_topics(b, prefix, ws, n, now_s);
+}
+
+/* ------------------------------------------------------------------------- */
+/*  Listener HTTP                                                            */
+/* ------------------------------------------------------------------------- */
+
+typedef struct {
+    stats_sock_t    fd;
+    stats_render_fn fn;
+    void           *arg;
+} stats_http_t;
+
+/* Envía len bytes aunque send() acepte menos por llamada. */
+static int stats_send_all(stats_sock_t c, const char *p, size_t len) {
+    while (len > 0) {
+        int r = send(c, p, len > 65536 ? 65536 : (int)len, MSG_NOSIGNAL);
+        if (r <= 0) return -1;
+        p   += r;
+        len -= (size_t)r;
+    }
+    return 0;
+}
+
+/* Lee el pedido (hasta la línea en blanco) y responde con las métricas. */
+static void stats_http_serve(stats_http_t *h, stats_sock_t c) {
+#ifdef _WIN32
+    DWORD tv = STATS_HTTP_TIMEOUT_MS;
+#else
+    struct timeval tv = { STATS_HTTP_TIMEOUT_MS / 1000, (STATS_HTTP_TIMEOUT_MS % 1000) * 1000 };
+#endif
+    setsockopt(c, SOL_SOCKET, SO_RCVTIMEO, (const char*)&tv, sizeof(tv));
+
+    char req[2048];
+    int n = 0;
+    req[0] = '\0';
+    while (n < (int)sizeof(req) - 1 && !strstr(req, "\r\n\r\n") && !strstr(req, "\n\n")) {
+        int r = recv(c, req + n, (int)sizeof(req) - 1 - n, 0);
+        if (r <= 0) return;  // cerró o no mandó nada a tiempo
+        n += r;
+        req[n] = '\0';
+    }
+
+    int ok = strncmp(req, "GET /metrics ", 13) == 0 || strncmp(req, "GET / ", 6) == 0;
+    stats_buf_t b;
+    stats_buf_init(&b, STATS_PROM);
+    if (ok) h->fn(&b, h->arg);
+    if (b.oom) ok = 0;
+
+    char head[256];
+    int hn = snprintf(head, sizeof(head),
+                      "HTTP/1.0 %s\r\nContent-Type: %s\r\nContent-Length: %lu\r\nConnection: close\r\n\r\n",
+                      ok ? "200 OK" : "404 Not Found",
+                      ok ? "text/plain; version=0.0.4; charset=utf-8" : "text/plain",
+                      ok ? (unsigned long)b.len : 0ul);
+    if (stats_send_all(c, head, (size_t)hn) == 0 && ok) (void)stats_send_all(c, b.data, b.len);
+    stats_buf_free(&b);
+}
+
+static void *stats_http_run(void *arg) {
+    stats_http_t *h = (stats_http_t*)arg;
+    for (;;) {
+        stats_sock_t c = accept(h->fd, NULL, NULL);
+        if (c == STATS_BAD_SOCK) { thread_sleep_ms(10); continue; }
+        stats_http_serve(h, c);
+        stats_sock_close(c);
+    }
+    return NULL;
+}
+
+int stats_http_start(int port, stats_render_fn fn, void *arg) {
+    stats_sock_t fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd == STATS_BAD_SOCK) return -1;
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, (const char*)&one, sizeof(one));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family      = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port        = htons((unsigned short)port);
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, 16) != 0) {
+        stats_sock_close(fd);
+        return -1;
+    }
+
+    stats_http_t *h = (stats_http_t*)malloc(sizeof(*h));
+    thread_t t;
+    if (!h) { stats_sock_close(fd); return -1; }
+    h->fd  = fd;
+    h->fn  = fn;
+    h->arg = arg;
+    if (thread_start(&t, stats_http_run, h) != 0) {
+        stats_sock_close(fd);
+        free(h);
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,266 @@
+/**
+ * @file stats.h
+ * @brief Métricas de los brokers: contadores por worker, histogramas de
+ *        latencia y contadores por tópico, con un costo mínimo al contar.
+ *
+ * Cada worker escribe solo en su stats_worker_t (alineado a línea de caché,
+ * así que dos workers nunca comparten una línea) y cualquier hilo puede
+ * leerlo en cualquier momento:
+ *
+ *  - Los contadores son atómicos de 64 bits, pero como cada uno tiene un
+ *    único escritor se suman con una carga y un almacenamiento relajados
+ *    (stats_add()): en x86-64 es un add común, sin lock ni barreras.
+ *  - Los histogramas de latencia (en µs) tienen un balde por potencia de 2:
+ *    registrar un valor es un clz y un incremento.
+ *  - Los tópicos publicados se cuentan en una tabla por worker de
+ *    STATS_TOPICS entradas (direccionamiento abierto, con un hash que lee el
+ *    nombre de a 8 bytes: buscar el tópico de cada PUB cuesta unos pocos ns).
+ *    Una entrada se ocupa una sola vez y no se borra: quien la
+ *    lee ve el nombre completo o no la ve. Si la tabla se llena, los tópicos
+ *    nuevos van a topics_full. Cada entrada lleva además los mensajes del
+ *    segundo en curso y del anterior, de donde sale la tasa (stats_topic_rate()).
+ *
+ * stats.c arma el texto de las métricas (formato de exposición de
+ * Prometheus, o líneas "STAT" para el comando STATS) sumando los tópicos de
+ * todos los workers, y opcionalmente lo sirve por HTTP (stats_http_start()).
+ *
+ * Compilación: añadir ../common/stats.c a la línea de gcc del broker.
+ */
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define STATS_CACHELINE   64
+#define STATS_TOPICS      256  ///< Tópicos con contadores propios por worker (potencia de 2).
+#define STATS_TOPIC_PROBE 16   ///< Entradas que se prueban antes de dar la tabla por llena.
+#define STATS_TOPIC_NAME  64   ///< Nombres más largos se guardan cortados (el hash es del completo).
+#define STATS_HIST_BUCKETS 26  ///< [0,1) µs, [1,2), [2,4), ..., [2^23, 2^24) y el resto.
+
+/** Contador con un solo escritor (el worker dueño) y cualquier cantidad de lectores. */
+typedef _Atomic uint64_t stats_ctr_t;
+
+/** Contadores de cada worker (ver stats_names en stats.c). */
+typedef enum {
+    STATS_PUB_IN = 0,   ///< PUB recibidos.
+    STATS_PUB_BYTES,    ///< Bytes de payload de esos PUB.
+    STATS_MSG_OUT,      ///< Mensajes entregados a suscriptores (encolados o enviados).
+    STATS_BYTES_OUT,    ///< Bytes escritos hacia los clientes.
+    STATS_DROPS,        ///< Mensajes descartados (cola llena, datagrama que no cabe).
+    STATS_SLOW_CLOSE,   ///< Clientes desconectados por lentos o inactivos.
+    STATS_CONNS,        ///< Conexiones abiertas (gauge).
+    STATS_ACCEPTED,     ///< Conexiones aceptadas.
+    STATS_QUEUE_HWM,    ///< Máximo de la cola de salida de un cliente, en bytes (TCP),
+                        ///< o de datagramas en un lote de recepción (UDP).
+    STATS_COUNT
+} stats_id_t;
+
+/**
+ * @brief Histograma de latencias en µs, un balde por potencia de 2.
+ */
+typedef struct {
+    stats_ctr_t bucket[STATS_HIST_BUCKETS];
+    stats_ctr_t sum;        ///< Suma de los valores (µs).
+} stats_hist_t;
+
+/**
+ * @brief Contadores de un tópico en un worker.
+ */
+typedef struct {
+    atomic_int  used;       ///< 1 cuando name ya está escrito (se publica con release).
+    uint32_t    hash;       ///< stats_hash() del nombre completo.
+    char        name[STATS_TOPIC_NAME];
+    stats_ctr_t pubs;       ///< PUB recibidos por este worker.
+    stats_ctr_t bytes;      ///< Bytes de payload de esos PUB.
+    stats_ctr_t out;        ///< Entregas a suscriptores de este worker.
+    stats_ctr_t sec;        ///< Segundo de cur (reloj del broker).
+    stats_ctr_t cur;        ///< PUB recibidos en el segundo sec.
+    stats_ctr_t prev;       ///< PUB recibidos en el segundo sec - 1.
+} stats_topic_t;
+
+/**
+ * @brief Métricas de un worker: solo él escribe, cualquiera lee.
+ */
+typedef struct {
+    _Alignas(STATS_CACHELINE) stats_ctr_t c[STATS_COUNT];
+    stats_ctr_t   topics_full;      ///< PUB a tópicos que ya no entraron en la tabla.
+    stats_hist_t  batch_us;         ///< Tiempo de atender un lote de eventos / datagramas.
+    stats_hist_t  xpub_us;          ///< Espera de un PUB en la cola hacia otro worker (TCP, -t).
+    stats_topic_t topics[STATS_TOPICS];
+} stats_worker_t;
+
+/** @brief Suma n a un contador propio (un solo escritor: sin lock). */
+static inline void stats_add(stats_ctr_t *c, uint64_t n) {
+    atomic_store_explicit(c, atomic_load_explicit(c, memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+/** @brief Resta n a un gauge propio. */
+static inline void stats_sub(stats_ctr_t *c, uint64_t n) {
+    atomic_store_explicit(c, atomic_load_explicit(c, memory_order_relaxed) - n, memory_order_relaxed);
+}
+
+/** @brief Sube un máximo propio a v si lo supera. */
+static inline void stats_max(stats_ctr_t *c, uint64_t v) {
+    if (v > atomic_load_explicit(c, memory_order_relaxed))
+        atomic_store_explicit(c, v, memory_order_relaxed);
+}
+
+/** @brief Valor actual de un contador (desde cualquier hilo). */
+static inline uint64_t stats_get(const stats_ctr_t *c) {
+    return atomic_load_explicit((stats_ctr_t*)c, memory_order_relaxed);
+}
+
+/** @brief Balde de un valor en µs: 0 para [0,1), k para [2^(k-1), 2^k). */
+static inline int stats_hist_bucket(uint64_t us) {
+    if (us == 0) return 0;
+    int k = 64 - __builtin_clzll(us);
+    return k < STATS_HIST_BUCKETS - 1 ? k : STATS_HIST_BUCKETS - 1;
+}
+
+/** @brief Registra una latencia de us µs. */
+static inline void stats_hist_add(stats_hist_t *h, uint64_t us) {
+    stats_add(&h->bucket[stats_hist_bucket(us)], 1);
+    stats_add(&h->sum, us);
+}
+
+/** @brief Hash del nombre (len bytes), de a 8 bytes por multiplicación. */
+static inline uint32_t stats_hash(const char *name, int len) {
+    uint64_t h = (uint64_t)len * 0x9E3779B97F4A7C15ull;
+    int i = 0;
+    for (; i + 8 <= len; i += 8) {
+        uint64_t w;
+        memcpy(&w, name + i, 8);
+        h = (h ^ w) * 0xFF51AFD7ED558CCDull;
+        h ^= h >> 32;
+    }
+    if (i < len) {
+        uint64_t w = 0;
+        memcpy(&w, name + i, (size_t)(len - i));
+        h = (h ^ w) * 0xFF51AFD7ED558CCDull;
+        h ^= h >> 32;
+    }
+    return (uint32_t)h;
+}
+
+/**
+ * @brief Entrada del tópico topic (len bytes) en la tabla del worker; la
+ *        ocupa si no estaba.
+ * @return NULL si la tabla está llena (el PUB se cuenta en topics_full).
+ */
+static inline stats_topic_t *stats_topic(stats_worker_t *w, const char *topic, int len) {
+    uint32_t h = stats_hash(topic, len);
+    int n = len < STATS_TOPIC_NAME - 1 ? len : STATS_TOPIC_NAME - 1;
+    for (uint32_t i = 0; i < STATS_TOPIC_PROBE; i++) {
+        stats_topic_t *t = &w->topics[(h + i) & (STATS_TOPICS - 1)];
+        if (atomic_load_explicit(&t->used, memory_order_relaxed)) {
+            if (t->hash == h && memcmp(t->name, topic, n) == 0 && t->name[n] == '\0') return t;
+            continue;
+        }
+        t->hash = h;
+        memcpy(t->name, topic, n);
+        t->name[n] = '\0';
+        atomic_store_explicit(&t->used, 1, memory_order_release);
+        return t;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Cuenta un PUB de bytes bytes en el tópico t, en el segundo now_s.
+ */
+static inline void stats_topic_pub(stats_worker_t *w, stats_topic_t *t, uint64_t bytes, uint64_t now_s) {
+    if (!t) { stats_add(&w->topics_full, 1); return; }
+    stats_add(&t->pubs, 1);
+    stats_add(&t->bytes, bytes);
+    uint64_t s = stats_get(&t->sec);
+    if (s != now_s) {
+        // Cambió el segundo: cur pasa a ser el anterior si eran consecutivos
+        atomic_store_explicit(&t->prev, s + 1 == now_s ? stats_get(&t->cur) : 0, memory_order_relaxed);
+        atomic_store_explicit(&t->cur, 0, memory_order_relaxed);
+        atomic_store_explicit(&t->sec, now_s, memory_order_relaxed);
+    }
+    stats_add(&t->cur, 1);
+}
+
+/**
+ * @brief PUB por segundo del tópico t: los del último segundo completo.
+ */
+static inline uint64_t stats_topic_rate(const stats_topic_t *t, uint64_t now_s) {
+    uint64_t s = stats_get(&t->sec);
+    if (s == now_s)     return stats_get(&t->prev);
+    if (s + 1 == now_s) return stats_get(&t->cur);
+    return 0;
+}
+
+/* ------------------------------------------------------------------------- */
+/*  Texto de las métricas (stats.c)                                          */
+/* ------------------------------------------------------------------------- */
+
+/** Formatos del texto. */
+typedef enum {
+    STATS_PROM = 0,   ///< Exposición de Prometheus: # HELP / # TYPE y baldes acumulados.
+    STATS_PLAIN,      ///< "<métrica>{etiquetas} <valor>" por línea, con percentiles.
+    STATS_LINES       ///< Igual, con "STAT " delante (respuesta al comando STATS).
+} stats_format_t;
+
+/**
+ * @brief Texto que se va armando (crece solo).
+ */
+typedef struct {
+    char  *data;
+    size_t len, cap;
+    int    format;      ///< stats_format_t.
+    int    oom;         ///< 1 si faltó memoria en algún momento (el texto queda corto).
+} stats_buf_t;
+
+/** @brief Prepara un texto vacío en el formato dado. */
+void stats_buf_init(stats_buf_t *b, int format);
+
+/** @brief Libera el texto. */
+void stats_buf_free(stats_buf_t *b);
+
+/** @brief Agrega texto con formato printf. */
+void stats_printf(stats_buf_t *b, const char *fmt, ...)
+#if defined(__GNUC__)
+    __attribute__((format(printf, 2, 3)))
+#endif
+    ;
+
+/**
+ * @brief Agrega una métrica suelta: con STATS_PROM su # HELP / # TYPE y
+ *        luego la muestra.
+ *
+ * @param type   "counter" o "gauge".
+ * @param labels Etiquetas sin llaves ("worker=\"0\""), o NULL.
+ */
+void stats_put(stats_buf_t *b, const char *name, const char *type, const char *help,
+               const char *labels, uint64_t value);
+
+/**
+ * @brief Agrega los contadores e histogramas de los n workers (etiqueta
+ *        worker) y los tópicos de todos, sumados por nombre.
+ *
+ * @param prefix Prefijo de los nombres ("pubsub_tcp").
+ * @param now_s  Segundo actual del reloj con que se cuentan los PUB (tasas).
+ */
+void stats_render(stats_buf_t *b, const char *prefix, stats_worker_t *ws, int n, uint64_t now_s);
+
+/** Arma el texto de las métricas para el listener HTTP (formato STATS_PROM). */
+typedef void (*stats_render_fn)(stats_buf_t *b, void *arg);
+
+/**
+ * @brief Lanza un hilo que sirve las métricas por HTTP en el puerto port
+ *        (GET /metrics, una conexión a la vez).
+ *
+ * fn corre en ese hilo: tiene que poder leer las métricas desde fuera de los
+ * workers. Winsock ya debe estar inicializado.
+ *
+ * @return 0 si ok, -1 si no se pudo abrir el puerto o lanzar el hilo.
+ */
+int stats_http_start(int port, stats_render_fn fn, void *arg);
+
+#endif /* STATS_H */
@@ -0,0 +1,260 @@
+/**
+ * @file text_cmd.h
+ * @brief Comandos del protocolo textual: parser de una sola pasada, sin copias.
+ *
+ * Una línea ("PUB <topic> <mensaje>", "SUB <topic> FROM <seq>", ...) se
+ * separa en un solo recorrido: text_parse() devuelve el comando, el topic y
+ * el payload como rebanadas del propio buffer de recepción, y de paso dónde
+ * termina la línea. El payload no se vuelve a recorrer (ni trim, ni strchr,
+ * ni strlen) y nada se copia:
+ *
+ *  - La línea termina en el primer '\n', '\r' o '\0', como con el trim y el
+ *    strlen() de antes; lo que siga hasta el '\n' se descarta.
+ *  - El espacio que cierra el topic y el fin de línea se buscan de a 16 bytes
+ *    (SSE2, siempre presente en x86-64) o de a 32 si se compila con -mavx2:
+ *    un payload largo cuesta unas pocas comparaciones por bloque y no varias
+ *    por byte. En otras arquitecturas se usa el bucle simple.
+ *  - Solo escribe los '\0' que terminan el topic y la línea, en el buffer.
+ *
+ * Los dos brokers lo usan: el TCP sobre su buffer de entrada (ver
+ * linebuf_next_cmd() en tcp_utils.h) y el UDP sobre cada datagrama.
+ * bench/bench_parse.c lo compara con el análisis con funciones de cadena.
+ *
+ * Módulo solo de cabecera (funciones inline).
+ */
+
+#ifndef TEXT_CMD_H
+#define TEXT_CMD_H
+
+#include <stdint.h>
+#include <string.h>
+#if defined(__AVX2__) || defined(__SSE2__)
+  #include <immintrin.h>
+#endif
+
+/** Comando de la línea (la palabra inicial). */
+typedef enum {
+    TEXT_UNKNOWN = 0,
+    TEXT_SUB,     ///< SUB <topic> [FROM <seq>]
+    TEXT_RSUB,    ///< RSUB <topic> [FROM <seq>]
+    TEXT_UNSUB,   ///< UNSUB <topic>
+    TEXT_PUB,     ///< PUB <topic> <mensaje...>
+    TEXT_SPUB,    ///< SPUB <seq> <topic> <mensaje...>
+    TEXT_NACK,    ///< NACK <topic> <desde> [<hasta>]
+    TEXT_PING,    ///< PING
+    TEXT_PONG,    ///< PONG [...]
+    TEXT_BIN,     ///< BIN
+    TEXT_STATS,   ///< STATS
+    TEXT_TRACE    ///< TRACE
+} text_op_t;
+
+/** Error de sintaxis de un comando reconocido (text_cmd_t::err). */
+typedef enum {
+    TEXT_OK = 0,
+    TEXT_BAD_SEQ,     ///< Número ausente o mal formado (SPUB, FROM, NACK).
+    TEXT_NO_PAYLOAD   ///< PUB / SPUB sin mensaje.
+} text_err_t;
+
+/**
+ * @brief Comando analizado: rebanadas del buffer de la línea.
+ */
+typedef struct {
+    int         op;         ///< text_op_t.
+    int         err;        ///< text_err_t (con err != TEXT_OK el resto puede estar a medias).
+    char       *topic;      ///< Terminado en '\0' dentro del buffer (NULL si el comando no lleva).
+    int         topic_len;
+    const char *payload;    ///< PUB / SPUB: el mensaje (terminado en '\0', puede ser vacío).
+    int         plen;
+    uint32_t    seq;        ///< SPUB: número; SUB / RSUB: FROM; NACK: desde.
+    uint32_t    seq2;       ///< NACK: hasta (0 = abierto).
+    int         has_seq;    ///< SUB / RSUB: 1 si trae FROM.
+} text_cmd_t;
+
+/**
+ * @brief Posición del primer '\n', '\r' o '\0' de p[0, n) (y del primer ' ' si
+ *        space), o n si no hay ninguno.
+ */
+static inline int text_scan(const char *p, int n, int space) {
+    int i = 0;
+#if defined(__AVX2__)
+    const __m256i nl32 = _mm256_set1_epi8('\n'), cr32 = _mm256_set1_epi8('\r');
+    const __m256i z32 = _mm256_setzero_si256(), sp32 = _mm256_set1_epi8(space ? ' ' : '\n');
+    for (; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(p + i));
+        __m256i m = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, nl32), _mm256_cmpeq_epi8(v, cr32)),
+                                    _mm256_or_si256(_mm256_cmpeq_epi8(v, z32), _mm256_cmpeq_epi8(v, sp32)));
+        unsigned bits = (unsigned)_mm256_movemask_epi8(m);
+        if (bits) return i + __builtin_ctz(bits);
+    }
+#endif
+#if defined(__SSE2__)
+    const __m128i nl = _mm_set1_epi8('\n'), cr = _mm_set1_epi8('\r');
+    const __m128i z = _mm_setzero_si128(), sp = _mm_set1_epi8(space ? ' ' : '\n');
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(p + i));
+        __m128i m = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, nl), _mm_cmpeq_epi8(v, cr)),
+                                 _mm_or_si128(_mm_cmpeq_epi8(v, z), _mm_cmpeq_epi8(v, sp)));
+        unsigned bits = (unsigned)_mm_movemask_epi8(m);
+        if (bits) return i + __builtin_ctz(bits);
+    }
+#endif
+    for (; i < n; i++) {
+        char c = p[i];
+        if (c == '\n' || c == '\r' || c == '\0' || (space && c == ' ')) return i;
+    }
+    return n;
+}
+
+/* Lee los dígitos de buf[*i, end) como número de 32 bits; 0 si no hay ninguno. */
+static inline int text_u32(const char *buf, int *i, int end, uint32_t *v) {
+    int k = *i;
+    uint32_t x = 0;
+    while (k < end && buf[k] >= '0' && buf[k] <= '9') x = x * 10 + (uint32_t)(buf[k++] - '0');
+    if (k == *i) return 0;
+    *i = k;
+    *v = x;
+    return 1;
+}
+
+/* 1 si buf[0, len) empieza con la palabra w (sizeof incluye el '\0'). */
+#define TEXT_WORD(buf, len, w) ((len) >= (int)sizeof(w) - 1 && memcmp((buf), (w), sizeof(w) - 1) == 0)
+
+/**
+ * @brief Analiza la línea al comienzo de buf[0, len).
+ *
+ * Con final = 0 (flujo TCP) una línea sin '\n' todavía no está completa: no
+ * se toca el buffer y se devuelve 0. Con final = 1 (un datagrama, o lo que
+ * quedó al cerrar la conexión) el fin de buf también cierra la línea, y
+ * buf[len] tiene que poder escribirse.
+ *
+ * @return Bytes que ocupa la línea, incluido su '\n' (lo que hay que
+ *         consumir), o 0 si falta el resto.
+ */
+static inline int text_parse(char *buf, int len, int final, text_cmd_t *cmd) {
+    int k = 0, e, t = -1, tend = 0;   // k: inicio del argumento; e: fin de línea; t/tend: topic
+
+    cmd->op = TEXT_UNKNOWN;
+    cmd->err = TEXT_OK;
+    cmd->topic = NULL;
+    cmd->topic_len = 0;
+    cmd->payload = NULL;
+    cmd->plen = 0;
+    cmd->seq = cmd->seq2 = 0;
+    cmd->has_seq = 0;
+
+    switch (len > 0 ? buf[0] : 0) {
+    case 'P':
+        if      (TEXT_WORD(buf, len, "PUB "))  { cmd->op = TEXT_PUB;  k = 4; }
+        else if (TEXT_WORD(buf, len, "PING"))  { cmd->op = TEXT_PING; k = 4; }
+        else if (TEXT_WORD(buf, len, "PONG"))  { cmd->op = TEXT_PONG; k = 4; }
+        break;
+    case 'S':
+        if      (TEXT_WORD(buf, len, "SUB "))  { cmd->op = TEXT_SUB;  k = 4; }
+        else if (TEXT_WORD(buf, len, "SPUB ")) { cmd->op = TEXT_SPUB; k = 5; }
+        else if (TEXT_WORD(buf, len, "STATS")) { cmd->op = TEXT_STATS; k = 5; }
+        break;
+    case 'R':
+        if (TEXT_WORD(buf, len, "RSUB "))  { cmd->op = TEXT_RSUB;  k = 5; }
+        break;
+    case 'U':
+        if (TEXT_WORD(buf, len, "UNSUB ")) { cmd->op = TEXT_UNSUB; k = 6; }
+        break;
+    case 'N':
+        if (TEXT_WORD(buf, len, "NACK "))  { cmd->op = TEXT_NACK;  k = 5; }
+        break;
+    case 'B':
+        if (TEXT_WORD(buf, len, "BIN"))    { cmd->op = TEXT_BIN;   k = 3; }
+        break;
+    case 'T':
+        if (TEXT_WORD(buf, len, "TRACE"))  { cmd->op = TEXT_TRACE; k = 5; }
+        break;
+    }
+
+    switch (cmd->op) {
+    case TEXT_SPUB:
+        // <seq> y un espacio, y luego igual que PUB
+        if (!text_u32(buf, &k, len, &cmd->seq) || k >= len || buf[k] != ' ') {
+            cmd->err = TEXT_BAD_SEQ;
+            e = k + text_scan(buf + k, len - k, 0);
+            break;
+        }
+        k++;
+        /* fallthrough */
+    case TEXT_PUB:
+        // <topic> hasta el primer espacio; el resto de la línea es el payload
+        t = k;
+        tend = k + text_scan(buf + k, len - k, 1);
+        if (tend >= len || buf[tend] != ' ') {
+            cmd->err = TEXT_NO_PAYLOAD;
+            e = tend;
+            break;
+        }
+        k = tend + 1;
+        e = k + text_scan(buf + k, len - k, 0);
+        cmd->payload = buf + k;
+        cmd->plen = e - k;
+        break;
+
+    case TEXT_NACK: {
+        // <topic> <desde> [<hasta>]
+        t = k;
+        tend = k + text_scan(buf + k, len - k, 1);
+        if (tend >= len || buf[tend] != ' ') { cmd->err = TEXT_BAD_SEQ; e = tend; break; }
+        k = tend + 1;
+        if (!text_u32(buf, &k, len, &cmd->seq)) cmd->err = TEXT_BAD_SEQ;
+        else if (k < len && buf[k] == ' ') { k++; (void)text_u32(buf, &k, len, &cmd->seq2); }
+        e = k + text_scan(buf + k, len - k, 0);
+        break;
+    }
+
+    case TEXT_SUB:
+    case TEXT_RSUB:
+    case TEXT_UNSUB:
+        // El topic es el resto de la línea, salvo un " FROM <seq>" (SUB / RSUB)
+        t = k;
+        e = tend = k + text_scan(buf + k, len - k, 0);
+        if (cmd->op == TEXT_UNSUB) break;
+        for (int q = k; (q += text_scan(buf + q, e - q, 1)) < e; q++) {
+            if (e - q < 6 || memcmp(buf + q, " FROM ", 6) != 0) continue;
+            int d = q + 6;
+            if (!text_u32(buf, &d, e, &cmd->seq) || d != e) cmd->err = TEXT_BAD_SEQ;
+            cmd->has_seq = 1;
+            tend = q;
+            break;
+        }
+        break;
+
+    case TEXT_PING:
+    case TEXT_BIN:
+    case TEXT_STATS:
+    case TEXT_TRACE:
+        // Sin argumentos: "PINGx" o "BIN 1" no son estos comandos
+        e = k + text_scan(buf + k, len - k, 0);
+        if (e != k) cmd->op = TEXT_UNKNOWN;
+        break;
+
+    default:
+        e = k + text_scan(buf + k, len - k, 0);
+    }
+
+    // Fin de la línea: el '\n' (quizás después de un '\r' o un '\0')
+    int used;
+    if (e < len && buf[e] == '\n') {
+        used = e + 1;
+    } else {
+        const char *nl = e < len ? (const char*)memchr(buf + e, '\n', len - e) : NULL;
+        if (nl)          used = (int)(nl - buf) + 1;
+        else if (final)  used = len;
+        else             return 0;
+    }
+
+    buf[e] = '\0';
+    if (t >= 0) {
+        buf[tend] = '\0';
+        cmd->topic = buf + t;
+        cmd->topic_len = tend - t;
+    }
+    return used;
+}
+
+#endif /* TEXT_CMD_H */
@@ -0,0 +1,145 @@
+/**
+ * @file threads.h
+ * @brief Hilos, mutex y locks de lectura/escritura para Windows y POSIX.
+ *
+ * Lo mínimo que necesitan los brokers para correr un event loop por núcleo
+ * (workers): crear y esperar hilos, proteger estado compartido y guardar
+ * estado por hilo.
+ *
+ *  - POSIX: pthreads (compilar con -pthread).
+ *  - Windows: CreateThread y SRWLOCK (sin bibliotecas extra).
+ *
+ * Módulo solo de cabecera (funciones inline).
+ */
+
+#ifndef THREADS_H
+#define THREADS_H
+
+/* pthread_rwlock_t, clock_gettime() y nanosleep() son POSIX.1-2008: con
+ * -std=c11 (sin extensiones GNU) la libc los oculta si no se piden antes del
+ * primer include del sistema. _DEFAULT_SOURCE mantiene en glibc lo que
+ * _POSIX_C_SOURCE solo ocultaría (SO_REUSEPORT, entre otros). */
+#if !defined(_WIN32) && defined(__STRICT_ANSI__) && !defined(_POSIX_C_SOURCE) \
+    && !defined(_XOPEN_SOURCE) && !defined(_GNU_SOURCE)
+  #define _POSIX_C_SOURCE 200809L
+  #define _DEFAULT_SOURCE
+#endif
+
+#include <stdlib.h>
+
+#ifdef _WIN32
+  #include <winsock2.h>   // antes que windows.h, que si no arrastra winsock.h
+  #include <windows.h>
+#else
+  #include <errno.h>
+  #include <pthread.h>
+  #include <time.h>
+  #include <unistd.h>
+#endif
+
+/** Almacenamiento por hilo: cada worker ve su propia copia de la variable. */
+#if defined(_MSC_VER)
+  #define THREAD_LOCAL __declspec(thread)
+#else
+  #define THREAD_LOCAL _Thread_local
+#endif
+
+/** Función de un hilo. */
+typedef void *(*thread_fn)(void *arg);
+
+#ifdef _WIN32
+
+typedef HANDLE thread_t;
+typedef SRWLOCK mutex_t;
+typedef SRWLOCK rwlock_t;
+
+/* CreateThread espera otra firma: se pasa por un trampolín con fn y arg. */
+typedef struct { thread_fn fn; void *arg; } thread_start_t;
+
+static inline DWORD WINAPI thread_trampoline(LPVOID p) {
+    thread_start_t st = *(thread_start_t*)p;
+    free(p);
+    st.fn(st.arg);
+    return 0;
+}
+
+static inline int thread_start(thread_t *t, thread_fn fn, void *arg) {
+    thread_start_t *st = (thread_start_t*)malloc(sizeof(*st));
+    if (!st) return -1;
+    st->fn  = fn;
+    st->arg = arg;
+    *t = CreateThread(NULL, 0, thread_trampoline, st, 0, NULL);
+    if (!*t) { free(st); return -1; }
+    return 0;
+}
+
+static inline void thread_join(thread_t t) {
+    WaitForSingleObject(t, INFINITE);
+    CloseHandle(t);
+}
+
+static inline void mutex_init(mutex_t *m)    { InitializeSRWLock(m); }
+static inline void mutex_destroy(mutex_t *m) { (void)m; }
+static inline void mutex_lock(mutex_t *m)    { AcquireSRWLockExclusive(m); }
+static inline void mutex_unlock(mutex_t *m)  { ReleaseSRWLockExclusive(m); }
+
+static inline void rwlock_init(rwlock_t *l)     { InitializeSRWLock(l); }
+static inline void rwlock_destroy(rwlock_t *l)  { (void)l; }
+static inline void rwlock_rdlock(rwlock_t *l)   { AcquireSRWLockShared(l); }
+static inline void rwlock_rdunlock(rwlock_t *l) { ReleaseSRWLockShared(l); }
+static inline void rwlock_wrlock(rwlock_t *l)   { AcquireSRWLockExclusive(l); }
+static inline void rwlock_wrunlock(rwlock_t *l) { ReleaseSRWLockExclusive(l); }
+
+/** @brief Duerme el hilo actual ms milisegundos. */
+static inline void thread_sleep_ms(int ms) { Sleep((DWORD)ms); }
+
+/** @brief Núcleos disponibles. */
+static inline int cpu_count(void) {
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    return (int)si.dwNumberOfProcessors;
+}
+
+#else
+
+typedef pthread_t        thread_t;
+typedef pthread_mutex_t  mutex_t;
+typedef pthread_rwlock_t rwlock_t;
+
+/** @brief Lanza fn(arg) en un hilo nuevo. @return 0 si ok, -1 si falla. */
+static inline int thread_start(thread_t *t, thread_fn fn, void *arg) {
+    return pthread_create(t, NULL, fn, arg) == 0 ? 0 : -1;
+}
+
+/** @brief Espera a que el hilo termine. */
+static inline void thread_join(thread_t t) {
+    pthread_join(t, NULL);
+}
+
+static inline void mutex_init(mutex_t *m)    { pthread_mutex_init(m, NULL); }
+static inline void mutex_destroy(mutex_t *m) { pthread_mutex_destroy(m); }
+static inline void mutex_lock(mutex_t *m)    { pthread_mutex_lock(m); }
+static inline void mutex_unlock(mutex_t *m)  { pthread_mutex_unlock(m); }
+
+static inline void rwlock_init(rwlock_t *l)     { pthread_rwlock_init(l, NULL); }
+static inline void rwlock_destroy(rwlock_t *l)  { pthread_rwlock_destroy(l); }
+static inline void rwlock_rdlock(rwlock_t *l)   { pthread_rwlock_rdlock(l); }
+static inline void rwlock_rdunlock(rwlock_t *l) { pthread_rwlock_unlock(l); }
+static inline void rwlock_wrlock(rwlock_t *l)   { pthread_rwlock_wrlock(l); }
+static inline void rwlock_wrunlock(rwlock_t *l) { pthread_rwlock_unlock(l); }
+
+/** @brief Duerme el hilo actual ms milisegundos. */
+static inline void thread_sleep_ms(int ms) {
+    struct timespec ts = { ms / 1000, (long)(ms % 1000) * 1000000L };
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR) {}  // señal: dormir lo que falta
+}
+
+/** @brief Núcleos disponibles. */
+static inline int cpu_count(void) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+}
+
+#endif
+
+#endif /* THREADS_H */
@@ -0,0 +1,205 @@
+/**
+ * @file timer_wheel.h
+ * @brief Rueda de temporizadores jerárquica: programar, cancelar y vencer en O(1).
+ *
+ * Para vencimientos masivos (leases de suscriptores, timeouts de conexiones)
+ * donde un heap costaría O(log n) por operación y recorrer la tabla entera en
+ * cada tick costaría O(n):
+ *
+ *  - El tiempo se mide en ticks (el llamador elige su duración). La rueda
+ *    tiene TW_LEVELS niveles de TW_SLOTS ranuras: el nivel 0 cubre los
+ *    próximos 64 ticks, uno por ranura; el nivel l, 64^(l+1) ticks en
+ *    ranuras de 64^l.
+ *  - Un temporizador es intrusivo (va dentro del objeto al que pertenece) y
+ *    se guarda en una lista doblemente enlazada de su ranura: programarlo y
+ *    cancelarlo es O(1), sin reservar memoria.
+ *  - Cada 64 ticks la ranura que toca del nivel 1 se reparte en el nivel 0
+ *    (y así hacia arriba cada 64^l): cada temporizador baja a lo sumo
+ *    TW_LEVELS - 1 veces en toda su vida, así que vencer n cuesta O(n) en
+ *    total y O(1) por tick cuando no vence nada.
+ *  - Un vencimiento más lejano que TW_MAX_TICKS se acorta a ese máximo.
+ *  - tw_next() dice cuánto puede dormir un event loop sin pasarse del
+ *    próximo vencimiento.
+ *
+ * No es segura entre hilos: quien la comparte la protege con un lock.
+ * Módulo solo de cabecera (funciones inline).
+ */
+
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define TW_BITS   6                      ///< log2 de las ranuras por nivel.
+#define TW_SLOTS  (1u << TW_BITS)
+#define TW_MASK   (TW_SLOTS - 1)
+#define TW_LEVELS 4
+#define TW_MAX_TICKS ((1ull << (TW_BITS * TW_LEVELS)) - 1)  ///< Horizonte de la rueda.
+
+/**
+ * @brief Temporizador (va dentro del objeto que lo usa).
+ */
+typedef struct tw_timer {
+    struct tw_timer  *next;
+    struct tw_timer **pprev;    ///< NULL = no programado.
+    uint64_t          expires;  ///< Tick en que vence.
+} tw_timer_t;
+
+/**
+ * @brief Rueda de temporizadores.
+ */
+typedef struct {
+    tw_timer_t *slots[TW_LEVELS][TW_SLOTS];
+    uint64_t    now;            ///< Próximo tick por procesar.
+    size_t      count;          ///< Temporizadores programados.
+} timer_wheel_t;
+
+/** Función que recibe cada temporizador vencido (ya fuera de la rueda). */
+typedef void (*tw_fn)(tw_timer_t *t, void *arg);
+
+/** @brief Prepara una rueda vacía que empieza en el tick now. */
+static inline void tw_init(timer_wheel_t *tw, uint64_t now) {
+    for (int l = 0; l < TW_LEVELS; l++)
+        for (unsigned i = 0; i < TW_SLOTS; i++) tw->slots[l][i] = NULL;
+    tw->now   = now;
+    tw->count = 0;
+}
+
+/** @brief Prepara un temporizador sin programar. */
+static inline void tw_timer_init(tw_timer_t *t) {
+    t->next    = NULL;
+    t->pprev   = NULL;
+    t->expires = 0;
+}
+
+/** @brief 1 si el temporizador está programado. */
+static inline int tw_pending(const tw_timer_t *t) {
+    return t->pprev != NULL;
+}
+
+/* Encadena t en la ranura que le toca según cuánto falta para su vencimiento. */
+static inline void tw_place(timer_wheel_t *tw, tw_timer_t *t) {
+    if ((int64_t)(t->expires - tw->now) < 0) t->expires = tw->now;  // ya vencido: en el próximo tick
+    uint64_t delta = t->expires - tw->now;
+    if (delta > TW_MAX_TICKS) t->expires = tw->now + TW_MAX_TICKS;
+
+    int l = 0;
+    while (l < TW_LEVELS - 1 && delta >= (1ull << (TW_BITS * (l + 1)))) l++;
+    tw_timer_t **head = &tw->slots[l][(t->expires >> (TW_BITS * l)) & TW_MASK];
+    t->next  = *head;
+    t->pprev = head;
+    if (*head) (*head)->pprev = &t->next;
+    *head = t;
+}
+
+/* Saca t de su lista (sin tocar count). */
+static inline void tw_unlink(tw_timer_t *t) {
+    *t->pprev = t->next;
+    if (t->next) t->next->pprev = t->pprev;
+    t->next  = NULL;
+    t->pprev = NULL;
+}
+
+/**
+ * @brief Cancela el temporizador si está programado.
+ */
+static inline void tw_cancel(timer_wheel_t *tw, tw_timer_t *t) {
+    if (!t->pprev) return;
+    tw_unlink(t);
+    tw->count--;
+}
+
+/**
+ * @brief Programa t para el tick expires (si ya estaba programado, lo mueve).
+ *
+ * Un tick ya pasado vence en el próximo tw_advance().
+ */
+static inline void tw_add(timer_wheel_t *tw, tw_timer_t *t, uint64_t expires) {
+    tw_cancel(tw, t);
+    t->expires = expires;
+    tw_place(tw, t);
+    tw->count++;
+}
+
+/* Reparte la ranura idx del nivel l en los niveles de abajo. */
+static inline void tw_cascade(timer_wheel_t *tw, int l, unsigned idx) {
+    tw_timer_t *t = tw->slots[l][idx];
+    tw->slots[l][idx] = NULL;
+    while (t) {
+        tw_timer_t *next = t->next;
+        tw_place(tw, t);
+        t = next;
+    }
+}
+
+/**
+ * @brief Procesa los ticks hasta now inclusive y llama a fn con cada
+ *        temporizador vencido.
+ *
+ * El temporizador ya está fuera de la rueda cuando fn lo recibe: fn puede
+ * volver a programarlo (vence en un tick posterior, nunca en el que se está
+ * procesando), cancelar otros o liberar el objeto que lo contiene.
+ *
+ * @return Temporizadores vencidos.
+ */
+static inline size_t tw_advance(timer_wheel_t *tw, uint64_t now, tw_fn fn, void *arg) {
+    size_t fired = 0;
+    while ((int64_t)(now - tw->now) >= 0) {
+        if (tw->count == 0) {  // nada programado: salta directo
+            tw->now = now + 1;
+            break;
+        }
+        uint64_t tick = tw->now;
+        unsigned idx = (unsigned)(tick & TW_MASK);
+        for (int l = 1; idx == 0 && l < TW_LEVELS; l++) {
+            idx = (unsigned)((tick >> (TW_BITS * l)) & TW_MASK);
+            tw_cascade(tw, l, idx);
+        }
+
+        // La ranura se pasa a una lista local: lo que fn programe cae en ticks futuros
+        tw_timer_t *due = tw->slots[0][tick & TW_MASK];
+        tw->slots[0][tick & TW_MASK] = NULL;
+        if (due) due->pprev = &due;
+        tw->now = tick + 1;
+        while (due) {
+            tw_timer_t *t = due;
+            tw_unlink(t);
+            tw->count--;
+            fired++;
+            fn(t, arg);
+        }
+    }
+    return fired;
+}
+
+/**
+ * @brief Ticks que se pueden esperar sin pasarse del próximo tick con trabajo.
+ *
+ * Para el timeout de un event loop. Exacto si lo próximo está en el nivel 0;
+ * si no, es lo que falta para que baje la ranura más cercana de un nivel
+ * superior (ahí se vuelve a calcular). Recorre a lo sumo TW_LEVELS * TW_SLOTS
+ * ranuras.
+ *
+ * @return 0 si hay algo que procesar en el tick now, -1 si no hay nada programado.
+ */
+static inline int64_t tw_next(const timer_wheel_t *tw) {
+    if (tw->count == 0) return -1;
+    int64_t best = -1;
+    for (int l = 0; l < TW_LEVELS && best != 0; l++) {
+        unsigned shift = TW_BITS * l;
+        uint64_t base = tw->now >> shift;
+        // La ranura actual de un nivel superior ya bajó, salvo que now sea
+        // justo su comienzo: lo que tiene es de la próxima vuelta (k = TW_SLOTS)
+        unsigned k0 = (base << shift) == tw->now ? 0 : 1;
+        for (unsigned k = k0; k <= TW_SLOTS - (l == 0); k++) {
+            if (!tw->slots[l][(base + k) & TW_MASK]) continue;
+            int64_t at = (int64_t)(((base + k) << shift) - tw->now);
+            if (best < 0 || at < best) best = at;
+            break;
+        }
+    }
+    return best;
+}
+
+#endif /* TIMER_WHEEL_H */
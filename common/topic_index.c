@@ -0,0 +1,405 @@
+/**
+ * @file topic_index.c
+ * @brief Registro de tópicos internados con listas de suscriptores (ver topic_index.h).
+ *
+ * Notas:
+ *  - Un id es estable mientras el tópico tenga suscripciones o esté fijado;
+ *    al liberarse pasa a free_ids y el próximo topic_intern() lo reutiliza.
+ *  - La tabla hash se mantiene con factor de carga <= 1/2 y se duplica al
+ *    superarlo; las colisiones se resuelven con sondeo lineal, y las bajas
+ *    corren hacia atrás las entradas siguientes de la cadena (sin lápidas).
+ *  - Trie de patrones: cada nodo es un nivel. Los hijos literales viven en una
+ *    tabla hash propia del nodo; el hijo '+' y el patrón '#' se guardan aparte,
+ *    así que en cada nivel el recorrido hace una búsqueda hash y, como mucho,
+ *    una bifurcación por '+'.
+ */
+
+#include "topic_index.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* Hash FNV-1a de 32 bits. */
+static uint32_t fnv1a(const char *s, int len) {
+    uint32_t h = 2166136261u;
+    for (int i = 0; i < len; i++) {
+        h ^= (unsigned char)s[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+uint32_t topic_hash(const char *name, int len) {
+    return fnv1a(name, len);
+}
+
+/* ------------------------------------------------------------------------- */
+/*  Trie de patrones                                                         */
+/* ------------------------------------------------------------------------- */
+
+struct topic_trie {
+    char          *level;   // segmento literal (NULL en la raíz y en '+')
+    uint32_t       len;
+    uint32_t       hash;
+    topic_trie_t **kids;    // hijos literales: tabla hash (NULL = libre)
+    uint32_t       nkids;
+    uint32_t       cap;     // potencia de 2
+    topic_trie_t  *plus;    // hijo '+'
+    topic_id_t     exact;   // patrón que termina en este nodo
+    topic_id_t     multi;   // patrón "<este prefijo>/#"
+};
+
+static topic_trie_t *trie_node_new(const char *level, int len, uint32_t h) {
+    topic_trie_t *n = (topic_trie_t*)calloc(1, sizeof(*n));
+    if (!n) return NULL;
+    n->exact = n->multi = TOPIC_NONE;
+    if (level) {
+        n->level = (char*)malloc(len + 1);
+        if (!n->level) { free(n); return NULL; }
+        memcpy(n->level, level, len);
+        n->level[len] = '\0';
+        n->len  = (uint32_t)len;
+        n->hash = h;
+    }
+    return n;
+}
+
+static void trie_free(topic_trie_t *n) {
+    if (!n) return;
+    for (uint32_t i = 0; i < n->cap; i++) trie_free(n->kids[i]);
+    trie_free(n->plus);
+    free(n->kids);
+    free(n->level);
+    free(n);
+}
+
+static const topic_trie_t *trie_child(const topic_trie_t *n, const char *level, int len, uint32_t h) {
+    if (!n->nkids) return NULL;
+    uint32_t mask = n->cap - 1;
+    for (uint32_t i = h & mask; n->kids[i]; i = (i + 1) & mask) {
+        const topic_trie_t *k = n->kids[i];
+        if (k->hash == h && k->len == (uint32_t)len && memcmp(k->level, level, len) == 0)
+            return k;
+    }
+    return NULL;
+}
+
+/* Inserta k en la tabla de hijos de n (sin comprobar duplicados). */
+static void trie_put_kid(topic_trie_t *n, topic_trie_t *k) {
+    uint32_t mask = n->cap - 1;
+    uint32_t i = k->hash & mask;
+    while (n->kids[i]) i = (i + 1) & mask;
+    n->kids[i] = k;
+}
+
+static topic_trie_t *trie_child_add(topic_trie_t *n, const char *level, int len, uint32_t h) {
+    topic_trie_t *k = (topic_trie_t*)trie_child(n, level, len, h);
+    if (k) return k;
+
+    if ((n->nkids + 1) * 2 > n->cap) {
+        uint32_t ncap = n->cap ? n->cap * 2 : 4;
+        topic_trie_t **old = n->kids;
+        uint32_t ocap = n->cap;
+        n->kids = (topic_trie_t**)calloc(ncap, sizeof(*n->kids));
+        if (!n->kids) { n->kids = old; return NULL; }
+        n->cap = ncap;
+        for (uint32_t i = 0; i < ocap; i++) if (old[i]) trie_put_kid(n, old[i]);
+        free(old);
+    }
+    k = trie_node_new(level, len, h);
+    if (!k) return NULL;
+    trie_put_kid(n, k);
+    n->nkids++;
+    return k;
+}
+
+static int is_wild(const char *lv, int len, char w) {
+    return len == 1 && lv[0] == w;
+}
+
+int topic_classify(const char *name, int len) {
+    int wild = 0;
+    const char *p = name, *end = name + len;
+    while (1) {
+        const char *slash = (const char*)memchr(p, TOPIC_SEP, end - p);
+        const char *lend  = slash ? slash : end;
+        int n = (int)(lend - p);
+        if (is_wild(p, n, TOPIC_WILD_ALL)) {
+            if (slash) return -1;  // '#' solo puede ser el último nivel
+            wild = 1;
+        } else if (is_wild(p, n, TOPIC_WILD_ONE)) {
+            wild = 1;
+        } else if (memchr(p, TOPIC_WILD_ONE, n) || memchr(p, TOPIC_WILD_ALL, n)) {
+            return -1;             // comodín mezclado con texto
+        }
+        if (!slash) break;
+        p = slash + 1;
+    }
+    return wild;
+}
+
+/* Inserta el patrón id (nombre name) en el trie. */
+static int trie_insert(topic_index_t *ix, const char *name, int len, topic_id_t id) {
+    if (!ix->trie && !(ix->trie = trie_node_new(NULL, 0, 0))) return -1;
+
+    topic_trie_t *n = ix->trie;
+    const char *p = name, *end = name + len;
+    while (1) {
+        const char *slash = (const char*)memchr(p, TOPIC_SEP, end - p);
+        const char *lend  = slash ? slash : end;
+        int lvlen = (int)(lend - p);
+
+        if (is_wild(p, lvlen, TOPIC_WILD_ALL)) { n->multi = id; return 0; }
+        if (is_wild(p, lvlen, TOPIC_WILD_ONE)) {
+            if (!n->plus && !(n->plus = trie_node_new(NULL, 0, 0))) return -1;
+            n = n->plus;
+        } else {
+            n = trie_child_add(n, p, lvlen, fnv1a(p, lvlen));
+            if (!n) return -1;
+        }
+        if (!slash) break;
+        p = slash + 1;
+    }
+    n->exact = id;
+    return 0;
+}
+
+/* 1 si el nodo ya no sostiene ningún patrón. */
+static int trie_empty(const topic_trie_t *n) {
+    return n->exact == TOPIC_NONE && n->multi == TOPIC_NONE && !n->nkids && !n->plus;
+}
+
+/* Saca el hijo literal k de la tabla de n, corriendo hacia atrás los que lo siguen. */
+static void trie_kid_remove(topic_trie_t *n, const topic_trie_t *k) {
+    uint32_t mask = n->cap - 1;
+    uint32_t i = k->hash & mask;
+    while (n->kids[i] != k) i = (i + 1) & mask;
+    n->kids[i] = NULL;
+    for (uint32_t j = (i + 1) & mask; n->kids[j]; j = (j + 1) & mask) {
+        uint32_t home = n->kids[j]->hash & mask;
+        if (((j - home) & mask) >= ((j - i) & mask)) {  // su lugar natural no está entre i y j
+            n->kids[i] = n->kids[j];
+            n->kids[j] = NULL;
+            i = j;
+        }
+    }
+    n->nkids--;
+}
+
+/* Quita el patrón de niveles [p, end) debajo de n y poda los nodos que quedan
+ * vacíos. Devuelve 1 si n mismo quedó vacío. */
+static int trie_remove(topic_trie_t *n, const char *p, const char *end) {
+    const char *slash = (const char*)memchr(p, TOPIC_SEP, end - p);
+    const char *lend  = slash ? slash : end;
+    int lvlen = (int)(lend - p);
+
+    if (is_wild(p, lvlen, TOPIC_WILD_ALL)) {
+        n->multi = TOPIC_NONE;
+    } else {
+        topic_trie_t *k = is_wild(p, lvlen, TOPIC_WILD_ONE)
+                        ? n->plus : (topic_trie_t*)trie_child(n, p, lvlen, fnv1a(p, lvlen));
+        if (!k) return 0;
+        int empty;
+        if (slash) {
+            empty = trie_remove(k, slash + 1, end);
+        } else {
+            k->exact = TOPIC_NONE;
+            empty = trie_empty(k);
+        }
+        if (empty) {
+            if (k == n->plus) n->plus = NULL;
+            else              trie_kid_remove(n, k);
+            trie_free(k);
+        }
+    }
+    return trie_empty(n);
+}
+
+/* Recorre el trie con los niveles [p, end); p == NULL indica "sin niveles restantes". */
+static void trie_match(const topic_trie_t *n, const char *p, const char *end,
+                       topic_match_fn fn, void *arg) {
+    // "<prefijo>/#" coincide con el prefijo y con cualquier cantidad de niveles debajo.
+    if (n->multi != TOPIC_NONE) fn(n->multi, arg);
+    if (!p) {
+        if (n->exact != TOPIC_NONE) fn(n->exact, arg);
+        return;
+    }
+    const char *slash = (const char*)memchr(p, TOPIC_SEP, end - p);
+    const char *lend  = slash ? slash : end;
+    const char *next  = slash ? slash + 1 : NULL;
+    int lvlen = (int)(lend - p);
+
+    const topic_trie_t *k = trie_child(n, p, lvlen, fnv1a(p, lvlen));
+    if (k)       trie_match(k, next, end, fn, arg);
+    if (n->plus) trie_match(n->plus, next, end, fn, arg);
+}
+
+void topic_match(const topic_index_t *ix, const char *topic, int len,
+                 topic_match_fn fn, void *arg) {
+    if (!ix->npatterns) return;
+    trie_match(ix->trie, topic, topic + len, fn, arg);
+}
+
+/* ------------------------------------------------------------------------- */
+/*  Registro                                                                 */
+/* ------------------------------------------------------------------------- */
+
+void topic_index_init(topic_index_t *ix) {
+    memset(ix, 0, sizeof(*ix));
+    pool_init(&ix->sub_pool, sizeof(topic_sub_t));
+}
+
+void topic_index_free(topic_index_t *ix) {
+    for (uint32_t i = 0; i < ix->ntopics; i++) {
+        topic_t *t = &ix->topics[i];
+        free(t->subs);
+        free(t->name);
+    }
+    free(ix->topics);
+    free(ix->free_ids);
+    free(ix->slots);
+    trie_free(ix->trie);
+    pool_destroy(&ix->sub_pool);  // enlaces aún activos incluidos
+    memset(ix, 0, sizeof(*ix));
+}
+
+/* Busca el slot de name: el que lo contiene o el primero libre de su cadena. */
+static uint32_t find_slot(const topic_index_t *ix, const char *name, int len, uint32_t h) {
+    uint32_t mask = ix->nslots - 1;
+    uint32_t i = h & mask;
+    while (ix->slots[i]) {
+        const topic_t *t = &ix->topics[ix->slots[i] - 1];
+        if (t->hash == h && t->len == (uint32_t)len && memcmp(t->name, name, len) == 0)
+            return i;
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+/* Duplica la tabla hash y reubica todos los ids. */
+static int grow_slots(topic_index_t *ix) {
+    uint32_t n = ix->nslots ? ix->nslots * 2 : 64;
+    uint32_t *slots = (uint32_t*)calloc(n, sizeof(*slots));
+    if (!slots) return -1;
+
+    free(ix->slots);
+    ix->slots  = slots;
+    ix->nslots = n;
+    for (uint32_t id = 0; id < ix->ntopics; id++) {
+        if (!ix->topics[id].name) continue;  // id libre
+        uint32_t i = ix->topics[id].hash & (n - 1);
+        while (slots[i]) i = (i + 1) & (n - 1);
+        slots[i] = id + 1;
+    }
+    return 0;
+}
+
+topic_id_t topic_lookup(const topic_index_t *ix, const char *name, int len) {
+    if (!ix->nslots) return TOPIC_NONE;
+    uint32_t s = find_slot(ix, name, len, fnv1a(name, len));
+    return ix->slots[s] ? ix->slots[s] - 1 : TOPIC_NONE;
+}
+
+topic_id_t topic_intern(topic_index_t *ix, const char *name, int len) {
+    uint32_t h = fnv1a(name, len);
+    if (ix->nslots) {
+        uint32_t s = find_slot(ix, name, len, h);
+        if (ix->slots[s]) return ix->slots[s] - 1;
+    }
+
+    if ((topic_count(ix) + 1) * 2 > ix->nslots && grow_slots(ix) != 0) return TOPIC_NONE;
+    if (!ix->nfree && ix->ntopics == ix->cap) {
+        uint32_t ncap = ix->cap ? ix->cap * 2 : 64;
+        uint32_t *f = (uint32_t*)realloc(ix->free_ids, ncap * sizeof(*f));
+        if (!f) return TOPIC_NONE;
+        ix->free_ids = f;
+        topic_t *t = (topic_t*)realloc(ix->topics, ncap * sizeof(*t));
+        if (!t) return TOPIC_NONE;
+        ix->topics = t;
+        ix->cap    = ncap;
+    }
+
+    char *copy = (char*)malloc(len + 1);
+    if (!copy) return TOPIC_NONE;
+    memcpy(copy, name, len);
+    copy[len] = '\0';
+
+    topic_id_t id = ix->nfree ? ix->free_ids[--ix->nfree] : ix->ntopics++;
+    topic_t *t = &ix->topics[id];
+    memset(t, 0, sizeof(*t));
+    t->name = copy;
+    t->len  = (uint32_t)len;
+    t->hash = h;
+    ix->slots[find_slot(ix, name, len, h)] = id + 1;
+
+    if (topic_classify(name, len) == 1) {
+        t->pattern = 1;
+        ix->npatterns++;
+        if (trie_insert(ix, name, len, id) != 0) {
+            (void)topic_release(ix, id);
+            return TOPIC_NONE;
+        }
+    }
+    return id;
+}
+
+int topic_release(topic_index_t *ix, topic_id_t id) {
+    topic_t *t = &ix->topics[id];
+    if (!t->name || t->nsubs || t->pins) return 0;
+
+    // Sacar el id de la tabla hash, corriendo hacia atrás el resto de su cadena
+    uint32_t mask = ix->nslots - 1;
+    uint32_t i = t->hash & mask;
+    while (ix->slots[i] != id + 1) i = (i + 1) & mask;
+    ix->slots[i] = 0;
+    for (uint32_t j = (i + 1) & mask; ix->slots[j]; j = (j + 1) & mask) {
+        uint32_t home = ix->topics[ix->slots[j] - 1].hash & mask;
+        if (((j - home) & mask) >= ((j - i) & mask)) {
+            ix->slots[i] = ix->slots[j];
+            ix->slots[j] = 0;
+            i = j;
+        }
+    }
+
+    if (t->pattern) {
+        if (ix->trie && trie_remove(ix->trie, t->name, t->name + t->len)) {
+            trie_free(ix->trie);
+            ix->trie = NULL;
+        }
+        ix->npatterns--;
+    }
+    free(t->subs);
+    free(t->name);
+    memset(t, 0, sizeof(*t));
+    ix->free_ids[ix->nfree++] = id;  // free_ids crece junto con topics: siempre hay lugar
+    return 1;
+}
+
+topic_sub_t *topic_subscribe(topic_index_t *ix, topic_id_t id, void *owner) {
+    topic_t *t = &ix->topics[id];
+    if (t->nsubs == t->cap) {
+        uint32_t ncap = t->cap ? t->cap * 2 : 4;
+        topic_sub_t **s = (topic_sub_t**)realloc(t->subs, ncap * sizeof(*s));
+        if (!s) return NULL;
+        t->subs = s;
+        t->cap  = ncap;
+    }
+    topic_sub_t *sub = (topic_sub_t*)pool_alloc(&ix->sub_pool);
+    if (!sub) return NULL;
+    sub->owner = owner;
+    sub->topic = id;
+    sub->pos   = t->nsubs;
+    sub->live_from = 0;
+    sub->replaying = 0;
+    t->subs[t->nsubs++] = sub;
+    return sub;
+}
+
+void topic_unsubscribe(topic_index_t *ix, topic_sub_t *sub) {
+    topic_id_t id = sub->topic;
+    topic_t *t = &ix->topics[id];
+    topic_sub_t *last = t->subs[--t->nsubs];
+    t->subs[sub->pos] = last;
+    last->pos = sub->pos;
+    pool_put(&ix->sub_pool, sub);
+    if (!t->nsubs) (void)topic_release(ix, id);
+}
@@ -0,0 +1,204 @@
+/**
+ * @file topic_index.h
+ * @brief Registro de tópicos compartido por los brokers TCP y UDP.
+ *
+ * Cada nombre de tópico se *interna* una sola vez y recibe un identificador
+ * entero (topic_id_t) estable. A partir de ahí el broker trabaja con enteros:
+ * cada tópico guarda la lista compacta de sus suscripciones, de modo que
+ * publicar cuesta O(suscriptores del tópico) y no O(tamaño de la tabla).
+ *
+ *  - topic_intern()/topic_lookup(): tabla hash (FNV-1a, direccionamiento
+ *    abierto) de nombre -> id. lookup no inserta: publicar en un tópico sin
+ *    suscriptores no hace crecer el registro.
+ *  - topic_subscribe()/topic_unsubscribe(): alta y baja en O(1). Cada
+ *    suscripción (topic_sub_t) recuerda su posición en el arreglo del tópico
+ *    y la baja se hace con swap-remove. Los enlaces salen de un pool propio
+ *    del registro (common/pool.h): altas y bajas repetidas no llaman a malloc.
+ *  - Un tópico vive mientras tenga suscripciones o esté fijado
+ *    (topic_pin()): al irse la última se libera su nombre, su rama del trie
+ *    y su id, que otro tópico puede reutilizar. Así el churn de SUB/UNSUB no
+ *    hace crecer el registro.
+ *  - Tópicos jerárquicos separados por '/' (p.ej. liga/partidoA/goles) con
+ *    comodines de un nivel ('+') y multinivel ('#', solo como último nivel).
+ *    Un patrón con comodines se interna igual que cualquier tópico (tiene su
+ *    id y su lista de suscripciones) y además se inserta en un trie por
+ *    niveles. topic_match() recorre ese trie: su coste depende de la
+ *    profundidad del tópico publicado, no de cuántos patrones existen.
+ *
+ * El módulo no conoce sockets: el dueño de cada suscripción es un puntero
+ * opaco (client_t* en TCP, sub_t* en UDP).
+ *
+ * Compilación: añadir ../common/topic_index.c a la línea de gcc del broker.
+ */
+
+#ifndef TOPIC_INDEX_H
+#define TOPIC_INDEX_H
+
+#include <stdint.h>
+#include "pool.h"
+
+/** Identificador interno de un tópico (índice en el registro). */
+typedef uint32_t topic_id_t;
+
+/** Valor de topic_id_t que indica "tópico inexistente". */
+#define TOPIC_NONE ((topic_id_t)0xFFFFFFFFu)
+
+/**
+ * @brief Una suscripción: enlace entre un dueño y un tópico.
+ */
+typedef struct topic_sub {
+    void       *owner;  ///< Conexión o suscriptor dueño (opaco para el índice).
+    topic_id_t  topic;  ///< Tópico suscrito.
+    uint32_t    pos;    ///< Posición dentro de topic_t::subs (para baja O(1)).
+    uint32_t    live_from; ///< Historial (broker TCP): primer número que se entrega en vivo (0 = todos).
+    int         replaying; ///< Historial: 1 mientras se reenvía lo retenido (nada en vivo).
+} topic_sub_t;
+
+/**
+ * @brief Entrada del registro: nombre interno y sus suscripciones.
+ */
+typedef struct {
+    char         *name;   ///< Nombre terminado en '\0'.
+    uint32_t      len;    ///< Longitud del nombre.
+    uint32_t      hash;   ///< Hash FNV-1a del nombre.
+    int           pattern;///< 1 si el nombre contiene comodines.
+    topic_sub_t **subs;   ///< Suscripciones activas (arreglo denso).
+    uint32_t      nsubs;
+    uint32_t      cap;
+    uint32_t      pins;   ///< Usos que no son suscripciones (ver topic_pin()).
+} topic_t;
+
+/** Nodo del trie de patrones (definido en topic_index.c). */
+typedef struct topic_trie topic_trie_t;
+
+/**
+ * @brief Registro de tópicos.
+ */
+typedef struct {
+    topic_t  *topics;    ///< Tópicos indexados por topic_id_t (name == NULL: id libre).
+    uint32_t  ntopics;   ///< ids en uso o libres (topic_count() da los vivos).
+    uint32_t  cap;
+    uint32_t *free_ids;  ///< ids liberados, para reutilizar (lugar para cap).
+    uint32_t  nfree;
+    uint32_t *slots;     ///< Tabla hash: id+1 (0 = libre).
+    uint32_t  nslots;    ///< Potencia de 2.
+    topic_trie_t *trie;  ///< Raíz del trie de patrones (NULL si no hay ninguno).
+    uint32_t  npatterns; ///< Patrones con comodines internados.
+    pool_t    sub_pool;  ///< Enlaces topic_sub_t (mismo dueño/lock que el registro).
+} topic_index_t;
+
+/** Separador de niveles en tópicos jerárquicos. */
+#define TOPIC_SEP       '/'
+/** Comodín de un nivel. */
+#define TOPIC_WILD_ONE  '+'
+/** Comodín multinivel (solo como último nivel). */
+#define TOPIC_WILD_ALL  '#'
+
+/**
+ * @brief Clasifica un nombre de tópico.
+ * @return 0 si es literal, 1 si es un patrón válido con comodines, -1 si es
+ *         un patrón inválido ('#' fuera del último nivel o comodín mezclado
+ *         con texto en el mismo nivel).
+ */
+int topic_classify(const char *name, int len);
+
+/** Callback de topic_match(): recibe cada patrón que coincide. */
+typedef void (*topic_match_fn)(topic_id_t pattern, void *arg);
+
+/** @brief Hash FNV-1a de un nombre (el mismo que usa la tabla del registro). */
+uint32_t topic_hash(const char *name, int len);
+
+/** @brief Inicializa un registro vacío. */
+void topic_index_init(topic_index_t *ix);
+
+/** @brief Libera el registro (las suscripciones aún activas también). */
+void topic_index_free(topic_index_t *ix);
+
+/**
+ * @brief Devuelve el id de un tópico, creándolo si no existía.
+ *
+ * Si el nombre es un patrón con comodines también se inserta en el trie.
+ * Quien llama debe rechazar antes los patrones inválidos (topic_classify()).
+ * Un tópico recién creado debe recibir enseguida una suscripción o un
+ * topic_pin(); si no, liberarlo con topic_release().
+ *
+ * @return id del tópico, o TOPIC_NONE si no hay memoria.
+ */
+topic_id_t topic_intern(topic_index_t *ix, const char *name, int len);
+
+/**
+ * @brief Busca un tópico sin crearlo.
+ * @return id del tópico, o TOPIC_NONE si no existe.
+ */
+topic_id_t topic_lookup(const topic_index_t *ix, const char *name, int len);
+
+/**
+ * @brief Libera el tópico id si no tiene suscripciones ni está fijado.
+ * @return 1 si se liberó (el id deja de ser válido), 0 si sigue en uso.
+ */
+int topic_release(topic_index_t *ix, topic_id_t id);
+
+/** @brief Fija el tópico id: no se libera hasta el topic_unpin() que lo equilibre. */
+static inline void topic_pin(topic_index_t *ix, topic_id_t id) {
+    ix->topics[id].pins++;
+}
+
+/** @brief Deshace un topic_pin(); el tópico se libera si ya no tiene usos. */
+static inline void topic_unpin(topic_index_t *ix, topic_id_t id) {
+    ix->topics[id].pins--;
+    (void)topic_release(ix, id);
+}
+
+/** @brief 1 si id es un tópico existente (los ids liberados no lo son). */
+static inline int topic_valid(const topic_index_t *ix, topic_id_t id) {
+    return id < ix->ntopics && ix->topics[id].name != NULL;
+}
+
+/** @brief Tópicos existentes (patrones incluidos). */
+static inline uint32_t topic_count(const topic_index_t *ix) {
+    return ix->ntopics - ix->nfree;
+}
+
+/**
+ * @brief Invoca fn por cada patrón con comodines que coincide con topic.
+ *
+ * Las suscripciones exactas no se reportan (se obtienen con topic_lookup());
+ * si no hay patrones internados no hace nada.
+ */
+void topic_match(const topic_index_t *ix, const char *topic, int len,
+                 topic_match_fn fn, void *arg);
+
+/** @brief 1 si el tópico es un patrón con comodines (no se puede publicar en él). */
+static inline int topic_is_pattern(const topic_index_t *ix, topic_id_t id) {
+    return ix->topics[id].pattern;
+}
+
+/** @brief Nombre de un tópico internado (terminado en '\0'). */
+static inline const char *topic_name(const topic_index_t *ix, topic_id_t id) {
+    return ix->topics[id].name;
+}
+
+/**
+ * @brief Suscribe a owner al tópico id.
+ * @return Enlace de la suscripción (necesario para darla de baja), o NULL si no hay memoria.
+ */
+topic_sub_t *topic_subscribe(topic_index_t *ix, topic_id_t id, void *owner);
+
+/**
+ * @brief Da de baja una suscripción en O(1) y libera el enlace.
+ *
+ * Si era la última del tópico y no está fijado, el tópico se libera con
+ * ella: quien necesite su nombre después debe tomarlo antes o fijarlo.
+ */
+void topic_unsubscribe(topic_index_t *ix, topic_sub_t *sub);
+
+/**
+ * @brief Suscripciones activas de un tópico.
+ * @param n Salida con la cantidad de suscripciones.
+ */
+static inline topic_sub_t **topic_subscribers(const topic_index_t *ix, topic_id_t id, uint32_t *n) {
+    *n = ix->topics[id].nsubs;
+    return ix->topics[id].subs;
+}
+
+#endif /* TOPIC_INDEX_H */
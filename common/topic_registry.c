@@ -0,0 +1,107 @@
+/**
+ * @file topic_registry.c
+ * @brief Registro de tópicos compartido entre workers (ver topic_registry.h).
+ *
+ * Notas:
+ *  - En modo rutas el dueño de cada suscripción del índice es el número de
+ *    worker codificado como puntero (worker + 1, para no usar NULL). Cada
+ *    tópico tiene a lo sumo una suscripción por worker, así que buscarla es
+ *    recorrer una lista de pocos elementos.
+ *  - version empieza en 1 (0 marca entradas vacías de las cachés) y se
+ *    incrementa dentro del lock de escritura en cada cambio de rutas.
+ */
+
+#include "topic_registry.h"
+#include <stdint.h>
+#include <string.h>
+
+#define WORKER_OWNER(w)  ((void*)(uintptr_t)((w) + 1))
+#define OWNER_WORKER(o)  ((int)((uintptr_t)(o) - 1))
+
+void topic_registry_init(topic_registry_t *r) {
+    topic_index_init(&r->ix);
+    rwlock_init(&r->lock);
+    atomic_init(&r->version, 1);
+}
+
+void topic_registry_free(topic_registry_t *r) {
+    topic_index_free(&r->ix);
+    rwlock_destroy(&r->lock);
+}
+
+/* Suscripción del worker al tópico id, o NULL. */
+static topic_sub_t *find_worker(const topic_index_t *ix, topic_id_t id, int worker) {
+    uint32_t n;
+    topic_sub_t **subs = topic_subscribers(ix, id, &n);
+    for (uint32_t i = 0; i < n; i++)
+        if (subs[i]->owner == WORKER_OWNER(worker)) return subs[i];
+    return NULL;
+}
+
+int topic_registry_follow(topic_registry_t *r, const char *name, int len, int worker) {
+    int rc = 0;
+    topic_registry_write(r);
+    topic_id_t id = topic_intern(&r->ix, name, len);
+    if (id == TOPIC_NONE) rc = -1;
+    else if (!find_worker(&r->ix, id, worker) && !topic_subscribe(&r->ix, id, WORKER_OWNER(worker))) {
+        (void)topic_release(&r->ix, id);  // recién creado y sin nadie: no dejarlo
+        rc = -1;
+    }
+    atomic_fetch_add_explicit(&r->version, 1, memory_order_release);
+    topic_registry_write_done(r);
+    return rc;
+}
+
+void topic_registry_unfollow(topic_registry_t *r, const char *name, int len, int worker) {
+    topic_registry_write(r);
+    topic_id_t id = topic_lookup(&r->ix, name, len);
+    topic_sub_t *sub = id == TOPIC_NONE ? NULL : find_worker(&r->ix, id, worker);
+    if (sub) topic_unsubscribe(&r->ix, sub);
+    atomic_fetch_add_explicit(&r->version, 1, memory_order_release);
+    topic_registry_write_done(r);
+}
+
+/* Estado de topic_registry_route(): máscara de workers acumulada. */
+typedef struct {
+    const topic_index_t *ix;
+    uint64_t             mask;
+} route_t;
+
+/* Agrega a la máscara los workers suscritos al tópico o patrón id. */
+static void route_list(topic_id_t id, void *arg) {
+    route_t *rt = (route_t*)arg;
+    uint32_t n;
+    topic_sub_t **subs = topic_subscribers(rt->ix, id, &n);
+    for (uint32_t i = 0; i < n; i++) rt->mask |= (uint64_t)1 << OWNER_WORKER(subs[i]->owner);
+}
+
+uint64_t topic_registry_route(topic_registry_t *r, const char *topic, int len) {
+    route_t rt = { &r->ix, 0 };
+
+    topic_registry_read(r);
+    topic_id_t id = topic_lookup(&r->ix, topic, len);
+    if (id != TOPIC_NONE) route_list(id, &rt);
+    topic_match(&r->ix, topic, len, route_list, &rt);
+    topic_registry_read_done(r);
+    return rt.mask;
+}
+
+uint64_t topic_registry_route_cached(topic_registry_t *r, route_cache_t *c,
+                                     const char *topic, int len) {
+    // La versión se lee antes de calcular: si cambia mientras tanto, la entrada
+    // queda con la versión vieja y la próxima consulta la recalcula.
+    unsigned v = atomic_load_explicit(&r->version, memory_order_acquire);
+    if (len >= ROUTE_NAME_MAX) return topic_registry_route(r, topic, len);
+
+    uint32_t h = topic_hash(topic, len);
+    route_entry_t *e = &c->e[h & (ROUTE_CACHE_SIZE - 1)];
+    if (e->version == v && e->hash == h && e->len == len && memcmp(e->name, topic, len) == 0)
+        return e->mask;
+
+    e->mask    = topic_registry_route(r, topic, len);
+    e->version = v;
+    e->hash    = h;
+    e->len     = len;
+    memcpy(e->name, topic, len);
+    return e->mask;
+}
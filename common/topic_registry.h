@@ -0,0 +1,116 @@
+/**
+ * @file topic_registry.h
+ * @brief Registro de tópicos compartido entre los workers de un broker.
+ *
+ * Un topic_index_t (common/topic_index.h) protegido por un lock de
+ * lectura/escritura: muchos workers publican a la vez (lectura) y las altas y
+ * bajas de suscripciones lo modifican (escritura), que son mucho menos
+ * frecuentes.
+ *
+ * Se usa de dos maneras:
+ *  - **Rutas por worker** (broker TCP): cada worker conserva su propio índice
+ *    con sus conexiones y en el registro solo anota qué tópicos y patrones le
+ *    interesan (topic_registry_follow()/unfollow()). Un PUB pregunta con
+ *    topic_registry_route() qué workers deben recibirlo; con
+ *    topic_registry_route_cached() la respuesta sale de una caché del worker
+ *    sin tomar el lock mientras las suscripciones no cambien.
+ *  - **Índice compartido** (broker UDP): el índice del registro guarda las
+ *    suscripciones mismas y los workers lo leen y modifican tomando el lock
+ *    (topic_registry_read()/write()).
+ *
+ * Compilación: añadir ../common/topic_registry.c y ../common/topic_index.c a
+ * la línea de gcc del broker (y -pthread en POSIX).
+ */
+
+#ifndef TOPIC_REGISTRY_H
+#define TOPIC_REGISTRY_H
+
+#include "threads.h"      // primero: fija _POSIX_C_SOURCE antes de los includes del sistema
+#include "topic_index.h"
+#include <stdatomic.h>
+
+/** Máximo de workers que pueden anotarse en un registro (bits de la máscara de rutas). */
+#define REGISTRY_MAX_WORKERS 64
+
+/**
+ * @brief Índice de tópicos con su lock.
+ */
+typedef struct {
+    topic_index_t ix;       ///< Tópicos y suscripciones (dueño = worker o suscriptor).
+    rwlock_t      lock;     ///< Lectura para publicar, escritura para cambiar suscripciones.
+    atomic_uint   version;  ///< Cambia con cada follow/unfollow (invalida las cachés de rutas).
+} topic_registry_t;
+
+/** Entradas de una caché de rutas (potencia de 2). */
+#define ROUTE_CACHE_SIZE  1024
+/** Nombres más largos no se guardan en la caché. */
+#define ROUTE_NAME_MAX    64
+
+/**
+ * @brief Ruta calculada para un tópico publicado.
+ */
+typedef struct {
+    unsigned version;              ///< Versión del registro al calcularla (0 = vacía).
+    uint32_t hash;
+    int      len;
+    uint64_t mask;                 ///< Resultado de topic_registry_route().
+    char     name[ROUTE_NAME_MAX];
+} route_entry_t;
+
+/**
+ * @brief Caché de rutas de un worker (de mapeo directo por hash del tópico).
+ *
+ * Es privada de un hilo: no necesita sincronización propia.
+ */
+typedef struct {
+    route_entry_t e[ROUTE_CACHE_SIZE];
+} route_cache_t;
+
+/** @brief Inicializa un registro vacío. */
+void topic_registry_init(topic_registry_t *r);
+
+/** @brief Libera el registro. */
+void topic_registry_free(topic_registry_t *r);
+
+/** @brief Toma el lock para leer el índice (varios lectores a la vez). */
+static inline void topic_registry_read(topic_registry_t *r)        { rwlock_rdlock(&r->lock); }
+/** @brief Suelta el lock de lectura. */
+static inline void topic_registry_read_done(topic_registry_t *r)   { rwlock_rdunlock(&r->lock); }
+/** @brief Toma el lock para modificar el índice (exclusivo). */
+static inline void topic_registry_write(topic_registry_t *r)       { rwlock_wrlock(&r->lock); }
+/** @brief Suelta el lock de escritura. */
+static inline void topic_registry_write_done(topic_registry_t *r)  { rwlock_wrunlock(&r->lock); }
+
+/**
+ * @brief Anota que el worker tiene suscriptores del tópico o patrón name.
+ *
+ * Se llama cuando su primer suscriptor local se da de alta; una segunda
+ * llamada para el mismo par no hace nada.
+ *
+ * @param worker Índice del worker (0..REGISTRY_MAX_WORKERS-1).
+ * @return 0 si ok, -1 si no hay memoria.
+ */
+int topic_registry_follow(topic_registry_t *r, const char *name, int len, int worker);
+
+/**
+ * @brief Borra la anotación de topic_registry_follow() (último suscriptor local fuera).
+ */
+void topic_registry_unfollow(topic_registry_t *r, const char *name, int len, int worker);
+
+/**
+ * @brief Workers con suscriptores de topic, exactos o por patrón.
+ * @return Máscara de bits: el bit w indica que el worker w debe recibir el PUB.
+ */
+uint64_t topic_registry_route(topic_registry_t *r, const char *topic, int len);
+
+/**
+ * @brief topic_registry_route() servido desde la caché del worker.
+ *
+ * Si la versión del registro no cambió desde que se guardó la ruta del
+ * tópico, el resultado sale de la caché con una lectura atómica y sin lock;
+ * si cambió (o el tópico no estaba) se recalcula y se guarda.
+ */
+uint64_t topic_registry_route_cached(topic_registry_t *r, route_cache_t *c,
+                                     const char *topic, int len);
+
+#endif /* TOPIC_REGISTRY_H */
@@ -0,0 +1,182 @@
+/**
+ * @file trace.c
+ * @brief Registro de los anillos de traza y volcado a JSON (ver trace.h).
+ *
+ * Notas:
+ *  - trace_dump() no detiene a nadie: lee head de cada anillo, copia los
+ *    registros y vuelve a leer head. Lo que el hilo escribió mientras tanto
+ *    pudo pisar los registros más viejos de la copia; esos se descartan y el
+ *    resto es exactamente lo que el hilo publicó.
+ *  - El JSON usa eventos "B"/"E" por hilo (Chrome trace event format), con
+ *    el dato de cada etapa en args del "E". Un "E" cuyo "B" ya se perdió al
+ *    dar la vuelta el anillo lo ignoran tanto Chrome como Perfetto.
+ *  - SIGUSR2 solo levanta una bandera: el volcado (E/S y memoria) corre en
+ *    el hilo de trace_start(), que la revisa cada TRACE_POLL_MS.
+ */
+
+#ifdef PUBSUB_TRACE
+
+#include "threads.h"  // primero: fija _POSIX_C_SOURCE antes de los includes del sistema
+#include "trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+  #define trace_getpid() ((long)GetCurrentProcessId())
+#else
+  #include <signal.h>
+  #define trace_getpid() ((long)getpid())
+#endif
+
+/** Cada cuánto mira el hilo de volcado si se pidió uno, en ms. */
+#define TRACE_POLL_MS 100
+
+THREAD_LOCAL trace_ring_t *trace_self;
+static THREAD_LOCAL int trace_failed;            // 1 si este hilo no pudo tener anillo
+
+static trace_ring_t *_Atomic trace_rings[TRACE_THREADS];
+static atomic_int trace_nrings;
+static atomic_int trace_pending;                 // volcado pedido (señal o TRACE)
+static uint64_t   trace_t0;                      // ticks en trace_start()
+static uint64_t   trace_ns0;                     // reloj monótono en trace_start()
+static char       trace_path[256];
+static char       trace_name[32];
+
+static const char *trace_names[TRACE_EVENTS] = {
+    "batch", "read", "parse", "handle", "fanout", "flush", "xpub", "drop"
+};
+
+/* Reloj monótono en ns (para convertir ticks a tiempo). */
+static uint64_t trace_clock_ns(void) {
+#ifdef _WIN32
+    LARGE_INTEGER f, t;
+    QueryPerformanceFrequency(&f);
+    QueryPerformanceCounter(&t);
+    return (uint64_t)(t.QuadPart / f.QuadPart * 1000000000 + t.QuadPart % f.QuadPart * 1000000000 / f.QuadPart);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+trace_ring_t *trace_attach(const char *kind, int id) {
+    if (trace_self) return trace_self;
+    if (trace_failed) return NULL;
+    int n = atomic_fetch_add_explicit(&trace_nrings, 1, memory_order_relaxed);
+    trace_ring_t *r = n < TRACE_THREADS ? (trace_ring_t*)calloc(1, sizeof(*r)) : NULL;
+    if (!r) { trace_failed = 1; return NULL; }
+    r->tid = n + 1;
+    if (kind) snprintf(r->name, sizeof(r->name), "%s %d", kind, id);
+    else      snprintf(r->name, sizeof(r->name), "hilo %d", n + 1);
+    atomic_store_explicit(&trace_rings[n], r, memory_order_release);
+    return trace_self = r;
+}
+
+int trace_request(void) {
+    atomic_store(&trace_pending, 1);
+    return 0;
+}
+
+/* Copia los registros publicados de r que siguen intactos; devuelve cuántos
+ * y deja en *first el número del primero. */
+static size_t trace_snapshot(trace_ring_t *r, trace_rec_t *out, uint64_t *first) {
+    uint64_t h1 = atomic_load_explicit(&r->head, memory_order_acquire);
+    uint64_t lo = h1 > TRACE_RING ? h1 - TRACE_RING : 0;
+    for (uint64_t i = lo; i < h1; i++) out[i - lo] = r->rec[i & (TRACE_RING - 1)];
+    atomic_thread_fence(memory_order_acquire);
+    // El hilo pudo publicar hasta h2 y estar escribiendo el registro h2: todo
+    // lo anterior a h2 + 1 - TRACE_RING pudo pisarse durante la copia.
+    uint64_t h2 = atomic_load_explicit(&r->head, memory_order_relaxed);
+    uint64_t safe = h2 + 1 > TRACE_RING ? h2 + 1 - TRACE_RING : 0;
+    if (safe > lo) {
+        if (safe >= h1) { *first = h1; return 0; }
+        memmove(out, out + (safe - lo), (size_t)(h1 - safe) * sizeof(*out));
+        lo = safe;
+    }
+    *first = lo;
+    return (size_t)(h1 - lo);
+}
+
+long trace_dump(const char *path) {
+    FILE *f = fopen(path, "w");
+    if (!f) return -1;
+    trace_rec_t *buf = (trace_rec_t*)malloc(TRACE_RING * sizeof(*buf));
+    if (!buf) { fclose(f); return -1; }
+
+    // Ticks por µs medidos desde trace_start() (1000 sin TSC: ticks = ns)
+    uint64_t dt = trace_ticks() - trace_t0, dns = trace_clock_ns() - trace_ns0;
+    double per_us = dns ? (double)dt * 1000.0 / (double)dns : 1000.0;
+
+    fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    fprintf(f, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"%s\"}}",
+            trace_name);
+    long total = 0;
+    int n = atomic_load_explicit(&trace_nrings, memory_order_relaxed);
+    for (int t = 0; t < n && t < TRACE_THREADS; t++) {
+        trace_ring_t *r = atomic_load_explicit(&trace_rings[t], memory_order_acquire);
+        if (!r) continue;  // recién reservado, aún sin publicar
+        fprintf(f, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+                   "\"args\":{\"name\":\"%s\"}}", r->tid, r->name);
+        uint64_t first;
+        size_t cnt = trace_snapshot(r, buf, &first);
+        for (size_t i = 0; i < cnt; i++) {
+            const trace_rec_t *e = &buf[i];
+            if (e->ev >= TRACE_EVENTS) continue;
+            double us = (double)(int64_t)(e->tsc - trace_t0) / per_us;
+            if (e->ph == TRACE_PH_BEGIN)
+                fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"B\",\"ts\":%.3f,\"pid\":1,\"tid\":%d}",
+                        trace_names[e->ev], us, r->tid);
+            else
+                fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"%s\",\"ts\":%.3f,\"pid\":1,\"tid\":%d,"
+                           "\"args\":{\"n\":%u}}",
+                        trace_names[e->ev], e->ph == TRACE_PH_END ? "E" : "i\",\"s\":\"t",
+                        us, r->tid, e->arg);
+        }
+        total += (long)cnt;
+    }
+    fprintf(f, "\n]}\n");
+    free(buf);
+    if (fclose(f) != 0) return -1;
+    return total;
+}
+
+#ifndef _WIN32
+static void trace_on_signal(int sig) {
+    (void)sig;
+    atomic_store(&trace_pending, 1);  // atomic_int sin lock: seguro en un handler
+}
+#endif
+
+/* Hilo de volcado: espera pedidos y escribe el archivo fuera de los workers. */
+static void *trace_run(void *arg) {
+    (void)arg;
+    for (;;) {
+        thread_sleep_ms(TRACE_POLL_MS);
+        if (!atomic_exchange(&trace_pending, 0)) continue;
+        long n = trace_dump(trace_path);
+        if (n < 0) fprintf(stderr, "[trace] no se pudo escribir %s\n", trace_path);
+        else       fprintf(stderr, "[trace] %ld eventos en %s\n", n, trace_path);
+    }
+    return NULL;
+}
+
+int trace_start(const char *name) {
+    trace_t0  = trace_ticks();
+    trace_ns0 = trace_clock_ns();
+    snprintf(trace_name, sizeof(trace_name), "%s", name);
+    snprintf(trace_path, sizeof(trace_path), "%s-%ld.trace.json", name, trace_getpid());
+#ifndef _WIN32
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = trace_on_signal;
+    sa.sa_flags   = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGUSR2, &sa, NULL);
+#endif
+    thread_t t;
+    return thread_start(&t, trace_run, NULL);
+}
+
+#endif /* PUBSUB_TRACE */
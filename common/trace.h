@@ -0,0 +1,161 @@
+/**
+ * @file trace.h
+ * @brief Puntos de traza del camino caliente: registros con marca de tiempo
+ *        (rdtsc) en un anillo por hilo, volcados a JSON de Chrome / Perfetto.
+ *
+ * Sirve para ver, cuando sube el p99, en qué etapa se va el tiempo: la lectura
+ * del socket, el análisis del comando, su despacho, el fan-out de un PUB o la
+ * escritura de las colas. Cada etapa se marca con TRACE_BEGIN / TRACE_END (o
+ * TRACE_MARK para un hecho puntual, como un descarte).
+ *
+ * Se compila solo si se define PUBSUB_TRACE (-DPUBSUB_TRACE, y añadir
+ * ../common/trace.c a la línea de gcc). Sin esa macro todas las TRACE_* se
+ * expanden a ((void)0) y no queda ni una instrucción en el camino caliente.
+ *
+ * Con la traza activa:
+ *  - Cada hilo escribe en su propio anillo de TRACE_RING registros de 16
+ *    bytes (se crea con el primer evento): una lectura del TSC, tres
+ *    almacenamientos y la publicación de head, sin locks ni atómicos de
+ *    lectura-modificación-escritura. Al llenarse pisa lo más viejo: el
+ *    anillo guarda siempre la última ventana.
+ *  - trace_dump() copia los anillos mientras los hilos siguen escribiendo y
+ *    descarta lo que pudo pisarse durante la copia (ver trace.c).
+ *  - El volcado lo hace un hilo aparte cuando llega SIGUSR2 (POSIX) o un
+ *    cliente manda TRACE (trace_request()): escribe
+ *    `<nombre>-<pid>.trace.json`, que se abre en chrome://tracing o en
+ *    https://ui.perfetto.dev.
+ *
+ * El TSC se convierte a µs con la relación entre ticks y reloj monótono
+ * medida entre trace_start() y el volcado: supone un TSC invariante (todo
+ * x86-64 actual). En otras arquitecturas se usa el reloj monótono en ns.
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+/** @brief Etapas que se trazan (los nombres del JSON están en trace.c). */
+typedef enum {
+    TRACE_BATCH,    ///< Un lote de eventos (TCP) o de datagramas (UDP).
+    TRACE_READ,     ///< recv() de un cliente TCP (el recvmmsg() UDP bloquea: no se traza).
+    TRACE_PARSE,    ///< Separar un comando: línea de texto o trama.
+    TRACE_HANDLE,   ///< Despachar un comando ya separado.
+    TRACE_FANOUT,   ///< Repartir un PUB entre los suscriptores del worker.
+    TRACE_FLUSH,    ///< Escritura vectorizada de una cola TCP / sendmmsg() de un fan-out UDP.
+    TRACE_XPUB,     ///< PUBs recibidos de otros workers (TCP, -t).
+    TRACE_DROP,     ///< Mensaje descartado (puntual).
+    TRACE_EVENTS
+} trace_event_t;
+
+#ifdef PUBSUB_TRACE
+
+#include "threads.h"
+#include <stdatomic.h>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+  #ifdef _MSC_VER
+    #include <intrin.h>
+  #else
+    #include <x86intrin.h>
+  #endif
+  #define TRACE_RDTSC 1
+#elif !defined(_WIN32)
+  #include <time.h>
+#endif
+
+#ifndef TRACE_RING
+  #define TRACE_RING (1u << 16)  ///< Registros por hilo (potencia de 2): 1 MB.
+#endif
+#define TRACE_THREADS 128        ///< Hilos con anillo como máximo.
+
+enum { TRACE_PH_BEGIN, TRACE_PH_END, TRACE_PH_MARK };
+
+/** @brief Un registro: etapa, fase (comienzo, fin o puntual), ticks y un dato. */
+typedef struct {
+    uint64_t tsc;
+    uint32_t arg;       ///< Dato de la etapa (bytes, entregas, comando...).
+    uint16_t ev;        ///< trace_event_t.
+    uint16_t ph;        ///< TRACE_PH_*.
+} trace_rec_t;
+
+/** @brief Anillo de un hilo: solo él escribe, trace_dump() lee. */
+typedef struct {
+    _Atomic uint64_t head;   ///< Registros escritos desde que se creó.
+    int         tid;         ///< Número del hilo en el JSON.
+    char        name[32];    ///< Nombre del hilo en el JSON.
+    trace_rec_t rec[TRACE_RING];
+} trace_ring_t;
+
+extern THREAD_LOCAL trace_ring_t *trace_self;
+
+/**
+ * @brief Crea y registra el anillo del hilo actual, llamado "<kind> <id>"
+ *        (o "hilo <n>" si kind es NULL).
+ * @return El anillo, o NULL si no hay memoria o ya hay TRACE_THREADS.
+ */
+trace_ring_t *trace_attach(const char *kind, int id);
+
+/**
+ * @brief Fija el instante de referencia, instala SIGUSR2 y lanza el hilo que
+ *        vuelca a `<name>-<pid>.trace.json`.
+ * @return 0 si ok, -1 si no se pudo lanzar el hilo.
+ */
+int trace_start(const char *name);
+
+/** @brief Pide un volcado al hilo de trace_start() (no bloquea). @return 0. */
+int trace_request(void);
+
+/**
+ * @brief Escribe el contenido de todos los anillos en path.
+ * @return Registros escritos, o -1 si no se pudo crear el archivo.
+ */
+long trace_dump(const char *path);
+
+/** @brief Ticks del TSC (o ns del reloj monótono sin TSC). */
+static inline uint64_t trace_ticks(void) {
+#ifdef TRACE_RDTSC
+    return __rdtsc();
+#elif defined(_WIN32)
+    LARGE_INTEGER t;
+    QueryPerformanceCounter(&t);
+    return (uint64_t)t.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+/** @brief Agrega un registro al anillo del hilo (lo crea la primera vez). */
+static inline void trace_emit(int ev, int ph, uint32_t arg) {
+    trace_ring_t *r = trace_self;
+    if (!r && !(r = trace_attach(NULL, 0))) return;
+    uint64_t h = atomic_load_explicit(&r->head, memory_order_relaxed);
+    trace_rec_t *e = &r->rec[h & (TRACE_RING - 1)];
+    e->tsc = trace_ticks();
+    e->arg = arg;
+    e->ev  = (uint16_t)ev;
+    e->ph  = (uint16_t)ph;
+    atomic_store_explicit(&r->head, h + 1, memory_order_release);
+}
+
+#define TRACE_BEGIN(ev)         trace_emit((ev), TRACE_PH_BEGIN, 0)
+#define TRACE_END(ev, arg)      trace_emit((ev), TRACE_PH_END, (uint32_t)(arg))
+#define TRACE_MARK(ev, arg)     trace_emit((ev), TRACE_PH_MARK, (uint32_t)(arg))
+#define TRACE_THREAD(kind, id)  ((void)trace_attach((kind), (id)))
+#define TRACE_START(name)       trace_start(name)
+#define TRACE_REQUEST()         trace_request()
+
+#else
+
+#define TRACE_BEGIN(ev)         ((void)0)
+#define TRACE_END(ev, arg)      ((void)0)
+#define TRACE_MARK(ev, arg)     ((void)0)
+#define TRACE_THREAD(kind, id)  ((void)0)
+#define TRACE_START(name)       0
+#define TRACE_REQUEST()         (-1)
+
+#endif /* PUBSUB_TRACE */
+
+#endif /* TRACE_H */
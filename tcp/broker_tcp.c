@@ -1,207 +1,1871 @@
 /**
- * Broker TCP (Windows / Winsock2) para un sistema Publicador–Suscriptor.
+ * Broker TCP (Windows / Winsock2, Linux / POSIX) para un sistema Publicador–Suscriptor.
  *
  * Protocolo textual (línea terminada en '\n'):
- *   - SUB <topic>                 -> Un cliente se registra como suscriptor de <topic>.
+ *   - SUB <topic>                 -> Un cliente agrega <topic> a sus suscripciones.
+ *                                    <topic> puede ser un patrón jerárquico con
+ *                                    comodines: liga/+/goles, liga/partidoA/#
+ *   - SUB <topic> FROM <seq>      -> Igual, y con historial (-H) recibe primero lo
+ *                                    retenido del topic desde el número <seq>.
+ *   - UNSUB <topic>               -> Un cliente quita <topic> de sus suscripciones.
  *   - PUB <topic> <mensaje...>    -> Un cliente publica un <mensaje> para el <topic>.
+ *   - SPUB <seq> <topic> <mensaje...> -> PUB con número de secuencia: el broker
+ *                                    confirma con "ACK <seq>\n" (acumulativo, uno
+ *                                    por lote de lectura con el último <seq>).
  *   - Respuesta a SUB: "OK SUB <topic>\n"
+ *   - Respuesta a UNSUB: "OK UNSUB <topic>\n" o "ERR not subscribed\n"
+ *   - Patrón mal formado, PUB sobre un patrón o topic de MAX_TOPIC bytes o
+ *     más (en texto igual que en binario): "ERR invalid topic\n"
  *   - Reenvío a suscriptores: "MSG <topic> <payload>\n"
+ *   - Fin del historial reenviado tras un SUB (-H): "REPLAY <topic> <seq>\n",
+ *     con el número del próximo mensaje del topic.
+ *   - PING                        -> "PONG <suscripciones>\n". Solo con -K el broker
+ *                                    manda a su vez "PING\n" a un suscriptor sin
+ *                                    tráfico; el cliente puede responder "PONG" (o
+ *                                    ignorarlo).
+ *   - BIN                         -> Pasa la conexión a tramas binarias ("OK BIN\n").
+ *   - STATS                       -> Métricas del broker y de la conexión: una línea
+ *                                    "STAT <métrica>{etiquetas} <valor>\n" por valor
+ *                                    y al final "END\n" (FRAME_STATS en binario).
+ *   - TRACE                       -> Vuelca la traza a un archivo ("OK TRACE\n"); solo
+ *                                    en un broker compilado con -DPUBSUB_TRACE.
+ *
+ * Protocolo binario (common/frame.h), tras negociar con "BIN":
+ *   - Cabecera fija de 12 bytes (opcode, topic id, longitudes) + nombre + payload
+ *     crudo: payloads de cualquier tamaño (hasta FRAME_MAX_PAYLOAD) y con cualquier
+ *     byte, sin escapes. OK a SUB/TOPIC devuelve el id del topic; PUB/UNSUB pueden
+ *     usarlo en lugar del nombre.
+ *   - Clientes de texto y binarios conviven: cada PUB se formatea una vez por
+ *     formato y cada suscriptor lo recibe en el suyo. Un suscriptor de texto
+ *     recibe el payload cortado en el primer '\n' y a MAX_LINE.
  *
  * Diseño:
- *   - Este broker acepta múltiples conexiones TCP y usa select() para multiplexar I/O.
- *   - Cada cliente puede ser "suscriptor" de un único topic (campo is_subscriber=1 y topic asignado).
+ *   - Este broker acepta múltiples conexiones TCP y multiplexa la E/S con el event
+ *     loop de tcp_utils (epoll en Linux, select/poll como respaldo).
+ *   - Cada evento trae el puntero al client_t del socket listo, así que el coste de
+ *     cada despertar depende de los sockets listos y no del tamaño de la tabla.
+ *   - Los sockets de clientes son no bloqueantes y edge-triggered: cada evento de
+ *     lectura vacía el socket con recv() por bloques en el linebuf del cliente y
+ *     despacha todas las líneas completas; una línea parcial espera al siguiente
+ *     evento sin bloquear al resto. Cada línea se analiza en una sola pasada
+ *     (common/text_cmd.h): topic y payload quedan como rebanadas del linebuf,
+ *     sin copias ni recorridos extra del payload.
+ *   - Cada PUB se codifica una sola vez por formato en un mensaje con contador de
+ *     referencias (msg_t); las colas de los suscriptores guardan un puntero y un
+ *     desplazamiento, así que memoria y copias por PUB no crecen con el fan-out.
+ *   - Toda escritura hacia un cliente pasa por su cola de salida (outq). Durante un
+ *     lote de eventos solo se encola; al final del lote cada cliente con datos se
+ *     vacía con escrituras vectorizadas (writev/WSASend) de hasta -i mensajes y -w
+ *     bytes, así una ráfaga de PUBs cuesta pocas llamadas por suscriptor y no una
+ *     por mensaje. Lo que no cabe en el socket queda encolado hasta EV_WRITE.
+ *     La cola está acotada en bytes (-q) y al desbordarse se aplica la política
+ *     elegida (-o): descartar el más viejo, descartar el nuevo o desconectar al
+ *     consumidor lento. Así un suscriptor atascado no frena el fan-out a los
+ *     demás ni la aceptación de conexiones.
+ *   - Los tópicos se internan en un topic_index_t (common/topic_index.h): cada tópico
+ *     tiene su lista de suscriptores y un PUB recorre solo esa lista.
+ *   - Cada cliente mantiene un conjunto de suscripciones (sus enlaces en el índice), así
+ *     que una sola conexión puede seguir varios tópicos; alta y baja son O(1) en el índice.
  *   - Los "publishers" no necesitan identificarse; envían "PUB ..." y el broker reenvía a quienes estén suscritos.
+ *   - Con -t N el broker corre N workers (hilos), cada uno con su propio socket de
+ *     escucha (SO_REUSEPORT, el kernel reparte las conexiones), su event loop, sus
+ *     clientes y su índice de tópicos. Un registro compartido (common/topic_registry.h)
+ *     anota qué workers tienen suscriptores de cada tópico o patrón: un PUB se
+ *     entrega a los clientes locales y se encola para cada otro worker interesado,
+ *     que lo reparte entre los suyos. Cada par de workers está unido por una cola
+ *     SPSC acotada (-r, common/spsc_ring.h) y las rutas salen de una caché por
+ *     worker, así que el camino del PUB no toma locks. Un worker dormido se
+ *     despierta con su eventfd una sola vez por lote, no por mensaje.
+ *   - Memoria (common/pool.h): clientes, suscripciones, mensajes, nodos de las
+ *     colas, buffers de entrada y PUBs entre workers salen de pools por worker
+ *     cortados en slabs. Publicar en régimen estable no llama a malloc/free y la
+ *     memoria no crece con el recambio de conexiones. Un PUB reenviado vuelve al
+ *     pool del worker que lo creó aunque lo suelte otro (pila atómica del pool).
+ *   - Historial (-H bytes, common/retained.h): cada topic publicado retiene sus
+ *     últimos mensajes (hasta esos bytes y HISTORY_SLOTS mensajes) en un anillo
+ *     compartido por todos los workers, que los numera. Un SUB a un topic
+ *     concreto recibe lo retenido (todo, o desde FROM <seq>) antes de los
+ *     mensajes nuevos. El reenvío avanza solo cuando la cola de salida de ese
+ *     cliente se vacía, así que sale al ritmo al que el cliente lee y no
+ *     frena el fan-out en vivo a los demás. Se retienen a lo sumo -N topics
+ *     (RETAINED_TOPICS_DEFAULT): los PUB a uno nuevo pasado ese máximo se
+ *     reparten sin numerar ni retener y se cuentan en las métricas.
+ *   - Modo durable (-D dir, common/msg_log.h): el historial va a un log por
+ *     topic en segmentos mapeados y sobrevive a un reinicio; la numeración
+ *     sigue donde quedó. Se lleva a disco cada -S mensajes y/o cada -T ms (un
+ *     hilo aparte, sin frenar los PUB). Un SUB sin FROM recibe los últimos
+ *     HISTORY_SLOTS; con FROM, todo lo que haya en el log desde ese número.
+ *     Cada log conserva hasta -C bytes (MSG_LOG_KEEP): al crear un segmento
+ *     nuevo se borran los más viejos.
+ *     A un cliente binario el historial le llega directo desde el segmento
+ *     mapeado, sin copiarlo.
+ *
+ *   - Temporizadores (common/timer_wheel.h): cada worker tiene dos ruedas que
+ *     fijan el timeout de evloop_wait(), así que no hay un tick periódico ni un
+ *     recorrido de la tabla de clientes. Con -I, una conexión sin suscripciones
+ *     que no envía nada en esos segundos se cierra, igual que un suscriptor
+ *     cuyo socket no acepta un byte en ese plazo; con -K, un suscriptor sin
+ *     tráfico en esos segundos recibe un PING. Los dos vienen apagados: un
+ *     cliente que no los conoce (un publicador que solo escribe cuando tiene
+ *     algo, un suscriptor de texto que no espera PING) sigue igual. Con -d ms una cola que no llena una escritura (-w) espera
+ *     hasta esos ms a juntar más mensajes antes del writev.
+ *
+ *   - Métricas (common/stats.h): cada worker cuenta PUBs, entregas, bytes,
+ *     descartes, conexiones, el máximo de las colas de salida, el tiempo de
+ *     cada lote de eventos y la espera de los PUBs entre workers, en
+ *     contadores propios alineados a línea de caché (sin atomics con lock ni
+ *     líneas compartidas), y cada tópico publicado en una tabla por worker.
+ *     El reloj es el que ya se lee una vez por lote. STATS las devuelve por
+ *     el protocolo y con -M puerto se sirven además en formato Prometheus
+ *     (GET /metrics) desde un hilo aparte que solo las lee.
+ *
+ *   - Traza (common/trace.h, compilando con -DPUBSUB_TRACE y ../common/trace.c):
+ *     cada etapa del camino caliente (lote, recv, análisis, despacho, fan-out,
+ *     writev, PUBs de otros workers, descartes) deja registros con el TSC en
+ *     un anillo por worker; SIGUSR2 o TRACE los vuelcan en formato Chrome
+ *     trace / Perfetto. Sin la macro los puntos de traza no generan código.
+ *
+ * Uso:
+ *   broker_tcp.exe [-b epoll|poll|select] [-q bytes] [-o drop-oldest|drop-newest|disconnect]
+ *                  [-i iovecs] [-w bytes] [-t workers (0 = uno por núcleo)]
+ *                  [-r entradas] [-H bytes] [-N topics]
+ *                  [-D dir [-C bytes] [-S mensajes] [-T ms]]
+ *                  [-I segundos] [-K segundos] [-d ms] [-M puerto]
  *
  * Notas (Windows):
  *   - Requiere inicializar Winsock con winsock_init() y limpiar con winsock_cleanup().
  *   - Cierre de sockets con tcp_close() (closesocket) en lugar de close().
- *   - select() utiliza FD_SET/FD_ISSET/FD_ZERO y FD_SETSIZE como límite de descriptores.
+ *   - En Windows solo está disponible el backend select(), limitado a FD_SETSIZE sockets,
+ *     y un único worker (no hay reparto de conexiones con SO_REUSEPORT).
  */
 
 #include "tcp_utils.h"
+#include "../common/topic_index.h"
+#include "../common/topic_registry.h"
+#include "../common/spsc_ring.h"
+#include "../common/pool.h"
+#include "../common/retained.h"
+#include "../common/timer_wheel.h"
+#include "../common/stats.h"
+#include "../common/trace.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
-/* Número máximo de clientes manejados por select().
- * FD_SETSIZE es definido por Winsock; por defecto es suficiente para una práctica
- * de laboratorio. Si esperas MUCHAS conexiones, considera un poll/IOCP o select
- * con ajuste de FD_SETSIZE en compilación.
- */
-#define MAX_CLIENTS  FD_SETSIZE
+/* Eventos procesados como máximo por cada llamada a evloop_wait(). */
+#define MAX_EVENTS   256
+
+/* Límite por defecto de la cola de salida de cada cliente (bytes pendientes). */
+#define OUTQ_LIMIT_DEFAULT  (256 * 1024)
+
+/* Mensajes retenidos como máximo por topic con historial (-H acota los bytes).
+ * En modo durable es lo que recibe un SUB sin FROM. */
+#define HISTORY_SLOTS  4096
+
+/* Bytes retenidos por topic en memoria si -D se usa sin -H (topics sin log). */
+#define HISTORY_BYTES_DEFAULT  (1024 * 1024)
+
+/* Topics resueltos con FRAME_TOPIC que una conexión puede tener fijados a la
+ * vez (sus suscripciones no cuentan). */
+#define MAX_PINS  256
+
+/* Temporizadores de conexión (ver on_idle): resolución, cierre de una
+ * conexión sin suscripciones que no envía nada (-I) y PING a un suscriptor
+ * sin tráfico (-K), en segundos; 0 = apagado, lo que viene por defecto. */
+#define IDLE_TICK_MS      100
+#define IDLE_DEFAULT_S    0
+#define HEARTBEAT_DEFAULT_S 0
+
+/* Política al desbordarse la cola de salida de un cliente. */
+typedef enum {
+    OVF_DROP_OLDEST,   // descarta los mensajes más antiguos hasta que quepa el nuevo
+    OVF_DROP_NEWEST,   // descarta el mensaje nuevo
+    OVF_DISCONNECT     // desconecta al consumidor lento
+} overflow_policy_t;
 
 /* Estructura de cliente:
  *  - fd: socket del cliente
- *  - topic: si el cliente es suscriptor, aquí se guarda el topic al que está suscrito
- *  - is_subscriber: 1 si es suscriptor; 0 si no (publisher o desconocido)
+ *  - slot: posición en la tabla clients[] (para borrado O(1))
+ *  - in: buffer de entrada (líneas parciales entre eventos)
+ *  - out: cola de salida; want_write indica si se vigila EV_WRITE
+ *  - binary: formato negociado de la conexión (texto o tramas)
+ *  - closing/next_dead: cierre diferido hasta terminar el lote de eventos
+ *  - subs: enlaces en el índice de tópicos de cada suscripción del cliente
+ *  - epoch: marca del último PUB entregado, para no duplicar entre patrones
+ *  - flush_pending/next_flush: vaciado de la cola diferido al final del lote
+ *  - ack_seq/ack_pending: último SPUB procesado y aún no confirmado
+ *  - replay: reenvíos de historial en curso, en orden de llegada de los SUB
+ *  - idle_timer/last_rx/last_tx/last_ping: inactividad y heartbeat (ver on_idle)
+ *  - flush_timer: vaciado diferido de la cola (-d, ver flush_pending)
+ *  - cmds/msgs_out/drops: métricas de la conexión (ver send_stats)
  */
-typedef struct {
+typedef struct client {
     socket_t fd;
-    char     topic[MAX_TOPIC]; // si es sub, guarda su tópico
-    int      is_subscriber;    // 1=sub, 0=publisher/unknown
+    int      slot;
+    linebuf_t in;              // datos recibidos aún no procesados
+    outq_t   out;              // datos pendientes de envío
+    int      want_write;       // 1 si EV_WRITE está armado en el loop
+    int      closing;          // 1 si ya se pidió su cierre
+    struct client *next_dead;  // enlace en la lista de cierres diferidos
+    int      binary;           // 1 tras "BIN": entrada y salida en tramas (common/frame.h)
+    topic_sub_t **subs;        // suscripciones (vacío = publisher/unknown)
+    int      nsubs, cap_subs;
+    topic_id_t *pins;          // topics fijados con FRAME_TOPIC (ver do_topic)
+    int      npins, cap_pins;
+    uint32_t epoch;            // último pub_epoch entregado (deduplicación)
+    int      flush_pending;    // 1 si está en flush_list
+    struct client *next_flush; // enlace en la lista de vaciados del lote
+    uint32_t ack_seq;          // número del último SPUB procesado
+    int      ack_pending;      // 1 si falta enviar "ACK <ack_seq>"
+    struct replay *replay;     // reenvíos de historial pendientes (NULL = ninguno)
+    tw_timer_t idle_timer;     // próxima revisión de inactividad / heartbeat
+    tw_timer_t flush_timer;    // vaciado diferido pendiente
+    uint64_t last_rx;          // ms en que llegó lo último del cliente
+    uint64_t last_tx;          // ms en que el socket aceptó datos por última vez
+    uint64_t last_ping;        // ms del último PING enviado (heartbeat)
+    uint64_t cmds;             // comandos recibidos (líneas o tramas)
+    uint64_t msgs_out;         // mensajes encolados hacia el cliente
+    uint64_t drops;            // mensajes descartados por la política de la cola
 } client_t;
 
-/* Tabla de clientes:
- *  - Índice i en [0, MAX_CLIENTS) identifica una "ranura" de cliente.
- *  - Una ranura vacía se marca con fd == INVALID_SOCKET.
+/* Reenvío del historial de un topic a un cliente (ver replay_pump):
+ *  - sub: suscripción que lo pidió (no recibe en vivo mientras dura)
+ *  - rt: historial del topic; next: próximo número a reenviar
+ */
+typedef struct replay {
+    topic_sub_t      *sub;
+    retained_topic_t *rt;
+    uint32_t          next;
+    struct replay    *next_replay;
+} replay_t;
+
+/* Estado de cada worker: las variables THREAD_LOCAL de este archivo son
+ * privadas del hilo que las usa (clientes, event loop, índice, listas del lote),
+ * así que el código de un worker es el mismo que con un solo hilo. */
+
+/* Tabla de clientes del worker:
+ *  - Arreglo denso y dinámico de punteros; crece al duplicar su capacidad.
+ *  - Al desconectarse un cliente, el último ocupa su ranura (swap-remove).
+ */
+static THREAD_LOCAL client_t **clients;
+static THREAD_LOCAL int        nclients, cap_clients;
+
+/* Bucle de eventos del worker. */
+static THREAD_LOCAL evloop_t *loop;
+
+/* Tópicos y suscriptores de los clientes del worker. */
+static THREAD_LOCAL topic_index_t topics;
+
+/* client_t del worker (se reutilizan al reconectarse clientes). */
+static THREAD_LOCAL pool_t client_pool;
+
+/* Marcadores de udata para el socket de escucha y el despertador del worker
+ * (los clientes usan su client_t*). */
+static int listen_tag;
+static int wake_tag;
+
+/* Capacidad por defecto de cada cola entre dos workers (PUBs en vuelo). */
+#define XPUB_RING_DEFAULT  4096
+
+/* PUB reenviado a otros workers: "<topic>\0<payload>" en una sola reserva,
+ * compartida por todos los destinos; el último en soltarla la devuelve al pool
+ * del worker que la creó (owner, clase cls; -1 = malloc por su tamaño). */
+typedef struct {
+    atomic_int refs;
+    int        tlen;
+    int        plen;
+    uint32_t   seq;    // número en el historial del topic (0 = sin historial)
+    uint64_t   stamp;  // loop_us del lote que lo publicó (ver drain_rings)
+    short      owner;
+    short      cls;
+    char       data[];
+} xpub_t;
+
+/* Worker:
+ *  - id: posición en workers[] (bit en las máscaras del registro de rutas)
+ *  - from[w]: cola SPSC con los PUBs que el worker w manda a este
+ *  - sleeping: 1 mientras espera en evloop_wait(); solo entonces hace falta
+ *    despertarlo con wake
+ *  - ring_drops: PUBs descartados por encontrar llena la cola hacia este worker
+ *  - xpub_pools: memoria de los PUBs que este worker reenvía a otros
+ */
+typedef struct {
+    int          id;
+    thread_t     thread;
+    ev_wakeup_t  wake;
+    atomic_int   sleeping;
+    spsc_ring_t  from[REGISTRY_MAX_WORKERS];
+    atomic_long  ring_drops;
+    pool_sizes_t xpub_pools;
+} worker_t;
+
+/* Arreglo estático: respeta la alineación a línea de caché de las colas. */
+static worker_t workers[REGISTRY_MAX_WORKERS];
+static int      nworkers = 1;                   // ver -t
+static unsigned ring_size = XPUB_RING_DEFAULT;  // ver -r
+static THREAD_LOCAL worker_t *self;           // worker del hilo actual
+
+/* Métricas de cada worker (stats[w] es del worker w, ver common/stats.h) y
+ * las del worker del hilo actual. */
+static stats_worker_t stats[REGISTRY_MAX_WORKERS];
+static THREAD_LOCAL stats_worker_t *wstats;
+
+/* Puerto del listener HTTP de métricas (-M; 0 = sin listener). */
+static int metrics_port;
+
+/* Qué workers tienen suscriptores de cada tópico o patrón (solo con -t > 1),
+ * y la caché de esas rutas de cada worker. */
+static topic_registry_t routes;
+static THREAD_LOCAL route_cache_t *route_cache;
+
+/* Workers a los que este encoló PUBs durante el lote actual (ver notify_workers). */
+static THREAD_LOCAL uint64_t notify_mask;
+
+/* Backend de eventos pedido con -b (cada worker crea su propio loop). */
+static evloop_backend_t backend = EVLOOP_AUTO;
+
+/* Configuración de las colas de salida (ver -q / -o). */
+static int               outq_limit  = OUTQ_LIMIT_DEFAULT;
+static overflow_policy_t outq_policy = OVF_DROP_OLDEST;
+
+/* Topes de cada escritura vectorizada (ver -i / -w). */
+static int iov_max   = OUTQ_IOV_MAX;
+static int iov_bytes = OUTQ_IOV_BYTES;
+
+/* Historial de cada topic, compartido por los workers (-H y/o -D; ver
+ * history_on). Con -D cada topic lo guarda en su log bajo log_dir. */
+static retained_t     history;
+static int            history_on;
+static size_t         history_bytes;
+static uint32_t       history_topics = RETAINED_TOPICS_DEFAULT;  /* -N; 0 = sin límite */
+static size_t         log_keep = MSG_LOG_KEEP;  /* -C: bytes de log por topic; 0 = todo */
+static const char    *log_dir;
+static msg_log_sync_t log_sync;
+
+/* Temporizadores del worker, integrados al event loop: cada vuelta el timeout
+ * de evloop_wait() llega hasta el próximo vencimiento (ver timers_timeout).
+ *  - idle_timers: inactividad y heartbeat, en ticks de IDLE_TICK_MS
+ *  - flush_timers: vaciados diferidos (-d), en ticks de 1 ms
+ *  - loop_us / loop_ms: reloj leído una vez por vuelta, después de evloop_wait() */
+static THREAD_LOCAL timer_wheel_t idle_timers;
+static THREAD_LOCAL timer_wheel_t flush_timers;
+static THREAD_LOCAL uint64_t      loop_us;
+static THREAD_LOCAL uint64_t      loop_ms;
+
+/* Configuración de los temporizadores, en ms (ver -I / -K / -d; 0 = apagado). */
+static uint64_t idle_ms  = IDLE_DEFAULT_S * 1000;
+static uint64_t beat_ms  = HEARTBEAT_DEFAULT_S * 1000;
+static uint64_t flush_ms;
+
+/* idle_check_ms: cada cuánto revisar un cliente que no tiene un plazo más cercano. */
+static uint64_t idle_check_ms(void) {
+    if (!idle_ms) return beat_ms;
+    return beat_ms && beat_ms < idle_ms ? beat_ms : idle_ms;
+}
+
+/* mono_us: reloj monótono en µs (para loop_us y las latencias de las métricas). */
+static uint64_t mono_us(void) {
+#ifdef _WIN32
+    LARGE_INTEGER f, t;
+    QueryPerformanceFrequency(&f);
+    QueryPerformanceCounter(&t);
+    return (uint64_t)(t.QuadPart / f.QuadPart * 1000000 + t.QuadPart % f.QuadPart * 1000000 / f.QuadPart);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+#endif
+}
+
+/* Clientes con mensajes encolados durante el lote actual (ver schedule_flush). */
+static THREAD_LOCAL client_t *flush_list;
+
+/* Clientes cerrados durante el lote de eventos actual; se liberan al final
+ * del lote para que ningún puntero de events[] quede colgando. */
+static THREAD_LOCAL client_t *dead_list;
+
+/* local_subscribe:
+ *   - Alta de owner en el índice del worker. Con varios workers, el primer
+ *     suscriptor local de un tópico anota al worker en el registro de rutas.
+ *   - Devuelve el enlace, o NULL si no hay memoria.
+ */
+static topic_sub_t *local_subscribe(topic_id_t id, void *owner) {
+    topic_sub_t *sub = topic_subscribe(&topics, id, owner);
+    uint32_t n;
+    (void)topic_subscribers(&topics, id, &n);
+    if (!sub || nworkers == 1 || n > 1) return sub;
+
+    const char *name = topic_name(&topics, id);
+    if (topic_registry_follow(&routes, name, (int)strlen(name), self->id) != 0) {
+        topic_unsubscribe(&topics, sub);
+        return NULL;
+    }
+    return sub;
+}
+
+/* local_unsubscribe:
+ *   - Baja en el índice del worker; al irse el último suscriptor local de un
+ *     tópico el worker deja de figurar en el registro de rutas.
+ */
+static void local_unsubscribe(topic_sub_t *sub) {
+    uint32_t n;
+    (void)topic_subscribers(&topics, sub->topic, &n);
+    if (nworkers > 1 && n == 1) {
+        // Antes de la baja: con ella el topic puede liberarse (y su nombre)
+        const char *name = topic_name(&topics, sub->topic);
+        topic_registry_unfollow(&routes, name, (int)strlen(name), self->id);
+    }
+    topic_unsubscribe(&topics, sub);
+}
+
+/* client_close:
+ *   - Saca al cliente del event loop y lo marca para liberarse al final del lote.
+ */
+static void client_close(client_t *c) {
+    if (c->closing) return;
+    c->closing = 1;
+    evloop_del(loop, c->fd);
+    tw_cancel(&idle_timers, &c->idle_timer);
+    tw_cancel(&flush_timers, &c->flush_timer);
+    c->next_dead = dead_list;
+    dead_list = c;
+}
+
+/* reap_dead:
+ *   - Cierra los sockets y libera el estado de los clientes marcados.
+ */
+static void reap_dead(void) {
+    while (dead_list) {
+        client_t *c = dead_list;
+        dead_list = c->next_dead;
+
+        tcp_close(c->fd);
+        linebuf_free(&c->in);
+        outq_clear(&c->out);
+        while (c->replay) {
+            replay_t *r = c->replay;
+            c->replay = r->next_replay;
+            free(r);
+        }
+        for (int i=0; i<c->nsubs; i++) local_unsubscribe(c->subs[i]);
+        free(c->subs);
+        for (int i=0; i<c->npins; i++) topic_unpin(&topics, c->pins[i]);
+        free(c->pins);
+
+        client_t *last = clients[--nclients];
+        clients[c->slot] = last;
+        last->slot = c->slot;
+        pool_put(&client_pool, c);
+        stats_sub(&wstats->c[STATS_CONNS], 1);
+    }
+}
+
+/* set_want_write: arma o desarma EV_WRITE para el cliente. */
+static void set_want_write(client_t *c, int on) {
+    if (c->want_write == on) return;
+    c->want_write = on;
+    evloop_mod(loop, c->fd, EV_READ | EV_EDGE | (on ? EV_WRITE : 0), c);
+}
+
+static void replay_pump(client_t *c);
+
+/* client_flush:
+ *   - Vacía la cola de salida mientras el socket acepte datos, juntando varios
+ *     mensajes por llamada (writev/WSASend) según -i / -w.
+ *   - Si la cola quedó vacía y hay historial por reenviar, encola el siguiente tramo.
+ *   - Anota en last_tx si el socket aceptó algo (ver on_idle).
+ */
+static void client_flush(client_t *c) {
+    int before = c->out.bytes;
+    tw_cancel(&flush_timers, &c->flush_timer);
+    TRACE_BEGIN(TRACE_FLUSH);
+    int r = outq_flush_v(c->fd, &c->out, iov_max, iov_bytes);
+    TRACE_END(TRACE_FLUSH, before - c->out.bytes);
+    if (r < 0) { client_close(c); return; }
+    if (c->out.bytes < before) {
+        c->last_tx = loop_ms;
+        stats_add(&wstats->c[STATS_BYTES_OUT], (uint64_t)(before - c->out.bytes));
+    }
+    set_want_write(c, r == OUTQ_PENDING);
+    if (r == OUTQ_EMPTY && c->replay) replay_pump(c);
+}
+
+/* schedule_flush:
+ *   - Anota al cliente para vaciar su cola al final del lote de eventos. Así los
+ *     mensajes de una ráfaga de PUBs se acumulan y salen en una sola escritura
+ *     vectorizada en lugar de un send() por mensaje.
+ *   - Si ya espera EV_WRITE, el socket está lleno: se vaciará con ese evento.
  */
-static client_t clients[MAX_CLIENTS];
+static void schedule_flush(client_t *c) {
+    if (c->flush_pending || c->want_write) return;
+    c->flush_pending = 1;
+    c->next_flush = flush_list;
+    flush_list = c;
+}
+
+/* flush_pending:
+ *   - Vacía las colas de los clientes anotados durante el lote.
+ *   - Con -d, una cola que todavía no llena una escritura (-w bytes) espera
+ *     hasta -d ms en flush_timers a que se junte más: menos writev por
+ *     suscriptor a cambio de esa latencia. La que llega a -w sale en el lote.
+ */
+static void flush_pending(void) {
+    while (flush_list) {
+        client_t *c = flush_list;
+        flush_list = c->next_flush;
+        c->flush_pending = 0;
+        if (c->closing) continue;
+        if (flush_ms && c->out.bytes < iov_bytes) {
+            if (!tw_pending(&c->flush_timer))
+                tw_add(&flush_timers, &c->flush_timer, loop_ms + flush_ms);
+            continue;
+        }
+        client_flush(c);
+    }
+}
 
-/* trim_newline: elimina '\r' o '\n' al final de una cadena (si aparecen). */
-static void trim_newline(char *s) {
-    for (int i=0; s[i]; ++i)
-        if (s[i]=='\r' || s[i]=='\n') { s[i]=0; break; }
+/* on_flush:
+ *   - Vence el vaciado diferido de un cliente (-d).
+ */
+static void on_flush(tw_timer_t *t, void *arg) {
+    (void)arg;
+    client_t *c = (client_t*)((char*)t - offsetof(client_t, flush_timer));
+    client_flush(c);
+}
+
+/* client_send_msg:
+ *   - Encola el mensaje compartido m para el cliente sin bloquear nunca,
+ *     aplicando la política de desborde; el envío real ocurre al final del lote
+ *     (flush_pending) o con EV_WRITE. La cola guarda solo una referencia a m y
+ *     su desplazamiento, nunca una copia.
+ *   - Cuenta lo descartado y el máximo de la cola en las métricas.
+ */
+static void client_send_msg(client_t *c, msg_t *m) {
+    if (c->closing) return;
+
+    // Con la cola vacía el mensaje siempre entra, aunque supere -q.
+    if (c->out.count > 0 && c->out.bytes + m->len > outq_limit) {
+        // Lo acumulado en este lote quizá aún no se intentó enviar: vaciarlo
+        // antes de aplicar la política (solo un socket lleno cuenta como lento).
+        if (!c->want_write) {
+            client_flush(c);
+            if (c->closing) return;
+        }
+    }
+    if (c->out.count > 0 && c->out.bytes + m->len > outq_limit) {
+        switch (outq_policy) {
+        case OVF_DROP_NEWEST:
+            c->drops++;
+            stats_add(&wstats->c[STATS_DROPS], 1);
+            TRACE_MARK(TRACE_DROP, 1);
+            return;
+        case OVF_DISCONNECT:
+            stats_add(&wstats->c[STATS_SLOW_CLOSE], 1);
+            client_close(c);
+            return;
+        case OVF_DROP_OLDEST: {
+            int before = c->out.count;
+            while (c->out.bytes + m->len > outq_limit && outq_drop_oldest(&c->out)) {}
+            int fits = c->out.count == 0 || c->out.bytes + m->len <= outq_limit;
+            uint64_t dropped = (uint64_t)(before - c->out.count) + !fits;
+            c->drops += dropped;
+            stats_add(&wstats->c[STATS_DROPS], dropped);
+            TRACE_MARK(TRACE_DROP, dropped);
+            if (!fits) return;  // no cabe
+            break;
+        }
+        }
+    }
+
+    if (outq_push_msg(&c->out, m, 0) != 0) { client_close(c); return; }
+    c->msgs_out++;
+    stats_max(&wstats->c[STATS_QUEUE_HWM], (uint64_t)c->out.bytes);
+    schedule_flush(c);
+}
+
+/* client_send:
+ *   - Envía una respuesta puntual (OK/ERR, banner): la copia a un msg_t propio.
+ */
+static void client_send(client_t *c, const char *buf, int len) {
+    if (c->closing) return;
+    msg_t *m = msg_new(buf, len);
+    if (!m) { client_close(c); return; }
+    client_send_msg(c, m);
+    msg_unref(m);
+}
+
+/* reply_ok:
+ *   - Confirma al cliente una operación sobre el topic id, en su formato:
+ *     "OK <verb> <topic>\n" o una trama FRAME_OK con el id y el nombre.
+ */
+static void reply_ok(client_t *c, const char *verb, topic_id_t id) {
+    const char *name = topic_name(&topics, id);
+    char out[FRAME_HDR + MAX_LINE];
+    int n;
+    if (c->binary) n = frame_encode(out, FRAME_OK, id, name, (int)strlen(name), NULL, 0);
+    else           n = snprintf(out, sizeof(out), "OK %s %s\n", verb, name);
+    client_send(c, out, n);
+}
+
+/* reply_err:
+ *   - Informa un error al cliente: "ERR <reason>\n" o una trama FRAME_ERR.
+ */
+static void reply_err(client_t *c, const char *reason) {
+    char out[FRAME_HDR + MAX_LINE];
+    int n;
+    if (c->binary) n = frame_encode(out, FRAME_ERR, FRAME_NO_TOPIC, NULL, 0, reason, (uint32_t)strlen(reason));
+    else           n = snprintf(out, sizeof(out), "ERR %s\n", reason);
+    client_send(c, out, n);
+}
+
+/* Estado de un fan-out en curso (compartido por las listas exacta y de patrones).
+ * El mensaje se codifica a lo sumo una vez por formato, en un msg_t compartido
+ * por las colas de todos los suscriptores de ese formato: la línea de texto
+ * para los clientes textuales y la trama FRAME_MSG para los binarios. */
+typedef struct {
+    topic_id_t  id;             // topic publicado (TOPIC_NONE si no está internado)
+    const char *topic;
+    const char *payload;
+    int         plen;
+    uint32_t    seq;            // número en el historial del topic (0 = sin historial)
+    msg_t      *text;           // "MSG <topic> <payload>\n" (NULL = sin formatear)
+    msg_t      *bin;            // trama FRAME_MSG (NULL = sin formatear)
+    uint64_t    delivered;      // suscriptores a los que se encoló (métricas)
+} fanout_t;
+
+/* fanout_text:
+ *   - Formatea la línea "MSG <topic> <payload>\n". El protocolo textual no
+ *     admite saltos de línea ni líneas de más de MAX_LINE: un payload binario
+ *     se corta en su primer '\n' y al espacio disponible.
+ */
+static int fanout_text(fanout_t *f) {
+    int plen = f->plen;
+    const char *nl = (const char*)memchr(f->payload, '\n', plen);
+    if (nl) plen = (int)(nl - f->payload);
+
+    // "MSG " + topic + ' ': se arma directo en el mensaje, sin snprintf
+    int tlen = (int)strlen(f->topic);  // < MAX_TOPIC: lo validan handle_line / frame_topic
+    int n = 4 + tlen + 1;
+    if (plen > MAX_LINE - 1 - n) plen = MAX_LINE - 1 - n;
+
+    if (!(f->text = msg_alloc(n + plen + 1))) return -1;
+    char *d = f->text->data;
+    memcpy(d, "MSG ", 4);
+    memcpy(d + 4, f->topic, tlen);
+    d[n - 1] = ' ';
+    memcpy(d + n, f->payload, plen);
+    d[n + plen] = '\n';
+    return 0;
+}
+
+/* fanout_bin: codifica la trama FRAME_MSG (id + nombre + payload crudo). */
+static int fanout_bin(fanout_t *f) {
+    int tlen = (int)strlen(f->topic);
+    if (!(f->bin = msg_alloc((int)frame_size(tlen, f->plen)))) return -1;
+    frame_encode(f->bin->data, FRAME_MSG, f->id == TOPIC_NONE ? FRAME_NO_TOPIC : f->id,
+                 f->topic, tlen, f->payload, f->plen);
+    return 0;
+}
+
+/* Contador de publicaciones: un cliente con client_t::epoch == pub_epoch ya
+ * recibió el PUB en curso (evita duplicados si varios patrones coinciden). */
+static THREAD_LOCAL uint32_t pub_epoch;
+
+/* fanout_list:
+ *  - Envía el mensaje del fan-out a los suscriptores del topic/patrón id, a cada
+ *    uno en su formato (texto o trama binaria).
+ *  - Una suscripción que está recibiendo el historial no lo recibe en vivo (le
+ *    llegará por el reenvío, en orden), ni tampoco lo anterior al punto en que
+ *    el reenvío terminó (con varios workers puede llegar después).
+ */
+static void fanout_list(topic_id_t id, void *arg) {
+    fanout_t *f = (fanout_t*)arg;
+    uint32_t nsubs;
+    topic_sub_t **subs = topic_subscribers(&topics, id, &nsubs);
+
+    for (uint32_t i=0; i<nsubs; i++) {
+        client_t *c = (client_t*)subs[i]->owner;
+        if (c->epoch == pub_epoch) continue;
+        c->epoch = pub_epoch;
+        if (f->seq && (subs[i]->replaying ||
+                       (subs[i]->live_from && seq_after(subs[i]->live_from, f->seq)))) continue;
+
+        if (c->binary) {
+            if (!f->bin && fanout_bin(f) != 0) continue;
+            client_send_msg(c, f->bin);
+        } else {
+            if (!f->text && fanout_text(f) != 0) continue;
+            client_send_msg(c, f->text);
+        }
+        f->delivered++;
+    }
+}
+
+/* fanout_local:
+ *  - Entrega payload (plen bytes, puede contener cualquier byte) a los suscriptores
+ *    exactos del topic entre los clientes de este worker. id es su id si quien
+ *    publica ya lo conoce, o TOPIC_NONE para buscarlo en el índice (sin crearlo).
+ *  - Si hay patrones con comodines, el trie aporta los que coinciden (coste según
+ *    la profundidad del topic, no la cantidad de patrones).
+ *  - Cada cliente recibe el mensaje una sola vez aunque coincida por varias vías.
+ *  - seq es su número en el historial del topic (0 = sin historial).
+ *  - ts son las métricas del topic en este worker, si quien publica ya las
+ *    buscó (NULL = buscarlas aquí, solo si hubo entregas).
+ */
+static void fanout_local(topic_id_t id, const char *topic, const char *payload, int plen,
+                         uint32_t seq, stats_topic_t *ts) {
+    int len = (int)strlen(topic);
+    fanout_t f;
+    f.topic   = topic;
+    f.payload = payload;
+    f.plen    = plen;
+    f.seq     = seq;
+    f.text    = NULL;
+    f.bin     = NULL;
+    f.delivered = 0;
+    pub_epoch++;
+    TRACE_BEGIN(TRACE_FANOUT);
+
+    if (id == TOPIC_NONE) id = topic_lookup(&topics, topic, len);
+    f.id = id;
+    if (id != TOPIC_NONE) fanout_list(id, &f);
+    topic_match(&topics, topic, len, fanout_list, &f);
+
+    TRACE_END(TRACE_FANOUT, f.delivered);
+    if (f.delivered) {
+        stats_add(&wstats->c[STATS_MSG_OUT], f.delivered);
+        if (ts || (ts = stats_topic(wstats, topic, len)) != NULL) stats_add(&ts->out, f.delivered);
+    }
+
+    // Las colas que lo encolaron conservan su referencia; aquí se suelta la propia.
+    msg_unref(f.text);
+    msg_unref(f.bin);
+}
+
+/* xpub_unref: suelta una referencia al PUB compartido; la última lo devuelve
+ * al pool de su worker (directamente si es este, por la pila atómica si no). */
+static void xpub_unref(xpub_t *p) {
+    if (atomic_fetch_sub_explicit(&p->refs, 1, memory_order_acq_rel) != 1) return;
+    if (p->cls < 0) { free(p); return; }
+    pool_t *pool = &workers[p->owner].xpub_pools.cls[p->cls];
+    if (p->owner == self->id) pool_put(pool, p);
+    else pool_put_remote(pool, p);
 }
 
 /* broadcast_to_topic:
- *  - Construye una línea "MSG <topic> <payload>\n"
- *  - La envía a todos los clientes suscriptores cuyo topic coincide exactamente.
+ *  - Con un solo worker equivale a fanout_local().
+ *  - Con varios, la ruta del topic (caché del worker sobre el registro) indica qué
+ *    workers tienen suscriptores, exactos o por patrón. El PUB se copia una sola
+ *    vez y se encola en la cola SPSC hacia cada uno; este worker lo entrega a
+ *    sus propios clientes solo si figura en la máscara.
+ *  - Si la cola hacia un worker está llena, ese worker no recibe el PUB (se
+ *    cuenta en ring_drops): el worker que publica nunca se bloquea.
+ *  - Con historial (-H) el PUB se retiene y numera antes de repartirse, tenga
+ *    o no suscriptores.
+ *  - El PUB se cuenta en las métricas de este worker (y de su topic).
+ */
+static void broadcast_to_topic(topic_id_t id, const char *topic, const char *payload, int plen) {
+    int tlen = (int)strlen(topic);
+    stats_topic_t *ts = stats_topic(wstats, topic, tlen);
+    stats_add(&wstats->c[STATS_PUB_IN], 1);
+    stats_add(&wstats->c[STATS_PUB_BYTES], (uint64_t)plen);
+    stats_topic_pub(wstats, ts, (uint64_t)plen, loop_ms / 1000);
+
+    uint32_t seq = 0;
+    if (history_on) {
+        retained_topic_t *rt = retained_get(&history, topic, tlen);
+        if (rt) seq = retained_push(rt, payload, (uint32_t)plen);
+    }
+    if (nworkers > 1) {
+        uint64_t mask = topic_registry_route_cached(&routes, route_cache, topic, tlen);
+        uint64_t remote = mask & ~((uint64_t)1 << self->id);
+
+        if (remote) {
+            size_t size = sizeof(xpub_t) + tlen + 1 + plen;
+            int cls = pool_class(size);
+            xpub_t *p = (xpub_t*)(cls >= 0 ? pool_alloc(&self->xpub_pools.cls[cls]) : malloc(size));
+            if (p) {
+                int n = 0;
+                for (uint64_t m = remote; m; m &= m - 1) n++;
+                atomic_init(&p->refs, n);
+                p->tlen  = tlen;
+                p->plen  = plen;
+                p->seq   = seq;
+                p->stamp = loop_us;
+                p->owner = (short)self->id;
+                p->cls   = (short)cls;
+                memcpy(p->data, topic, tlen + 1);
+                memcpy(p->data + tlen + 1, payload, plen);
+
+                for (int w=0; w<nworkers; w++) {
+                    if (!(remote >> w & 1)) continue;
+                    if (spsc_push(&workers[w].from[self->id], p) != 0) {
+                        atomic_fetch_add_explicit(&workers[w].ring_drops, 1, memory_order_relaxed);
+                        xpub_unref(p);
+                    }
+                }
+                notify_mask |= remote;
+            }
+        }
+        if (!(mask >> self->id & 1)) return;
+    }
+    fanout_local(id, topic, payload, plen, seq, ts);
+}
+
+/* notify_workers:
+ *   - Al final del lote despierta a los workers que recibieron PUBs y están
+ *     dormidos: un aviso por destino y lote, no uno por mensaje.
+ *   - La barrera ordena las escrituras en las colas antes de leer sleeping; el
+ *     consumidor hace lo simétrico (ver worker_run), así ninguno de los dos
+ *     puede perderse el PUB del otro.
+ */
+static void notify_workers(void) {
+    if (!notify_mask) return;
+    atomic_thread_fence(memory_order_seq_cst);
+    for (int w=0; w<nworkers; w++) {
+        if ((notify_mask >> w & 1) && atomic_load_explicit(&workers[w].sleeping, memory_order_relaxed))
+            ev_wakeup_signal(&workers[w].wake);
+    }
+    notify_mask = 0;
+}
+
+/* rings_pending: 1 si alguna cola hacia este worker tiene PUBs. */
+static int rings_pending(void) {
+    for (int w=0; w<nworkers; w++)
+        if (w != self->id && spsc_pending(&self->from[w])) return 1;
+    return 0;
+}
+
+/* drain_rings:
+ *   - Reparte entre los clientes de este worker todos los PUBs que los demás
+ *     le encolaron. Cada cola tiene un único productor: no hay locks.
+ *   - La espera de cada PUB (desde el comienzo del lote que lo publicó) va al
+ *     histograma xpub_us; el reloj se lee una vez, con el primer PUB.
+ */
+static void drain_rings(void) {
+    uint64_t now = 0;
+    TRACE_BEGIN(TRACE_XPUB);
+    for (int w=0; w<nworkers; w++) {
+        if (w == self->id) continue;
+        xpub_t *p;
+        while ((p = (xpub_t*)spsc_pop(&self->from[w])) != NULL) {
+            if (!now) now = mono_us();
+            stats_hist_add(&wstats->xpub_us, now > p->stamp ? now - p->stamp : 0);
+            fanout_local(TOPIC_NONE, p->data, p->data + p->tlen + 1, p->plen, p->seq, NULL);
+            xpub_unref(p);
+        }
+    }
+    TRACE_END(TRACE_XPUB, now != 0);
+}
+
+/* client_find_sub:
+ *   - Posición de la suscripción del cliente al topic id, o -1.
+ *   - El conjunto de un cliente es pequeño (unos pocos tópicos): búsqueda lineal.
+ */
+static int client_find_sub(const client_t *c, topic_id_t id) {
+    for (int i=0; i<c->nsubs; i++)
+        if (c->subs[i]->topic == id) return i;
+    return -1;
+}
+
+/* client_subscribe:
+ *   - Agrega el topic id al conjunto del cliente (si ya estaba, no hace nada).
+ *   - Devuelve 0 si ok, -1 si no hay memoria.
+ */
+static int client_subscribe(client_t *c, topic_id_t id) {
+    if (client_find_sub(c, id) >= 0) return 0;
+    if (c->nsubs == c->cap_subs) {
+        int ncap = c->cap_subs ? c->cap_subs * 2 : 4;
+        topic_sub_t **t = (topic_sub_t**)realloc(c->subs, ncap * sizeof(*t));
+        if (!t) return -1;
+        c->subs = t;
+        c->cap_subs = ncap;
+    }
+    topic_sub_t *sub = local_subscribe(id, c);
+    if (!sub) return -1;
+    c->subs[c->nsubs++] = sub;
+    return 0;
+}
+
+/* replay_cancel:
+ *   - Descarta el reenvío de historial pendiente para la suscripción sub, si hay.
+ */
+static void replay_cancel(client_t *c, const topic_sub_t *sub) {
+    for (replay_t **pp = &c->replay; *pp; pp = &(*pp)->next_replay) {
+        if ((*pp)->sub != sub) continue;
+        replay_t *r = *pp;
+        *pp = r->next_replay;
+        free(r);
+        return;
+    }
+}
+
+/* client_unsubscribe:
+ *   - Quita el topic id del conjunto del cliente.
+ *   - Devuelve 0 si ok, -1 si el cliente no estaba suscrito.
+ */
+static int client_unsubscribe(client_t *c, topic_id_t id) {
+    int i = client_find_sub(c, id);
+    if (i < 0) return -1;
+    replay_cancel(c, c->subs[i]);
+    local_unsubscribe(c->subs[i]);
+    c->subs[i] = c->subs[--c->nsubs];
+    return 0;
+}
+
+/* reply_replay:
+ *   - Avisa el fin del historial del topic id: "REPLAY <topic> <next>\n" o una
+ *     trama FRAME_REPLAY; lo que siga del topic llega en vivo desde el número next.
+ */
+static void reply_replay(client_t *c, topic_id_t id, uint32_t next) {
+    const char *name = topic_name(&topics, id);
+    char out[FRAME_HDR + MAX_LINE];
+    int n;
+    if (c->binary) {
+        unsigned char seq[FRAME_SEQ_LEN];
+        frame_put32(seq, next);
+        n = frame_encode(out, FRAME_REPLAY, id, name, (int)strlen(name), (const char*)seq, FRAME_SEQ_LEN);
+    } else {
+        n = snprintf(out, sizeof(out), "REPLAY %s %u\n", name, next);
+    }
+    client_send(c, out, n);
+}
+
+/* log_seg_release:
+ *   - Suelta el segmento de log de un msg_extern() del historial (ver replay_pump).
+ */
+static void log_seg_release(void *arg) {
+    msg_log_release((msg_log_seg_t*)arg);
+}
+
+/* replay_pump:
+ *   - Encola el historial pendiente del cliente, un mensaje a la vez y en el
+ *     orden de los SUB, mientras su cola de salida esté por debajo de la mitad
+ *     de -q. client_flush() lo retoma cada vez que la cola se vacía: el
+ *     historial sale al ritmo al que el cliente lee, sin copias de más y sin
+ *     desplazar lo que el cliente recibe en vivo de otros topics.
+ *   - Lo publicado mientras dura el reenvío también entra al anillo, así que
+ *     sale por aquí y en orden; al alcanzar el final la suscripción pasa a
+ *     recibir en vivo desde ese número y el cliente recibe REPLAY.
+ *   - Lo que el anillo descarta antes de que el cliente llegue a leerlo se
+ *     saltea (como un mensaje descartado por drop-oldest).
+ *   - Desde un log (-D) la trama binaria ya está en el segmento mapeado: se
+ *     encola un msg_t que apunta ahí, sin copiar el mensaje. El msg_t retiene
+ *     el segmento hasta que se escribe, aunque la retención (-C) lo borre.
+ */
+static void replay_pump(client_t *c) {
+    while (c->replay && !c->closing && c->out.bytes < outq_limit / 2) {
+        replay_t *r = c->replay;
+        retained_topic_t *rt = r->rt;
+        fanout_t f = {0};
+        int done = 0;
+
+        mutex_lock(&rt->lock);
+        uint32_t first = retained_first_locked(rt), last = retained_next_locked(rt);
+        if (seq_after(first, r->next)) r->next = first;
+        if (seq_after(r->next, last)) r->next = last;
+        if (r->next == last) {
+            r->sub->live_from = r->next;
+            r->sub->replaying = 0;
+            done = 1;
+        } else {
+            msg_log_rec_t rec = {0};
+            (void)retained_at(rt, r->next++, &rec);
+            f.id      = r->sub->topic;
+            f.topic   = rt->name;
+            f.payload = rec.payload;
+            f.plen    = (int)rec.len;
+            if (c->binary && rec.frame) {
+                f.bin = msg_extern(rec.frame, (int)rec.frame_len, log_seg_release, rec.seg);
+                if (f.bin) msg_log_hold(rec.seg);  // se suelta con el último msg_unref()
+            } else if (c->binary) {
+                (void)fanout_bin(&f);
+            } else {
+                (void)fanout_text(&f);
+            }
+        }
+        mutex_unlock(&rt->lock);
+
+        if (done) {
+            c->replay = r->next_replay;
+            reply_replay(c, r->sub->topic, r->next);
+            free(r);
+            continue;
+        }
+        msg_t *m = c->binary ? f.bin : f.text;
+        if (!m || outq_push_msg(&c->out, m, 0) != 0) {
+            msg_unref(m);
+            client_close(c);
+            return;
+        }
+        msg_unref(m);
+        schedule_flush(c);
+    }
+}
+
+/* replay_start:
+ *   - Agrega a la cola del cliente el reenvío del historial del topic para la
+ *     suscripción sub, desde el número from (0 = los últimos HISTORY_SLOTS
+ *     retenidos). Si esa suscripción ya está recibiendo su historial no se repite.
+ *   - Devuelve 0 si ok, -1 si no hay memoria o el topic no entra en el
+ *     historial (-N).
+ */
+static int replay_start(client_t *c, topic_sub_t *sub, const char *topic, uint32_t from) {
+    if (sub->replaying) return 0;
+    retained_topic_t *rt = retained_get(&history, topic, (int)strlen(topic));
+    replay_t *r = rt ? (replay_t*)malloc(sizeof(*r)) : NULL;
+    if (!r) return -1;
+    r->sub  = sub;
+    r->rt   = rt;
+    r->next = from ? from : retained_next(rt) - HISTORY_SLOTS;  // replay_pump acota al más viejo
+    r->next_replay = NULL;
+
+    replay_t **pp = &c->replay;
+    while (*pp) pp = &(*pp)->next_replay;
+    *pp = r;
+    sub->replaying = 1;
+    return 0;
+}
+
+/* do_sub:
+ *   - SUB en cualquiera de los dos formatos.
+ *   - Con historial (-H o -D), un topic concreto recibe después del OK lo retenido
+ *     desde from (0 = lo último) y al final REPLAY. Los patrones no tienen historial.
+ */
+static void do_sub(client_t *c, const char *topic, uint32_t from) {
+    // '#' solo como último nivel y los comodines ocupan un nivel completo
+    int kind = topic_classify(topic, (int)strlen(topic));
+    if (kind < 0) {
+        reply_err(c, "invalid topic");
+        return;
+    }
+
+    // Internar el topic y agregarlo al conjunto del cliente
+    topic_id_t id = topic_intern(&topics, topic, (int)strlen(topic));
+    if (id == TOPIC_NONE || client_subscribe(c, id) != 0) {
+        if (id != TOPIC_NONE) (void)topic_release(&topics, id);
+        reply_err(c, "out of memory");
+        return;
+    }
+    reply_ok(c, "SUB", id);
+
+    if (history_on && kind == 0) {
+        if (replay_start(c, c->subs[client_find_sub(c, id)], topic, from) != 0) {
+            reply_err(c, retained_full(&history) ? "too many topics" : "out of memory");
+            return;
+        }
+        replay_pump(c);
+    }
+}
+
+/* do_unsub: UNSUB en cualquiera de los dos formatos (id ya resuelto). */
+static void do_unsub(client_t *c, topic_id_t id) {
+    if (id == TOPIC_NONE || client_find_sub(c, id) < 0) {
+        reply_err(c, "not subscribed");
+        return;
+    }
+    topic_pin(&topics, id);  // el OK lleva el nombre: que la baja no libere el topic antes
+    (void)client_unsubscribe(c, id);
+    reply_ok(c, "UNSUB", id);
+    topic_unpin(&topics, id);
+}
+
+/* do_topic:
+ *   - FRAME_TOPIC: resuelve name a un id para publicar luego sin el nombre.
+ *   - El id queda fijado a la conexión (no se libera ni se reutiliza) hasta
+ *     que se cierre; como mucho MAX_PINS por conexión, además de sus
+ *     suscripciones, que ya lo mantienen vivo.
+ */
+static void do_topic(client_t *c, const char *name) {
+    topic_id_t id = topic_lookup(&topics, name, (int)strlen(name));
+    if (id != TOPIC_NONE) {
+        if (client_find_sub(c, id) >= 0) { reply_ok(c, "TOPIC", id); return; }
+        for (int i=0; i<c->npins; i++)
+            if (c->pins[i] == id) { reply_ok(c, "TOPIC", id); return; }
+    }
+    if (c->npins == MAX_PINS) { reply_err(c, "too many topics"); return; }
+    if (c->npins == c->cap_pins) {
+        int ncap = c->cap_pins ? c->cap_pins * 2 : 4;
+        topic_id_t *p = (topic_id_t*)realloc(c->pins, ncap * sizeof(*p));
+        if (!p) { reply_err(c, "out of memory"); return; }
+        c->pins = p;
+        c->cap_pins = ncap;
+    }
+    if (id == TOPIC_NONE && (id = topic_intern(&topics, name, (int)strlen(name))) == TOPIC_NONE) {
+        reply_err(c, "out of memory");
+        return;
+    }
+    topic_pin(&topics, id);
+    c->pins[c->npins++] = id;
+    reply_ok(c, "TOPIC", id);
+}
+
+/* do_pub: PUB en cualquiera de los dos formatos. */
+static void do_pub(client_t *c, topic_id_t id, const char *topic, const char *payload, int plen) {
+    // Se publica en tópicos concretos, nunca en patrones
+    if (strpbrk(topic, "+#")) {
+        reply_err(c, "invalid topic");
+        return;
+    }
+    broadcast_to_topic(id, topic, payload, plen);
+}
+
+/* note_ack:
+ *   - Anota que el SPUB seq del cliente ya se procesó. El ACK sale una sola
+ *     vez al final de la lectura (send_ack): confirma todos los anteriores.
+ */
+static void note_ack(client_t *c, uint32_t seq) {
+    c->ack_seq = seq;
+    c->ack_pending = 1;
+}
+
+/* send_ack:
+ *   - Encola el ACK acumulativo pendiente: "ACK <seq>\n" o una trama FRAME_ACK.
+ */
+static void send_ack(client_t *c) {
+    char out[FRAME_HDR + FRAME_SEQ_LEN];
+    int n;
+    c->ack_pending = 0;
+    if (c->binary) {
+        unsigned char seq[FRAME_SEQ_LEN];
+        frame_put32(seq, c->ack_seq);
+        n = frame_encode(out, FRAME_ACK, FRAME_NO_TOPIC, NULL, 0, (const char*)seq, FRAME_SEQ_LEN);
+    } else {
+        n = snprintf(out, sizeof(out), "ACK %u\n", c->ack_seq);
+    }
+    client_send(c, out, n);
+}
+
+/* send_pong:
+ *   - Responde un PING del cliente con sus suscripciones: "PONG <n>\n" o FRAME_PONG.
+ */
+static void send_pong(client_t *c) {
+    char out[FRAME_HDR + FRAME_SEQ_LEN];
+    int n;
+    if (c->binary) {
+        unsigned char cnt[FRAME_SEQ_LEN];
+        frame_put32(cnt, (uint32_t)c->nsubs);
+        n = frame_encode(out, FRAME_PONG, FRAME_NO_TOPIC, NULL, 0, (const char*)cnt, FRAME_SEQ_LEN);
+    } else {
+        n = snprintf(out, sizeof(out), "PONG %d\n", c->nsubs);
+    }
+    client_send(c, out, n);
+}
+
+/* render_stats:
+ *   - Métricas de todos los workers (common/stats.h) y las propias del broker
+ *     TCP. Solo lee contadores: corre en cualquier worker o en el hilo de -M.
  */
-static void broadcast_to_topic(const char *topic, const char *payload) {
-    char out[MAX_LINE];
-    int n = snprintf(out, sizeof(out), "MSG %s %s\n", topic, payload);
-    if (n < 0) return;
+static void render_stats(stats_buf_t *b, void *arg) {
+    (void)arg;
+    char labels[32];
+    stats_render(b, "pubsub_tcp", stats, nworkers, mono_us() / 1000000);
+    for (int w=0; w<nworkers && nworkers > 1; w++) {
+        snprintf(labels, sizeof(labels), "worker=\"%d\"", w);
+        stats_put(b, "pubsub_tcp_xpub_dropped_total", "counter",
+                  "PUBs perdidos por encontrar llena la cola hacia el worker.", labels,
+                  (uint64_t)atomic_load_explicit(&workers[w].ring_drops, memory_order_relaxed));
+    }
+    if (history_on) {
+        stats_put(b, "pubsub_tcp_history_topics", "gauge", "Topics con historial.", NULL,
+                  atomic_load_explicit(&history.count, memory_order_relaxed));
+        stats_put(b, "pubsub_tcp_history_refused_total", "counter",
+                  "Topics nuevos sin historial por superar -N.", NULL,
+                  (uint64_t)atomic_load_explicit(&history.refused, memory_order_relaxed));
+    }
+}
 
-    for (int i=0;i<MAX_CLIENTS;i++) {
-        if (clients[i].fd != INVALID_SOCKET &&
-            clients[i].is_subscriber == 1 &&
-            strncmp(clients[i].topic, topic, MAX_TOPIC) == 0) {
-            (void)writen(clients[i].fd, out, n);
+/* send_stats:
+ *   - Responde STATS: las métricas del broker y las de esta conexión (comandos
+ *     recibidos, mensajes encolados y descartados, cola y suscripciones), en
+ *     líneas "STAT ..." terminadas con "END\n" o en una trama FRAME_STATS.
+ */
+static void send_stats(client_t *c) {
+    stats_buf_t b;
+    stats_buf_init(&b, c->binary ? STATS_PLAIN : STATS_LINES);
+    render_stats(&b, NULL);
+    stats_put(&b, "pubsub_tcp_conn_commands_total", "counter", "Comandos recibidos.", NULL, c->cmds);
+    stats_put(&b, "pubsub_tcp_conn_queued_total", "counter", "Mensajes encolados.", NULL, c->msgs_out);
+    stats_put(&b, "pubsub_tcp_conn_dropped_total", "counter", "Mensajes descartados.", NULL, c->drops);
+    stats_put(&b, "pubsub_tcp_conn_queue_bytes", "gauge", "Bytes en cola.", NULL, (uint64_t)c->out.bytes);
+    stats_put(&b, "pubsub_tcp_conn_subscriptions", "gauge", "Suscripciones.", NULL, (uint64_t)c->nsubs);
+    if (!c->binary) stats_printf(&b, "END\n");
+    if (b.oom) {
+        reply_err(c, "out of memory");
+    } else if (c->binary) {
+        msg_t *m = msg_alloc((int)frame_size(0, (uint32_t)b.len));
+        if (m) {
+            frame_encode(m->data, FRAME_STATS, FRAME_NO_TOPIC, NULL, 0, b.data, (uint32_t)b.len);
+            client_send_msg(c, m);
+            msg_unref(m);
+        } else {
+            client_close(c);
         }
+    } else {
+        client_send(c, b.data, (int)b.len);
     }
+    stats_buf_free(&b);
+}
+
+/* do_trace:
+ *   - Responde TRACE: pide el volcado de la traza (lo escribe el hilo de
+ *     common/trace.c, sin frenar al worker) y confirma con "OK TRACE\n" o
+ *     FRAME_OK; si el broker se compiló sin PUBSUB_TRACE, "ERR trace disabled".
+ */
+static void do_trace(client_t *c) {
+    char out[FRAME_HDR + 16];
+    int n;
+    if (TRACE_REQUEST() != 0) { reply_err(c, "trace disabled"); return; }
+    if (c->binary) n = frame_encode(out, FRAME_OK, FRAME_NO_TOPIC, NULL, 0, NULL, 0);
+    else           n = snprintf(out, sizeof(out), "OK TRACE\n");
+    client_send(c, out, n);
+}
+
+/* text_topic_ok:
+ *   - 1 si el topic de un comando de texto cabe en MAX_TOPIC, el mismo límite
+ *     que frame_topic aplica a las tramas. Se valida una sola vez y el nombre
+ *     completo es el que usan el índice, el historial, las métricas y el log
+ *     (-D): nunca se recorta.
+ */
+static int text_topic_ok(const text_cmd_t *cmd) {
+    return cmd->topic_len < MAX_TOPIC;
 }
 
 /* handle_line:
- *   - Procesa un comando textual de un cliente (índice idx en la tabla).
+ *   - Procesa un comando textual del cliente c, ya analizado por
+ *     linebuf_next_cmd() (topic y payload apuntan al buffer de entrada).
  *   - Comandos soportados:
- *       SUB <topic>
+ *       SUB <topic> [FROM <seq>]
+ *       UNSUB <topic>
  *       PUB <topic> <mensaje...>
+ *       SPUB <seq> <topic> <mensaje...>
+ *       PING (responde "PONG <suscripciones>") / PONG (respuesta al heartbeat)
+ *       BIN  (pasa la conexión a tramas binarias)
+ *       STATS (métricas, ver send_stats)
+ *       TRACE (volcado de la traza, ver do_trace)
  *     Cualquier otro comando responde con "ERR unknown command\n".
  */
-static void handle_line(int idx, char *line) {
-    trim_newline(line);
+static void handle_line(client_t *c, text_cmd_t *cmd) {
+    switch (cmd->op) {
+    // SUB <topic> [FROM <seq>]  -> el cliente agrega el topic a sus suscripciones
+    case TEXT_SUB:
+        if (cmd->err) { reply_err(c, "bad sequence"); return; }
+        if (!text_topic_ok(cmd)) { reply_err(c, "invalid topic"); return; }
+        do_sub(c, cmd->topic, cmd->seq);
+        break;
 
-    // SUB <topic>  -> el cliente se registra como suscriptor del topic
-    if (strncmp(line, "SUB ", 4) == 0) {
-        char *topic = line + 4;
+    // UNSUB <topic>  -> el cliente quita el topic de sus suscripciones
+    case TEXT_UNSUB:
+        do_unsub(c, text_topic_ok(cmd) ? topic_lookup(&topics, cmd->topic, cmd->topic_len) : TOPIC_NONE);
+        break;
 
-        // Evitar overflow si envían un topic larguísimo
-        if ((int)strlen(topic) >= MAX_TOPIC) topic[MAX_TOPIC-1] = '\0';
+    // PUB <topic> <mensaje...>  -> reenviar a todos los suscriptores de ese topic
+    case TEXT_PUB:
+        if (cmd->err) return; // formato inválido (sin payload)
+        if (!text_topic_ok(cmd)) { reply_err(c, "invalid topic"); return; }
+        do_pub(c, TOPIC_NONE, cmd->topic, cmd->payload, cmd->plen);
+        break;
 
-        // Guardar estado del cliente como suscriptor
-        strncpy(clients[idx].topic, topic, MAX_TOPIC);
-        clients[idx].is_subscriber = 1;
+    // SPUB <seq> <topic> <mensaje...>  -> PUB que el broker confirma con ACK
+    case TEXT_SPUB:
+        if (cmd->err == TEXT_BAD_SEQ) { reply_err(c, "bad sequence"); return; }
+        if (cmd->err) { reply_err(c, "missing payload"); return; }
+        if (text_topic_ok(cmd)) do_pub(c, TOPIC_NONE, cmd->topic, cmd->payload, cmd->plen);
+        else                    reply_err(c, "invalid topic");
+        note_ack(c, cmd->seq);  // también si el PUB fue rechazado: ya tuvo respuesta
+        break;
 
-        // Confirmación
-        char ok[MAX_LINE];
-        int n = snprintf(ok, sizeof(ok), "OK SUB %s\n", clients[idx].topic);
-        (void)writen(clients[idx].fd, ok, n);
+    // PING / PONG  -> mantener viva la conexión (basta con que llegue: ver on_idle)
+    case TEXT_PING:
+        send_pong(c);
+        break;
+    case TEXT_PONG:
+        break;
 
-    // PUB <topic> <mensaje...>  -> reenviar a todos los suscriptores de ese topic
-    } else if (strncmp(line, "PUB ", 4) == 0) {
-        char *p = line + 4;
-        char *space = strchr(p, ' ');
-        if (!space) return; // formato inválido (sin payload)
-        *space = '\0';
+    // STATS  -> métricas del broker y de esta conexión
+    case TEXT_STATS:
+        send_stats(c);
+        break;
 
-        const char *topic   = p;
-        const char *payload = space + 1;
+    case TEXT_TRACE:
+        do_trace(c);
+        break;
 
-        broadcast_to_topic(topic, payload);
+    // BIN  -> desde aquí la conexión habla tramas binarias en ambos sentidos
+    case TEXT_BIN: {
+        const char *ok = "OK BIN\n";
+        client_send(c, ok, (int)strlen(ok));
+        c->binary = 1;
+        break;
+    }
 
-    } else {
+    default:
         // Comando no reconocido
-        const char *err = "ERR unknown command\n";
-        (void)writen(clients[idx].fd, err, (int)strlen(err));
+        reply_err(c, "unknown command");
     }
 }
 
-int main(void) {
-    // Inicializa la pila de Winsock (WSAStartup). Obligatorio en Windows.
-    if (winsock_init() != 0) return 1;
+/* frame_topic:
+ *   - Copia el nombre de la trama a name (terminado en '\0').
+ *   - Devuelve 0 si ok, -1 si está vacío, excede MAX_TOPIC o contiene '\0'.
+ */
+static int frame_topic(const frame_t *f, char *name) {
+    if (f->name_len == 0 || f->name_len >= MAX_TOPIC) return -1;
+    if (memchr(f->name, '\0', f->name_len)) return -1;
+    memcpy(name, f->name, f->name_len);
+    name[f->name_len] = '\0';
+    return 0;
+}
 
-    // Crea socket de escucha, lo liga a INADDR_ANY:PORT y lo pone en listen()
-    socket_t listenfd = tcp_listen_any(BROKER_PORT);
-    printf("[broker] escuchando en puerto %d...\n", BROKER_PORT);
+/* frame_topic_id:
+ *   - id de la trama si es un topic existente, o TOPIC_NONE (también si el
+ *     id ya fue liberado).
+ */
+static topic_id_t frame_topic_id(const frame_t *f) {
+    if (f->topic == FRAME_NO_TOPIC || !topic_valid(&topics, (topic_id_t)f->topic)) return TOPIC_NONE;
+    return (topic_id_t)f->topic;
+}
+
+/* handle_frame:
+ *   - Procesa una trama binaria del cliente c (ver common/frame.h).
+ *   - UNSUB y PUB aceptan el topic por id (el que devolvió OK) o por nombre.
+ *   - Un SUB con payload trae el número desde el que se pide el historial.
+ */
+static void handle_frame(client_t *c, const frame_t *f) {
+    char name[MAX_TOPIC];
+    topic_id_t id;
+
+    switch (f->op) {
+    case FRAME_SUB:
+        if (frame_topic(f, name) != 0) { reply_err(c, "invalid topic"); return; }
+        do_sub(c, name, f->len >= FRAME_SEQ_LEN ? frame_get32((const unsigned char*)f->payload) : 0);
+        break;
+
+    case FRAME_UNSUB:
+        id = frame_topic_id(f);
+        if (id == TOPIC_NONE && frame_topic(f, name) == 0)
+            id = topic_lookup(&topics, name, (int)strlen(name));
+        do_unsub(c, id);
+        break;
+
+    case FRAME_TOPIC:
+        // Resolver nombre -> id para publicar luego sin enviar el nombre
+        if (frame_topic(f, name) != 0 || topic_classify(name, (int)strlen(name)) != 0) {
+            reply_err(c, "invalid topic");
+            return;
+        }
+        do_topic(c, name);
+        break;
+
+    case FRAME_PUB:
+    case FRAME_SPUB: {
+        const char *payload = f->payload;
+        int plen = (int)f->len;
+        if (f->op == FRAME_SPUB) {
+            if (plen < FRAME_SEQ_LEN) { reply_err(c, "bad sequence"); return; }
+            payload += FRAME_SEQ_LEN;
+            plen    -= FRAME_SEQ_LEN;
+        }
+        id = frame_topic_id(f);
+        if (id != TOPIC_NONE) {
+            do_pub(c, id, topic_name(&topics, id), payload, plen);
+        } else if (frame_topic(f, name) == 0) {
+            do_pub(c, TOPIC_NONE, name, payload, plen);
+        } else {
+            reply_err(c, "invalid topic");
+        }
+        if (f->op == FRAME_SPUB) note_ack(c, frame_get32((const unsigned char*)f->payload));
+        break;
+    }
+
+    case FRAME_PING:
+        send_pong(c);
+        break;
+
+    case FRAME_PONG:
+        break;
+
+    case FRAME_STATS:
+        send_stats(c);
+        break;
 
-    // Inicializa tabla de clientes a "vacío"
-    for (int i=0;i<MAX_CLIENTS;i++) clients[i].fd = INVALID_SOCKET;
+    case FRAME_TRACE:
+        do_trace(c);
+        break;
 
-    // Conjuntos de descriptores para select()
-    fd_set allset, rset;
-    FD_ZERO(&allset);
-    FD_SET(listenfd, &allset);
-    socket_t maxfd = listenfd;  // máximo descriptor a vigilar
+    default:
+        reply_err(c, "unknown command");
+    }
+}
+
+/* client_add:
+ *   - Reserva un client_t para connfd y lo agrega a la tabla y al event loop.
+ *   - Devuelve NULL si no hay memoria o el backend no admite más sockets.
+ */
+static client_t *client_add(socket_t connfd) {
+    if (nclients == cap_clients) {
+        int ncap = cap_clients ? cap_clients * 2 : 1024;
+        client_t **t = (client_t**)realloc(clients, ncap * sizeof(*t));
+        if (!t) return NULL;
+        clients = t;
+        cap_clients = ncap;
+    }
+    client_t *c = (client_t*)pool_alloc(&client_pool);
+    if (!c) return NULL;
+    memset(c, 0, sizeof(*c));
+    c->fd = connfd;
 
+    if (evloop_add(loop, connfd, EV_READ | EV_EDGE, c) != 0) { pool_put(&client_pool, c); return NULL; }
+
+    c->slot = nclients;
+    clients[nclients++] = c;
+
+    stats_add(&wstats->c[STATS_CONNS], 1);
+    stats_add(&wstats->c[STATS_ACCEPTED], 1);
+    c->last_rx = c->last_tx = loop_ms;
+    if (idle_ms || beat_ms) tw_add(&idle_timers, &c->idle_timer, (loop_ms + idle_check_ms()) / IDLE_TICK_MS);
+    return c;
+}
+
+/* accept_all:
+ *   - El socket de escucha es no bloqueante y está en modo edge-triggered:
+ *     hay que aceptar hasta vaciar la cola (EWOULDBLOCK).
+ */
+static void accept_all(socket_t listenfd) {
     while (1) {
-        // rset es el conjunto "temporal" que select va a modificar
-        rset = allset;
+        struct sockaddr_in cliaddr; socklen_t len = sizeof(cliaddr);
+        socket_t connfd = accept(listenfd, (struct sockaddr*)&cliaddr, &len);
+        if (connfd == INVALID_SOCKET) {
+            int e = WSAGetLastError();
+            if (e == WSAEINTR) continue;
+            if (!SOCK_WOULDBLOCK(e)) fprintf(stderr, "accept() err: %d\n", e);
+            return;
+        }
+        // Los clientes se leen en modo edge-triggered: el socket debe ser no bloqueante.
+        set_nonblock(connfd);
+        // Sin Nagle: los MSG pequeños salen de inmediato en vez de esperar el ACK
+        // retardado del suscriptor (que además llenaría la cola de salida).
+        set_nodelay(connfd, 1);
 
-        // Bloquea hasta que haya sockets listos para leer
-        int nready = select((int)maxfd+1, &rset, NULL, NULL, NULL);
-        if (nready == SOCKET_ERROR) {
-            fprintf(stderr, "select() err: %d\n", WSAGetLastError());
-            break;
+        client_t *c = client_add(connfd);
+        if (!c) {
+            // Sin espacio: rechazar y avisar
+            const char *msg="ERR too many clients\n";
+            writen(connfd, msg, (int)strlen(msg));
+            tcp_close(connfd);
+            continue;
+        }
+
+        // Enviar banner informativo
+        const char *hello="OK broker ready\n";
+        client_send(c, hello, (int)strlen(hello));
+    }
+}
+
+/* client_read:
+ *   - Vacía el socket del cliente (hasta EWOULDBLOCK, requisito del modo edge)
+ *     y despacha cada línea o trama completa recibida.
+ *   - Tras "BIN" el resto del buffer ya son tramas: el modo se revisa en cada vuelta.
+ *   - Devuelve 0 si el cliente sigue conectado, -1 si fue eliminado.
+ */
+static int client_read(client_t *c) {
+    while (!c->closing) {
+        TRACE_BEGIN(TRACE_READ);
+        int r = linebuf_fill(c->fd, &c->in);
+        TRACE_END(TRACE_READ, r > 0 ? r : 0);
+        if (r == LB_AGAIN) break;
+        if (r == LB_OVERFLOW) {
+            const char *err = "ERR line too long\n";
+            (void)send(c->fd, err, (int)strlen(err), 0);  // mejor esfuerzo antes de cerrar
+        }
+        if (r > 0) c->last_rx = loop_ms;
+        if (r <= 0) {
+            // El peer cerró: una última línea sin '\n' también se procesa.
+            int len;
+            char *rest = (r == 0 && !c->binary) ? linebuf_take_rest(&c->in, &len) : NULL;
+            if (rest) {
+                text_cmd_t cmd;
+                text_parse(rest, len, 1, &cmd);
+                c->cmds++;
+                handle_line(c, &cmd);
+            }
+            client_close(c);
+            return -1;
         }
 
-        // ¿Hay una nueva conexión entrante en el listenfd?
-        if (FD_ISSET(listenfd, &rset)) {
-            struct sockaddr_in cliaddr; int len = sizeof(cliaddr);
-            socket_t connfd = accept(listenfd, (struct sockaddr*)&cliaddr, &len);
-            if (connfd != INVALID_SOCKET) {
-                // Buscar un hueco libre en la tabla de clientes
-                int i;
-                for (i=0;i<MAX_CLIENTS;i++)
-                    if (clients[i].fd == INVALID_SOCKET) { clients[i].fd = connfd; break; }
-
-                if (i == MAX_CLIENTS) {
-                    // Sin espacio: rechazar y avisar
-                    const char *msg="ERR too many clients\n";
-                    writen(connfd, msg, (int)strlen(msg));
-                    tcp_close(connfd);
-                } else {
-                    // Inicializar estado del nuevo cliente
-                    clients[i].is_subscriber = 0;
-                    clients[i].topic[0] = '\0';
-
-                    // Añadir a la lista vigilada por select()
-                    FD_SET(connfd, &allset);
-                    if (connfd > maxfd) maxfd = connfd;
-
-                    // Enviar banner informativo
-                    const char *hello="OK broker ready\n";
-                    writen(connfd, hello, (int)strlen(hello));
+        while (!c->closing) {
+            if (c->binary) {
+                frame_t f;
+                TRACE_BEGIN(TRACE_PARSE);
+                int fr = linebuf_next_frame(&c->in, &f);
+                TRACE_END(TRACE_PARSE, fr);
+                if (fr == 0) break;
+                if (fr < 0) {
+                    reply_err(c, "bad frame");
+                    client_flush(c);  // mejor esfuerzo antes de cerrar
+                    client_close(c);
+                    return -1;
                 }
+                c->cmds++;
+                TRACE_BEGIN(TRACE_HANDLE);
+                handle_frame(c, &f);
+                TRACE_END(TRACE_HANDLE, f.op);
+            } else {
+                text_cmd_t cmd;
+                TRACE_BEGIN(TRACE_PARSE);
+                int got = linebuf_next_cmd(&c->in, &cmd);
+                TRACE_END(TRACE_PARSE, got);
+                if (!got) break;
+                c->cmds++;
+                TRACE_BEGIN(TRACE_HANDLE);
+                handle_line(c, &cmd);
+                TRACE_END(TRACE_HANDLE, cmd.op);
             }
-            if (--nready <= 0) continue; // No quedan más sockets listos
         }
+    }
+    // Un solo ACK por lectura: confirma todos los SPUB que trajo
+    if (c->ack_pending && !c->closing) send_ack(c);
+    linebuf_release(&c->in);
+    return c->closing ? -1 : 0;
+}
 
-        // Iterar sobre todos los clientes y procesar los que tengan datos
-        for (int i=0;i<MAX_CLIENTS;i++) {
-            socket_t fd = clients[i].fd;
-            if (fd == INVALID_SOCKET) continue;
+/* send_ping:
+ *   - Heartbeat a un suscriptor: "PING\n" o una trama FRAME_PING.
+ */
+static void send_ping(client_t *c) {
+    char out[FRAME_HDR];
+    int n;
+    if (c->binary) n = frame_encode(out, FRAME_PING, FRAME_NO_TOPIC, NULL, 0, NULL, 0);
+    else           n = snprintf(out, sizeof(out), "PING\n");
+    client_send(c, out, n);
+    c->last_ping = loop_ms;
+}
 
-            if (FD_ISSET(fd, &rset)) {
-                char line[MAX_LINE];
+/* on_idle:
+ *   - Revisión de inactividad de un cliente. Recibir o enviar no toca el
+ *     temporizador (solo last_rx / last_tx): al vencer se mira cuánto pasó de
+ *     verdad y se vuelve a programar para el próximo plazo.
+ *   - Sin suscripciones y -I ms sin recibir nada: se cierra (publicador
+ *     inactivo o conexión medio abierta).
+ *   - Con suscripciones y la cola bloqueada (EV_WRITE) -I ms sin que el
+ *     socket acepte un byte: se cierra (el consumidor dejó de leer).
+ *   - Con suscripciones y -K ms sin tráfico en ningún sentido: PING.
+ */
+static void on_idle(tw_timer_t *t, void *arg) {
+    (void)arg;
+    client_t *c = (client_t*)((char*)t - offsetof(client_t, idle_timer));
+    uint64_t now = loop_ms, next = now + idle_check_ms();
 
-                // readline() lee hasta '\n' o cierre del peer
-                int n = readline(fd, line, sizeof(line));
-                if (n <= 0) {
-                    // El cliente cerró o error: limpiar su estado y sacarlo del set
-                    tcp_close(fd);
-                    FD_CLR(fd, &allset);
-                    clients[i].fd = INVALID_SOCKET;
-                    continue;
-                }
+    if (c->nsubs == 0) {
+        if (idle_ms) {
+            if (now - c->last_rx >= idle_ms) { stats_add(&wstats->c[STATS_SLOW_CLOSE], 1); client_close(c); return; }
+            next = c->last_rx + idle_ms;
+        }
+    } else {
+        if (idle_ms && c->want_write) {
+            if (now - c->last_tx >= idle_ms) { stats_add(&wstats->c[STATS_SLOW_CLOSE], 1); client_close(c); return; }
+            next = c->last_tx + idle_ms;
+        }
+        if (beat_ms) {
+            uint64_t last = c->last_rx > c->last_tx ? c->last_rx : c->last_tx;
+            if (c->last_ping > last) last = c->last_ping;
+            if (now - last >= beat_ms) { send_ping(c); last = now; }
+            if (last + beat_ms < next) next = last + beat_ms;
+        }
+    }
+    tw_add(&idle_timers, &c->idle_timer, (next + IDLE_TICK_MS - 1) / IDLE_TICK_MS);
+}
+
+/* timers_timeout:
+ *   - ms que el event loop puede dormir sin pasarse del próximo vencimiento
+ *     de idle_timers o flush_timers; -1 si no hay ninguno programado.
+ */
+static int timers_timeout(void) {
+    int64_t wait = INT64_MAX, n;
+    if ((n = tw_next(&flush_timers)) >= 0)
+        wait = (int64_t)(flush_timers.now + (uint64_t)n - loop_ms);
+    if ((n = tw_next(&idle_timers)) >= 0) {
+        int64_t w = (int64_t)((idle_timers.now + (uint64_t)n) * IDLE_TICK_MS - loop_ms);
+        if (w < wait) wait = w;
+    }
+    if (wait == INT64_MAX) return -1;
+    return wait < 0 ? 0 : (int)(wait > 60000 ? 60000 : wait);
+}
+
+/* parse_policy: traduce el argumento de -o a overflow_policy_t. */
+static int parse_policy(const char *name, overflow_policy_t *out) {
+    if      (strcmp(name, "drop-oldest") == 0) *out = OVF_DROP_OLDEST;
+    else if (strcmp(name, "drop-newest") == 0) *out = OVF_DROP_NEWEST;
+    else if (strcmp(name, "disconnect")  == 0) *out = OVF_DISCONNECT;
+    else return -1;
+    return 0;
+}
+
+/* parse_backend: traduce el argumento de -b a evloop_backend_t. */
+static int parse_backend(const char *name, evloop_backend_t *out) {
+    if      (strcmp(name, "epoll")  == 0) *out = EVLOOP_EPOLL;
+    else if (strcmp(name, "poll")   == 0) *out = EVLOOP_POLL;
+    else if (strcmp(name, "select") == 0) *out = EVLOOP_SELECT;
+    else return -1;
+    return 0;
+}
+
+/* worker_run:
+ *   - Bucle de un worker: su socket de escucha, su event loop y sus clientes.
+ *   - Con varios workers cada uno escucha el mismo puerto con SO_REUSEPORT y
+ *     vigila además su despertador (PUBs de otros workers).
+ */
+static void *worker_run(void *arg) {
+    self = (worker_t*)arg;
+    wstats = &stats[self->id];
+    TRACE_THREAD("tcp worker", self->id);
+    topic_index_init(&topics);
+    pool_init(&client_pool, sizeof(client_t));
+    if (nworkers > 1 && !(route_cache = (route_cache_t*)calloc(1, sizeof(*route_cache)))) {
+        fprintf(stderr, "[broker] sin memoria para la caché de rutas\n");
+        exit(1);
+    }
+
+    loop = evloop_create(backend);
+    if (!loop) {
+        fprintf(stderr, "[broker] backend de eventos no disponible en esta plataforma\n");
+        exit(1);
+    }
+
+    // Crea socket de escucha, lo liga a INADDR_ANY:PORT y lo pone en listen()
+    socket_t listenfd = nworkers > 1 ? tcp_listen_shared(BROKER_PORT) : tcp_listen_any(BROKER_PORT);
+    set_nonblock(listenfd);
+    evloop_add(loop, listenfd, EV_READ | EV_EDGE, &listen_tag);
+    if (nworkers > 1) evloop_add(loop, self->wake.rfd, EV_READ, &wake_tag);
+    if (self->id == 0)
+        printf("[broker] escuchando en puerto %d (%s, %d worker%s)...\n", BROKER_PORT,
+               evloop_backend_name(loop), nworkers, nworkers > 1 ? "s" : "");
 
-                // Despachar el comando recibido
-                handle_line(i, line);
+    ev_event_t events[MAX_EVENTS];
+    loop_us = mono_us();
+    loop_ms = loop_us / 1000;
+    tw_init(&idle_timers, loop_ms / IDLE_TICK_MS);
+    tw_init(&flush_timers, loop_ms);
+
+    while (1) {
+        // Dormir hasta el próximo temporizador. Anunciar que se va a dormir y recién
+        // entonces revisar las colas: un PUB encolado después de esta revisión verá
+        // sleeping = 1 y despertará al worker.
+        int timeout = timers_timeout();
+        if (nworkers > 1) {
+            atomic_store_explicit(&self->sleeping, 1, memory_order_relaxed);
+            atomic_thread_fence(memory_order_seq_cst);
+            if (rings_pending()) timeout = 0;
+        }
+
+        // Bloquea hasta que haya sockets listos; solo devuelve los listos
+        int nready = evloop_wait(loop, events, MAX_EVENTS, timeout);
+        if (nworkers > 1) atomic_store_explicit(&self->sleeping, 0, memory_order_relaxed);
+        loop_us = mono_us();
+        loop_ms = loop_us / 1000;
+        if (nready < 0) {
+            fprintf(stderr, "evloop_wait() err: %d\n", WSAGetLastError());
+            break;
+        }
+        TRACE_BEGIN(TRACE_BATCH);
+
+        for (int k=0; k<nready; k++) {
+            // ¿Hay conexiones entrantes en el listenfd?
+            if (events[k].udata == &listen_tag) {
+                accept_all(listenfd);
+                continue;
+            }
+            // Aviso de otro worker: los PUBs se leen de las colas tras el lote
+            if (events[k].udata == &wake_tag) {
+                ev_wakeup_drain(&self->wake);
+                continue;
             }
+
+            client_t *c = (client_t*)events[k].udata;
+            if (c->closing) continue;  // cerrado antes en este mismo lote
+
+            // Socket escribible: vaciar lo que quedó en la cola de salida.
+            if (events[k].events & EV_WRITE) client_flush(c);
+
+            // Leer todo lo disponible y despachar las líneas completas;
+            // si el cliente cerró o hubo error, client_read() lo marca para cierre.
+            if (events[k].events & EV_READ) (void)client_read(c);
         }
+
+        // Repartir los PUBs de otros workers, avisar a los que recibieron PUBs de
+        // este, vencer temporizadores (inactividad, heartbeat, vaciados diferidos),
+        // enviar lo encolado durante el lote (una escritura vectorizada por
+        // cliente) y luego liberar los clientes cerrados
+        if (nworkers > 1) {
+            drain_rings();
+            notify_workers();
+        }
+        tw_advance(&idle_timers, loop_ms / IDLE_TICK_MS, on_idle, NULL);
+        tw_advance(&flush_timers, loop_ms, on_flush, NULL);
+        flush_pending();
+        reap_dead();
+        if (nready > 0) stats_hist_add(&wstats->batch_us, mono_us() - loop_us);
+        TRACE_END(TRACE_BATCH, nready);
     }
 
-    // Cierre ordenado del socket de escucha y limpieza de Winsock
+    // Cierre ordenado: clientes, socket de escucha y memoria del worker
+    for (int i=0; i<nclients; i++) client_close(clients[i]);
+    reap_dead();
     tcp_close(listenfd);
+    evloop_destroy(loop);
+    topic_index_free(&topics);
+    free(route_cache);
+    free(clients);
+    pool_destroy(&client_pool);
+    tcp_pools_free();
+    return NULL;
+}
+
+/* log_syncer:
+ *   - Hilo de la política por tiempo (-T): cada tantos ms lleva a disco lo que
+ *     los PUB agregaron a los logs. Corre mientras viva el broker.
+ */
+static void *log_syncer(void *arg) {
+    (void)arg;
+    for (;;) {
+        thread_sleep_ms((int)log_sync.every_ms);
+        retained_sync_all(&history);
+    }
+    return NULL;
+}
+
+int main(int argc, char **argv) {
+    for (int i=1; i<argc; i++) {
+        if (strcmp(argv[i], "-b") == 0 && i+1 < argc && parse_backend(argv[i+1], &backend) == 0) {
+            i++;
+        } else if (strcmp(argv[i], "-q") == 0 && i+1 < argc && atoi(argv[i+1]) > 0) {
+            outq_limit = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-o") == 0 && i+1 < argc && parse_policy(argv[i+1], &outq_policy) == 0) {
+            i++;
+        } else if (strcmp(argv[i], "-i") == 0 && i+1 < argc && atoi(argv[i+1]) > 0) {
+            iov_max = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-w") == 0 && i+1 < argc && atoi(argv[i+1]) > 0) {
+            iov_bytes = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-t") == 0 && i+1 < argc && atoi(argv[i+1]) >= 0
+                   && atoi(argv[i+1]) <= REGISTRY_MAX_WORKERS) {
+            nworkers = atoi(argv[++i]);
+            if (nworkers == 0) nworkers = cpu_count();
+            if (nworkers > REGISTRY_MAX_WORKERS) {  // -t 0 con más núcleos que el máximo
+                fprintf(stderr, "[broker] %d núcleos: se usan %d workers (el máximo)\n",
+                        nworkers, REGISTRY_MAX_WORKERS);
+                nworkers = REGISTRY_MAX_WORKERS;
+            }
+        } else if (strcmp(argv[i], "-r") == 0 && i+1 < argc && atoi(argv[i+1]) > 0) {
+            ring_size = (unsigned)atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-H") == 0 && i+1 < argc && atol(argv[i+1]) > 0) {
+            history_bytes = (size_t)atol(argv[++i]);
+        } else if (strcmp(argv[i], "-N") == 0 && i+1 < argc && atol(argv[i+1]) >= 0) {
+            history_topics = (uint32_t)atol(argv[++i]);
+        } else if (strcmp(argv[i], "-D") == 0 && i+1 < argc) {
+            log_dir = argv[++i];
+        } else if (strcmp(argv[i], "-C") == 0 && i+1 < argc && atoll(argv[i+1]) >= 0) {
+            log_keep = (size_t)atoll(argv[++i]);
+        } else if (strcmp(argv[i], "-S") == 0 && i+1 < argc && atoi(argv[i+1]) > 0) {
+            log_sync.every_msgs = (uint32_t)atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-T") == 0 && i+1 < argc && atoi(argv[i+1]) > 0) {
+            log_sync.every_ms = (uint32_t)atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-I") == 0 && i+1 < argc && atoi(argv[i+1]) >= 0) {
+            idle_ms = (uint64_t)atoi(argv[++i]) * 1000;
+        } else if (strcmp(argv[i], "-K") == 0 && i+1 < argc && atoi(argv[i+1]) >= 0) {
+            beat_ms = (uint64_t)atoi(argv[++i]) * 1000;
+        } else if (strcmp(argv[i], "-d") == 0 && i+1 < argc && atoi(argv[i+1]) >= 0) {
+            flush_ms = (uint64_t)atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-M") == 0 && i+1 < argc && atoi(argv[i+1]) > 0
+                   && atoi(argv[i+1]) < 65536) {
+            metrics_port = atoi(argv[++i]);
+        } else {
+            fprintf(stderr, "Uso: %s [-b epoll|poll|select] [-q bytes] "
+                            "[-o drop-oldest|drop-newest|disconnect] [-i iovecs] [-w bytes] "
+                            "[-t workers(0..%d)] [-r entradas] [-H bytes] [-N topics] "
+                            "[-D dir [-C bytes] [-S mensajes] [-T ms]] [-I segundos] [-K segundos] [-d ms] [-M puerto]\n",
+                    argv[0], REGISTRY_MAX_WORKERS);
+            return 1;
+        }
+    }
+    if (log_dir && !MSG_LOG_SUPPORTED) {
+        fprintf(stderr, "[broker] -D requiere mmap (POSIX)\n");
+        return 1;
+    }
+    history_on = history_bytes || log_dir;
+    if (history_on && retained_init(&history, HISTORY_SLOTS,
+                                    history_bytes ? history_bytes : HISTORY_BYTES_DEFAULT) != 0) {
+        fprintf(stderr, "[broker] sin memoria para el historial\n");
+        return 1;
+    }
+    if (history_on) retained_set_max(&history, history_topics);
+    if (log_dir) {
+        retained_set_log(&history, log_dir, 0, log_keep, &log_sync);
+        fprintf(stderr, "[broker] log en %s: %d topics recuperados\n", log_dir, retained_load(&history));
+        thread_t syncer;
+        if (log_sync.every_ms && thread_start(&syncer, log_syncer, NULL) != 0) {
+            fprintf(stderr, "[broker] no se pudo lanzar el hilo de sincronización\n");
+            return 1;
+        }
+    }
+    if (nworkers > 1 && !TCP_HAVE_REUSEPORT) {
+        fprintf(stderr, "[broker] -t > 1 requiere SO_REUSEPORT (Linux)\n");
+        return 1;
+    }
+
+    // Inicializa la pila de Winsock (WSAStartup). Obligatorio en Windows.
+    if (winsock_init() != 0) return 1;
+    (void)raise_fd_limit();
+    topic_registry_init(&routes);
+    if (metrics_port) {
+        if (stats_http_start(metrics_port, render_stats, NULL) != 0) {
+            fprintf(stderr, "[broker] no se pudo abrir el puerto de métricas %d\n", metrics_port);
+            return 1;
+        }
+        printf("[broker] métricas en http://0.0.0.0:%d/metrics\n", metrics_port);
+    }
+    if (TRACE_START("broker_tcp") != 0) {
+        fprintf(stderr, "[broker] no se pudo lanzar el hilo de la traza\n");
+        return 1;
+    }
+
+    // Las colas existen antes de lanzar los hilos: cualquier worker puede
+    // recibir un PUB para otro apenas acepta su primera conexión.
+    for (int w=0; w<nworkers; w++) {
+        workers[w].id = w;
+        if (nworkers == 1) break;
+        pool_sizes_init(&workers[w].xpub_pools);
+        if (ev_wakeup_init(&workers[w].wake) != 0) {
+            fprintf(stderr, "[broker] no se pudo crear el despertador del worker %d\n", w);
+            return 1;
+        }
+        for (int from=0; from<nworkers; from++) {
+            if (from != w && spsc_init(&workers[w].from[from], ring_size) != 0) {
+                fprintf(stderr, "[broker] sin memoria para las colas entre workers\n");
+                return 1;
+            }
+        }
+    }
+    for (int w=1; w<nworkers; w++) {
+        if (thread_start(&workers[w].thread, worker_run, &workers[w]) != 0) {
+            fprintf(stderr, "[broker] no se pudo lanzar el worker %d\n", w);
+            return 1;
+        }
+    }
+
+    // El hilo principal es el worker 0
+    worker_run(&workers[0]);
+
+    for (int w=1; w<nworkers; w++) thread_join(workers[w].thread);
+    for (int w=0; w<nworkers && nworkers > 1; w++) {
+        long drops = atomic_load(&workers[w].ring_drops);
+        if (drops) fprintf(stderr, "[broker] worker %d: %ld PUBs perdidos por cola llena\n", w, drops);
+        ev_wakeup_close(&workers[w].wake);
+        for (int from=0; from<nworkers; from++) spsc_free(&workers[w].from[from]);
+        pool_sizes_destroy(&workers[w].xpub_pools);
+    }
+    topic_registry_free(&routes);
+    retained_free(&history);
     winsock_cleanup();
     return 0;
 }
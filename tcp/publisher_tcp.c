@@ -9,8 +9,35 @@
  *   - Petición:  "PUB <topic> <mensaje...>\n"
  *   - Respuesta esperada del broker: no requerida para el publisher (envío fire-and-forget)
  *
+ * Con -B negocia tramas binarias ("BIN", ver common/frame.h) y publica con una
+ * trama FRAME_PUB: el payload viaja crudo, sin límite de MAX_LINE. Si el mensaje
+ * es "-", el payload se lee completo de la entrada estándar (datos binarios).
+ *
+ * Modo continuo (-f): en lugar de un PUB por conexión, mantiene una sola conexión
+ * abierta y publica cada línea de un archivo o de la entrada estándar ("-f -")
+ * hasta el fin de los datos (o Ctrl-C):
+ *   - Cada línea es "<topic> <mensaje...>", o solo el mensaje si se dio <topic>
+ *     en la línea de comandos.
+ *   - Los PUB van en tubería (pipelining): no se espera ninguna respuesta entre
+ *     uno y otro. Todo lo que llega en una lectura de la entrada se junta en un
+ *     buffer de hasta -w bytes (64 KB por defecto) que sale con un solo writen().
+ *   - -n desactiva Nagle (TCP_NODELAY) para que un lote chico no espere ACKs;
+ *     -c pone el tapón TCP_CORK (Linux) durante cada lote para emitir solo
+ *     segmentos llenos.
+ *   - Al terminar cierra la escritura, cuenta los ERR que devolvió el broker e
+ *     informa PUBs, bytes, escrituras y la tasa lograda.
+ *
+ * Con -a <ventana> el modo continuo publica con SPUB / FRAME_SPUB: cada PUB
+ * lleva un número de secuencia y el broker confirma con un ACK acumulativo
+ * por lote leído. El publicador deja a lo sumo <ventana> PUBs sin confirmar:
+ * al llegar al límite envía el lote y espera ACKs antes de seguir; el resto
+ * del tiempo recoge los ACK que ya llegaron sin bloquearse. Al final espera la
+ * confirmación del último PUB y la tasa informada la incluye.
+ *
  * Uso:
- *   publisher_tcp.exe 127.0.0.1 PartidoA "Gol EquipoA min32"
+ *   publisher_tcp.exe [-B] 127.0.0.1 PartidoA "Gol EquipoA min32"
+ *   publisher_tcp.exe -B 127.0.0.1 PartidoA - < foto.jpg
+ *   publisher_tcp.exe [-B] [-n] [-c] [-w bytes] [-a ventana] -f eventos.txt 127.0.0.1 [PartidoA]
  *
  * Notas (Windows/Winsock):
  *   - Se debe inicializar Winsock con winsock_init() antes de usar sockets
@@ -23,20 +50,358 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <fcntl.h>
+#ifdef _WIN32
+  #include <io.h>
+  #define read_fd  _read
+  #define open_fd  _open
+  #define close_fd _close
+  #define SHUT_WR  SD_SEND
+#else
+  #include <sys/select.h>
+  #define read_fd  read
+  #define open_fd  open
+  #define close_fd close
+#endif
 
 // Uso:
-//   publisher_tcp.exe 127.0.0.1 PartidoA "Gol EquipoA min32"
+//   publisher_tcp.exe [-B] 127.0.0.1 PartidoA "Gol EquipoA min32"
+//   publisher_tcp.exe [-B] [-n] [-c] [-w bytes] [-a ventana] -f <archivo|-> 127.0.0.1 [PartidoA]
+
+/* Tamaño por defecto del lote de PUBs de cada escritura en modo continuo (-w). */
+#define BATCH_DEFAULT  (64 * 1024)
+
+/* Ctrl-C en modo continuo: terminar el lote en curso e informar. */
+static volatile sig_atomic_t stop;
+static void on_sigint(int sig) { (void)sig; stop = 1; }
+
+/* Lee toda la entrada estándar en memoria dinámica (payload binario). */
+static char *read_stdin(uint32_t *len) {
+    size_t cap = 64 * 1024, n = 0, r;
+    char *buf = (char*)malloc(cap);
+    if (!buf) return NULL;
+    while ((r = fread(buf + n, 1, cap - n, stdin)) > 0) {
+        n += r;
+        if (n == cap) {
+            if (cap >= FRAME_MAX_PAYLOAD) break;
+            char *b = (char*)realloc(buf, cap * 2);
+            if (!b) break;
+            buf = b; cap *= 2;
+        }
+    }
+    if (n > FRAME_MAX_PAYLOAD) n = FRAME_MAX_PAYLOAD;
+    *len = (uint32_t)n;
+    return buf;
+}
+
+/* Modo binario: negocia tramas y envía un FRAME_PUB. */
+static void publish_binary(socket_t s, const char *topic, const char *payload, uint32_t len) {
+    const char *bin = "BIN\n";
+    linebuf_t in = {0};
+    (void)writen(s, bin, (int)strlen(bin));
+    (void)linebuf_read_line(s, &in, NULL);  // "OK BIN"
+    if (frame_write(s, FRAME_PUB, FRAME_NO_TOPIC, topic, (int)strlen(topic), payload, len) != 0)
+        fprintf(stderr, "no se pudo publicar en %s\n", topic);
+    linebuf_free(&in);
+}
+
+/* Reloj en segundos para medir la tasa del modo continuo. */
+static double now_s(void) {
+#ifdef _WIN32
+    return GetTickCount64() / 1e3;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+#endif
+}
+
+/* Estado del modo continuo. */
+typedef struct {
+    socket_t    s;
+    int         binary;
+    int         cork;       // -c: TCP_CORK alrededor de cada lote
+    const char *topic;      // tópico fijo, o NULL si cada línea trae el suyo
+    char       *batch;      // PUBs pendientes de enviar
+    int         len, cap;
+    long        pubs, bytes, writes, skipped;
+    long        window;     // -a: máximo de SPUB sin confirmar (0 = PUB sin ACK)
+    uint32_t    seq;        // último número asignado
+    uint32_t    acked;      // último número confirmado por el broker
+    long        errs, stalls;  // ERR recibidos; veces que se esperó por la ventana
+    linebuf_t   lb;         // respuestas del broker
+} stream_t;
+
+/* SPUB enviados (o en el lote) que el broker aún no confirmó. */
+static long stream_inflight(const stream_t *st) {
+    return (long)(uint32_t)(st->seq - st->acked);
+}
+
+/* 1 si hay datos para leer en s sin bloquear. */
+static int readable(socket_t s) {
+    fd_set rd;
+    struct timeval tv = {0, 0};
+    FD_ZERO(&rd);
+    FD_SET(s, &rd);
+    return select((int)s + 1, &rd, NULL, NULL, &tv) > 0;
+}
+
+/* Procesa una respuesta ya recibida (ACK o ERR).
+ * @return 1 si consumió una, 0 si faltan datos, -1 si el flujo es inválido. */
+static int stream_reply(stream_t *st) {
+    if (st->binary) {
+        frame_t f;
+        int r = linebuf_next_frame(&st->lb, &f);
+        if (r <= 0) return r;
+        if (f.op == FRAME_ACK && f.len >= FRAME_SEQ_LEN)
+            st->acked = frame_get32((const unsigned char*)f.payload);
+        else if (f.op == FRAME_ERR)
+            st->errs++;
+        return 1;
+    }
+    char *line = linebuf_next_line(&st->lb, NULL);
+    if (!line) return 0;
+    if (strncmp(line, "ACK ", 4) == 0)
+        st->acked = (uint32_t)strtoul(line + 4, NULL, 10);
+    else if (strncmp(line, "ERR", 3) == 0)
+        st->errs++;
+    return 1;
+}
+
+/* Lee respuestas hasta que queden a lo sumo max_inflight SPUB sin confirmar.
+ * Sin block solo consume lo que ya llegó. @return 0, o -1 si se cerró la conexión. */
+static int stream_wait(stream_t *st, long max_inflight, int block) {
+    while (1) {
+        int r;
+        while ((r = stream_reply(st)) > 0) {}
+        if (r < 0) return -1;
+        if (stream_inflight(st) <= max_inflight) return 0;
+        if (!block && !readable(st->s)) return 0;
+        if (linebuf_fill(st->s, &st->lb) <= 0) return -1;
+    }
+}
+
+/* Envía el lote acumulado con una sola escritura. */
+static int stream_flush(stream_t *st) {
+    if (st->len == 0) return 0;
+    if (st->cork) (void)set_cork(st->s, 1);
+    int w = writen(st->s, st->batch, st->len);
+    if (st->cork) (void)set_cork(st->s, 0);
+    if (w != st->len) return -1;
+    st->bytes += st->len;
+    st->writes++;
+    st->len = 0;
+    return 0;
+}
+
+/* Agrega al lote el PUB de una línea de entrada (sin '\n'). */
+static int stream_add(stream_t *st, char *line, int n) {
+    if (n > 0 && line[n-1] == '\r') n--;
+    if (n == 0) return 0;
+
+    const char *topic = st->topic, *msg = line;
+    int tlen, mlen = n;
+    if (!topic) {
+        char *sp = (char*)memchr(line, ' ', n);
+        if (!sp) { st->skipped++; return 0; }  // falta el mensaje
+        topic = line;
+        tlen  = (int)(sp - line);
+        msg   = sp + 1;
+        mlen  = n - tlen - 1;
+    } else {
+        tlen = (int)strlen(topic);
+    }
+    if (tlen == 0 || tlen >= MAX_TOPIC) { st->skipped++; return 0; }
+
+    // Ventana llena: el lote sale ya y se espera hasta que haya lugar.
+    if (st->window > 0 && stream_inflight(st) >= st->window) {
+        if (stream_flush(st) != 0) return -1;
+        st->stalls++;
+        if (stream_wait(st, st->window - 1, 1) != 0) return -1;
+    }
+    char seq[16];
+    int slen = 0;
+    if (st->window > 0)
+        slen = st->binary ? FRAME_SEQ_LEN : snprintf(seq, sizeof(seq), "%u ", st->seq + 1);
+
+    // Lo que no entra en el lote sale antes; un PUB solo más grande que -w
+    // agranda el buffer en lugar de partirse.
+    int need = st->binary ? (int)frame_size(tlen, slen + mlen)
+                          : tlen + mlen + 6 + (slen ? slen + 1 : 0);
+    if (!st->binary && need > MAX_LINE - 1) {  // el broker no acepta líneas más largas
+        mlen -= need - (MAX_LINE - 1);
+        need  = MAX_LINE - 1;
+    }
+    if (st->len + need > st->cap && stream_flush(st) != 0) return -1;
+    if (need > st->cap) {
+        char *b = (char*)realloc(st->batch, need);
+        if (!b) return -1;
+        st->batch = b;
+        st->cap = need;
+    }
+
+    char *out = st->batch + st->len;
+    if (st->binary) {
+        int h = frame_encode_head(out, slen ? FRAME_SPUB : FRAME_PUB, FRAME_NO_TOPIC,
+                                  topic, tlen, (uint32_t)(slen + mlen));
+        if (slen) frame_put32((unsigned char*)out + h, st->seq + 1);
+        memcpy(out + h + slen, msg, mlen);
+    } else {
+        if (slen) {  // "SPUB <seq> "
+            memcpy(out, "SPUB ", 5);
+            memcpy(out + 5, seq, slen);
+            out += 5 + slen;
+        } else {
+            memcpy(out, "PUB ", 4);
+            out += 4;
+        }
+        memcpy(out, topic, tlen);
+        out[tlen] = ' ';
+        memcpy(out + 1 + tlen, msg, mlen);
+        out[1 + tlen + mlen] = '\n';
+    }
+    st->len += need;
+    if (slen) st->seq++;
+    st->pubs++;
+    return 0;
+}
+
+/* Modo continuo: publica cada línea de fd por la conexión s hasta EOF o Ctrl-C. */
+static int publish_stream(stream_t *st, int fd) {
+    int cap = st->cap > MAX_LINE * 4 ? st->cap : MAX_LINE * 4;
+    char *in = (char*)malloc(cap);
+    if (!in) return -1;
+    int have = 0, r = 0;
+    double t0 = now_s();
+
+    // Cada read() trae lo que haya disponible; sus líneas completas forman un
+    // lote que sale entero antes de volver a leer (no se retiene a la espera
+    // de más datos, así una entrada lenta no acumula latencia).
+    while (!stop) {
+        int n = (int)read_fd(fd, in + have, cap - have);
+        if (n <= 0) break;
+        have += n;
+
+        char *p = in, *end = in + have, *nl;
+        while ((nl = (char*)memchr(p, '\n', end - p)) != NULL) {
+            if ((r = stream_add(st, p, (int)(nl - p))) != 0) break;
+            p = nl + 1;
+        }
+        if (r != 0) break;
+        have = (int)(end - p);
+        if (have == cap) { st->skipped++; have = 0; }  // línea más larga que el buffer
+        memmove(in, p, have);
+        if ((r = stream_flush(st)) != 0) break;
+        if (st->window > 0 && (r = stream_wait(st, st->window, 0)) != 0) break;
+    }
+    if (r == 0 && have > 0 && stream_add(st, in, have) == 0) r = stream_flush(st);
+    // Con ventana, la tasa cuenta hasta la confirmación del último SPUB.
+    if (r == 0 && st->window > 0) r = stream_wait(st, 0, 1);
+    double secs = now_s() - t0;
+    free(in);
+
+    // Cerrar la escritura y leer hasta que el broker cierre: cuenta los ERR
+    // (PUB en un patrón, etc.) sin haber esperado respuesta por cada PUB.
+    shutdown(st->s, SHUT_WR);
+    while (stream_reply(st) > 0 || linebuf_fill(st->s, &st->lb) > 0) {}
+    linebuf_free(&st->lb);
+    long errs = st->errs;
+
+    if (secs <= 0) secs = 1e-9;
+    fprintf(stderr, "[publisher] %ld PUBs, %ld bytes en %ld escrituras, %.3f s: "
+                    "%.0f PUBs/s, %.2f MB/s%s",
+            st->pubs, st->bytes, st->writes, secs, st->pubs / secs, st->bytes / secs / 1e6,
+            r != 0 ? " (conexión perdida)" : "");
+    if (st->window > 0)
+        fprintf(stderr, ", %ld confirmados (%ld esperas por la ventana de %ld)",
+                st->pubs - stream_inflight(st), st->stalls, st->window);
+    if (errs)        fprintf(stderr, ", %ld ERR del broker", errs);
+    if (st->skipped) fprintf(stderr, ", %ld líneas ignoradas", st->skipped);
+    fprintf(stderr, "\n");
+    return r;
+}
 
 int main(int argc, char **argv) {
-    // Validación mínima de argumentos: host, topic y al menos una palabra de mensaje.
-    if (argc < 4) {
-        fprintf(stderr, "Uso: %s <host> <topic> <mensaje...>\n", argv[0]);
+    int binary = 0, nodelay = 0, cork = 0, batch = BATCH_DEFAULT;
+    long window = 0;
+    const char *file = NULL;
+
+    // Opciones antes de los argumentos posicionales ("-" solo es el mensaje).
+    while (argc > 1 && argv[1][0] == '-' && argv[1][1] != '\0') {
+        if      (strcmp(argv[1], "-B") == 0) binary = 1;
+        else if (strcmp(argv[1], "-n") == 0) nodelay = 1;
+        else if (strcmp(argv[1], "-c") == 0) cork = 1;
+        else if (strcmp(argv[1], "-f") == 0 && argc > 2) { file = argv[2]; argv++; argc--; }
+        else if (strcmp(argv[1], "-w") == 0 && argc > 2 && atoi(argv[2]) > 0) {
+            batch = atoi(argv[2]); argv++; argc--;
+        } else if (strcmp(argv[1], "-a") == 0 && argc > 2 && atol(argv[2]) > 0) {
+            window = atol(argv[2]); argv++; argc--;
+        } else break;
+        argv++; argc--;
+    }
+
+    // Validación mínima de argumentos: host, topic y al menos una palabra de mensaje
+    // (en modo continuo basta el host; el topic es opcional).
+    if (file ? argc < 2 || argc > 3 : argc < 4) {
+        fprintf(stderr, "Uso: %s [-B] <host> <topic> <mensaje...|->\n"
+                        "     %s [-B] [-n] [-c] [-w bytes] [-a ventana] -f <archivo|-> <host> [topic]\n",
+                argv[0], argv[0]);
         return 1;
     }
 
     // Inicializa la pila de sockets de Windows.
     if (winsock_init() != 0) return 1;
 
+    if (file) {
+        int fd = strcmp(file, "-") == 0 ? 0 : open_fd(file, O_RDONLY);
+        if (fd < 0) { perror(file); winsock_cleanup(); return 1; }
+
+        socket_t s = tcp_connect(argv[1], BROKER_PORT);
+        char line[MAX_LINE];
+        (void)readline(s, line, sizeof(line));  // banner
+        if (nodelay) (void)set_nodelay(s, 1);
+        if (cork && set_cork(s, 0) != 0) {
+            fprintf(stderr, "TCP_CORK no disponible: se ignora -c\n");
+            cork = 0;
+        }
+        if (binary) {
+            // La respuesta a BIN es la única que se espera: después todo va en tubería.
+            linebuf_t in = {0};
+            (void)writen(s, "BIN\n", 4);
+            (void)linebuf_read_line(s, &in, NULL);  // "OK BIN"
+            linebuf_free(&in);
+        }
+
+        stream_t st;
+        memset(&st, 0, sizeof(st));
+        st.s      = s;
+        st.binary = binary;
+        st.cork   = cork;
+        st.window = window;
+        st.topic  = argc == 3 ? argv[2] : NULL;
+        st.cap    = batch;
+        st.batch  = (char*)malloc(batch);
+        if (!st.batch) { tcp_close(s); winsock_cleanup(); return 1; }
+
+#ifdef _WIN32
+        signal(SIGINT, on_sigint);
+#else
+        // Sin SA_RESTART: Ctrl-C interrumpe el read() bloqueado de la entrada.
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = on_sigint;
+        sigaction(SIGINT, &sa, NULL);
+#endif
+        int r = publish_stream(&st, fd);
+        free(st.batch);
+        if (fd != 0) close_fd(fd);
+        tcp_close(s);
+        winsock_cleanup();
+        return r != 0;
+    }
+
     const char *host  = argv[1];  // IP o nombre del broker (p.ej., "127.0.0.1")
     const char *topic = argv[2];  // Tópico al que se publica (p.ej., "PartidoA")
 
@@ -55,6 +420,20 @@ int main(int argc, char **argv) {
     char line[MAX_LINE];
     (void)readline(s, line, sizeof(line)); // ignoramos el contenido; solo sincroniza
 
+    if (binary) {
+        if (argc == 4 && strcmp(argv[3], "-") == 0) {
+            uint32_t len;
+            char *data = read_stdin(&len);
+            if (data) publish_binary(s, topic, data, len);
+            free(data);
+        } else {
+            publish_binary(s, topic, payload, (uint32_t)strlen(payload));
+        }
+        tcp_close(s);
+        winsock_cleanup();
+        return 0;
+    }
+
     // Formatear y enviar el comando PUB con topic + payload.
     char out[MAX_LINE];
     int n = snprintf(out, sizeof(out), "PUB %s %s\n", topic, payload);
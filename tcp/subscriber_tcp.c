@@ -2,22 +2,33 @@
  * Subscriber TCP (Windows / Winsock2) para un sistema Publicador–Suscriptor.
  *
  * Rol:
- *   - Se conecta al broker TCP, recibe el banner inicial, envía el comando
- *     SUB <topic> para registrarse y luego queda escuchando mensajes del broker.
+ *   - Se conecta al broker TCP, recibe el banner inicial, envía un comando
+ *     SUB <topic> por cada tópico pedido (todos por la misma conexión) y luego
+ *     queda escuchando mensajes del broker.
  *
  * Protocolo textual (línea terminada en '\n'):
  *   - Petición de suscripción: "SUB <topic>\n"
  *   - Confirmación del broker: "OK SUB <topic>\n"
  *   - Mensajes reenviados por el broker: "MSG <topic> <payload>\n"
+ *   - Fin del historial (broker con -H): "REPLAY <topic> <seq>\n"
+ *   - Heartbeat del broker (-K): "PING\n", se responde "PONG\n" sin mostrarlo
+ *
+ * Con -B negocia tramas binarias ("BIN", ver common/frame.h): SUB y MSG viajan
+ * como tramas y el payload se escribe tal cual llega (cualquier byte y tamaño).
+ *
+ * Con -f <seq> se suscribe con "SUB <topic> FROM <seq>": si el broker retiene
+ * historial, recibe primero lo publicado desde ese número. El REPLAY que cierra
+ * el historial (a stderr) dice el número del primer mensaje en vivo.
  *
  * Uso:
- *   subscriber_tcp.exe 127.0.0.1 PartidoA
+ *   subscriber_tcp.exe [-B] [-f seq] 127.0.0.1 PartidoA [PartidoB ...]
  *
  * Notas (Windows/Winsock):
  *   - Requiere winsock_init() antes de cualquier operación de socket y
  *     winsock_cleanup() al finalizar.
  *   - tcp_connect() establece la conexión al puerto BROKER_PORT.
- *   - readline() y writen() implementan E/S bloqueante y simple por líneas.
+ *   - linebuf_read_line() lee por bloques (un recv() por ráfaga, no por byte)
+ *     y writen() envía de forma bloqueante.
  */
 
 #include "tcp_utils.h"
@@ -26,12 +37,67 @@
 #include <string.h>
 
 // Uso:
-//   subscriber_tcp.exe 127.0.0.1 PartidoA
+//   subscriber_tcp.exe [-B] [-f seq] 127.0.0.1 PartidoA [PartidoB ...]
+
+/* Modo binario: negocia tramas, se suscribe y muestra cada FRAME_MSG.
+ * from_seq != NULL: el SUB lleva ese número en el payload (historial). */
+static void run_binary(socket_t s, linebuf_t *in, int ntopics, char **topics, const char *from_seq) {
+    const char *bin = "BIN\n";
+    char *line;
+    frame_t f;
+
+    (void)writen(s, bin, (int)strlen(bin));
+    if ((line = linebuf_read_line(s, in, NULL)) != NULL) {
+        fprintf(stderr, "%s\n", line); // esperado: "OK BIN"
+    }
+
+    unsigned char from[FRAME_SEQ_LEN];
+    if (from_seq) frame_put32(from, (uint32_t)strtoul(from_seq, NULL, 10));
+
+    for (int i=0; i<ntopics; i++) {
+        if (frame_write(s, FRAME_SUB, FRAME_NO_TOPIC, topics[i], (int)strlen(topics[i]),
+                        from_seq ? (const char*)from : NULL, from_seq ? FRAME_SEQ_LEN : 0) != 0) {
+            fprintf(stderr, "topic invalido: %s\n", topics[i]);
+            continue;
+        }
+        if (!linebuf_read_frame(s, in, &f)) return;
+        if (f.op == FRAME_OK)
+            fprintf(stderr, "OK SUB %.*s (id %u)\n", (int)f.name_len, f.name, f.topic);
+        else
+            fprintf(stderr, "ERR %.*s\n", (int)f.len, f.payload);
+    }
+
+    while (linebuf_read_frame(s, in, &f)) {
+        if (f.op == FRAME_PING) {
+            (void)frame_write(s, FRAME_PONG, FRAME_NO_TOPIC, NULL, 0, NULL, 0);
+            continue;
+        }
+        if (f.op == FRAME_REPLAY && f.len >= FRAME_SEQ_LEN)
+            fprintf(stderr, "REPLAY %.*s %u\n", (int)f.name_len, f.name,
+                    frame_get32((const unsigned char*)f.payload));
+        if (f.op != FRAME_MSG) continue;
+        // "MSG <topic> " seguido del payload crudo
+        printf("MSG %.*s ", (int)f.name_len, f.name);
+        fwrite(f.payload, 1, f.len, stdout);
+        putchar('\n');
+        fflush(stdout);
+    }
+    fprintf(stderr, "desconectado\n");
+}
 
 int main(int argc, char **argv) {
-    // Validación de argumentos: host y topic
+    int binary = 0;
+    const char *from_seq = NULL;  // -f: pedir el historial desde ese número
+    while (argc > 1 && argv[1][0] == '-') {
+        if (strcmp(argv[1], "-B") == 0) binary = 1;
+        else if (strcmp(argv[1], "-f") == 0 && argc > 2) { from_seq = argv[2]; argv++; argc--; }
+        else break;
+        argv++; argc--;
+    }
+
+    // Validación de argumentos: host y al menos un topic
     if (argc < 3) {
-        fprintf(stderr, "Uso: %s <host> <topic>\n", argv[0]);
+        fprintf(stderr, "Uso: %s [-B] [-f seq] <host> <topic> [topic...]\n", argv[0]);
         return 1;
     }
 
@@ -39,40 +105,58 @@ int main(int argc, char **argv) {
     if (winsock_init() != 0) return 1;
 
     const char *host  = argv[1];  // IP o nombre del broker, ej: "127.0.0.1"
-    const char *topic = argv[2];  // Tópico a suscribirse, ej: "PartidoA"
 
     // Conexión TCP con el broker en el puerto BROKER_PORT (definido en tcp_utils.h).
     socket_t s = tcp_connect(host, BROKER_PORT);
 
+    // Buffer de entrada: recv() por bloques, las líneas se separan en memoria.
+    linebuf_t in = {0};
+    char *line;
+
     // Leer banner/bienvenida del broker (opcional, informativo).
-    char line[MAX_LINE];
-    if (readline(s, line, sizeof(line)) > 0) {
-        fprintf(stderr, "%s", line); // típico: "OK broker ready"
+    if ((line = linebuf_read_line(s, &in, NULL)) != NULL) {
+        fprintf(stderr, "%s\n", line); // típico: "OK broker ready"
     }
 
-    // Construir y enviar el comando de suscripción.
-    char subline[MAX_LINE];
-    int n = snprintf(subline, sizeof(subline), "SUB %s\n", topic);
-    (void)writen(s, subline, n);
+    if (binary) {
+        run_binary(s, &in, argc - 2, argv + 2, from_seq);
+        linebuf_free(&in);
+        tcp_close(s);
+        winsock_cleanup();
+        return 0;
+    }
 
-    // Leer confirmación de suscripción.
-    if (readline(s, line, sizeof(line)) > 0) {
-        fprintf(stderr, "%s", line); // esperado: "OK SUB <topic>"
+    // Construir y enviar un comando de suscripción por cada tópico (argv[2..]).
+    for (int i=2; i<argc; i++) {
+        char subline[MAX_LINE];
+        int n = from_seq ? snprintf(subline, sizeof(subline), "SUB %s FROM %s\n", argv[i], from_seq)
+                         : snprintf(subline, sizeof(subline), "SUB %s\n", argv[i]);
+        (void)writen(s, subline, n);
+
+        // Leer confirmación de suscripción.
+        if ((line = linebuf_read_line(s, &in, NULL)) != NULL) {
+            fprintf(stderr, "%s\n", line); // esperado: "OK SUB <topic>"
+        }
     }
 
     // Bucle principal: quedar a la espera de mensajes del broker.
     while (1) {
-        int r = readline(s, line, sizeof(line));
-        if (r <= 0) {                       // desconexión del broker o error
+        line = linebuf_read_line(s, &in, NULL);
+        if (!line) {                        // desconexión del broker o error
             fprintf(stderr, "desconectado\n");
             break;
         }
+        // El fin del historial es informativo, como las confirmaciones
+        if (strncmp(line, "REPLAY ", 7) == 0) { fprintf(stderr, "%s\n", line); continue; }
+        // Heartbeat del broker: responder para que vea tráfico en ambos sentidos
+        if (strcmp(line, "PING") == 0) { (void)writen(s, "PONG\n", 5); continue; }
         // Imprime el mensaje tal cual llega: "MSG <topic> <payload>"
-        printf("%s", line);
+        printf("%s\n", line);
         fflush(stdout);
     }
 
     // Cierre ordenado y limpieza de Winsock.
+    linebuf_free(&in);
     tcp_close(s);
     winsock_cleanup();
     return 0;
@@ -1,6 +1,6 @@
 /**
  * @file tcp_utils.c
- * @brief Utilidades de red para TCP sobre Windows (Winsock2).
+ * @brief Utilidades de red para TCP sobre Windows (Winsock2) y Linux (POSIX).
  *
  * Provee funciones de inicialización/cierre de Winsock, helpers para:
  * - Crear un socket en escucha (server) ligado a INADDR_ANY:PORT.
@@ -8,6 +8,12 @@
  * - Cambiar a modo no bloqueante.
  * - Lectura bloqueante por líneas (hasta '\n').
  * - Escritura garantizada de un buffer completo.
+ * - Lectura bufferizada por líneas o tramas binarias (linebuf) para sockets no bloqueantes.
+ * - Mensajes con contador de referencias (msg_t) compartidos entre colas.
+ * - Pools por hilo para mensajes, nodos de la cola y buffers de entrada.
+ * - Cola de salida (outq) vaciada con send() no bloqueante.
+ * - Bucle de eventos con backends epoll (Linux), poll (POSIX) y select.
+ * - Despertador del bucle desde otro hilo (eventfd en Linux, pipe en POSIX).
  *
  * Requisitos:
  *  - Llamar a winsock_init() antes de usar cualquier función de sockets.
@@ -15,26 +21,49 @@
  *
  * Notas:
  *  - Diseñado para Windows: usa SOCKET, closesocket(), ioctlsocket() y WSA*.
+ *    En POSIX tcp_utils.h mapea esos nombres a sus equivalentes (errno, close()).
  *  - Enlazar con ws2_32 (gcc: -lws2_32, MSVC: ws2_32.lib).
  */
 
 #define _CRT_SECURE_NO_WARNINGS
 #include "tcp_utils.h"
+#include "../common/threads.h"
+#include "../common/pool.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#ifndef _WIN32
+  #include <fcntl.h>
+  #include <limits.h>
+  #include <poll.h>
+  #include <signal.h>
+  #include <sys/resource.h>
+  #include <sys/select.h>
+  #include <sys/uio.h>
+#endif
+#ifdef __linux__
+  #include <sys/epoll.h>
+  #include <sys/eventfd.h>
+  #define HAVE_EPOLL 1
+#endif
+
 /**
  * @brief Inicializa la librería Winsock (WSAStartup).
  * @return 0 si ok, -1 si falla.
  */
 int winsock_init(void) {
+#ifdef _WIN32
     WSADATA wsa;
     int r = WSAStartup(MAKEWORD(2,2), &wsa);
     if (r != 0) {
         fprintf(stderr, "WSAStartup failed: %d\n", r);
         return -1;
     }
+#else
+    // Un send() sobre un peer cerrado debe devolver EPIPE, no matar al broker.
+    signal(SIGPIPE, SIG_IGN);
+#endif
     return 0;
 }
 
@@ -42,7 +71,9 @@ int winsock_init(void) {
  * @brief Limpia la librería Winsock (WSACleanup).
  */
 void winsock_cleanup(void) {
+#ifdef _WIN32
     WSACleanup();
+#endif
 }
 
 /**
@@ -54,13 +85,8 @@ int tcp_close(socket_t s) {
     return CLOSESOCK(s);
 }
 
-/**
- * @brief Crea un socket servidor TCP, lo liga a INADDR_ANY:port y lo pone en listen().
- *
- * @param port Puerto local a escuchar (host order).
- * @return SOCKET válido listo para accept(), o termina el proceso si hay error.
- */
-socket_t tcp_listen_any(uint16_t port) {
+/* Crea el socket de escucha; con shared también activa SO_REUSEPORT. */
+static socket_t listen_on(uint16_t port, int shared) {
     socket_t s = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
     if (s == INVALID_SOCKET) {
         fprintf(stderr, "socket() failed: %d\n", WSAGetLastError());
@@ -70,6 +96,14 @@ socket_t tcp_listen_any(uint16_t port) {
     // Reusar dirección inmediatamente al reiniciar el servidor.
     BOOL yes = 1;
     setsockopt(s, SOL_SOCKET, SO_REUSEADDR, (const char*)&yes, sizeof(yes));
+#ifdef SO_REUSEPORT
+    if (shared && setsockopt(s, SOL_SOCKET, SO_REUSEPORT, (const char*)&yes, sizeof(yes)) != 0) {
+        fprintf(stderr, "SO_REUSEPORT failed: %d\n", WSAGetLastError());
+        tcp_close(s); exit(1);
+    }
+#else
+    (void)shared;
+#endif
 
     struct sockaddr_in addr;
     memset(&addr, 0, sizeof(addr));
@@ -88,6 +122,25 @@ socket_t tcp_listen_any(uint16_t port) {
     return s;
 }
 
+/**
+ * @brief Crea un socket servidor TCP, lo liga a INADDR_ANY:port y lo pone en listen().
+ *
+ * @param port Puerto local a escuchar (host order).
+ * @return SOCKET válido listo para accept(), o termina el proceso si hay error.
+ */
+socket_t tcp_listen_any(uint16_t port) {
+    return listen_on(port, 0);
+}
+
+/**
+ * @brief Como tcp_listen_any() pero con SO_REUSEPORT (uno por worker).
+ *
+ * @return SOCKET válido listo para accept(), o termina el proceso si hay error.
+ */
+socket_t tcp_listen_shared(uint16_t port) {
+    return listen_on(port, 1);
+}
+
 /**
  * @brief Conecta a un host:port por TCP (resolviendo DNS si hace falta).
  *
@@ -132,8 +185,41 @@ socket_t tcp_connect(const char *host, uint16_t port) {
  * @return 0 si ok, SOCKET_ERROR si falla.
  */
 int set_nonblock(socket_t s) {
+#ifdef _WIN32
     u_long mode = 1;
     return ioctlsocket(s, FIONBIO, &mode);
+#else
+    int fl = fcntl(s, F_GETFL, 0);
+    if (fl < 0) return SOCKET_ERROR;
+    return fcntl(s, F_SETFL, fl | O_NONBLOCK);
+#endif
+}
+
+/**
+ * @brief Activa/desactiva TCP_NODELAY (Nagle) en un socket TCP.
+ * @param s  SOCKET válido.
+ * @param on 1 desactiva Nagle, 0 lo reactiva.
+ * @return 0 si ok, SOCKET_ERROR si falla.
+ */
+int set_nodelay(socket_t s, int on) {
+    BOOL v = on ? 1 : 0;
+    return setsockopt(s, IPPROTO_TCP, TCP_NODELAY, (const char*)&v, sizeof(v));
+}
+
+/**
+ * @brief Pone o quita el tapón TCP_CORK (Linux); en otras plataformas falla.
+ * @param s  SOCKET válido.
+ * @param on 1 retiene segmentos parciales, 0 los libera.
+ * @return 0 si ok, SOCKET_ERROR si falla o no está disponible.
+ */
+int set_cork(socket_t s, int on) {
+#ifdef TCP_CORK
+    int v = on ? 1 : 0;
+    return setsockopt(s, IPPROTO_TCP, TCP_CORK, (const char*)&v, sizeof(v));
+#else
+    (void)s; (void)on;
+    return SOCKET_ERROR;
+#endif
 }
 
 /**
@@ -195,3 +281,689 @@ int writen(socket_t s, const char *buf, int len) {
     }
     return total;
 }
+
+/* ------------------------------------------------------------------------- */
+/*  Pools del hilo                                                           */
+/* ------------------------------------------------------------------------- */
+
+/* Cada hilo tiene sus propios pools: los msg_t, nodos y buffers de entrada
+ * nunca cambian de hilo, así que reservar y liberar no necesita atómicos. */
+static THREAD_LOCAL pool_sizes_t msg_pools;   // msg_t por clase de tamaño
+static THREAD_LOCAL pool_t       node_pool;   // outq_node_t
+static THREAD_LOCAL pool_t       lb_pool;     // buffers de LINEBUF_SIZE
+
+/* Prepara los pools del hilo en su primer uso. */
+static void pools_init(void) {
+    if (pool_ready(&node_pool)) return;
+    pool_sizes_init(&msg_pools);
+    pool_init(&node_pool, sizeof(outq_node_t));
+    pool_init(&lb_pool, LINEBUF_SIZE);
+}
+
+void tcp_pools_free(void) {
+    if (!pool_ready(&node_pool)) return;
+    pool_sizes_destroy(&msg_pools);
+    pool_destroy(&node_pool);
+    pool_destroy(&lb_pool);
+    node_pool.size = 0;
+}
+
+/* Suelta la memoria de un linebuf: al pool si es de LINEBUF_SIZE. */
+static void lb_data_free(char *data, int cap) {
+    if (!data) return;
+    if (cap == LINEBUF_SIZE) pool_put(&lb_pool, data);
+    else free(data);
+}
+
+/**
+ * @brief Lee con un único recv() todo lo que quepa en el espacio libre del buffer.
+ *
+ * Antes de leer, la línea parcial que quede se mueve al principio del buffer
+ * (como mucho LINEBUF_SIZE bytes, y solo cuando hay algo consumido delante).
+ */
+int linebuf_fill(socket_t s, linebuf_t *lb) {
+    if (!lb->data) {
+        pools_init();
+        lb->data = (char*)pool_alloc(&lb_pool);
+        if (!lb->data) return -1;
+        lb->start = lb->end = 0;
+        lb->cap   = LINEBUF_SIZE;
+    }
+    if (lb->start > 0) {
+        int pending = lb->end - lb->start;
+        if (pending > 0) memmove(lb->data, lb->data + lb->start, pending);
+        lb->start = 0;
+        lb->end   = pending;
+    }
+    // Se reserva un byte para poder terminar en '\0' una línea sin '\n'.
+    int room = lb->cap - 1 - lb->end;
+    if (room <= 0) return LB_OVERFLOW;  // línea más larga que el buffer
+
+    while (1) {
+        int r = recv(s, lb->data + lb->end, room, 0);
+        if (r > 0) { lb->end += r; return r; }
+        if (r == 0) return 0;
+        int e = WSAGetLastError();
+        if (e == WSAEINTR) continue;
+        if (SOCK_WOULDBLOCK(e)) return LB_AGAIN;
+        return -1;
+    }
+}
+
+char *linebuf_next_line(linebuf_t *lb, int *len) {
+    if (!lb->data || lb->start >= lb->end) return NULL;
+
+    char *line = lb->data + lb->start;
+    char *nl   = (char*)memchr(line, '\n', lb->end - lb->start);
+    if (!nl) return NULL;
+
+    int n = (int)(nl - line);
+    if (n > 0 && line[n-1] == '\r') n--;
+    line[n] = '\0';
+    lb->start = (int)(nl - lb->data) + 1;
+    if (len) *len = n;
+    return line;
+}
+
+char *linebuf_read_line(socket_t s, linebuf_t *lb, int *len) {
+    while (1) {
+        char *line = linebuf_next_line(lb, len);
+        if (line) return line;
+        if (linebuf_fill(s, lb) <= 0) return NULL;
+    }
+}
+
+char *linebuf_take_rest(linebuf_t *lb, int *len) {
+    if (!lb->data || lb->start >= lb->end) return NULL;
+    char *line = lb->data + lb->start;
+    int n = lb->end - lb->start;   // end < cap: cabe el terminador
+    line[n] = '\0';
+    lb->start = lb->end;
+    if (len) *len = n;
+    return line;
+}
+
+int linebuf_next_cmd(linebuf_t *lb, text_cmd_t *cmd) {
+    if (!lb->data || lb->start >= lb->end) return 0;
+    int n = text_parse(lb->data + lb->start, lb->end - lb->start, 0, cmd);
+    lb->start += n;
+    return n > 0;
+}
+
+int linebuf_next_frame(linebuf_t *lb, frame_t *f) {
+    if (!lb->data) return 0;
+    long total = frame_decode(lb->data + lb->start, lb->end - lb->start, f);
+    if (total < 0) return -1;
+    if (total == 0) return 0;
+    if (total <= lb->end - lb->start) {
+        lb->start += (int)total;
+        return 1;
+    }
+
+    // Trama incompleta: asegurar espacio para recibirla entera (más el byte
+    // que linebuf_fill() reserva) tras compactar lo pendiente al inicio.
+    if (total + 1 > lb->cap) {
+        int pending = lb->end - lb->start;
+        char *d = (char*)malloc((size_t)total + 1);
+        if (!d) return -1;
+        memcpy(d, lb->data + lb->start, pending);
+        lb_data_free(lb->data, lb->cap);
+        lb->data  = d;
+        lb->cap   = (int)total + 1;
+        lb->start = 0;
+        lb->end   = pending;
+    }
+    return 0;
+}
+
+int linebuf_read_frame(socket_t s, linebuf_t *lb, frame_t *f) {
+    while (1) {
+        int r = linebuf_next_frame(lb, f);
+        if (r != 0) return r > 0;
+        if (linebuf_fill(s, lb) <= 0) return 0;
+    }
+}
+
+int frame_write(socket_t s, int op, uint32_t topic, const char *name, int name_len,
+                const char *payload, uint32_t len) {
+    char head[FRAME_HDR + MAX_TOPIC];
+    if (name_len < 0 || name_len >= MAX_TOPIC) return -1;
+    int n = frame_encode_head(head, op, topic, name, name_len, len);
+    if (writen(s, head, n) != n) return -1;
+    if (len > 0 && writen(s, payload, (int)len) != (int)len) return -1;
+    return 0;
+}
+
+void linebuf_release(linebuf_t *lb) {
+    if (lb->data && lb->start >= lb->end) linebuf_free(lb);
+}
+
+void linebuf_free(linebuf_t *lb) {
+    lb_data_free(lb->data, lb->cap);
+    lb->data  = NULL;
+    lb->start = lb->end = lb->cap = 0;
+}
+
+msg_t *msg_alloc(int len) {
+    pools_init();
+    int cls = pool_class(sizeof(msg_t) + (size_t)len);
+    msg_t *m = (msg_t*)(cls >= 0 ? pool_alloc(&msg_pools.cls[cls]) : malloc(sizeof(*m) + len));
+    if (!m) return NULL;
+    m->refs = 1;
+    m->len  = len;
+    m->cls  = cls;
+    m->data = (char*)(m + 1);
+    return m;
+}
+
+msg_t *msg_new(const char *data, int len) {
+    msg_t *m = msg_alloc(len);
+    if (m) memcpy(m->data, data, len);
+    return m;
+}
+
+/* Lo que guarda un msg_extern() tras la cabecera: a quién avisar al soltarlo. */
+typedef struct {
+    void (*release)(void *arg);
+    void  *arg;
+} msg_hold_t;
+
+msg_t *msg_extern(const char *data, int len, void (*release)(void *arg), void *arg) {
+    msg_t *m = msg_alloc((int)sizeof(msg_hold_t));
+    if (!m) return NULL;
+    msg_hold_t *h = (msg_hold_t*)m->data;
+    h->release = release;
+    h->arg     = arg;
+    m->len  = len;
+    m->data = (char*)data;
+    return m;
+}
+
+void msg_unref(msg_t *m) {
+    if (!m || --m->refs > 0) return;
+    if (m->data != (char*)(m + 1)) {  // de msg_extern()
+        msg_hold_t *h = (msg_hold_t*)(m + 1);
+        if (h->release) h->release(h->arg);
+    }
+    if (m->cls >= 0) pool_put(&msg_pools.cls[m->cls], m);
+    else free(m);
+}
+
+int outq_push_msg(outq_t *q, msg_t *m, int off) {
+    pools_init();
+    outq_node_t *n = (outq_node_t*)pool_alloc(&node_pool);
+    if (!n) return -1;
+    n->next = NULL;
+    n->msg  = msg_ref(m);
+    n->off  = off;
+
+    if (q->tail) q->tail->next = n; else q->head = n;
+    q->tail   = n;
+    q->bytes += m->len - off;
+    q->count++;
+    return 0;
+}
+
+int outq_push(outq_t *q, const char *data, int len) {
+    msg_t *m = msg_new(data, len);
+    if (!m) return -1;
+    int r = outq_push_msg(q, m, 0);
+    msg_unref(m);
+    return r;
+}
+
+/* Suelta el nodo y su referencia al mensaje. */
+static void outq_node_free(outq_node_t *n) {
+    msg_unref(n->msg);
+    pool_put(&node_pool, n);
+}
+
+int outq_drop_oldest(outq_t *q) {
+    outq_node_t **pp = &q->head;
+    if (*pp && (*pp)->off > 0) pp = &(*pp)->next;  // el primero va a medias
+    outq_node_t *n = *pp;
+    if (!n) return 0;
+
+    *pp = n->next;
+    if (q->tail == n) q->tail = (pp == &q->head) ? NULL : q->head;
+    q->bytes -= n->msg->len - n->off;
+    q->count--;
+    outq_node_free(n);
+    return 1;
+}
+
+/* Tope de iovecs por llamada que admite el sistema. */
+#ifdef _WIN32
+  #define SYS_IOV_MAX 1024
+#elif defined(IOV_MAX)
+  #define SYS_IOV_MAX IOV_MAX
+#else
+  #define SYS_IOV_MAX 1024
+#endif
+
+/* Escritura vectorizada no bloqueante: bytes enviados o SOCKET_ERROR. */
+#ifdef _WIN32
+typedef WSABUF iovec_t;
+static void iov_set(iovec_t *v, char *p, int n) { v->buf = p; v->len = (ULONG)n; }
+static int sock_writev(socket_t s, iovec_t *v, int n) {
+    DWORD sent = 0;
+    if (WSASend(s, v, (DWORD)n, &sent, 0, NULL, NULL) == SOCKET_ERROR) return SOCKET_ERROR;
+    return (int)sent;
+}
+#else
+typedef struct iovec iovec_t;
+static void iov_set(iovec_t *v, char *p, int n) { v->iov_base = p; v->iov_len = (size_t)n; }
+static int sock_writev(socket_t s, iovec_t *v, int n) {
+    return (int)writev(s, v, n);
+}
+#endif
+
+int outq_flush_v(socket_t s, outq_t *q, int max_iov, int max_bytes) {
+    iovec_t iov[SYS_IOV_MAX];
+    if (max_iov < 1) max_iov = 1;
+    if (max_iov > SYS_IOV_MAX) max_iov = SYS_IOV_MAX;
+
+    while (q->head) {
+        // Juntar mensajes desde la cabeza hasta los topes (siempre al menos uno).
+        int n = 0, batch = 0;
+        for (outq_node_t *m = q->head; m && n < max_iov; m = m->next) {
+            int len = m->msg->len - m->off;
+            if (n > 0 && batch + len > max_bytes) break;
+            iov_set(&iov[n++], m->msg->data + m->off, len);
+            batch += len;
+        }
+
+        int w = sock_writev(s, iov, n);
+        if (w == SOCKET_ERROR) {
+            int e = WSAGetLastError();
+            if (e == WSAEINTR) continue;
+            if (SOCK_WOULDBLOCK(e)) return OUTQ_PENDING;
+            return -1;
+        }
+
+        // Consumir lo escrito: mensajes completos fuera, el último quizá a medias.
+        int partial = w < batch;
+        q->bytes -= w;
+        while (w > 0) {
+            outq_node_t *m = q->head;
+            int left = m->msg->len - m->off;
+            if (w < left) { m->off += w; break; }
+            w -= left;
+            q->head = m->next;
+            if (!q->head) q->tail = NULL;
+            q->count--;
+            outq_node_free(m);
+        }
+        if (partial) return OUTQ_PENDING;  // el socket se llenó: esperar EV_WRITE
+    }
+    return OUTQ_EMPTY;
+}
+
+int outq_flush(socket_t s, outq_t *q) {
+    return outq_flush_v(s, q, OUTQ_IOV_MAX, OUTQ_IOV_BYTES);
+}
+
+void outq_clear(outq_t *q) {
+    outq_node_t *n = q->head;
+    while (n) {
+        outq_node_t *next = n->next;
+        outq_node_free(n);
+        n = next;
+    }
+    q->head = q->tail = NULL;
+    q->bytes = q->count = 0;
+}
+
+/**
+ * @brief Sube RLIMIT_NOFILE (soft) hasta el límite hard del proceso.
+ * @return Límite vigente, o -1 si no aplica (Windows) o falla.
+ */
+long raise_fd_limit(void) {
+#ifdef _WIN32
+    return -1;
+#else
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) != 0) return -1;
+    if (rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        if (setrlimit(RLIMIT_NOFILE, &rl) != 0) (void)getrlimit(RLIMIT_NOFILE, &rl);
+    }
+    return (long)rl.rlim_cur;
+#endif
+}
+
+/* ========================================================================= */
+/*  Event loop                                                               */
+/* ========================================================================= */
+
+/* Registro de un socket en los backends poll/select (epoll lo guarda el kernel). */
+typedef struct {
+    socket_t fd;
+    int      events;
+    void    *udata;
+} ev_reg_t;
+
+struct evloop {
+    evloop_backend_t backend;
+#ifdef HAVE_EPOLL
+    int                 epfd;    // descriptor de epoll
+    struct epoll_event *epev;    // buffer de salida de epoll_wait()
+    int                 epcap;
+#endif
+    // poll/select: tabla densa de registros; se borra con swap-remove.
+    ev_reg_t *regs;
+    int       nregs, cap;
+#ifndef _WIN32
+    struct pollfd *pfds;         // paralelo a regs (mismo índice)
+#endif
+};
+
+/* Busca un socket en la tabla densa (solo backends poll/select). */
+static int reg_find(const evloop_t *loop, socket_t fd) {
+    for (int i = 0; i < loop->nregs; i++)
+        if (loop->regs[i].fd == fd) return i;
+    return -1;
+}
+
+#ifndef _WIN32
+static short to_poll_events(int ev) {
+    short p = 0;
+    if (ev & EV_READ)  p |= POLLIN;
+    if (ev & EV_WRITE) p |= POLLOUT;
+    return p;
+}
+#endif
+
+#ifdef HAVE_EPOLL
+static uint32_t to_epoll_events(int ev) {
+    uint32_t e = 0;
+    if (ev & EV_READ)  e |= EPOLLIN | EPOLLRDHUP;
+    if (ev & EV_WRITE) e |= EPOLLOUT;
+    if (ev & EV_EDGE)  e |= EPOLLET;
+    return e;
+}
+#endif
+
+evloop_t *evloop_create(evloop_backend_t backend) {
+    if (backend == EVLOOP_AUTO) {
+#if defined(HAVE_EPOLL)
+        backend = EVLOOP_EPOLL;
+#elif !defined(_WIN32)
+        backend = EVLOOP_POLL;
+#else
+        backend = EVLOOP_SELECT;
+#endif
+    }
+#ifndef HAVE_EPOLL
+    if (backend == EVLOOP_EPOLL) return NULL;
+#endif
+#ifdef _WIN32
+    if (backend == EVLOOP_POLL) return NULL;
+#endif
+
+    evloop_t *loop = (evloop_t*)calloc(1, sizeof(*loop));
+    if (!loop) return NULL;
+    loop->backend = backend;
+
+#ifdef HAVE_EPOLL
+    if (backend == EVLOOP_EPOLL) {
+        loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+        if (loop->epfd < 0) { free(loop); return NULL; }
+        return loop;
+    }
+#endif
+    return loop;
+}
+
+void evloop_destroy(evloop_t *loop) {
+    if (!loop) return;
+#ifdef HAVE_EPOLL
+    if (loop->backend == EVLOOP_EPOLL) close(loop->epfd);
+    free(loop->epev);
+#endif
+#ifndef _WIN32
+    free(loop->pfds);
+#endif
+    free(loop->regs);
+    free(loop);
+}
+
+const char *evloop_backend_name(const evloop_t *loop) {
+    switch (loop->backend) {
+        case EVLOOP_EPOLL: return "epoll";
+        case EVLOOP_POLL:  return "poll";
+        default:           return "select";
+    }
+}
+
+int evloop_add(evloop_t *loop, socket_t fd, int events, void *udata) {
+#ifdef HAVE_EPOLL
+    if (loop->backend == EVLOOP_EPOLL) {
+        struct epoll_event e;
+        e.events   = to_epoll_events(events);
+        e.data.ptr = udata;
+        return epoll_ctl(loop->epfd, EPOLL_CTL_ADD, fd, &e);
+    }
+#endif
+    // select(): en Windows FD_SETSIZE limita la cantidad; en POSIX, el valor del fd.
+#ifdef _WIN32
+    if (loop->backend == EVLOOP_SELECT && loop->nregs >= FD_SETSIZE) return -1;
+#else
+    if (loop->backend == EVLOOP_SELECT && fd >= FD_SETSIZE) return -1;
+#endif
+    if (loop->nregs == loop->cap) {
+        int ncap = loop->cap ? loop->cap * 2 : 64;
+        ev_reg_t *r = (ev_reg_t*)realloc(loop->regs, ncap * sizeof(*r));
+        if (!r) return -1;
+        loop->regs = r;
+#ifndef _WIN32
+        struct pollfd *p = (struct pollfd*)realloc(loop->pfds, ncap * sizeof(*p));
+        if (!p) return -1;
+        loop->pfds = p;
+#endif
+        loop->cap = ncap;
+    }
+    int i = loop->nregs++;
+    loop->regs[i].fd     = fd;
+    loop->regs[i].events = events;
+    loop->regs[i].udata  = udata;
+#ifndef _WIN32
+    loop->pfds[i].fd      = fd;
+    loop->pfds[i].events  = to_poll_events(events);
+    loop->pfds[i].revents = 0;
+#endif
+    return 0;
+}
+
+int evloop_mod(evloop_t *loop, socket_t fd, int events, void *udata) {
+#ifdef HAVE_EPOLL
+    if (loop->backend == EVLOOP_EPOLL) {
+        struct epoll_event e;
+        e.events   = to_epoll_events(events);
+        e.data.ptr = udata;
+        return epoll_ctl(loop->epfd, EPOLL_CTL_MOD, fd, &e);
+    }
+#endif
+    int i = reg_find(loop, fd);
+    if (i < 0) return -1;
+    loop->regs[i].events = events;
+    loop->regs[i].udata  = udata;
+#ifndef _WIN32
+    loop->pfds[i].events = to_poll_events(events);
+#endif
+    return 0;
+}
+
+int evloop_del(evloop_t *loop, socket_t fd) {
+#ifdef HAVE_EPOLL
+    if (loop->backend == EVLOOP_EPOLL) {
+        struct epoll_event e;  // kernels < 2.6.9 exigen un puntero no nulo
+        memset(&e, 0, sizeof(e));
+        return epoll_ctl(loop->epfd, EPOLL_CTL_DEL, fd, &e);
+    }
+#endif
+    int i = reg_find(loop, fd);
+    if (i < 0) return -1;
+    int last = --loop->nregs;
+    loop->regs[i] = loop->regs[last];
+#ifndef _WIN32
+    loop->pfds[i] = loop->pfds[last];
+#endif
+    return 0;
+}
+
+#ifdef HAVE_EPOLL
+static int wait_epoll(evloop_t *loop, ev_event_t *out, int maxev, int timeout_ms) {
+    if (loop->epcap < maxev) {
+        struct epoll_event *e = (struct epoll_event*)realloc(loop->epev, maxev * sizeof(*e));
+        if (!e) return -1;
+        loop->epev  = e;
+        loop->epcap = maxev;
+    }
+    int n;
+    do {
+        n = epoll_wait(loop->epfd, loop->epev, maxev, timeout_ms);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0) return -1;
+
+    for (int i = 0; i < n; i++) {
+        uint32_t e = loop->epev[i].events;
+        int ev = 0;
+        if (e & (EPOLLIN | EPOLLRDHUP)) ev |= EV_READ;
+        if (e & EPOLLOUT)               ev |= EV_WRITE;
+        if (e & (EPOLLERR | EPOLLHUP))  ev |= EV_ERROR | EV_READ;
+        out[i].fd     = INVALID_SOCKET;  // epoll solo devuelve udata
+        out[i].events = ev;
+        out[i].udata  = loop->epev[i].data.ptr;
+    }
+    return n;
+}
+#endif
+
+#ifndef _WIN32
+static int wait_poll(evloop_t *loop, ev_event_t *out, int maxev, int timeout_ms) {
+    int n;
+    do {
+        n = poll(loop->pfds, (nfds_t)loop->nregs, timeout_ms);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0) return -1;
+
+    int k = 0;
+    for (int i = 0; i < loop->nregs && k < n && k < maxev; i++) {
+        short r = loop->pfds[i].revents;
+        if (!r) continue;
+        int ev = 0;
+        if (r & POLLIN)                       ev |= EV_READ;
+        if (r & POLLOUT)                      ev |= EV_WRITE;
+        if (r & (POLLERR | POLLHUP | POLLNVAL)) ev |= EV_ERROR | EV_READ;
+        out[k].fd     = loop->regs[i].fd;
+        out[k].events = ev;
+        out[k].udata  = loop->regs[i].udata;
+        k++;
+    }
+    return k;
+}
+#endif
+
+static int wait_select(evloop_t *loop, ev_event_t *out, int maxev, int timeout_ms) {
+    fd_set rset, wset;
+    FD_ZERO(&rset);
+    FD_ZERO(&wset);
+    socket_t maxfd = 0;
+    for (int i = 0; i < loop->nregs; i++) {
+        socket_t fd = loop->regs[i].fd;
+        if (loop->regs[i].events & EV_READ)  FD_SET(fd, &rset);
+        if (loop->regs[i].events & EV_WRITE) FD_SET(fd, &wset);
+        if (fd > maxfd) maxfd = fd;
+    }
+
+    struct timeval tv, *ptv = NULL;
+    if (timeout_ms >= 0) {
+        tv.tv_sec  = timeout_ms / 1000;
+        tv.tv_usec = (timeout_ms % 1000) * 1000;
+        ptv = &tv;
+    }
+
+    int n = select((int)maxfd + 1, &rset, &wset, NULL, ptv);
+    if (n == SOCKET_ERROR) {
+        if (WSAGetLastError() == WSAEINTR) return 0;
+        return -1;
+    }
+
+    int k = 0;
+    for (int i = 0; i < loop->nregs && k < maxev; i++) {
+        socket_t fd = loop->regs[i].fd;
+        int ev = 0;
+        if (FD_ISSET(fd, &rset)) ev |= EV_READ;
+        if (FD_ISSET(fd, &wset)) ev |= EV_WRITE;
+        if (!ev) continue;
+        out[k].fd     = fd;
+        out[k].events = ev;
+        out[k].udata  = loop->regs[i].udata;
+        k++;
+    }
+    return k;
+}
+
+int evloop_wait(evloop_t *loop, ev_event_t *out, int maxev, int timeout_ms) {
+#ifdef HAVE_EPOLL
+    if (loop->backend == EVLOOP_EPOLL) return wait_epoll(loop, out, maxev, timeout_ms);
+#endif
+#ifndef _WIN32
+    if (loop->backend == EVLOOP_POLL) return wait_poll(loop, out, maxev, timeout_ms);
+#endif
+    return wait_select(loop, out, maxev, timeout_ms);
+}
+
+/* ------------------------------------------------------------------------- */
+/*  Despertador entre hilos                                                  */
+/* ------------------------------------------------------------------------- */
+
+int ev_wakeup_init(ev_wakeup_t *w) {
+#if defined(HAVE_EPOLL)
+    w->rfd = w->wfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    return w->rfd < 0 ? -1 : 0;
+#elif !defined(_WIN32)
+    int p[2];
+    if (pipe(p) != 0) return -1;
+    set_nonblock(p[0]);
+    set_nonblock(p[1]);
+    w->rfd = p[0];
+    w->wfd = p[1];
+    return 0;
+#else
+    w->rfd = w->wfd = INVALID_SOCKET;
+    return -1;
+#endif
+}
+
+void ev_wakeup_signal(ev_wakeup_t *w) {
+#ifndef _WIN32
+    // eventfd suma al contador; en el pipe basta un byte. Si ya está lleno
+    // (EAGAIN) el consumidor igual tiene un despertar pendiente.
+    uint64_t one = 1;
+    ssize_t r = write(w->wfd, &one, w->rfd == w->wfd ? sizeof(one) : 1);
+    (void)r;
+#else
+    (void)w;
+#endif
+}
+
+void ev_wakeup_drain(ev_wakeup_t *w) {
+#ifndef _WIN32
+    char buf[64];
+    while (read(w->rfd, buf, sizeof(buf)) > 0) {
+        if (w->rfd == w->wfd) break;  // eventfd: una lectura pone el contador a cero
+    }
+#else
+    (void)w;
+#endif
+}
+
+void ev_wakeup_close(ev_wakeup_t *w) {
+#ifndef _WIN32
+    if (w->wfd != w->rfd) close(w->wfd);
+    close(w->rfd);
+#endif
+    w->rfd = w->wfd = INVALID_SOCKET;
+}
@@ -1,22 +1,32 @@
 /**
  * @file tcp_utils.h
- * @brief Definiciones y funciones auxiliares para sockets TCP con Winsock2.
+ * @brief Definiciones y funciones auxiliares para sockets TCP con Winsock2 / POSIX.
  *
  * Este módulo encapsula funciones de red básicas para programas cliente/servidor
- * en C usando la API de **Winsock2 (Windows)**.
+ * en C usando la API de **Winsock2 (Windows)** o sockets **POSIX (Linux)**.
  *
  * Incluye:
  *  - Inicialización y limpieza de Winsock (WSAStartup / WSACleanup)
  *  - Creación de sockets de servidor (bind + listen)
  *  - Conexión TCP a un host remoto
  *  - Lectura por línea y escritura completa
+ *  - Buffer de entrada por conexión (linebuf) para lectura no bloqueante por líneas
+ *    o por tramas binarias (common/frame.h)
+ *  - Cola de salida por conexión (outq) para escritura no bloqueante, con
+ *    mensajes compartidos por referencia (msg_t)
+ *  - Pools por hilo (common/pool.h) para mensajes, nodos de cola y buffers de
+ *    entrada: en régimen estable ni leer ni encolar llaman a malloc/free
  *  - Utilidades de cierre y modo no bloqueante
+ *  - Bucle de eventos (event loop) con backends epoll / poll / select
+ *  - Despertador del event loop desde otro hilo (ev_wakeup)
  *
- * **Compatibilidad:** solo Windows.
+ * **Compatibilidad:** Windows (Winsock2) y Linux (POSIX). En Linux el event
+ * loop usa epoll por defecto; select() queda como respaldo en todas partes.
  *
  * Para compilar con GCC:
  * @code
- * gcc archivo.c tcp_utils.c -o salida.exe -lws2_32
+ * gcc archivo.c tcp_utils.c -o salida.exe -lws2_32     (Windows)
+ * gcc archivo.c tcp_utils.c -o salida                  (Linux)
  * @endcode
  */
 
@@ -30,10 +40,40 @@
   typedef SOCKET socket_t;
   #define CLOSESOCK(s) closesocket(s)
 #else
-  #error "Este build es solo para Windows/Winsock2"
+  #if defined(__STRICT_ANSI__) && !defined(_POSIX_C_SOURCE) && !defined(_XOPEN_SOURCE) \
+      && !defined(_GNU_SOURCE)
+    #define _POSIX_C_SOURCE 200809L  // -std=c11: ver common/threads.h
+    #define _DEFAULT_SOURCE
+  #endif
+  #include <sys/types.h>
+  #include <sys/socket.h>
+  #include <netinet/in.h>
+  #include <netinet/tcp.h>
+  #include <arpa/inet.h>
+  #include <netdb.h>
+  #include <unistd.h>
+  #include <errno.h>
+  typedef int socket_t;
+  typedef int BOOL;
+  #define INVALID_SOCKET     (-1)
+  #define SOCKET_ERROR       (-1)
+  #define CLOSESOCK(s)       close(s)
+  /* Equivalencias mínimas para que el código escrito contra Winsock compile en POSIX. */
+  #define WSAGetLastError()  (errno)
+  #define WSAEINTR           EINTR
+  #define WSAEWOULDBLOCK     EWOULDBLOCK
 #endif
 
 #include <stdint.h>
+#include "../common/frame.h"
+#include "../common/text_cmd.h"
+
+/** Error de "reintentar más tarde" en un socket no bloqueante. */
+#ifdef _WIN32
+  #define SOCK_WOULDBLOCK(e) ((e) == WSAEWOULDBLOCK)
+#else
+  #define SOCK_WOULDBLOCK(e) ((e) == EAGAIN || (e) == EWOULDBLOCK)
+#endif
 
 /** Puerto por defecto del broker TCP */
 #define BROKER_PORT 8080
@@ -44,6 +84,10 @@
 
 /**
  * @brief Inicializa la pila de sockets de Windows (WSAStartup).
+ *
+ * En POSIX no hay nada que inicializar; solo se ignora SIGPIPE para que
+ * escribir en un socket cerrado devuelva error en vez de matar el proceso.
+ *
  * @return 0 si correcto, -1 si hay error.
  */
 int  winsock_init(void);
@@ -61,6 +105,25 @@ void winsock_cleanup(void);
  */
 socket_t tcp_listen_any(uint16_t port);
 
+/**
+ * @brief Como tcp_listen_any() pero con SO_REUSEPORT.
+ *
+ * Varios sockets (uno por worker) pueden escuchar el mismo puerto y el kernel
+ * reparte entre ellos las conexiones entrantes. Solo existe donde
+ * TCP_HAVE_REUSEPORT vale 1.
+ *
+ * @param port Puerto a escuchar (en orden de host).
+ * @return Socket válido listo para accept().
+ */
+socket_t tcp_listen_shared(uint16_t port);
+
+/** 1 si la plataforma reparte conexiones entre sockets con SO_REUSEPORT (Linux). */
+#if defined(SO_REUSEPORT) && defined(__linux__)
+  #define TCP_HAVE_REUSEPORT 1
+#else
+  #define TCP_HAVE_REUSEPORT 0
+#endif
+
 /**
  * @brief Establece una conexión TCP con un host remoto.
  *
@@ -77,6 +140,23 @@ socket_t tcp_connect(const char *host, uint16_t port);
  */
 int set_nonblock(socket_t s);
 
+/**
+ * @brief Activa o desactiva el algoritmo de Nagle (TCP_NODELAY).
+ * @param s  Socket TCP.
+ * @param on 1 para enviar cada segmento sin esperar ACKs (desactiva Nagle).
+ * @return 0 si correcto, SOCKET_ERROR si falla.
+ */
+int set_nodelay(socket_t s, int on);
+
+/**
+ * @brief Activa o desactiva TCP_CORK: con el tapón puesto el kernel solo
+ *        emite segmentos llenos; al quitarlo envía lo que quede.
+ * @param s  Socket TCP.
+ * @param on 1 para retener, 0 para soltar.
+ * @return 0 si correcto, SOCKET_ERROR si falla o la plataforma no lo tiene (solo Linux).
+ */
+int set_cork(socket_t s, int on);
+
 /**
  * @brief Cierra un socket (wrapper de closesocket()).
  * @param s Socket a cerrar.
@@ -104,4 +184,358 @@ int readline(socket_t s, char *buf, int maxlen);
  */
 int writen(socket_t s, const char *buf, int len);
 
-#endif /* TCP_UTILS_H */
\ No newline at end of file
+/* ------------------------------------------------------------------------- */
+/*  Lectura bufferizada por líneas                                           */
+/* ------------------------------------------------------------------------- */
+
+/** Capacidad del buffer de entrada de cada conexión (varias líneas de MAX_LINE). */
+#define LINEBUF_SIZE  (4 * MAX_LINE)
+
+/** Resultado de linebuf_fill(): el socket no bloqueante no tiene más datos. */
+#define LB_AGAIN     (-2)
+/** Resultado de linebuf_fill(): buffer lleno sin '\n' (línea demasiado larga). */
+#define LB_OVERFLOW  (-3)
+
+/**
+ * @brief Buffer de entrada de una conexión.
+ *
+ * Los bytes válidos están en data[start, end). Cada linebuf_fill() hace un
+ * único recv() sobre todo el espacio libre; linebuf_next_line() (o
+ * linebuf_next_cmd(), que además las analiza) va separando las líneas
+ * completas y lo que quede (una línea parcial) se conserva para el siguiente
+ * evento. La memoria se reserva al primer uso y se libera con
+ * linebuf_release() cuando el buffer queda vacío, así que una conexión ociosa
+ * no ocupa nada. Los buffers de LINEBUF_SIZE salen de un pool del hilo, así
+ * que tomarlo y soltarlo en cada evento no llama a malloc/free.
+ *
+ * En modo binario linebuf_next_frame() separa tramas; si una trama no cabe,
+ * el buffer crece hasta su tamaño y vuelve a LINEBUF_SIZE al liberarse.
+ */
+typedef struct {
+    char *data;   ///< Memoria del buffer (NULL mientras está vacío).
+    int   start;  ///< Primer byte aún no consumido.
+    int   end;    ///< Fin de los datos recibidos.
+    int   cap;    ///< Capacidad de data (LINEBUF_SIZE salvo tramas grandes).
+} linebuf_t;
+
+/**
+ * @brief Lee del socket lo que haya disponible (un solo recv()).
+ *
+ * @return Bytes leídos (>0), 0 si el peer cerró, LB_AGAIN si no hay datos
+ *         (socket no bloqueante), LB_OVERFLOW si el buffer está lleno sin
+ *         ninguna línea completa, -1 en error.
+ */
+int linebuf_fill(socket_t s, linebuf_t *lb);
+
+/**
+ * @brief Extrae la siguiente línea completa del buffer, sin copiarla.
+ *
+ * Sustituye el '\n' (y un '\r' previo) por '\0' y devuelve un puntero al
+ * interior del buffer, válido hasta la próxima llamada a linebuf_fill().
+ *
+ * @param len Salida opcional con la longitud de la línea (sin terminador).
+ * @return Línea terminada en '\0', o NULL si no queda ninguna completa.
+ */
+char *linebuf_next_line(linebuf_t *lb, int *len);
+
+/**
+ * @brief Lectura bloqueante de una línea usando el buffer (para clientes).
+ *
+ * Equivalente a readline() pero con un recv() por bloque en lugar de por byte.
+ * @return Línea terminada en '\0' (sin '\n'), o NULL si el peer cerró o hubo error.
+ */
+char *linebuf_read_line(socket_t s, linebuf_t *lb, int *len);
+
+/**
+ * @brief Devuelve como línea lo que quede sin '\n' (p.ej. al cerrar el peer).
+ * @return Resto terminado en '\0', o NULL si el buffer está vacío.
+ */
+char *linebuf_take_rest(linebuf_t *lb, int *len);
+
+/**
+ * @brief Extrae y analiza el siguiente comando de texto del buffer, sin copiarlo.
+ *
+ * Una sola pasada por la línea (common/text_cmd.h): encuentra el '\n' y a la
+ * vez separa comando, topic y payload. Los punteros de cmd apuntan al
+ * interior del buffer y son válidos hasta la próxima llamada a linebuf_fill().
+ *
+ * @return 1 si cmd contiene una línea, 0 si no queda ninguna completa.
+ */
+int linebuf_next_cmd(linebuf_t *lb, text_cmd_t *cmd);
+
+/**
+ * @brief Extrae la siguiente trama binaria completa del buffer, sin copiarla.
+ *
+ * Los punteros de f apuntan al interior del buffer y son válidos hasta la
+ * próxima llamada a linebuf_fill(). Si la cabecera anuncia una trama mayor
+ * que la capacidad actual, el buffer crece para que la próxima lectura la
+ * complete.
+ *
+ * @return 1 si f contiene una trama, 0 si faltan datos, -1 si los bytes no
+ *         son una trama válida o no hay memoria.
+ */
+int linebuf_next_frame(linebuf_t *lb, frame_t *f);
+
+/**
+ * @brief Lectura bloqueante de una trama usando el buffer (para clientes).
+ * @return 1 si f contiene una trama, 0 si el peer cerró o hubo error.
+ */
+int linebuf_read_frame(socket_t s, linebuf_t *lb, frame_t *f);
+
+/**
+ * @brief Envía una trama completa de forma bloqueante.
+ *
+ * Cabecera y nombre se copian a un buffer local; el payload se envía desde
+ * su propia memoria, sin copiarlo.
+ * @return 0 si ok, -1 si error o el nombre excede MAX_TOPIC.
+ */
+int frame_write(socket_t s, int op, uint32_t topic, const char *name, int name_len,
+                const char *payload, uint32_t len);
+
+/** @brief Libera la memoria del buffer si no contiene datos pendientes. */
+void linebuf_release(linebuf_t *lb);
+
+/** @brief Libera la memoria del buffer descartando lo pendiente. */
+void linebuf_free(linebuf_t *lb);
+
+/**
+ * @brief Libera los slabs de los pools del hilo (mensajes, nodos, buffers).
+ *
+ * Para el final de un worker, cuando ya no queda ningún msg_t, cola ni
+ * linebuf vivo creado por ese hilo.
+ */
+void tcp_pools_free(void);
+
+/* ------------------------------------------------------------------------- */
+/*  Cola de salida                                                           */
+/* ------------------------------------------------------------------------- */
+
+/** Resultado de outq_flush(): la cola quedó vacía. */
+#define OUTQ_EMPTY    1
+/** Resultado de outq_flush(): quedan datos (el socket devolvió EWOULDBLOCK). */
+#define OUTQ_PENDING  0
+
+/**
+ * @brief Mensaje inmutable con contador de referencias.
+ *
+ * Un PUB se codifica una sola vez en un msg_t y cada cola de salida que lo
+ * reciba guarda solo un puntero y su propio desplazamiento: la memoria y los
+ * memcpy por publicación no dependen de cuántos suscriptores la reciben.
+ * El contador no es atómico: un msg_t pertenece a un único hilo, y sale del
+ * pool de ese hilo según su clase de tamaño (los de más de 8 KB, de malloc).
+ * Los bytes van a continuación de la cabecera, salvo en los de msg_extern()
+ * (ahí va a quién avisar cuando se suelta, ver msg_hold_t en tcp_utils.c).
+ */
+typedef struct msg {
+    int   refs;
+    int   len;
+    int   cls;    ///< Clase de tamaño en el pool del hilo (-1 = malloc).
+    char *data;   ///< Bytes del mensaje (propios o externos).
+} msg_t;
+
+/**
+ * @brief Reserva un mensaje de len bytes sin inicializar, con una referencia.
+ * @return Mensaje nuevo, o NULL si no hay memoria.
+ */
+msg_t *msg_alloc(int len);
+
+/**
+ * @brief Crea un mensaje copiando len bytes de data, con una referencia.
+ * @return Mensaje nuevo, o NULL si no hay memoria.
+ */
+msg_t *msg_new(const char *data, int len);
+
+/**
+ * @brief Crea un mensaje que apunta a len bytes ajenos, sin copiarlos.
+ *
+ * Para enviar memoria de otro dueño (p. ej. un segmento mapeado de
+ * common/msg_log.h): el mensaje no la libera, pero al soltar su última
+ * referencia llama a release(arg) (si no es NULL) para que el dueño sepa que
+ * ya nadie la usa. release corre en el hilo del mensaje.
+ * @return Mensaje nuevo, o NULL si no hay memoria (release no se llama).
+ */
+msg_t *msg_extern(const char *data, int len, void (*release)(void *arg), void *arg);
+
+/** @brief Toma una referencia adicional. */
+static inline msg_t *msg_ref(msg_t *m) {
+    m->refs++;
+    return m;
+}
+
+/** @brief Suelta una referencia; libera el mensaje al llegar a cero. */
+void msg_unref(msg_t *m);
+
+/** Entrada de la cola: bytes [off, msg->len) del mensaje aún por enviar. */
+typedef struct outq_node {
+    struct outq_node *next;
+    msg_t            *msg;
+    int               off;
+} outq_node_t;
+
+/**
+ * @brief Cola FIFO de mensajes pendientes de envío de una conexión.
+ *
+ * La cola no impone límites: la política de desborde (descartar el más viejo,
+ * el más nuevo o desconectar) la decide quien la usa mirando outq_t::bytes.
+ */
+typedef struct {
+    outq_node_t *head, *tail;
+    int          bytes;   ///< Bytes pendientes (sin contar lo ya enviado del primero).
+    int          count;   ///< Mensajes en la cola.
+} outq_t;
+
+/**
+ * @brief Encola el mensaje m a partir del byte off (toma una referencia).
+ * @return 0 si ok, -1 si no hay memoria.
+ */
+int outq_push_msg(outq_t *q, msg_t *m, int off);
+
+/**
+ * @brief Copia un mensaje al final de la cola (para respuestas puntuales).
+ * @return 0 si ok, -1 si no hay memoria.
+ */
+int outq_push(outq_t *q, const char *data, int len);
+
+/**
+ * @brief Descarta el mensaje más antiguo que aún no empezó a enviarse.
+ *
+ * Si el primero está enviado a medias se conserva (cortarlo rompería el flujo)
+ * y se descarta el siguiente.
+ * @return 1 si descartó un mensaje, 0 si no había ninguno descartable.
+ */
+int outq_drop_oldest(outq_t *q);
+
+/** Máximo de mensajes por escritura vectorizada en outq_flush() (por defecto). */
+#define OUTQ_IOV_MAX     64
+/** Máximo de bytes por escritura vectorizada en outq_flush() (por defecto). */
+#define OUTQ_IOV_BYTES   (256 * 1024)
+
+/**
+ * @brief Envía sin bloquear todo lo posible de la cola con escrituras vectorizadas.
+ *
+ * Cada llamada al sistema (writev() en POSIX, WSASend() en Windows) junta
+ * hasta max_iov mensajes y max_bytes bytes de la cola, así que una ráfaga de
+ * N mensajes pequeños cuesta unas N/max_iov llamadas en lugar de N. Una
+ * escritura parcial indica que el socket se llenó y termina el vaciado.
+ *
+ * @param max_iov   Mensajes por llamada (se acota a IOV_MAX del sistema).
+ * @param max_bytes Bytes por llamada (al menos se envía un mensaje).
+ * @return OUTQ_EMPTY, OUTQ_PENDING, o -1 si el socket falló.
+ */
+int outq_flush_v(socket_t s, outq_t *q, int max_iov, int max_bytes);
+
+/**
+ * @brief outq_flush_v() con los topes por defecto (OUTQ_IOV_MAX / OUTQ_IOV_BYTES).
+ * @return OUTQ_EMPTY, OUTQ_PENDING, o -1 si el socket falló.
+ */
+int outq_flush(socket_t s, outq_t *q);
+
+/** @brief Vacía la cola soltando sus mensajes. */
+void outq_clear(outq_t *q);
+
+/**
+ * @brief Intenta subir el límite de descriptores abiertos al máximo permitido.
+ *
+ * Necesario para que un broker sostenga decenas de miles de conexiones
+ * (RLIMIT_NOFILE en Linux). En Windows no aplica.
+ *
+ * @return Límite vigente tras el ajuste, o -1 si no aplica / falla.
+ */
+long raise_fd_limit(void);
+
+/* ------------------------------------------------------------------------- */
+/*  Event loop                                                               */
+/* ------------------------------------------------------------------------- */
+
+/** Interés / evento: socket listo para leer. */
+#define EV_READ   0x01
+/** Interés / evento: socket listo para escribir. */
+#define EV_WRITE  0x02
+/** Interés: notificación por flanco (edge-triggered). Solo epoll lo respeta. */
+#define EV_EDGE   0x04
+/** Evento: error o cierre del peer (HUP/ERR). */
+#define EV_ERROR  0x08
+
+/** Backends disponibles para el event loop. */
+typedef enum {
+    EVLOOP_AUTO = 0,  ///< El mejor disponible: epoll en Linux, select en Windows.
+    EVLOOP_EPOLL,     ///< epoll (Linux). Coste por espera proporcional a sockets listos.
+    EVLOOP_POLL,      ///< poll() (POSIX). Respaldo sin límite FD_SETSIZE.
+    EVLOOP_SELECT     ///< select(). Respaldo universal, limitado a FD_SETSIZE.
+} evloop_backend_t;
+
+/** Evento entregado por evloop_wait(). */
+typedef struct {
+    socket_t fd;      ///< Socket que produjo el evento.
+    int      events;  ///< Combinación de EV_READ / EV_WRITE / EV_ERROR.
+    void    *udata;   ///< Puntero asociado en evloop_add()/evloop_mod().
+} ev_event_t;
+
+/** Bucle de eventos opaco. */
+typedef struct evloop evloop_t;
+
+/**
+ * @brief Crea un bucle de eventos.
+ * @param backend Backend pedido; EVLOOP_AUTO elige el mejor disponible.
+ * @return Bucle nuevo, o NULL si el backend no está disponible en esta plataforma.
+ */
+evloop_t *evloop_create(evloop_backend_t backend);
+
+/** @brief Libera el bucle (no cierra los sockets registrados). */
+void evloop_destroy(evloop_t *loop);
+
+/** @brief Nombre del backend en uso ("epoll", "poll" o "select"). */
+const char *evloop_backend_name(const evloop_t *loop);
+
+/**
+ * @brief Registra un socket con su interés y un puntero de usuario.
+ * @return 0 si ok, -1 si falla (p.ej. select() sin hueco en FD_SETSIZE).
+ */
+int evloop_add(evloop_t *loop, socket_t fd, int events, void *udata);
+
+/** @brief Cambia el interés y/o el puntero de usuario de un socket registrado. */
+int evloop_mod(evloop_t *loop, socket_t fd, int events, void *udata);
+
+/** @brief Quita un socket del bucle. Debe llamarse antes de cerrarlo. */
+int evloop_del(evloop_t *loop, socket_t fd);
+
+/**
+ * @brief Espera eventos.
+ *
+ * @param out        Arreglo de salida.
+ * @param maxev      Capacidad de out.
+ * @param timeout_ms Milisegundos de espera; -1 bloquea indefinidamente.
+ * @return Número de eventos (>=0), o -1 en error.
+ */
+int evloop_wait(evloop_t *loop, ev_event_t *out, int maxev, int timeout_ms);
+
+/* ------------------------------------------------------------------------- */
+/*  Despertador entre hilos                                                  */
+/* ------------------------------------------------------------------------- */
+
+/**
+ * @brief Descriptor que otro hilo puede marcar para despertar un event loop.
+ *
+ * rfd se registra con EV_READ en el bucle del hilo que espera; cualquier hilo
+ * llama a ev_wakeup_signal() y el dueño, al recibir el evento, llama a
+ * ev_wakeup_drain(). Varios avisos antes de drenar cuentan como uno.
+ * Usa eventfd en Linux y un pipe en el resto de POSIX; no existe en Windows.
+ */
+typedef struct {
+    socket_t rfd;   ///< Extremo a vigilar en el event loop.
+    socket_t wfd;   ///< Extremo donde se avisa (igual a rfd con eventfd).
+} ev_wakeup_t;
+
+/** @brief Crea el despertador (no bloqueante). @return 0 si ok, -1 si no existe o falla. */
+int  ev_wakeup_init(ev_wakeup_t *w);
+
+/** @brief Despierta al hilo dueño (seguro desde cualquier hilo). */
+void ev_wakeup_signal(ev_wakeup_t *w);
+
+/** @brief Consume los avisos pendientes (hilo dueño, tras EV_READ en rfd). */
+void ev_wakeup_drain(ev_wakeup_t *w);
+
+/** @brief Cierra los descriptores del despertador. */
+void ev_wakeup_close(ev_wakeup_t *w);
+
+#endif /* TCP_UTILS_H */
@@ -7,29 +7,144 @@
  *
  * A diferencia de TCP:
  *  - No hay conexiones persistentes: cada mensaje se envía como un datagrama independiente.
- *  - El broker mantiene manualmente una tabla de suscriptores (`subs[]`), asociando cada
- *    dirección (IP:puerto) con un topic.
+ *  - El broker mantiene manualmente una tabla de suscriptores: un hash de
+ *    direcciones (IP:puerto, `peers[]`) y, por cada una, sus suscripciones a
+ *    topics. Ambos salen de pools (common/pool.h) y la tabla se agranda sola:
+ *    no hay un máximo de suscriptores.
+ *  - Los topics se internan en un `topic_index_t` (common/topic_index.h) que guarda,
+ *    por topic, la lista de suscripciones: un PUB recorre solo esa lista y el
+ *    alta busca duplicados solo entre las suscripciones de la misma dirección.
+ *  - Con -t N corren N workers, cada uno con su socket ligado al mismo puerto
+ *    (SO_REUSEPORT). Tabla e índice se comparten a través de un registro con lock
+ *    de lectura/escritura (common/topic_registry.h): los PUB de todos los workers
+ *    se reparten en paralelo y solo SUB/UNSUB/TOPIC (y el vencimiento de los
+ *    leases) toman el lock exclusivo.
  *
  * **Protocolo textual** (líneas terminadas en '\n'):
  *
  *  | Comando del cliente | Descripción |
  *  |----------------------|-------------|
- *  | `SUB <topic>`        | El cliente se suscribe a un topic |
+ *  | `SUB <topic>`        | El cliente se suscribe a un topic (una dirección puede tener varios) |
+ *  | `SUB <patrón>`       | Igual, con comodines jerárquicos: `liga/+/goles`, `liga/partidoA/#` |
+ *  | `SUB <topic> FROM <seq>` | Igual, y recibe lo retenido del topic desde el número `<seq>` |
+ *  | `UNSUB <topic>`      | El cliente cancela su suscripción a un topic |
  *  | `PUB <topic> <msg>`  | Un publicador envía un mensaje sobre un topic |
+ *  | `SPUB <seq> <topic> <msg>` | PUB con número de secuencia, confirmado con `ACK <seq>` |
+ *  | `RSUB <topic> [FROM <seq>]` | Suscripción confiable: recibe `RMSG <seq> <topic> <msg>` |
+ *  | `NACK <topic> <desde> [<hasta>]` | Pide retransmitir los RMSG de ese rango |
+ *  | `PING`               | Renueva el lease de la dirección; responde `PONG <suscripciones>` |
+ *  | `STATS`              | Métricas del broker en líneas `STAT <nombre>{<etiquetas>} <valor>`, y `END` |
+ *  | `TRACE`              | Vuelca la traza a un archivo (`OK TRACE`; solo compilado con -DPUBSUB_TRACE) |
  *
  *  **Respuestas del broker:**
- *  - A `SUB`: `OK SUB <topic>\n`
+ *  - A `SUB`: `OK SUB <topic>\n`; si hay historial, luego lo retenido y al
+ *    final `REPLAY <topic> <seq>\n` (desde `<seq>` todo llega en vivo).
+ *  - A `UNSUB`: `OK UNSUB <topic>\n` o `ERR not subscribed\n`
  *  - A `PUB`: retransmite `MSG <topic> <payload>\n` a todos los suscriptores del topic.
- *  - En error: `ERR unknown command\n`
+ *  - A `SPUB`: lo mismo, y al terminar el lote recibido `ACK <seq>\n` con el
+ *    mayor número hasta el que llegaron todos los de esa dirección (ver
+ *    spub_arrived()): un hueco detiene el ACK hasta que el publicador
+ *    retransmite lo que falta. Un SPUB repetido no se vuelve a publicar.
+ *  - En error: `ERR unknown command\n`, `ERR invalid topic\n` (también un
+ *    topic de MAX_TOPIC bytes o más, en texto igual que en binario)
+ *
+ * **Protocolo binario** (common/frame.h): un datagrama que empieza con
+ * FRAME_MAGIC es una trama (cabecera fija con opcode, topic id y longitudes,
+ * luego nombre y payload crudos). El broker responde a esa dirección con tramas
+ * y registra la suscripción como binaria; los payloads pueden contener
+ * cualquier byte, hasta el límite de un datagrama. Texto y binario conviven:
+ * cada PUB se formatea una vez por formato y cada suscriptor lo recibe en el suyo.
+ *
+ * **Entrega confiable:** un suscriptor que usa RSUB (solo tópicos concretos)
+ * recibe cada mensaje con el número de secuencia de su tópico. El broker
+ * numera los mensajes de los tópicos que tienen algún suscriptor confiable y
+ * retiene los últimos -R en un anillo por tópico (common/retained.h, a lo
+ * sumo REL_BYTES bytes, o los de -H). Quien detecta un hueco manda NACK y recibe de nuevo
+ * los RMSG que siguen retenidos (hasta NACK_MAX por NACK); por lo ya descartado
+ * recibe `LOST <topic> <desde> <hasta>`. Solo se atiende el NACK de una
+ * dirección con RSUB a ese tópico: de otro modo el broker serviría para
+ * amplificar tráfico hacia una dirección falsificada. No hay bloqueo de cabeza de línea: los
+ * mensajes nuevos siguen saliendo mientras se recupera un hueco. Para probarlo
+ * en loopback, -L descarta a propósito ese porcentaje de los datagramas de
+ * mensajes (también de las retransmisiones).
+ *
+ * **Historial:** con -H bytes el broker retiene los últimos mensajes de cada
+ * topic publicado, tenga o no suscriptores (common/retained.h, -R mensajes y
+ * esos bytes por topic; es el mismo anillo que usa NACK). Un SUB o RSUB a un
+ * topic concreto recibe lo retenido hasta ese momento (o desde FROM <seq>)
+ * y después `REPLAY`. El reenvío corre fuera del lock de la tabla, en tandas
+ * de REPLAY_BURST datagramas entre lote y lote: el fan-out en vivo sigue
+ * mientras tanto (y se intercala, como todo en UDP, con el historial). Sin -H,
+ * FROM sirve para reanudar un tópico que ya tiene suscriptores confiables.
+ * Se retienen a lo sumo -N tópicos (RETAINED_TOPICS_DEFAULT, contando los de
+ * RSUB): un PUB a uno nuevo pasado ese máximo sale sin numerar ni retener, un
+ * RSUB recibe `ERR too many topics` y los rechazos se cuentan en las métricas.
+ *
+ * **Modo durable:** con -D dir el historial de cada topic va a un log en
+ * segmentos mapeados (common/msg_log.h) en lugar del anillo: guarda todo, no
+ * solo los últimos -R, y sobrevive a un reinicio (la numeración sigue donde
+ * quedó, así que NACK y FROM funcionan a través de él). Se lleva a disco cada
+ * -S mensajes y/o cada -T ms desde un hilo aparte. Un SUB sin FROM recibe los
+ * últimos -R mensajes; a un suscriptor binario no confiable el historial se le
+ * envía directo desde el segmento mapeado, sin copiarlo. Cada log conserva
+ * hasta -C bytes (MSG_LOG_KEEP por defecto): al crear un segmento se borran
+ * los más viejos, y lo que pidan NACK o FROM de antes llega como LOST.
+ *
+ * **Reinicio rápido:** con -P archivo un hilo escribe cada -W ms (si algo
+ * cambió) un snapshot binario de la tabla: tópicos con su numeración y cada
+ * suscripción (dirección, formato, confiable). Al arrancar se mapea y se
+ * vuelve a dar de alta todo antes de recibir el primer datagrama, así que
+ * los suscriptores siguen recibiendo sin volver a mandar SUB. La carga la
+ * mide bench/bench_snapshot.c: 1M suscripciones de 250.000 direcciones en
+ * 100.000 tópicos, unos 350 ms en un núcleo. La numeración en memoria sigue con un
+ * salto que los confiables ven como LOST (ver snap_load()).
+ *
+ * **Leases:** UDP no avisa cuando un suscriptor desaparece. Cada dirección
+ * tiene un lease de -l segundos (60 por defecto, 0 = nunca vence) que renueva
+ * cualquier SUB/RSUB o un `PING`; vencido, se dan de baja todas sus
+ * suscripciones y el fan-out deja de gastar envíos en ella. Los vencimientos
+ * viven en una rueda de temporizadores jerárquica (common/timer_wheel.h):
+ * programar y vencer cuesta O(1) por lease y un tick sin vencimientos, O(1).
+ * Con un solo worker la avanza el propio worker, que espera datagramas a lo
+ * sumo hasta el próximo vencimiento (tw_next()), y la tabla sigue sin lock;
+ * con varios, un hilo la avanza cada LEASE_TICK_MS. Un PING no toca la rueda (solo anota el
+ * tick, con el lock de lectura): el lease se reprograma al vencer si hubo
+ * señales. `PONG 0` le indica al suscriptor que el broker lo olvidó y debe
+ * volver a suscribirse (subscriber_udp lo hace solo).
+ *
+ * **E/S por lotes:** en Linux cada recvmmsg() trae hasta -m datagramas ya
+ * encolados en el socket y todo el fan-out de un PUB sale en un solo
+ * sendmmsg(). Donde no existen (Windows, kernels viejos) se recibe y envía
+ * un datagrama por llamada, con el mismo comportamiento. Cada datagrama de
+ * texto se analiza una sola vez (common/text_cmd.h): el mismo resultado decide
+ * el lock y despacha el comando, con topic y payload apuntando al lote.
+ *
+ * **Métricas:** cada worker cuenta en su propio bloque (common/stats.h, sin
+ * locks ni líneas de caché compartidas) PUB y bytes recibidos, datagramas y
+ * bytes del fan-out, descartes (-L o tramas que no caben), el lote más grande
+ * recibido, el tiempo de atender cada lote y los PUB por tópico con su tasa
+ * por segundo. STATS las responde en datagramas de hasta STATS_DGRAM bytes
+ * (en binario, tramas FRAME_STATS y una vacía al final); con -M puerto se
+ * sirven además en formato Prometheus en http://<broker>:<puerto>/metrics.
+ *
+ * **Traza:** compilado con -DPUBSUB_TRACE (y ../common/trace.c), cada etapa
+ * de un lote recibido (análisis, despacho, fan-out, sendmmsg, descartes)
+ * deja registros con el TSC en un anillo por worker (common/trace.h); SIGUSR2
+ * o TRACE los vuelcan a un JSON de Chrome trace / Perfetto. Sin la macro los
+ * puntos de traza no generan código.
  *
  * **Uso:**
  * @code
- *   broker_udp.exe
+ *   broker_udp.exe [-m datagramas] [-t workers (0 = uno por núcleo)] [-R mensajes] [-L porcentaje]
+ *                  [-H bytes] [-N tópicos] [-D dir [-C bytes] [-S mensajes] [-T ms]] [-P archivo [-W ms]]
+ *                  [-l segundos]
+ *                  [-M puerto]
  * @endcode
  *
  * **Compilación:**
  * @code
- *   gcc broker_udp.c udp_utils.c -o output/broker_udp.exe -lws2_32
+ *   gcc broker_udp.c udp_utils.c ../common/topic_index.c ../common/topic_registry.c ../common/msg_log.c ../common/stats.c -o output/broker_udp.exe -lws2_32
+ *   gcc broker_udp.c udp_utils.c ../common/topic_index.c ../common/topic_registry.c ../common/msg_log.c ../common/stats.c -o output/broker_udp -pthread
  * @endcode
  *
  * **Notas:**
@@ -38,22 +153,165 @@
  */
 
 #include "udp_utils.h"
+#include "../common/topic_index.h"
+#include "../common/topic_registry.h"
+#include "../common/retained.h"
+#include "../common/pool.h"
+#include "../common/timer_wheel.h"
+#include "../common/text_cmd.h"
+#include "../common/stats.h"
+#include "../common/trace.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#ifdef _WIN32
+  #include <io.h>
+#else
+  #include <fcntl.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+#endif
+
+#define PEER_BUCKETS 256     ///< Baldes iniciales de la tabla de direcciones (se duplica al llenarse).
+#define REL_SLOTS 1024       ///< Mensajes retenidos por tópico confiable (ver -R).
+#define REL_BYTES (1 << 20)  ///< Bytes de payload retenidos por tópico confiable.
+#define NACK_MAX  64         ///< Retransmisiones como máximo por NACK (el resto se vuelve a pedir).
+#define REPLAY_MAX   64      ///< Reenvíos de historial en curso por worker.
+#define REPLAY_BURST 64      ///< Datagramas de cada reenvío por vuelta (ver replay_step()).
+#define SNAP_INTERVAL_MS 1000  ///< Período por defecto de escritura del snapshot (ver -W).
+#define LEASE_DEFAULT_S  60    ///< Vida de una dirección sin SUB ni PING (ver -l).
+#define LEASE_TICK_MS    100   ///< Resolución de los vencimientos (un tick de la rueda).
+#define STATS_DGRAM      1400  ///< Bytes de métricas por datagrama de la respuesta a STATS.
+#define SPUB_SLOTS       4096  ///< Publicadores con numeración seguida por worker (ver spub_arrived()).
+#define PEER_PINS        256   ///< Tópicos resueltos con FRAME_TOPIC fijados por dirección.
 
-#define MAX_SUBS  256  ///< Tamaño máximo de la tabla de suscriptores.
+struct sub;
+
+/**
+ * @brief Dirección (IP:puerto) con al menos una suscripción o un tópico
+ *        fijado, y su lease.
+ *
+ * Un SUB, un TOPIC o un PING de la dirección la renueva; si pasa -l segundos
+ * sin ninguno, se dan de baja todas sus suscripciones y se sueltan sus
+ * tópicos (ver lease_expired()).
+ */
+typedef struct peer {
+    struct sockaddr_in addr;
+    struct sub  *subs;              ///< Suscripciones de la dirección.
+    uint32_t     nsubs;
+    topic_id_t  *pins;              ///< Tópicos resueltos con FRAME_TOPIC (ver do_topic()).
+    uint32_t     npins, cap_pins;
+    atomic_uint  seen;              ///< Tick del último SUB o PING (se escribe con el lock de lectura).
+    tw_timer_t   lease;             ///< Vencimiento en la rueda leases.
+    struct peer *hnext;             ///< Siguiente en su balde de peers[].
+} peer_t;
 
 /**
  * @brief Estructura que representa un suscriptor (dirección y topic asociado).
  */
-typedef struct {
-    int   used;                     ///< 1 si está ocupado, 0 si libre.
-    char  topic[MAX_TOPIC];         ///< Nombre del topic.
+typedef struct sub {
+    topic_sub_t *link;              ///< Enlace en el índice (incluye el id del topic).
+    int   binary;                   ///< 1 si recibe tramas binarias, 0 si texto.
+    int   reliable;                 ///< 1 si recibe RMSG numerados (RSUB).
     struct sockaddr_in addr;        ///< Dirección (IP + puerto) del suscriptor.
+    peer_t      *peer;              ///< Dirección dueña de la suscripción.
+    struct sub  *pnext;             ///< Siguiente suscripción de la misma dirección.
+    struct sub **pprev;
 } sub_t;
 
-static sub_t subs[MAX_SUBS];        ///< Tabla de suscriptores.
+/**
+ * @brief Reenvío del historial de un tópico a un suscriptor recién llegado.
+ */
+typedef struct {
+    struct sockaddr_in addr;        ///< Suscriptor.
+    int      binary;                ///< 1 si recibe tramas binarias.
+    int      reliable;              ///< 1 si recibe RMSG numerados.
+    topic_id_t id;
+    retained_topic_t *rt;           ///< Historial del tópico (nombre incluido).
+    uint32_t next;                  ///< Próximo número a reenviar.
+    uint32_t end;                   ///< Primer número que el suscriptor recibió en vivo.
+} replay_t;
+
+static peer_t **peers;              ///< Direcciones con suscripciones (hash con encadenamiento).
+static uint32_t npeer_buckets;      ///< Baldes de peers[] (potencia de 2).
+static uint32_t npeers;
+static pool_t   peer_pool;          ///< peer_t y sub_t (con el lock de escritura de la tabla).
+static pool_t   sub_pool;
+static timer_wheel_t leases;        ///< Vencimiento de cada dirección, en ticks de LEASE_TICK_MS.
+static uint32_t lease_ticks = LEASE_DEFAULT_S * 1000 / LEASE_TICK_MS;  ///< Vida de un lease (-l; 0 = no vence).
+static topic_registry_t registry;   ///< Registro de topics y sus suscriptores (ver table_lock()).
+static THREAD_LOCAL udp_sendq_t fanout_q;  ///< Datagramas del fan-out en curso (uno por worker).
+static int   nworkers = 1;          ///< Workers (ver -t).
+static int   batch = UDP_BATCH;     ///< Datagramas por recvmmsg() / sendmmsg() (ver -m).
+static retained_t    history;       ///< Anillos (o logs, con -D) por tópico: RSUB/NACK y, con -H o -D, todos.
+static size_t        history_bytes; ///< Bytes retenidos por tópico publicado (-H; 0 = sin historial).
+static uint32_t      history_topics = RETAINED_TOPICS_DEFAULT;  ///< Tópicos retenidos como máximo (-N; 0 = sin límite).
+static int           history_on;    ///< 1 si se retiene todo tópico publicado (-H o -D).
+static const char   *log_dir;       ///< Directorio del modo durable (-D; NULL = en memoria).
+static size_t        log_keep = MSG_LOG_KEEP;  ///< Bytes de log que se conservan por tópico (-C; 0 = todo).
+static msg_log_sync_t log_sync;     ///< Cuándo llevar los logs a disco (-S / -T).
+static uint32_t      rel_slots = REL_SLOTS;  ///< Mensajes retenidos por tópico (ver -R).
+static THREAD_LOCAL replay_t replays[REPLAY_MAX];  ///< Reenvíos en curso del worker.
+static THREAD_LOCAL int      nreplays;
+static double        loss_pct;      ///< Porcentaje de datagramas de mensajes descartados (-L).
+static const char   *snap_path;     ///< Snapshot de la tabla de suscriptores (-P; NULL = ninguno).
+static int           snap_ms = SNAP_INTERVAL_MS;  ///< Período de escritura del snapshot (-W).
+static int           table_shared;  ///< 1 si otro hilo usa la tabla (workers, snapshot o métricas).
+static int           lease_inline;  ///< 1 si el worker único avanza la rueda de leases (sin hilo).
+static THREAD_LOCAL uint32_t loss_rng;  ///< Generador del descarte de cada worker.
+static stats_worker_t stats[REGISTRY_MAX_WORKERS];  ///< Métricas de cada worker (common/stats.h).
+static THREAD_LOCAL stats_worker_t *wstats;         ///< Las del worker de este hilo.
+static THREAD_LOCAL uint64_t batch_us;  ///< Llegada del lote en curso (µs, ver now_us()).
+static int           metrics_port;  ///< Puerto HTTP de las métricas (-M; 0 = sin listener).
+
+/**
+ * @brief ACK pendiente para un publicador durante el lote en curso.
+ */
+typedef struct {
+    struct sockaddr_in addr;        ///< Publicador.
+    int      binary;                ///< 1 si responde con FRAME_ACK.
+    uint32_t seq;                   ///< Confirmado hasta acá (ver spub_t::acked).
+    char     buf[FRAME_HDR + FRAME_SEQ_LEN + 16];  ///< "ACK <seq>\n" o la trama.
+} ack_t;
+
+static THREAD_LOCAL ack_t acks[UDP_BATCH_MAX];  ///< Un ACK por publicador y lote.
+static THREAD_LOCAL int   nacks;
+
+/**
+ * @brief Numeración de los SPUB de un publicador.
+ *
+ * Los datagramas de una dirección llegan siempre al mismo worker (el kernel
+ * reparte por dirección), así que cada worker lleva los suyos sin lock.
+ */
+typedef struct {
+    struct sockaddr_in addr;        ///< Publicador (sin_family 0 = libre).
+    uint32_t acked;                 ///< Llegaron todos hasta este número: lo que se confirma.
+    uint64_t seen[UDP_ACK_WINDOW / 64];  ///< Llegados por encima de acked (bit = seq % UDP_ACK_WINDOW).
+} spub_t;
+
+static THREAD_LOCAL spub_t *spubs;  ///< SPUB_SLOTS de mapeo directo por dirección (con el primer SPUB).
+
+/**
+ * @brief Toma el lock de subs[] y del índice: lectura para PUB, escritura para el resto.
+ *
+ * Con un solo worker, sin snapshot y sin métricas HTTP no hay con quién
+ * competir y no se toma nada (los leases los vence el mismo worker).
+ */
+static void table_lock(int write) {
+    if (!table_shared) return;
+    if (write) topic_registry_write(&registry);
+    else       topic_registry_read(&registry);
+}
+
+/**
+ * @brief Suelta el lock tomado con table_lock().
+ */
+static void table_unlock(int write) {
+    if (!table_shared) return;
+    if (write) topic_registry_write_done(&registry);
+    else       topic_registry_read_done(&registry);
+}
 
 /**
  * @brief Compara dos direcciones UDP (IP y puerto).
@@ -63,106 +321,1793 @@ static int same_addr(const struct sockaddr_in *a, const struct sockaddr_in *b) {
     return a->sin_addr.s_addr == b->sin_addr.s_addr && a->sin_port == b->sin_port;
 }
 
+/** Reloj monótono en milisegundos. */
+static double now_ms(void) {
+#ifdef _WIN32
+    return (double)GetTickCount64();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+#endif
+}
+
+/** Reloj monótono en microsegundos (latencias y tasas de las métricas). */
+static uint64_t now_us(void) {
+#ifdef _WIN32
+    LARGE_INTEGER f, t;
+    QueryPerformanceFrequency(&f);
+    QueryPerformanceCounter(&t);
+    return (uint64_t)(t.QuadPart / f.QuadPart * 1000000 + t.QuadPart % f.QuadPart * 1000000 / f.QuadPart);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+#endif
+}
+
+/** Tick actual de la rueda de leases. */
+static uint64_t lease_now(void) {
+    return (uint64_t)(now_ms() / LEASE_TICK_MS);
+}
+
+static uint32_t addr_hash(const struct sockaddr_in *a) {
+    uint32_t h = (uint32_t)a->sin_addr.s_addr * 2654435761u ^ (uint32_t)a->sin_port * 40503u;
+    return h ^ (h >> 15);
+}
+
+/**
+ * @brief Prepara la tabla de direcciones con lugar para hint sin crecer.
+ * @return 0 si ok, -1 si no hay memoria.
+ */
+static int peers_init(size_t hint) {
+    npeer_buckets = PEER_BUCKETS;
+    while (npeer_buckets < hint && npeer_buckets < (1u << 30)) npeer_buckets <<= 1;
+    peers = (peer_t**)calloc(npeer_buckets, sizeof(*peers));
+    pool_init(&peer_pool, sizeof(peer_t));
+    pool_init(&sub_pool, sizeof(sub_t));
+    return peers ? 0 : -1;
+}
+
+/**
+ * @brief Duplica los baldes de peers[] (con el lock de escritura).
+ *
+ * Si no hay memoria la tabla sigue como estaba: solo se alargan las cadenas.
+ */
+static void peers_grow(void) {
+    uint32_t n = npeer_buckets * 2;
+    peer_t **b = (peer_t**)calloc(n, sizeof(*b));
+    if (!b) return;
+    for (uint32_t i = 0; i < npeer_buckets; i++) {
+        for (peer_t *p = peers[i], *next; p; p = next) {
+            next = p->hnext;
+            uint32_t k = addr_hash(&p->addr) & (n - 1);
+            p->hnext = b[k];
+            b[k] = p;
+        }
+    }
+    free(peers);
+    peers = b;
+    npeer_buckets = n;
+}
+
+/**
+ * @brief Dirección registrada, o NULL si no tiene suscripciones.
+ */
+static peer_t *peer_find(const struct sockaddr_in *addr) {
+    for (peer_t *p = peers[addr_hash(addr) & (npeer_buckets - 1)]; p; p = p->hnext)
+        if (same_addr(&p->addr, addr)) return p;
+    return NULL;
+}
+
+/**
+ * @brief Renueva el lease de la dirección (alcanza con el lock de lectura).
+ */
+static void peer_touch(peer_t *p) {
+    atomic_store_explicit(&p->seen, (unsigned)lease_now(), memory_order_relaxed);
+}
+
+/**
+ * @brief Dirección registrada o una nueva con su lease en marcha.
+ * @return NULL si no hay memoria.
+ */
+static peer_t *peer_get(const struct sockaddr_in *addr) {
+    peer_t *p = peer_find(addr);
+    if (p) return p;
+    if (!(p = (peer_t*)pool_alloc(&peer_pool))) return NULL;
+    if (npeers >= npeer_buckets) peers_grow();
+
+    uint64_t now = lease_now();
+    p->addr  = *addr;
+    p->subs  = NULL;
+    p->nsubs = 0;
+    p->pins  = NULL;
+    p->npins = p->cap_pins = 0;
+    atomic_init(&p->seen, (unsigned)now);
+    tw_timer_init(&p->lease);
+    if (lease_ticks) tw_add(&leases, &p->lease, now + lease_ticks);
+    uint32_t k = addr_hash(addr) & (npeer_buckets - 1);
+    p->hnext = peers[k];
+    peers[k] = p;
+    npeers++;
+    return p;
+}
+
+/**
+ * @brief Suelta los tópicos que la dirección fijó con TOPIC.
+ */
+static void peer_unpin(peer_t *p) {
+    for (uint32_t i = 0; i < p->npins; i++) topic_unpin(&registry.ix, p->pins[i]);
+    free(p->pins);
+    p->pins  = NULL;
+    p->npins = p->cap_pins = 0;
+}
+
+/**
+ * @brief Saca la dirección de la tabla (ya sin suscripciones) y la libera.
+ */
+static void peer_free(peer_t *p) {
+    peer_unpin(p);
+    peer_t **pp = &peers[addr_hash(&p->addr) & (npeer_buckets - 1)];
+    while (*pp != p) pp = &(*pp)->hnext;
+    *pp = p->hnext;
+    tw_cancel(&leases, &p->lease);
+    npeers--;
+    pool_put(&peer_pool, p);
+}
+
+/**
+ * @brief Agrega (dirección, topic id) a la tabla sin buscar duplicados.
+ * @return 0 si ok, -1 si no hay memoria.
+ */
+static int sub_insert(topic_id_t id, peer_t *p, int binary, int reliable) {
+    sub_t *sb = (sub_t*)pool_alloc(&sub_pool);
+    if (!sb) return -1;
+    if (!(sb->link = topic_subscribe(&registry.ix, id, sb))) {
+        pool_put(&sub_pool, sb);
+        return -1;
+    }
+    sb->binary   = binary;
+    sb->reliable = reliable;
+    sb->addr     = p->addr;
+    sb->peer     = p;
+    sb->pnext    = p->subs;
+    sb->pprev    = &p->subs;
+    if (p->subs) p->subs->pprev = &sb->pnext;
+    p->subs = sb;
+    p->nsubs++;
+    return 0;
+}
+
+/**
+ * @brief Da de baja una suscripción en O(1); la dirección que queda sin
+ *        ninguna (ni tópicos fijados) sale de la tabla.
+ */
+static void sub_free(sub_t *sb) {
+    peer_t *p = sb->peer;
+    topic_unsubscribe(&registry.ix, sb->link);
+    *sb->pprev = sb->pnext;
+    if (sb->pnext) sb->pnext->pprev = sb->pprev;
+    pool_put(&sub_pool, sb);
+    if (--p->nsubs == 0 && !p->npins) peer_free(p);
+}
+
 /**
  * @brief Registra o actualiza un suscriptor para un topic dado.
  *
- * Si el cliente ya estaba suscrito al mismo topic, no se duplica.
- * Si no existe, se inserta en la primera posición libre.
+ * Si el cliente ya estaba suscrito al mismo topic, no se duplica (solo se
+ * revisan las suscripciones de esa dirección) y solo se actualiza su formato.
+ * En los dos casos se renueva el lease de la dirección.
  *
- * @param topic Nombre del topic.
- * @param addr  Dirección del cliente (IP + puerto).
+ * @param topic  Nombre del topic.
+ * @param addr   Dirección del cliente (IP + puerto).
+ * @param binary 1 si el suscriptor recibe tramas binarias, 0 si texto.
+ * @param reliable 1 si recibe RMSG numerados (RSUB).
+ * @return id del topic, o TOPIC_NONE si no se pudo registrar.
  */
-static void add_or_update_sub(const char *topic, const struct sockaddr_in *addr) {
+static topic_id_t add_or_update_sub(const char *topic, const struct sockaddr_in *addr,
+                                    int binary, int reliable) {
+    int len = (int)strlen(topic);  // < MAX_TOPIC: lo validan handle_text() / frame_topic()
+    topic_id_t id = topic_intern(&registry.ix, topic, len);
+    if (id == TOPIC_NONE) return TOPIC_NONE;
+    peer_t *p = peer_get(addr);
+    if (!p) {
+        (void)topic_release(&registry.ix, id);
+        return TOPIC_NONE;
+    }
+    peer_touch(p);
+
     // Verificar si ya existe
-    for (int i=0; i<MAX_SUBS; i++) {
-        if (subs[i].used && same_addr(&subs[i].addr, addr) &&
-            strncmp(subs[i].topic, topic, MAX_TOPIC) == 0) {
-            return; // ya estaba registrado
+    for (sub_t *sb = p->subs; sb; sb = sb->pnext) {
+        if (sb->link->topic == id) {  // ya estaba registrado
+            sb->binary   = binary;
+            sb->reliable = reliable;
+            return id;
         }
     }
 
     // Insertar nuevo
-    for (int i=0; i<MAX_SUBS; i++) {
-        if (!subs[i].used) {
-            subs[i].used = 1;
-            strncpy(subs[i].topic, topic, MAX_TOPIC-1);
-            subs[i].topic[MAX_TOPIC-1] = '\0';
-            subs[i].addr = *addr;
-            return;
-        }
+    if (sub_insert(id, p, binary, reliable) == 0) return id;
+    if (p->nsubs == 0 && !p->npins) peer_free(p);
+    (void)topic_release(&registry.ix, id);
+    return TOPIC_NONE;
+}
+
+/**
+ * @brief Cancela la suscripción de una dirección a un topic.
+ *
+ * Solo se revisan las suscripciones de esa dirección; la baja en el índice
+ * es O(1).
+ *
+ * @param id Topic (TOPIC_NONE si nunca fue internado).
+ * @return 0 si se dio de baja, -1 si la dirección no estaba suscrita.
+ */
+static int remove_sub(topic_id_t id, const struct sockaddr_in *addr) {
+    if (id == TOPIC_NONE) return -1;
+    peer_t *p = peer_find(addr);
+    if (!p) return -1;
+
+    for (sub_t *sb = p->subs; sb; sb = sb->pnext) {
+        if (sb->link->topic != id) continue;
+        sub_free(sb);
+        return 0;
+    }
+    return -1;
+}
+
+/**
+ * @brief Vencimientos de una vuelta de lease_advance().
+ */
+typedef struct {
+    uint64_t now;
+    long     peers;             ///< Direcciones dadas de baja.
+    long     subs;              ///< Suscripciones que tenían.
+} lease_reap_t;
+
+/**
+ * @brief Vence el lease de una dirección (con el lock de escritura).
+ *
+ * Los PING renuevan solo seen, sin tocar la rueda: si la dirección dio
+ * señales desde que se programó, el lease se vuelve a programar desde la
+ * última; si no, se dan de baja todas sus suscripciones.
+ */
+static void lease_expired(tw_timer_t *t, void *arg) {
+    lease_reap_t *r = (lease_reap_t*)arg;
+    peer_t *p = (peer_t*)((char*)t - offsetof(peer_t, lease));
+    uint32_t idle = (uint32_t)r->now - atomic_load_explicit(&p->seen, memory_order_relaxed);
+    if (idle < lease_ticks) {
+        tw_add(&leases, t, r->now + (lease_ticks - idle));
+        return;
     }
+    r->peers++;
+    r->subs += p->nsubs;
+    peer_unpin(p);
+    if (!p->nsubs) { peer_free(p); return; }  // solo tenía tópicos fijados
+    while (p->nsubs > 1) sub_free(p->subs);
+    sub_free(p->subs);  // la última libera también la dirección
+}
 
-    fprintf(stderr, "[broker-udp] tabla de suscriptores llena\n");
+/**
+ * @brief Anillo del topic id, o NULL si no se retiene (sin -H ni RSUB).
+ */
+static retained_topic_t *rel_get(topic_id_t id) {
+    if (id == TOPIC_NONE) return NULL;
+    const char *name = topic_name(&registry.ix, id);
+    return retained_find(&history, name, (int)strlen(name));
+}
+
+/**
+ * @brief 1 si el datagrama de un mensaje debe descartarse a propósito (-L).
+ */
+static int loss_drop(void) {
+    if (loss_pct <= 0) return 0;
+    loss_rng ^= loss_rng << 13;  // xorshift32
+    loss_rng ^= loss_rng >> 17;
+    loss_rng ^= loss_rng << 5;
+    return loss_rng % 100000 < (uint32_t)(loss_pct * 1000);
+}
+
+/**
+ * @brief Responde a un cliente en su formato: "OK <verb> <topic>" o FRAME_OK.
+ */
+static void reply_ok(socket_t s, const struct sockaddr_in *dst, int binary,
+                     const char *verb, topic_id_t id) {
+    const char *name = topic_name(&registry.ix, id);
+    if (binary) {
+        (void)udp_sendto_frame(s, FRAME_OK, id, name, (int)strlen(name), NULL, 0, dst);
+    } else {
+        char ok[MAX_LINE];
+        snprintf(ok, sizeof(ok), "OK %s %s\n", verb, name);
+        (void)udp_sendto_str(s, ok, dst);
+    }
+}
+
+/**
+ * @brief Informa un error en el formato del cliente: "ERR <reason>" o FRAME_ERR.
+ */
+static void reply_err(socket_t s, const struct sockaddr_in *dst, int binary, const char *reason) {
+    if (binary) {
+        (void)udp_sendto_frame(s, FRAME_ERR, FRAME_NO_TOPIC, NULL, 0, reason,
+                               (uint32_t)strlen(reason), dst);
+    } else {
+        char err[MAX_LINE];
+        snprintf(err, sizeof(err), "ERR %s\n", reason);
+        (void)udp_sendto_str(s, err, dst);
+    }
+}
+
+/**
+ * @brief Estado de un fan-out en curso (lista exacta + patrones que coinciden).
+ *
+ * El mensaje se formatea a lo sumo una vez por formato: el datagrama de texto
+ * para los suscriptores textuales y la trama FRAME_MSG para los binarios.
+ */
+typedef struct {
+    topic_id_t  id;             ///< Topic publicado (TOPIC_NONE si no está internado).
+    const char *topic;
+    const char *payload;
+    int         plen;           ///< Longitud del payload (puede contener cualquier byte).
+    socket_t    s;
+    uint32_t    seq;            ///< Número del mensaje en su tópico (0 = tópico sin RSUB).
+    char        text[MAX_LINE]; ///< "MSG <topic> <payload>\n".
+    int         ntext;          ///< -1 = aún sin formatear.
+    char       *bin;            ///< Trama FRAME_MSG (apunta a fanout_frame).
+    int         nbin;           ///< -1 = aún sin formatear.
+    char        rtext[MAX_LINE];///< "RMSG <seq> <topic> <payload>\n" para los confiables.
+    int         nrtext;
+    char       *rbin;           ///< Trama FRAME_RMSG (apunta a fanout_rframe).
+    int         nrbin;
+    uint32_t    queued;         ///< Datagramas encolados (métricas).
+    uint64_t    bytes;          ///< Bytes de esos datagramas.
+} fanout_t;
+
+/**
+ * @brief Formatea el datagrama de texto "MSG <topic> <payload>\n", o
+ *        "RMSG <seq> <topic> <payload>\n" si seq no es 0.
+ *
+ * El protocolo textual no admite saltos de línea: un payload binario se corta
+ * en su primer '\n' y a MAX_LINE.
+ *
+ * @param out Al menos MAX_LINE bytes.
+ * @return Bytes del datagrama, o -1 si el encabezado solo ya no cabe en MAX_LINE.
+ */
+static int format_text(char *out, uint32_t seq, const char *topic, const char *payload, int plen) {
+    const char *nl = (const char*)memchr(payload, '\n', plen);
+    if (nl) plen = (int)(nl - payload);
+
+    int n = seq ? snprintf(out, MAX_LINE, "RMSG %u %s ", seq, topic)
+                : snprintf(out, MAX_LINE, "MSG %s ", topic);
+    if (n < 0 || n >= MAX_LINE - 1) return -1;
+    int room = MAX_LINE - 1 - n;
+    if (plen > room) plen = room;
+    memcpy(out + n, payload, plen);
+    out[n + plen] = '\n';
+    return n + plen + 1;
+}
+
+/**
+ * @brief Codifica la trama FRAME_MSG (id + nombre + payload crudo), o
+ *        FRAME_RMSG con el número delante del payload si seq no es 0.
+ *
+ * @param out Al menos UDP_MAX_DGRAM bytes.
+ * @return Bytes de la trama, o -1 si no cabe en un datagrama.
+ */
+static int format_bin(char *out, topic_id_t id, uint32_t seq, const char *topic,
+                      const char *payload, int plen) {
+    int tlen = (int)strlen(topic);
+    int slen = seq ? FRAME_SEQ_LEN : 0;
+    if (frame_size(tlen, slen + plen) > UDP_MAX_DGRAM) return -1;
+    int n = frame_encode_head(out, seq ? FRAME_RMSG : FRAME_MSG,
+                              id == TOPIC_NONE ? FRAME_NO_TOPIC : id, topic, tlen,
+                              (uint32_t)(slen + plen));
+    if (seq) frame_put32((unsigned char*)out + n, seq);
+    memcpy(out + n + slen, payload, plen);
+    return n + slen + plen;
+}
+
+/** Tramas FRAME_MSG / FRAME_RMSG del fan-out en curso: un datagrama como
+ *  máximo, reservadas una vez por worker en lugar de un malloc por PUB binario. */
+static THREAD_LOCAL char fanout_frame[UDP_MAX_DGRAM];
+static THREAD_LOCAL char fanout_rframe[UDP_MAX_DGRAM];
+
+/**
+ * @brief Encola un datagrama del fan-out hacia dst y lo cuenta.
+ */
+static void fanout_add(fanout_t *f, const char *buf, int n, const struct sockaddr_in *dst) {
+    udp_sendq_add(f->s, &fanout_q, buf, n, dst);
+    f->queued++;
+    f->bytes += (uint64_t)n;
+}
+
+/**
+ * @brief Encola el mensaje del fan-out para los suscriptores del topic/patrón id,
+ *        a cada uno en su formato (se envía todo junto en broadcast_topic()).
+ *
+ * Los suscriptores confiables del tópico reciben RMSG con el número f->seq.
+ * Cada formato se codifica una sola vez, la primera que se necesita.
+ */
+static void fanout_list(topic_id_t id, void *arg) {
+    fanout_t *f = (fanout_t*)arg;
+    uint32_t n;
+    topic_sub_t **list = topic_subscribers(&registry.ix, id, &n);
+
+    for (uint32_t i=0; i<n; i++) {
+        const sub_t *sb = (const sub_t*)list[i]->owner;
+        if (loss_drop()) { stats_add(&wstats->c[STATS_DROPS], 1); TRACE_MARK(TRACE_DROP, 1); continue; }
+        if (sb->reliable && f->seq) {
+            if (sb->binary) {
+                if (f->nrbin < 0) {
+                    f->rbin  = fanout_rframe;
+                    f->nrbin = format_bin(f->rbin, f->id, f->seq, f->topic, f->payload, f->plen);
+                }
+                if (f->nrbin < 0) { stats_add(&wstats->c[STATS_DROPS], 1); TRACE_MARK(TRACE_DROP, 1); continue; }
+                fanout_add(f, f->rbin, f->nrbin, &sb->addr);
+            } else {
+                if (f->nrtext < 0) f->nrtext = format_text(f->rtext, f->seq, f->topic, f->payload, f->plen);
+                if (f->nrtext < 0) { stats_add(&wstats->c[STATS_DROPS], 1); TRACE_MARK(TRACE_DROP, 1); continue; }
+                fanout_add(f, f->rtext, f->nrtext, &sb->addr);
+            }
+        } else if (sb->binary) {
+            if (f->nbin < 0) {
+                f->bin  = fanout_frame;
+                f->nbin = format_bin(f->bin, f->id, 0, f->topic, f->payload, f->plen);
+            }
+            if (f->nbin < 0) { stats_add(&wstats->c[STATS_DROPS], 1); TRACE_MARK(TRACE_DROP, 1); continue; }
+            fanout_add(f, f->bin, f->nbin, &sb->addr);
+        } else {
+            if (f->ntext < 0) f->ntext = format_text(f->text, 0, f->topic, f->payload, f->plen);
+            if (f->ntext < 0) { stats_add(&wstats->c[STATS_DROPS], 1); TRACE_MARK(TRACE_DROP, 1); continue; }
+            fanout_add(f, f->text, f->ntext, &sb->addr);
+        }
+    }
 }
 
 /**
  * @brief Envía un mensaje a todos los suscriptores de un topic.
  *
+ * Entrega a los suscriptores exactos del topic y a los de cada patrón con
+ * comodines que coincida (vía trie). Como cada fila de subs[] es un par
+ * (dirección, topic), una dirección suscrita a varios patrones que coinciden
+ * recibe una copia por suscripción. Los datagramas se juntan en fanout_q y
+ * salen con un único udp_sendq_flush() (sendmmsg en Linux).
+ *
+ * Si el tópico se retiene (historial con -H, o suscriptores confiables), el
+ * mensaje toma el siguiente número del tópico y queda en su anillo antes de salir.
+ * El PUB y sus datagramas se cuentan en las métricas del worker (y de su tópico).
+ *
+ * @param id      id del topic si el publicador lo conoce, o TOPIC_NONE.
  * @param topic   Tópico asociado al mensaje.
  * @param payload Contenido del mensaje.
+ * @param plen    Longitud del payload.
  * @param s       Socket UDP para envío.
  */
-static void broadcast_topic(const char *topic, const char *payload, socket_t s) {
-    char out[MAX_LINE];
-    snprintf(out, sizeof(out), "MSG %s %s\n", topic, payload);
+static void broadcast_topic(topic_id_t id, const char *topic, const char *payload, int plen, socket_t s) {
+    int len = (int)strlen(topic);
+    fanout_t f;
+    f.topic   = topic;
+    f.payload = payload;
+    f.plen    = plen;
+    f.s       = s;
+    f.ntext   = -1;
+    f.nbin    = -1;
+    f.bin     = NULL;
+    f.nrtext  = -1;
+    f.nrbin   = -1;
+    f.rbin    = NULL;
+    f.seq     = 0;
+    f.queued  = 0;
+    f.bytes   = 0;
+
+    stats_topic_t *ts = stats_topic(wstats, topic, len);
+    stats_add(&wstats->c[STATS_PUB_IN], 1);
+    stats_add(&wstats->c[STATS_PUB_BYTES], (uint64_t)plen);
+    stats_topic_pub(wstats, ts, (uint64_t)plen, batch_us / 1000000);
+
+    if (id == TOPIC_NONE) id = topic_lookup(&registry.ix, topic, len);
+    f.id = id;
+    retained_topic_t *rt = history_on ? retained_get(&history, topic, len)
+                                      : retained_find(&history, topic, len);
+    if (rt) f.seq = retained_push(rt, payload, (uint32_t)plen);
+    TRACE_BEGIN(TRACE_FANOUT);
+    if (id != TOPIC_NONE) fanout_list(id, &f);
+    topic_match(&registry.ix, topic, len, fanout_list, &f);
+    TRACE_END(TRACE_FANOUT, f.queued);
+    TRACE_BEGIN(TRACE_FLUSH);
+    (void)udp_sendq_flush(s, &fanout_q);  // antes del próximo PUB: la cola apunta a f.text/f.bin
+    TRACE_END(TRACE_FLUSH, f.bytes);
+    if (f.queued) {
+        stats_add(&wstats->c[STATS_MSG_OUT], f.queued);
+        stats_add(&wstats->c[STATS_BYTES_OUT], f.bytes);
+        if (ts) stats_add(&ts->out, f.queued);
+    }
+}
+
+/** 1 si el SPUB seq de p ya llegó (seq dentro de la ventana sobre acked). */
+static int spub_bit(const spub_t *p, uint32_t seq) {
+    return (int)(p->seen[(seq % UDP_ACK_WINDOW) / 64] >> (seq % 64) & 1);
+}
+
+/** Marca o desmarca la llegada del SPUB seq de p. */
+static void spub_set(spub_t *p, uint32_t seq, int on) {
+    uint64_t m = (uint64_t)1 << (seq % 64);
+    if (on) p->seen[(seq % UDP_ACK_WINDOW) / 64] |= m;
+    else    p->seen[(seq % UDP_ACK_WINDOW) / 64] &= ~m;
+}
+
+/**
+ * @brief Registra que llegó el SPUB seq de src y avanza su número confirmado
+ *        mientras no haya huecos.
+ *
+ * Una dirección nueva (o que otra desplazó de su lugar en spubs) arranca
+ * desde 1 si seq está dentro de la primera ventana, y si no desde seq. Un
+ * seq más de UDP_ACK_WINDOW por delante de lo confirmado solo puede llegar
+ * si el publicador ya abandonó los que faltan (su ventana es menor): se dan
+ * por perdidos y la ventana se corre.
+ *
+ * @param acked Salida: número hasta el que confirmar.
+ * @return 1 si el SPUB es nuevo y hay que publicarlo, 0 si es una repetición.
+ */
+static int spub_arrived(const struct sockaddr_in *src, uint32_t seq, uint32_t *acked) {
+    if (!spubs && !(spubs = (spub_t*)calloc(SPUB_SLOTS, sizeof(*spubs)))) {
+        *acked = seq;  // sin memoria: como antes, el ACK dice solo que llegó este
+        return 1;
+    }
+    spub_t *p = &spubs[addr_hash(src) & (SPUB_SLOTS - 1)];
+    if (!p->addr.sin_family || !same_addr(&p->addr, src)) {
+        memset(p, 0, sizeof(*p));
+        p->addr  = *src;
+        p->acked = seq <= UDP_ACK_WINDOW ? 0 : seq - 1;
+    }
 
-    for (int i=0; i<MAX_SUBS; i++) {
-        if (subs[i].used && strncmp(subs[i].topic, topic, MAX_TOPIC) == 0) {
-            (void)udp_sendto_str(s, out, &subs[i].addr);
+    int fresh = 0;
+    uint32_t d = seq - p->acked;
+    if (d != 0 && d < 0x80000000u) {  // por delante de lo confirmado
+        if (d > UDP_ACK_WINDOW) {
+            uint32_t base = seq - UDP_ACK_WINDOW;
+            if (base - p->acked >= UDP_ACK_WINDOW) memset(p->seen, 0, sizeof(p->seen));
+            else for (uint32_t q = p->acked + 1; q != base + 1; q++) spub_set(p, q, 0);
+            p->acked = base;
+        }
+        if (!spub_bit(p, seq)) {
+            spub_set(p, seq, 1);
+            fresh = 1;
+            while (spub_bit(p, p->acked + 1)) spub_set(p, ++p->acked, 0);
         }
     }
+    *acked = p->acked;
+    return fresh;
 }
 
 /**
- * @brief Programa principal: ciclo del broker UDP.
+ * @brief Anota el ACK de src hasta seq; sale en flush_acks().
  *
- * - Inicializa Winsock.
- * - Crea socket UDP ligado a BROKER_UDP_PORT.
- * - Recibe datagramas y los procesa según el comando recibido.
+ * Un publicador que mandó varios SPUB en el mismo lote recibe un solo ACK,
+ * con el mayor número.
  */
-int main(void) {
-    if (winsock_init() != 0) return 1;
-    memset(subs, 0, sizeof(subs));
+static void note_ack(const struct sockaddr_in *src, int binary, uint32_t seq) {
+    for (int i=0; i<nacks; i++) {
+        if (same_addr(&acks[i].addr, src)) {
+            if (seq_after(seq, acks[i].seq)) acks[i].seq = seq;
+            return;
+        }
+    }
+    if (nacks == UDP_BATCH_MAX) return;  // no pasa: hay a lo sumo un datagrama por entrada
+    acks[nacks].addr   = *src;
+    acks[nacks].binary = binary;
+    acks[nacks].seq    = seq;
+    nacks++;
+}
 
-    socket_t s = udp_bind_any(BROKER_UDP_PORT);
-    printf("[broker-udp] escuchando UDP en puerto %d...\n", BROKER_UDP_PORT);
+/**
+ * @brief Envía los ACK del lote (juntos, con sendmmsg en Linux) y vacía la lista.
+ */
+static void flush_acks(socket_t s) {
+    for (int i=0; i<nacks; i++) {
+        ack_t *a = &acks[i];
+        int n;
+        if (a->binary) {
+            unsigned char seq[FRAME_SEQ_LEN];
+            frame_put32(seq, a->seq);
+            n = frame_encode(a->buf, FRAME_ACK, FRAME_NO_TOPIC, NULL, 0, (const char*)seq, FRAME_SEQ_LEN);
+        } else {
+            n = snprintf(a->buf, sizeof(a->buf), "ACK %u\n", a->seq);
+        }
+        udp_sendq_add(s, &fanout_q, a->buf, n, &a->addr);
+    }
+    if (nacks > 0) (void)udp_sendq_flush(s, &fanout_q);
+    nacks = 0;
+}
+
+/**
+ * @brief Avisa a r->addr el fin del historial: "REPLAY <topic> <end>" o FRAME_REPLAY.
+ */
+static void reply_replay(socket_t s, const replay_t *r) {
+    if (r->binary) {
+        unsigned char seq[FRAME_SEQ_LEN];
+        frame_put32(seq, r->end);
+        (void)udp_sendto_frame(s, FRAME_REPLAY, r->id, r->rt->name, r->rt->len,
+                               (const char*)seq, FRAME_SEQ_LEN, &r->addr);
+    } else {
+        char out[MAX_LINE];
+        snprintf(out, sizeof(out), "REPLAY %s %u\n", r->rt->name, r->end);
+        (void)udp_sendto_str(s, out, &r->addr);
+    }
+}
+
+/**
+ * @brief Avanza los reenvíos de historial del worker: hasta REPLAY_BURST
+ *        datagramas de cada uno.
+ *
+ * Corre sin el lock de la tabla (el nombre sale del propio historial) y toma
+ * el del tópico un mensaje a la vez, como nack_step(): los PUB de todos los
+ * workers siguen saliendo mientras se reenvía. Lo que el anillo descartó antes
+ * de llegar a reenviarse se saltea. Desde un log (-D), a un suscriptor binario
+ * no confiable se le envía la trama tal como está en el segmento mapeado.
+ */
+static void replay_step(socket_t s) {
+    static THREAD_LOCAL char out[UDP_MAX_DGRAM];
+    for (int i = 0; i < nreplays; ) {
+        replay_t *r = &replays[i];
+        int done = 0;
+        for (int k = 0; k < REPLAY_BURST && !done; k++) {
+            const char *dgram = out;
+            msg_log_seg_t *seg = NULL;
+            int n = -1;
+            mutex_lock(&r->rt->lock);
+            uint32_t first = retained_first_locked(r->rt);
+            if (seq_after(first, r->next)) r->next = first;
+            if (seq_after(r->next, r->end) || r->next == r->end) {
+                done = 1;
+            } else {
+                msg_log_rec_t rec = {0};
+                (void)retained_at(r->rt, r->next, &rec);
+                uint32_t seq = r->reliable ? r->next : 0;
+                if (r->binary && !seq && rec.frame && rec.frame_len <= UDP_MAX_DGRAM) {
+                    dgram = rec.frame;  // sigue mapeado al soltar el lock mientras se retenga
+                    n = (int)rec.frame_len;
+                    msg_log_hold(seg = rec.seg);
+                } else {
+                    n = r->binary ? format_bin(out, r->id, seq, r->rt->name, rec.payload, (int)rec.len)
+                                  : format_text(out, seq, r->rt->name, rec.payload, (int)rec.len);
+                }
+                r->next++;
+            }
+            mutex_unlock(&r->rt->lock);
+            if (n > 0 && !loss_drop()) (void)udp_sendto_buf(s, dgram, n, &r->addr);
+            msg_log_release(seg);
+        }
+        if (done) {
+            reply_replay(s, r);
+            replays[i] = replays[--nreplays];
+        } else {
+            i++;
+        }
+    }
+}
+
+/**
+ * @brief SUB o RSUB (reliable = 1) en cualquiera de los dos formatos.
+ *
+ * La numeración es por tópico concreto: RSUB no acepta patrones. Un tópico
+ * concreto con historial (-H o -D, o FROM sobre un tópico retenido) agenda el
+ * reenvío de lo retenido desde from (has_from = 0: los últimos -R) hasta el último
+ * publicado: lo siguiente ya le llega en vivo, porque el alta y ese corte se
+ * hacen con el lock de escritura.
+ */
+static void do_sub(socket_t s, const struct sockaddr_in *src, int binary, const char *topic,
+                   int reliable, int has_from, uint32_t from) {
+    int len = (int)strlen(topic);
+    int kind = topic_classify(topic, len);
+    if (kind < 0 || (reliable && kind != 0)) {
+        reply_err(s, src, binary, "invalid topic");
+        return;
+    }
+    topic_id_t id = add_or_update_sub(topic, src, binary, reliable);
+    if (id == TOPIC_NONE) {
+        reply_err(s, src, binary, "out of memory");
+        return;
+    }
+    retained_topic_t *rt = NULL;
+    if (reliable || (history_on && kind == 0)) {
+        if (!(rt = retained_get(&history, topic, len))) {
+            reply_err(s, src, binary, retained_full(&history) ? "too many topics" : "out of memory");
+            return;
+        }
+    } else if (has_from && kind == 0) {
+        rt = retained_find(&history, topic, len);
+    }
+    reply_ok(s, src, binary, reliable ? "RSUB" : "SUB", id);
+
+    if (!rt || (!history_on && !has_from)) return;
+    if (nreplays == REPLAY_MAX) {
+        reply_err(s, src, binary, "too many replays");
+        return;
+    }
+    replay_t *r = &replays[nreplays++];
+    r->addr     = *src;
+    r->binary   = binary;
+    r->reliable = reliable;
+    r->id       = id;
+    r->rt       = rt;
+    r->end      = retained_next(rt);
+    r->next     = has_from ? from : r->end - rel_slots;  // replay_step() acota al más viejo
+    if (seq_after(r->next, r->end)) r->next = r->end;
+}
+
+/**
+ * @brief Informa a dst que el rango [from, to] del tópico ya no está retenido.
+ */
+static void reply_lost(socket_t s, const struct sockaddr_in *dst, int binary, topic_id_t id,
+                       const char *name, int len, uint32_t from, uint32_t to) {
+    if (binary) {
+        unsigned char range[2 * FRAME_SEQ_LEN];
+        frame_put32(range, from);
+        frame_put32(range + FRAME_SEQ_LEN, to);
+        (void)udp_sendto_frame(s, FRAME_LOST, id, name, len, (const char*)range, sizeof(range), dst);
+    } else {
+        char lost[MAX_LINE];
+        snprintf(lost, sizeof(lost), "LOST %.*s %u %u\n", len, name, from, to);
+        (void)udp_sendto_str(s, lost, dst);
+    }
+}
+
+/**
+ * @brief Retransmisión pedida por un NACK, a la espera de que se suelte el
+ *        lock de la tabla (ver nack_step()).
+ */
+typedef struct {
+    struct sockaddr_in addr;        ///< Suscriptor que pidió el rango.
+    int      binary;
+    topic_id_t id;
+    retained_topic_t *rt;           ///< Historial del tópico (nombre incluido); NULL = nada pendiente.
+    uint32_t from, to;
+} nack_t;
+
+static THREAD_LOCAL nack_t nack_pending;  ///< NACK del datagrama en curso (uno por worker).
+
+/**
+ * @brief 1 si la dirección tiene un RSUB al tópico id (con el lock de la tabla).
+ */
+static int reliable_subscriber(const struct sockaddr_in *src, topic_id_t id) {
+    peer_t *p = peer_find(src);
+    for (sub_t *sb = p ? p->subs : NULL; sb; sb = sb->pnext)
+        if (sb->link->topic == id && sb->reliable) return 1;
+    return 0;
+}
+
+/**
+ * @brief NACK: agenda la retransmisión a src de los RMSG [from, to] que sigan
+ *        retenidos (to = 0: hasta el último publicado).
+ *
+ * Con el lock de la tabla solo se valida: el NACK vale únicamente si src
+ * tiene un RSUB al tópico, y se atienden a lo sumo NACK_MAX mensajes (el
+ * suscriptor vuelve a pedir los que sigan faltando). Los datagramas salen en
+ * nack_step(), ya sin el lock.
+ */
+static void do_nack(socket_t s, const struct sockaddr_in *src, int binary, topic_id_t id,
+                    uint32_t from, uint32_t to) {
+    retained_topic_t *rt = rel_get(id);
+    if (!rt) { reply_err(s, src, binary, "not reliable"); return; }
+    if (!reliable_subscriber(src, id)) { reply_err(s, src, binary, "not subscribed"); return; }
 
-    char buf[MAX_LINE];
-    struct sockaddr_in src;
+    nack_t *nk = &nack_pending;
+    nk->addr   = *src;
+    nk->binary = binary;
+    nk->id     = id;
+    nk->rt     = rt;
+    nk->from   = from;
+    nk->to     = to;
+}
 
-    // Bucle principal: escucha datagramas y procesa comandos
+/**
+ * @brief Envía la retransmisión agendada por do_nack(), sin el lock de la tabla.
+ *
+ * Cada mensaje se copia al datagrama con el lock del tópico tomado y se envía
+ * ya sin él, así la recuperación no frena a los PUB del mismo tópico. Lo que
+ * el anillo ya descartó se informa con un único LOST; lo que todavía no se
+ * publicó se ignora (un NACK abierto sirve de sondeo para la pérdida del final).
+ */
+static void nack_step(socket_t s) {
+    static THREAD_LOCAL char out[UDP_MAX_DGRAM];
+    nack_t *nk = &nack_pending;
+    retained_topic_t *rt = nk->rt;
+    if (!rt) return;
+    nk->rt = NULL;
+    uint32_t from = nk->from, to = nk->to;
+
+    mutex_lock(&rt->lock);
+    uint32_t first = retained_first_locked(rt), last = retained_next_locked(rt) - 1;
+    mutex_unlock(&rt->lock);
+    if (to == 0 || seq_after(to, last)) to = last;
+    if (from == 0) from = 1;
+    if (seq_after(from, to)) return;
+
+    if (seq_after(first, from)) {  // la parte vieja del rango ya no está
+        uint32_t lost_to = seq_after(first, to) ? to : first - 1;
+        reply_lost(s, &nk->addr, nk->binary, nk->id, rt->name, rt->len, from, lost_to);
+        if (lost_to == to) return;
+        from = first;
+    }
+    for (uint32_t seq = from, k = 0; k < NACK_MAX; seq++, k++) {
+        msg_log_rec_t rec;
+        int n = -1;
+        mutex_lock(&rt->lock);
+        int found = retained_at(rt, seq, &rec) == 0;
+        if (found)
+            n = nk->binary ? format_bin(out, nk->id, seq, rt->name, rec.payload, (int)rec.len)
+                           : format_text(out, seq, rt->name, rec.payload, (int)rec.len);
+        mutex_unlock(&rt->lock);
+        if (!found) {  // lo desplazó un PUB mientras se retransmitía
+            reply_lost(s, &nk->addr, nk->binary, nk->id, rt->name, rt->len, seq, to);
+            return;
+        }
+        if (n > 0 && !loss_drop()) (void)udp_sendto_buf(s, out, n, &nk->addr);
+        if (seq == to) break;
+    }
+}
+
+/**
+ * @brief UNSUB en cualquiera de los dos formatos (id ya resuelto).
+ */
+static void do_unsub(socket_t s, const struct sockaddr_in *src, int binary, topic_id_t id) {
+    if (id == TOPIC_NONE) {
+        reply_err(s, src, binary, "not subscribed");
+        return;
+    }
+    topic_pin(&registry.ix, id);  // el OK lleva el nombre: que la baja no libere el tópico antes
+    if (remove_sub(id, src) != 0) reply_err(s, src, binary, "not subscribed");
+    else                          reply_ok(s, src, binary, "UNSUB", id);
+    topic_unpin(&registry.ix, id);
+}
+
+/**
+ * @brief TOPIC: resuelve name a un id para publicar luego sin el nombre.
+ *
+ * El id queda fijado a la dirección (no se libera ni se reutiliza) hasta que
+ * venza su lease; como mucho PEER_PINS por dirección, además de sus
+ * suscripciones, que ya lo mantienen vivo. Con el lock de escritura.
+ */
+static void do_topic(socket_t s, const struct sockaddr_in *src, const char *name) {
+    int len = (int)strlen(name);
+    peer_t *p = peer_get(src);
+    if (!p) { reply_err(s, src, 1, "out of memory"); return; }
+    peer_touch(p);
+
+    topic_id_t id = topic_lookup(&registry.ix, name, len);
+    if (id != TOPIC_NONE) {
+        for (sub_t *sb = p->subs; sb; sb = sb->pnext)
+            if (sb->link->topic == id) { reply_ok(s, src, 1, "TOPIC", id); return; }
+        for (uint32_t i = 0; i < p->npins; i++)
+            if (p->pins[i] == id) { reply_ok(s, src, 1, "TOPIC", id); return; }
+    }
+    const char *err = NULL;
+    if (p->npins == PEER_PINS) {
+        err = "too many topics";
+    } else if (p->npins == p->cap_pins) {
+        uint32_t ncap = p->cap_pins ? p->cap_pins * 2 : 4;
+        topic_id_t *pins = (topic_id_t*)realloc(p->pins, ncap * sizeof(*pins));
+        if (pins) { p->pins = pins; p->cap_pins = ncap; }
+        else      err = "out of memory";
+    }
+    if (!err && id == TOPIC_NONE && (id = topic_intern(&registry.ix, name, len)) == TOPIC_NONE)
+        err = "out of memory";
+    if (err) {
+        if (!p->nsubs && !p->npins) peer_free(p);  // dirección recién creada
+        reply_err(s, src, 1, err);
+        return;
+    }
+    topic_pin(&registry.ix, id);
+    p->pins[p->npins++] = id;
+    reply_ok(s, src, 1, "TOPIC", id);
+}
+
+/**
+ * @brief PING: renueva el lease de src y responde "PONG <n>" (o FRAME_PONG)
+ *        con las suscripciones que tiene; 0 si el broker no la conoce.
+ *
+ * Solo lee la tabla: corre con el lock de lectura, a la par de los PUB.
+ */
+static void do_ping(socket_t s, const struct sockaddr_in *src, int binary) {
+    peer_t *p = peer_find(src);
+    uint32_t n = 0;
+    if (p) {
+        peer_touch(p);
+        n = p->nsubs;
+    }
+    if (binary) {
+        unsigned char cnt[FRAME_SEQ_LEN];
+        frame_put32(cnt, n);
+        (void)udp_sendto_frame(s, FRAME_PONG, FRAME_NO_TOPIC, NULL, 0, (const char*)cnt,
+                               FRAME_SEQ_LEN, src);
+    } else {
+        char pong[32];
+        snprintf(pong, sizeof(pong), "PONG %u\n", n);
+        (void)udp_sendto_str(s, pong, src);
+    }
+}
+
+/**
+ * @brief Métricas de todos los workers (common/stats.h) y las de la tabla.
+ *
+ * Lee peers y tópicos: corre con el lock de la tabla tomado (ver http_stats()).
+ */
+static void render_stats(stats_buf_t *b, void *arg) {
+    (void)arg;
+    stats_render(b, "pubsub_udp", stats, nworkers, now_us() / 1000000);
+    stats_put(b, "pubsub_udp_peers", "gauge", "Direcciones con suscripciones.", NULL, npeers);
+    stats_put(b, "pubsub_udp_topics", "gauge", "Tópicos internados.", NULL, topic_count(&registry.ix));
+    stats_put(b, "pubsub_udp_history_topics", "gauge", "Tópicos retenidos (RSUB, -H o -D).", NULL,
+              atomic_load_explicit(&history.count, memory_order_relaxed));
+    stats_put(b, "pubsub_udp_history_refused_total", "counter",
+              "Tópicos nuevos sin retener por superar -N.", NULL,
+              (uint64_t)atomic_load_explicit(&history.refused, memory_order_relaxed));
+}
+
+/**
+ * @brief render_stats() desde el hilo HTTP de -M, con el lock de lectura.
+ */
+static void http_stats(stats_buf_t *b, void *arg) {
+    table_lock(0);
+    render_stats(b, arg);
+    table_unlock(0);
+}
+
+/**
+ * @brief STATS: responde las métricas del broker y las suscripciones de src.
+ *
+ * El texto se parte en datagramas de hasta STATS_DGRAM bytes, siempre entre
+ * líneas: en texto son líneas "STAT ..." y el último termina con "END\n"; en
+ * binario cada parte va en una trama FRAME_STATS y una vacía cierra la
+ * respuesta. UDP no garantiza que lleguen todas ni en orden.
+ *
+ * Solo lee la tabla: corre con el lock de lectura, a la par de los PUB.
+ */
+static void do_stats(socket_t s, const struct sockaddr_in *src, int binary) {
+    stats_buf_t b;
+    peer_t *p = peer_find(src);
+    stats_buf_init(&b, binary ? STATS_PLAIN : STATS_LINES);
+    render_stats(&b, NULL);
+    stats_put(&b, "pubsub_udp_peer_subscriptions", "gauge", "Suscripciones de la dirección.", NULL,
+              p ? p->nsubs : 0);
+    if (!binary) stats_printf(&b, "END\n");
+    if (b.oom) {
+        stats_buf_free(&b);
+        reply_err(s, src, binary, "out of memory");
+        return;
+    }
+
+    for (size_t off = 0; off < b.len; ) {
+        size_t n = b.len - off;
+        if (n > STATS_DGRAM) {  // corta después del último '\n' que entra
+            n = STATS_DGRAM;
+            while (n > 1 && b.data[off + n - 1] != '\n') n--;
+        }
+        if (binary)
+            (void)udp_sendto_frame(s, FRAME_STATS, FRAME_NO_TOPIC, NULL, 0, b.data + off,
+                                   (uint32_t)n, src);
+        else
+            (void)udp_sendto_buf(s, b.data + off, (int)n, src);
+        off += n;
+    }
+    if (binary) (void)udp_sendto_frame(s, FRAME_STATS, FRAME_NO_TOPIC, NULL, 0, NULL, 0, src);
+    stats_buf_free(&b);
+}
+
+/**
+ * @brief TRACE: pide el volcado de la traza (lo escribe el hilo de
+ *        common/trace.c) y responde "OK TRACE" o FRAME_OK; sin PUBSUB_TRACE,
+ *        "ERR trace disabled".
+ */
+static void do_trace(socket_t s, const struct sockaddr_in *src, int binary) {
+    if (TRACE_REQUEST() != 0) { reply_err(s, src, binary, "trace disabled"); return; }
+    if (binary) (void)udp_sendto_frame(s, FRAME_OK, FRAME_NO_TOPIC, NULL, 0, NULL, 0, src);
+    else        (void)udp_sendto_str(s, "OK TRACE\n", src);
+}
+
+/**
+ * @brief PUB en cualquiera de los dos formatos.
+ */
+static void do_pub(socket_t s, const struct sockaddr_in *src, int binary, topic_id_t id,
+                   const char *topic, const char *payload, int plen) {
+    if (strpbrk(topic, "+#")) {  // se publica en tópicos concretos, no en patrones
+        reply_err(s, src, binary, "invalid topic");
+        return;
+    }
+    broadcast_topic(id, topic, payload, plen, s);
+}
+
+/**
+ * @brief Copia el nombre de una trama a name (terminado en '\0').
+ * @return 0 si ok, -1 si está vacío, excede MAX_TOPIC o contiene '\0'.
+ */
+static int frame_topic(const frame_t *f, char *name) {
+    if (f->name_len == 0 || f->name_len >= MAX_TOPIC) return -1;
+    if (memchr(f->name, '\0', f->name_len)) return -1;
+    memcpy(name, f->name, f->name_len);
+    name[f->name_len] = '\0';
+    return 0;
+}
+
+/**
+ * @brief id de la trama si es un topic existente, o TOPIC_NONE (también si
+ *        el id ya fue liberado).
+ */
+static topic_id_t frame_topic_id(const frame_t *f) {
+    if (f->topic == FRAME_NO_TOPIC || !topic_valid(&registry.ix, (topic_id_t)f->topic)) return TOPIC_NONE;
+    return (topic_id_t)f->topic;
+}
+
+/**
+ * @brief Procesa un datagrama con una trama binaria (ver common/frame.h).
+ *
+ * UNSUB y PUB aceptan el topic por id (el que devolvió OK) o por nombre. Un
+ * SUB o RSUB con payload trae el número desde el que se pide el historial.
+ */
+static void handle_frame(socket_t s, const struct sockaddr_in *src, const char *buf, int n) {
+    frame_t f = {0};
+    char name[MAX_TOPIC];
+    topic_id_t id;
+
+    if (frame_decode(buf, n, &f) != n) {  // el datagrama debe ser exactamente una trama
+        reply_err(s, src, 1, "bad frame");
+        return;
+    }
+
+    switch (f.op) {
+    case FRAME_SUB:
+    case FRAME_RSUB:
+        if (frame_topic(&f, name) != 0) { reply_err(s, src, 1, "invalid topic"); return; }
+        do_sub(s, src, 1, name, f.op == FRAME_RSUB, f.len >= FRAME_SEQ_LEN,
+               f.len >= FRAME_SEQ_LEN ? frame_get32((const unsigned char*)f.payload) : 0);
+        break;
+
+    case FRAME_NACK:
+        if (f.len < 2 * FRAME_SEQ_LEN) { reply_err(s, src, 1, "bad sequence"); return; }
+        id = frame_topic_id(&f);
+        if (id == TOPIC_NONE && frame_topic(&f, name) == 0)
+            id = topic_lookup(&registry.ix, name, (int)strlen(name));
+        do_nack(s, src, 1, id, frame_get32((const unsigned char*)f.payload),
+                frame_get32((const unsigned char*)f.payload + FRAME_SEQ_LEN));
+        break;
+
+    case FRAME_UNSUB:
+        id = frame_topic_id(&f);
+        if (id == TOPIC_NONE && frame_topic(&f, name) == 0)
+            id = topic_lookup(&registry.ix, name, (int)strlen(name));
+        do_unsub(s, src, 1, id);
+        break;
+
+    case FRAME_PING:
+        do_ping(s, src, 1);
+        break;
+
+    case FRAME_STATS:
+        do_stats(s, src, 1);
+        break;
+
+    case FRAME_TRACE:
+        do_trace(s, src, 1);
+        break;
+
+    case FRAME_TOPIC:
+        if (frame_topic(&f, name) != 0 || topic_classify(name, (int)strlen(name)) != 0) {
+            reply_err(s, src, 1, "invalid topic");
+            return;
+        }
+        do_topic(s, src, name);
+        break;
+
+    case FRAME_PUB:
+    case FRAME_SPUB: {
+        const char *payload = f.payload;
+        int plen = (int)f.len;
+        if (f.op == FRAME_SPUB) {
+            if (plen < FRAME_SEQ_LEN) { reply_err(s, src, 1, "bad sequence"); return; }
+            payload += FRAME_SEQ_LEN;
+            plen    -= FRAME_SEQ_LEN;
+        }
+        uint32_t acked = 0;
+        if (f.op == FRAME_SPUB && !spub_arrived(src, frame_get32((const unsigned char*)f.payload), &acked)) {
+            note_ack(src, 1, acked);  // retransmisión de uno que ya llegó: solo el ACK
+            break;
+        }
+        id = frame_topic_id(&f);
+        if (id != TOPIC_NONE)
+            do_pub(s, src, 1, id, topic_name(&registry.ix, id), payload, plen);
+        else if (frame_topic(&f, name) == 0)
+            do_pub(s, src, 1, TOPIC_NONE, name, payload, plen);
+        else
+            reply_err(s, src, 1, "invalid topic");
+        if (f.op == FRAME_SPUB) note_ack(src, 1, acked);
+        break;
+    }
+
+    default:
+        reply_err(s, src, 1, "unknown command");
+    }
+}
+
+/**
+ * @brief 1 si el tópico de un comando de texto cabe en MAX_TOPIC, el mismo
+ *        límite que frame_topic() aplica a las tramas.
+ *
+ * Se valida una sola vez y el nombre completo es el que se usa en todas partes
+ * (índice, historial, NACK): nunca se recorta.
+ */
+static int text_topic_ok(const text_cmd_t *cmd) {
+    return cmd->topic_len < MAX_TOPIC;
+}
+
+/**
+ * @brief Procesa un datagrama de texto (una línea de comando), ya analizado
+ *        por text_parse().
+ */
+static void handle_text(socket_t s, const struct sockaddr_in *src, text_cmd_t *cmd) {
+    switch (cmd->op) {
+    case TEXT_SUB:
+    case TEXT_RSUB:
+        if (cmd->err) { reply_err(s, src, 0, "bad sequence"); return; }
+        if (!text_topic_ok(cmd)) { reply_err(s, src, 0, "invalid topic"); return; }
+        do_sub(s, src, 0, cmd->topic, cmd->op == TEXT_RSUB, cmd->has_seq, cmd->seq);
+        break;
+
+    case TEXT_NACK:
+        if (cmd->err) { reply_err(s, src, 0, "bad sequence"); return; }
+        do_nack(s, src, 0, topic_lookup(&registry.ix, cmd->topic, cmd->topic_len),
+                cmd->seq, cmd->seq2);
+        break;
+
+    case TEXT_UNSUB:
+        do_unsub(s, src, 0, text_topic_ok(cmd) ? topic_lookup(&registry.ix, cmd->topic, cmd->topic_len)
+                                               : TOPIC_NONE);
+        break;
+
+    case TEXT_PING:
+        do_ping(s, src, 0);
+        break;
+
+    case TEXT_STATS:
+        do_stats(s, src, 0);
+        break;
+
+    case TEXT_TRACE:
+        do_trace(s, src, 0);
+        break;
+
+    case TEXT_PUB:
+        if (cmd->err) return;
+        if (!text_topic_ok(cmd)) { reply_err(s, src, 0, "invalid topic"); return; }
+        do_pub(s, src, 0, TOPIC_NONE, cmd->topic, cmd->payload, cmd->plen);
+        break;
+
+    case TEXT_SPUB: {
+        if (cmd->err == TEXT_BAD_SEQ) { reply_err(s, src, 0, "bad sequence"); return; }
+        if (cmd->err) return;
+        uint32_t acked;
+        if (spub_arrived(src, cmd->seq, &acked)) {  // una retransmisión solo recibe el ACK
+            if (text_topic_ok(cmd)) do_pub(s, src, 0, TOPIC_NONE, cmd->topic, cmd->payload, cmd->plen);
+            else                    reply_err(s, src, 0, "invalid topic");
+        }
+        note_ack(src, 0, acked);
+        break;
+    }
+
+    default:
+        reply_err(s, src, 0, "unknown command");
+    }
+}
+
+/**
+ * @brief 1 si la trama es un PUB, SPUB, NACK, PING, STATS o TRACE: solo lee la tabla.
+ */
+static int frame_read_only(const char *buf, int n) {
+    return n > 1 && (buf[1] == FRAME_PUB || buf[1] == FRAME_SPUB || buf[1] == FRAME_NACK
+                     || buf[1] == FRAME_PING || buf[1] == FRAME_STATS || buf[1] == FRAME_TRACE);
+}
+
+/**
+ * @brief 1 si el comando de texto es un PUB, SPUB, NACK, PING, STATS o TRACE: solo lee la tabla.
+ */
+static int text_read_only(const text_cmd_t *cmd) {
+    return cmd->op == TEXT_PUB || cmd->op == TEXT_SPUB || cmd->op == TEXT_NACK
+        || cmd->op == TEXT_PING || cmd->op == TEXT_STATS || cmd->op == TEXT_TRACE;
+}
+
+/* ------------------------------------------------------------------------- */
+/*  Snapshot de la tabla de suscriptores (-P)                                */
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Formato (enteros en orden de red, como las tramas):
+ *
+ *   cabecera:      "PSUBSNP1" | tópicos u32 | suscripciones u32 | bytes de tópicos u32
+ *   cada tópico:   próximo número u32 | publicados desde el snapshot anterior u32 |
+ *                  largo u16 | nombre, alineado a 4
+ *   cada suscripción (SNAP_SUB bytes): tópico u32 (posición en la lista de
+ *                  arriba) | IPv4 | puerto | flags (SNAP_BINARY, SNAP_RELIABLE) | 0
+ *
+ * Próximo número 0 = el tópico no numera (sin historial ni suscriptores
+ * confiables). Se escribe en <archivo>.tmp y se renombra: quien lo lee ve
+ * siempre un snapshot completo.
+ */
+#define SNAP_MAGIC      "PSUBSNP1"
+#define SNAP_HDR        20
+#define SNAP_SUB        12
+#define SNAP_BINARY     1
+#define SNAP_RELIABLE   2
+#define SNAP_SEQ_MARGIN 1024  ///< Salto mínimo de la numeración al recuperar.
+#ifdef MAP_POPULATE
+  #define SNAP_MAP_FLAGS MAP_POPULATE  ///< Lee el archivo entero al mapear (Linux): sin fallos de página al cargar.
+#else
+  #define SNAP_MAP_FLAGS 0
+#endif
+
+/**
+ * @brief Buffer creciente donde se arma el snapshot.
+ */
+typedef struct {
+    char  *data;
+    size_t len, cap;
+} snap_buf_t;
+
+static int snap_reserve(snap_buf_t *b, size_t n) {
+    if (b->len + n <= b->cap) return 0;
+    size_t cap = b->cap ? b->cap : 4096;
+    while (cap < b->len + n) cap *= 2;
+    char *d = (char*)realloc(b->data, cap);
+    if (!d) return -1;
+    b->data = d;
+    b->cap  = cap;
+    return 0;
+}
+
+/**
+ * @brief Agrega el registro de un tópico, con su numeración si la tiene.
+ */
+static int snap_put_topic(snap_buf_t *b, const char *name, int len, retained_topic_t *rt) {
+    uint32_t next = 0, recent = 0;
+    if (rt) {
+        mutex_lock(&rt->lock);
+        next   = retained_next_locked(rt);
+        recent = rt->snap_next ? next - rt->snap_next : 0;
+        rt->snap_next = next;
+        mutex_unlock(&rt->lock);
+    }
+    size_t n = (10 + (size_t)len + 3) & ~(size_t)3;
+    if (snap_reserve(b, n) != 0) return -1;
+    unsigned char *p = (unsigned char*)b->data + b->len;
+    memset(p, 0, n);
+    frame_put32(p, next);
+    frame_put32(p + 4, recent);
+    frame_put16(p + 8, (uint16_t)len);
+    memcpy(p + 10, name, len);
+    b->len += n;
+    return 0;
+}
+
+/**
+ * @brief Arma el snapshot de la tabla en b.
+ *
+ * Con el lock de lectura de la tabla: los PUB siguen saliendo mientras se
+ * recorre; solo esperan los SUB/UNSUB.
+ * @return 0 si ok, -1 si no hay memoria.
+ */
+static int snap_build(snap_buf_t *b) {
+    b->len = 0;
+    if (snap_reserve(b, SNAP_HDR) != 0) return -1;
+    b->len = SNAP_HDR;
+
+    table_lock(0);
+    uint32_t nix = registry.ix.ntopics, ntopics = 0, nsubs = 0;
+    uint32_t *pos = (uint32_t*)calloc(nix ? nix : 1, sizeof(*pos));  // posición + 1 (0 = aún no)
+    int rc = pos ? 0 : -1;
+
+    // Tópicos con suscriptores, y después los que solo numeran (historial)
+    for (uint32_t k = 0; k < npeer_buckets && rc == 0; k++) {
+        for (peer_t *p = peers[k]; p && rc == 0; p = p->hnext) {
+            for (sub_t *sb = p->subs; sb && rc == 0; sb = sb->pnext) {
+                topic_id_t id = sb->link->topic;
+                nsubs++;
+                if (pos[id]) continue;
+                const char *name = topic_name(&registry.ix, id);
+                int len = (int)strlen(name);
+                rc = snap_put_topic(b, name, len, retained_find(&history, name, len));
+                pos[id] = ++ntopics;
+            }
+        }
+    }
+    if (rc == 0 && atomic_load(&history.count) > 0) {
+        rwlock_rdlock(&history.lock);
+        for (uint32_t k = 0; k < history.nbuckets && rc == 0; k++) {
+            for (retained_topic_t *t = history.buckets[k]; t && rc == 0; t = t->next) {
+                topic_id_t id = topic_lookup(&registry.ix, t->name, t->len);
+                if (id != TOPIC_NONE && pos[id]) continue;
+                rc = snap_put_topic(b, t->name, t->len, t);
+                ntopics++;
+            }
+        }
+        rwlock_rdunlock(&history.lock);
+    }
+    uint32_t topic_bytes = (uint32_t)(b->len - SNAP_HDR);
+
+    // Suscripciones, en el orden de la tabla
+    if (rc == 0 && snap_reserve(b, (size_t)nsubs * SNAP_SUB) != 0) rc = -1;
+    for (uint32_t k = 0; k < npeer_buckets && rc == 0; k++) {
+        for (const peer_t *pr = peers[k]; pr; pr = pr->hnext) {
+            for (const sub_t *sb = pr->subs; sb; sb = sb->pnext) {
+                unsigned char *p = (unsigned char*)b->data + b->len;
+                frame_put32(p, pos[sb->link->topic] - 1);
+                memcpy(p + 4, &sb->addr.sin_addr.s_addr, 4);
+                memcpy(p + 8, &sb->addr.sin_port, 2);
+                p[10] = (unsigned char)((sb->binary ? SNAP_BINARY : 0) | (sb->reliable ? SNAP_RELIABLE : 0));
+                p[11] = 0;
+                b->len += SNAP_SUB;
+            }
+        }
+    }
+    table_unlock(0);
+    free(pos);
+    if (rc != 0) return -1;
+
+    unsigned char *h = (unsigned char*)b->data;
+    memcpy(h, SNAP_MAGIC, 8);
+    frame_put32(h + 8, ntopics);
+    frame_put32(h + 12, nsubs);
+    frame_put32(h + 16, topic_bytes);
+    return 0;
+}
+
+/**
+ * @brief Escribe el snapshot en <snap_path>.tmp, lo lleva a disco y lo renombra.
+ * @return 0 si ok, -1 si falló (el snapshot anterior queda intacto).
+ */
+static int snap_write(const snap_buf_t *b) {
+    char tmp[1024];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", snap_path);
+    FILE *f = fopen(tmp, "wb");
+    if (!f) { perror(tmp); return -1; }
+    int ok = fwrite(b->data, 1, b->len, f) == b->len && fflush(f) == 0;
+#ifdef _WIN32
+    ok = ok && _commit(_fileno(f)) == 0;
+#else
+    ok = ok && fsync(fileno(f)) == 0;
+#endif
+    if (fclose(f) != 0) ok = 0;
+#ifdef _WIN32
+    if (ok) remove(snap_path);  // rename() no reemplaza en Windows
+#endif
+    if (!ok || rename(tmp, snap_path) != 0) {
+        perror(snap_path);
+        remove(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Hilo que escribe el snapshot cada snap_ms, solo si la tabla o la
+ *        numeración cambiaron desde el último.
+ */
+static void *snap_writer(void *arg) {
+    (void)arg;
+    snap_buf_t cur = {0}, last = {0};
+    for (;;) {
+        thread_sleep_ms(snap_ms);
+        if (snap_build(&cur) != 0) continue;
+        if (cur.len == last.len && memcmp(cur.data, last.data, cur.len) == 0) continue;
+        if (snap_write(&cur) != 0) continue;
+        snap_buf_t t = last;
+        last = cur;
+        cur  = t;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Mapea el snapshot para leerlo (en Windows, lo lee a memoria).
+ * @return Contenido del archivo, o NULL si no existe o no se pudo leer.
+ */
+static const char *snap_map(size_t *size) {
+#ifdef _WIN32
+    FILE *f = fopen(snap_path, "rb");
+    if (!f) return NULL;
+    char *data = NULL;
+    long n = fseek(f, 0, SEEK_END) == 0 ? ftell(f) : -1;
+    if (n > 0 && fseek(f, 0, SEEK_SET) == 0 && (data = (char*)malloc((size_t)n)) != NULL
+        && fread(data, 1, (size_t)n, f) != (size_t)n) {
+        free(data);
+        data = NULL;
+    }
+    fclose(f);
+    *size = data ? (size_t)n : 0;
+    return data;
+#else
+    int fd = open(snap_path, O_RDONLY);
+    if (fd < 0) return NULL;
+    struct stat st;
+    void *p = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0)
+        p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE | SNAP_MAP_FLAGS, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) return NULL;
+    *size = (size_t)st.st_size;
+    return (const char*)p;
+#endif
+}
+
+static void snap_unmap(const char *data, size_t size) {
+#ifdef _WIN32
+    (void)size;
+    free((void*)data);
+#else
+    munmap((void*)data, size);
+#endif
+}
+
+/**
+ * @brief Valida la cabecera del snapshot.
+ * @return Suscripciones que trae, o -1 si el archivo no es un snapshot válido.
+ */
+static long snap_check(const char *data, size_t size) {
+    const unsigned char *h = (const unsigned char*)data;
+    if (size < SNAP_HDR || memcmp(h, SNAP_MAGIC, 8) != 0) return -1;
+    uint32_t nsubs = frame_get32(h + 12), topic_bytes = frame_get32(h + 16);
+    if ((uint64_t)SNAP_HDR + topic_bytes + (uint64_t)nsubs * SNAP_SUB != size) return -1;
+    return (long)nsubs;
+}
+
+/**
+ * @brief Carga el snapshot ya validado: interna los tópicos, retoma su
+ *        numeración y da de alta cada suscripción.
+ *
+ * La numeración de un tópico en memoria sigue con un salto (lo publicado
+ * entre el último snapshot y la caída ya no existe): el doble de lo que se
+ * publicó en el último período, y al menos SNAP_SEQ_MARGIN. Un suscriptor
+ * confiable ve ese salto como un hueco y recibe LOST. Con -D el log ya trae
+ * la numeración exacta. Cada dirección arranca con un lease completo.
+ * @return Suscripciones cargadas.
+ */
+static long snap_load(const char *data, size_t size) {
+    const unsigned char *h = (const unsigned char*)data;
+    uint32_t ntopics = frame_get32(h + 8), nsubs = frame_get32(h + 12);
+    const unsigned char *p = h + SNAP_HDR, *end = p + frame_get32(h + 16);
+    topic_id_t *ids = (topic_id_t*)malloc((ntopics ? ntopics : 1) * sizeof(*ids));
+    if (!ids) return 0;
+
+    for (uint32_t i = 0; i < ntopics; i++) {
+        ids[i] = TOPIC_NONE;
+        if (end - p < 10) break;
+        uint32_t next = frame_get32(p), recent = frame_get32(p + 4);
+        int len = frame_get16(p + 8);
+        size_t n = (10 + (size_t)len + 3) & ~(size_t)3;
+        if ((size_t)(end - p) < n) break;
+        const char *name = (const char*)p + 10;
+        p += n;
+        if (len >= MAX_TOPIC || topic_classify(name, len) < 0) continue;
+
+        ids[i] = topic_intern(&registry.ix, name, len);
+        retained_topic_t *rt = next ? retained_get(&history, name, len) : NULL;
+        if (rt && next > 1) {
+            uint32_t skip = recent > SNAP_SEQ_MARGIN / 2 ? 2 * recent : SNAP_SEQ_MARGIN;
+            retained_resume(rt, next + skip);
+        }
+    }
+
+    long loaded = 0;
+    const unsigned char *q = (const unsigned char*)data + size - (size_t)nsubs * SNAP_SUB;
+    for (uint32_t i = 0; i < nsubs; i++, q += SNAP_SUB) {
+        uint32_t t = frame_get32(q);
+        if (t >= ntopics || ids[t] == TOPIC_NONE) continue;
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        memcpy(&addr.sin_addr.s_addr, q + 4, 4);
+        memcpy(&addr.sin_port, q + 8, 2);
+        peer_t *pr = peer_get(&addr);
+        if (!pr || sub_insert(ids[t], pr, q[10] & SNAP_BINARY ? 1 : 0, q[10] & SNAP_RELIABLE ? 1 : 0) != 0)
+            break;
+        loaded++;
+    }
+    for (uint32_t i = 0; i < ntopics; i++)  // los que quedaron sin suscriptores (solo historial)
+        if (ids[i] != TOPIC_NONE) (void)topic_release(&registry.ix, ids[i]);
+    free(ids);
+    return loaded;
+}
+
+/**
+ * @brief Avanza la rueda de leases hasta ahora y da de baja las direcciones vencidas.
+ *
+ * Toma el lock de escritura (si la tabla se comparte) solo lo que dura la
+ * vuelta: sin vencimientos es O(1), y cada dirección vencida cuesta O(sus
+ * suscripciones).
+ */
+static void lease_advance(void) {
+    lease_reap_t r = { lease_now(), 0, 0 };
+    table_lock(1);
+    (void)tw_advance(&leases, r.now, lease_expired, &r);
+    table_unlock(1);
+    if (r.peers)
+        fprintf(stderr, "[broker-udp] leases vencidos: %ld direcciones, %ld suscripciones\n",
+                r.peers, r.subs);
+}
+
+/**
+ * @brief Con un solo worker, acota la espera de datagramas en s al próximo
+ *        vencimiento de la rueda de leases.
+ *
+ * El plazo de SO_RCVTIMEO se cambia solo si el vigente se pasaría más de un
+ * tick o si el próximo vencimiento se alejó: a lo sumo un setsockopt() cada
+ * LEASE_TICK_MS, no uno por lote.
+ *
+ * @param cur Plazo puesto en s, en ms (0 = sin límite); se actualiza.
+ */
+static void lease_wait(socket_t s, int *cur) {
+    int64_t n = tw_next(&leases);
+    int ms = 0;
+    if (n >= 0) {
+        double w = (double)((leases.now + (uint64_t)n) * LEASE_TICK_MS) - now_ms();
+        ms = w < 1 ? 1 : w > 60000 ? 60000 : (int)w;
+    }
+    if (ms == 0 ? *cur == 0 : *cur != 0 && ms <= *cur && ms >= *cur - LEASE_TICK_MS) return;
+    if (udp_set_recv_timeout(s, ms) == 0) *cur = ms;
+}
+
+/**
+ * @brief Ciclo de un worker: recibe lotes de datagramas en su socket y procesa
+ *        cada comando en orden.
+ *
+ * Los que empiezan con FRAME_MAGIC son tramas binarias, el resto líneas de
+ * texto. Cada comando se atiende con el lock de la tabla en el modo que necesita.
+ * El reloj se lee una vez por lote: marca los PUB (tasas por tópico) y mide
+ * cuánto tardó el lote. Con un solo worker y leases, el mismo ciclo avanza la
+ * rueda entre lote y lote (ver lease_wait()).
+ */
+static void *worker_run(void *arg) {
+    int id = (int)(intptr_t)arg;
+    udp_batch_t in;
+    if (udp_batch_init(&in, batch) != 0 || udp_sendq_init(&fanout_q, batch) != 0) {
+        fprintf(stderr, "[broker-udp] sin memoria para los lotes\n");
+        exit(1);
+    }
+
+    wstats = &stats[id];
+    TRACE_THREAD("udp worker", id);
+    loss_rng = 2463534242u + (uint32_t)id * 7919u;  // semilla fija: corridas repetibles
+    socket_t s = nworkers > 1 ? udp_bind_shared(BROKER_UDP_PORT) : udp_bind_any(BROKER_UDP_PORT);
+    if (id == 0)
+        printf("[broker-udp] escuchando UDP en puerto %d (lotes de %d, %d worker%s)...\n",
+               BROKER_UDP_PORT, batch, nworkers, nworkers > 1 ? "s" : "");
+    if (id == 0 && loss_pct > 0)
+        printf("[broker-udp] descartando a propósito el %.2f%% de los mensajes\n", loss_pct);
+
+    // Bucle principal: recibe un lote de datagramas y procesa cada comando.
+    // Con historial por reenviar no se bloquea: si no hay datagramas, reenvía.
+    int rcv_ms = 0;  // plazo de recepción puesto en s (lease_wait())
     while (1) {
-        int n = udp_recvfrom_line(s, buf, sizeof(buf), &src);
-        if (n <= 0) continue;
-
-        // --- Protocolo ---
-        // SUB <topic>
-        // PUB <topic> <mensaje...>
-        if (strncmp(buf, "SUB ", 4) == 0) {
-            const char *topic = buf + 4;
-            add_or_update_sub(topic, &src);
-
-            char ok[MAX_LINE];
-            snprintf(ok, sizeof(ok), "OK SUB %s\n", topic);
-            (void)udp_sendto_str(s, ok, &src);
-
-        } else if (strncmp(buf, "PUB ", 4) == 0) {
-            char *p = buf + 4;
-            char *sp = strchr(p, ' ');
-            if (!sp) continue;
-            *sp = '\0';
-
-            const char *topic   = p;
-            const char *payload = sp + 1;
-            broadcast_topic(topic, payload, s);
+        if (lease_inline) lease_wait(s, &rcv_ms);
+        int k = nreplays > 0 && udp_wait_readable(s, 0) <= 0 ? 0 : udp_recv_batch(s, &in);
+        if (k > 0) {
+            batch_us = now_us();
+            stats_max(&wstats->c[STATS_QUEUE_HWM], (uint64_t)k);
+            TRACE_BEGIN(TRACE_BATCH);
+        }
+        for (int i=0; i<k; i++) {
+            char *buf = udp_batch_buf(&in, i);
+            if (in.len[i] <= 0) continue;
 
-        } else {
-            const char *err = "ERR unknown command\n";
-            (void)udp_sendto_str(s, err, &src);
+            if ((unsigned char)buf[0] == FRAME_MAGIC) {
+                int write = !frame_read_only(buf, in.len[i]);
+                table_lock(write);
+                TRACE_BEGIN(TRACE_HANDLE);
+                handle_frame(s, &in.src[i], buf, in.len[i]);
+                TRACE_END(TRACE_HANDLE, in.len[i] > 1 ? (unsigned char)buf[1] : 0);
+                table_unlock(write);
+                nack_step(s);
+            } else {
+                // Una sola pasada por la línea (cortada en MAX_LINE), que decide también el lock
+                text_cmd_t cmd;
+                TRACE_BEGIN(TRACE_PARSE);
+                text_parse(buf, in.len[i] < MAX_LINE ? in.len[i] : MAX_LINE - 1, 1, &cmd);
+                TRACE_END(TRACE_PARSE, in.len[i]);
+                int write = !text_read_only(&cmd);
+                table_lock(write);
+                TRACE_BEGIN(TRACE_HANDLE);
+                handle_text(s, &in.src[i], &cmd);
+                TRACE_END(TRACE_HANDLE, cmd.op);
+                table_unlock(write);
+                nack_step(s);
+            }
+            if (nreplays > 0) replay_step(s);  // el historial empieza antes que lo que sigue en el lote
+        }
+        flush_acks(s);  // fuera del lock: la lista es del worker
+        if (k > 0) {
+            stats_hist_add(&wstats->batch_us, now_us() - batch_us);
+            TRACE_END(TRACE_BATCH, k);
         }
+        if (nreplays > 0) replay_step(s);
+        if (lease_inline && lease_now() != leases.now) lease_advance();
     }
 
     udp_close(s);
+    udp_batch_free(&in);
+    udp_sendq_free(&fanout_q);
+    return NULL;
+}
+
+/**
+ * @brief Hilo de la política por tiempo (-T): lleva a disco lo agregado a los
+ *        logs cada tantos ms, mientras viva el broker.
+ */
+static void *log_syncer(void *arg) {
+    (void)arg;
+    for (;;) {
+        thread_sleep_ms((int)log_sync.every_ms);
+        retained_sync_all(&history);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Hilo de los leases (-l, varios workers): avanza la rueda cada
+ *        LEASE_TICK_MS (ver lease_advance()).
+ */
+static void *lease_reaper(void *arg) {
+    (void)arg;
+    for (;;) {
+        thread_sleep_ms(LEASE_TICK_MS);
+        lease_advance();
+    }
+    return NULL;
+}
+
+/**
+ * @brief Programa principal: prepara la tabla compartida y lanza los workers.
+ */
+int main(int argc, char **argv) {
+    for (int i=1; i<argc; i++) {
+        if (strcmp(argv[i], "-m") == 0 && i+1 < argc && atoi(argv[i+1]) > 0
+            && atoi(argv[i+1]) <= UDP_BATCH_MAX) {
+            batch = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-t") == 0 && i+1 < argc && atoi(argv[i+1]) >= 0
+                   && atoi(argv[i+1]) <= REGISTRY_MAX_WORKERS) {
+            nworkers = atoi(argv[++i]);
+            if (nworkers == 0) nworkers = cpu_count();
+            if (nworkers > REGISTRY_MAX_WORKERS) {  // -t 0 con más núcleos que el máximo
+                fprintf(stderr, "[broker-udp] %d núcleos: se usan %d workers (el máximo)\n",
+                        nworkers, REGISTRY_MAX_WORKERS);
+                nworkers = REGISTRY_MAX_WORKERS;
+            }
+        } else if (strcmp(argv[i], "-R") == 0 && i+1 < argc && atoi(argv[i+1]) > 0) {
+            rel_slots = (uint32_t)atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-L") == 0 && i+1 < argc && atof(argv[i+1]) >= 0
+                   && atof(argv[i+1]) < 100) {
+            loss_pct = atof(argv[++i]);
+        } else if (strcmp(argv[i], "-H") == 0 && i+1 < argc && atol(argv[i+1]) > 0) {
+            history_bytes = (size_t)atol(argv[++i]);
+        } else if (strcmp(argv[i], "-N") == 0 && i+1 < argc && atol(argv[i+1]) >= 0) {
+            history_topics = (uint32_t)atol(argv[++i]);
+        } else if (strcmp(argv[i], "-D") == 0 && i+1 < argc) {
+            log_dir = argv[++i];
+        } else if (strcmp(argv[i], "-C") == 0 && i+1 < argc && atoll(argv[i+1]) >= 0) {
+            log_keep = (size_t)atoll(argv[++i]);
+        } else if (strcmp(argv[i], "-S") == 0 && i+1 < argc && atoi(argv[i+1]) > 0) {
+            log_sync.every_msgs = (uint32_t)atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-T") == 0 && i+1 < argc && atoi(argv[i+1]) > 0) {
+            log_sync.every_ms = (uint32_t)atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-P") == 0 && i+1 < argc) {
+            snap_path = argv[++i];
+        } else if (strcmp(argv[i], "-W") == 0 && i+1 < argc && atoi(argv[i+1]) > 0) {
+            snap_ms = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-l") == 0 && i+1 < argc && atoi(argv[i+1]) >= 0
+                   && atoi(argv[i+1]) <= 7 * 24 * 3600) {
+            lease_ticks = (uint32_t)atoi(argv[++i]) * (1000 / LEASE_TICK_MS);
+        } else if (strcmp(argv[i], "-M") == 0 && i+1 < argc && atoi(argv[i+1]) > 0
+                   && atoi(argv[i+1]) <= 65535) {
+            metrics_port = atoi(argv[++i]);
+        } else {
+            fprintf(stderr, "Uso: %s [-m datagramas(1..%d)] [-t workers(0..%d)] [-R mensajes] "
+                            "[-L porcentaje] [-H bytes] [-N tópicos] [-D dir [-C bytes] [-S mensajes] [-T ms]] "
+                            "[-P archivo [-W ms]] [-l segundos] [-M puerto]\n",
+                    argv[0], UDP_BATCH_MAX, REGISTRY_MAX_WORKERS);
+            return 1;
+        }
+    }
+    if (log_dir && !MSG_LOG_SUPPORTED) {
+        fprintf(stderr, "[broker-udp] -D requiere mmap (POSIX)\n");
+        return 1;
+    }
+    history_on = history_bytes || log_dir;
+    if (nworkers > 1 && !UDP_HAVE_REUSEPORT) {
+        fprintf(stderr, "[broker-udp] -t > 1 requiere SO_REUSEPORT (Linux)\n");
+        return 1;
+    }
+
+    if (winsock_init() != 0) return 1;
+
+    // Con un snapshot válido la tabla de direcciones arranca del tamaño que necesita
+    size_t snap_size = 0;
+    const char *snap = snap_path ? snap_map(&snap_size) : NULL;
+    long snap_subs = snap ? snap_check(snap, snap_size) : 0;
+    if (snap_subs < 0) {
+        fprintf(stderr, "[broker-udp] %s no es un snapshot válido, se ignora\n", snap_path);
+        snap_unmap(snap, snap_size);
+        snap = NULL;
+        snap_subs = 0;
+    }
+    if (peers_init((size_t)snap_subs) != 0) {
+        fprintf(stderr, "[broker-udp] sin memoria para la tabla de suscriptores\n");
+        return 1;
+    }
+    tw_init(&leases, lease_now());
+    table_shared = nworkers > 1 || snap_path != NULL || metrics_port > 0;
+    lease_inline = lease_ticks > 0 && nworkers == 1;
+    topic_registry_init(&registry);
+    if (retained_init(&history, rel_slots, history_bytes ? history_bytes : REL_BYTES) != 0) {
+        fprintf(stderr, "[broker-udp] sin memoria para el historial\n");
+        return 1;
+    }
+    retained_set_max(&history, history_topics);
+    if (log_dir) {
+        retained_set_log(&history, log_dir, 0, log_keep, &log_sync);
+        fprintf(stderr, "[broker-udp] log en %s: %d topics recuperados\n", log_dir, retained_load(&history));
+        thread_t syncer;
+        if (log_sync.every_ms && thread_start(&syncer, log_syncer, NULL) != 0) {
+            fprintf(stderr, "[broker-udp] no se pudo lanzar el hilo de sincronización\n");
+            return 1;
+        }
+    }
+
+    // Suscriptores del snapshot: reciben los PUB apenas arranca el primer worker
+    if (snap) {
+        double t0 = now_ms();
+        long n = snap_load(snap, snap_size);
+        snap_unmap(snap, snap_size);
+        fprintf(stderr, "[broker-udp] snapshot %s: %ld suscripciones en %.1f ms\n",
+                snap_path, n, now_ms() - t0);
+    }
+    if (lease_ticks && !lease_inline) {
+        thread_t reaper;
+        if (thread_start(&reaper, lease_reaper, NULL) != 0) {
+            fprintf(stderr, "[broker-udp] no se pudo lanzar el hilo de los leases\n");
+            return 1;
+        }
+    }
+    if (metrics_port) {
+        if (stats_http_start(metrics_port, http_stats, NULL) != 0) {
+            fprintf(stderr, "[broker-udp] no se pudo abrir el puerto de métricas %d\n", metrics_port);
+            return 1;
+        }
+        printf("[broker-udp] métricas en http://0.0.0.0:%d/metrics\n", metrics_port);
+    }
+    if (TRACE_START("broker_udp") != 0) {
+        fprintf(stderr, "[broker-udp] no se pudo lanzar el hilo de la traza\n");
+        return 1;
+    }
+    if (snap_path) {
+        thread_t writer;
+        if (thread_start(&writer, snap_writer, NULL) != 0) {
+            fprintf(stderr, "[broker-udp] no se pudo lanzar el hilo del snapshot\n");
+            return 1;
+        }
+    }
+
+    thread_t threads[REGISTRY_MAX_WORKERS];
+    for (int w=1; w<nworkers; w++) {
+        if (thread_start(&threads[w], worker_run, (void*)(intptr_t)w) != 0) {
+            fprintf(stderr, "[broker-udp] no se pudo lanzar el worker %d\n", w);
+            return 1;
+        }
+    }
+
+    // El hilo principal es el worker 0
+    worker_run((void*)(intptr_t)0);
+
+    for (int w=1; w<nworkers; w++) thread_join(threads[w]);
+    topic_registry_free(&registry);
+    free(peers);
+    pool_destroy(&sub_pool);
+    pool_destroy(&peer_pool);
+    retained_free(&history);
     winsock_cleanup();
     return 0;
 }
@@ -17,9 +17,27 @@
  * El broker UDP recibe este mensaje y lo retransmite a todos los suscriptores
  * registrados en ese topic.
  *
+ * Con `-B` el datagrama es una trama binaria FRAME_PUB (common/frame.h): el
+ * payload viaja crudo. Si el mensaje es `-`, se lee de la entrada estándar
+ * (datos binarios, hasta lo que quepa en un datagrama).
+ *
+ * **Modo continuo** (`-f <archivo|->`): publica un datagrama por cada línea
+ * ("<topic> <mensaje...>", o solo el mensaje si se dio <topic>). Con
+ * `-a <ventana>` (hasta UDP_ACK_WINDOW) usa SPUB / FRAME_SPUB con un número de
+ * secuencia creciente y no deja más de <ventana> datagramas sin confirmar: al
+ * llenarse espera un ACK del broker. El ACK es acumulativo (el broker
+ * confirma el mayor número hasta el que le llegaron todos), así que se
+ * guarda una copia de cada datagrama hasta que lo cubre un ACK. Si pasan
+ * ACK_TIMEOUT_MS sin ACK nuevo se retransmite lo pendiente (el broker no
+ * publica dos veces el mismo número); tras ACK_RETRIES intentos lo pendiente
+ * se da por no confirmado y se sigue. Al final informa enviados,
+ * confirmados, retransmitidos y no confirmados.
+ *
  * **Uso:**
  * @code
- *   publisher_udp.exe 127.0.0.1 PartidoA "Gol EquipoA min32"
+ *   publisher_udp.exe [-B] 127.0.0.1 PartidoA "Gol EquipoA min32"
+ *   publisher_udp.exe -B 127.0.0.1 PartidoA - < datos.bin
+ *   publisher_udp.exe [-B] [-a ventana] -f eventos.txt 127.0.0.1 [PartidoA]
  * @endcode
  *
  * **Compilación:**
@@ -28,7 +46,7 @@
  * @endcode
  *
  * **Notas:**
- *  - No hay confirmación del broker: el envío es “fire and forget”.
+ *  - Sin -a no hay confirmación del broker: el envío es “fire and forget”.
  *  - UDP no garantiza entrega ni orden de los datagramas.
  *  - Ideal para análisis de pérdida de paquetes en Wireshark.
  */
@@ -39,12 +57,177 @@
 #include <string.h>
 
 // Uso:
-//   publisher_udp.exe 127.0.0.1 PartidoA "Gol EquipoA min32"
+//   publisher_udp.exe [-B] 127.0.0.1 PartidoA "Gol EquipoA min32"
+//   publisher_udp.exe [-B] [-a ventana] -f <archivo|-> 127.0.0.1 [PartidoA]
+
+/** Espera máxima por un ACK con la ventana llena (ms). */
+#define ACK_TIMEOUT_MS 200
+/** Retransmisiones de lo pendiente antes de darlo por no confirmado. */
+#define ACK_RETRIES    5
+
+/**
+ * @brief Estado del modo continuo.
+ */
+typedef struct {
+    socket_t    s;
+    struct sockaddr_in broker;
+    int         binary;
+    const char *topic;      ///< Tópico fijo, o NULL si cada línea trae el suyo.
+    long        window;     ///< -a: máximo sin confirmar (0 = PUB sin ACK).
+    uint32_t    seq;        ///< Último número enviado.
+    uint32_t    acked;      ///< Confirmados hasta este número (o abandonados tras ACK_RETRIES).
+    char      **held;       ///< Copia de cada SPUB sin confirmar (posición seq % window).
+    int        *held_len;
+    int         tries;      ///< Retransmisiones de lo pendiente sin un ACK nuevo.
+    long        sent, errs, skipped;
+    long        resent;     ///< Datagramas retransmitidos.
+    long        lost;       ///< SPUB abandonados sin confirmación.
+} stream_t;
+
+/**
+ * @brief Reenvía los SPUB que siguen sin confirmar, en orden.
+ */
+static void stream_resend(stream_t *st) {
+    for (uint32_t q = st->acked + 1; q != st->seq + 1; q++) {
+        long i = (long)(q % (uint32_t)st->window);
+        if (udp_sendto_buf(st->s, st->held[i], st->held_len[i], &st->broker) >= 0) st->resent++;
+    }
+}
+
+/**
+ * @brief Lee las respuestas del broker hasta que la ventana tenga lugar para
+ *        max_inflight.
+ *
+ * Cada ACK_TIMEOUT_MS sin un ACK nuevo retransmite lo pendiente; tras
+ * ACK_RETRIES veces lo que sigue sin confirmar cuenta en lost y la ventana
+ * se libera.
+ */
+static void stream_wait(stream_t *st, long max_inflight) {
+    static char buf[UDP_MAX_DGRAM + 1];
+    struct sockaddr_in from;
+    while ((long)(uint32_t)(st->seq - st->acked) > max_inflight) {
+        if (!udp_wait_readable(st->s, ACK_TIMEOUT_MS)) {
+            if (st->tries++ < ACK_RETRIES) {
+                stream_resend(st);
+                continue;
+            }
+            st->lost += (long)(uint32_t)(st->seq - st->acked);
+            st->acked = st->seq;
+            st->tries = 0;
+            return;
+        }
+        int n = udp_recvfrom_raw(st->s, buf, (int)sizeof(buf), &from);
+        if (n <= 0) continue;
+        uint32_t seq;
+        if ((unsigned char)buf[0] == FRAME_MAGIC) {
+            frame_t f;
+            if (frame_decode(buf, n, &f) != n) continue;
+            if (f.op == FRAME_ERR) { st->errs++; continue; }
+            if (f.op != FRAME_ACK || f.len < FRAME_SEQ_LEN) continue;
+            seq = frame_get32((const unsigned char*)f.payload);
+        } else if (strncmp(buf, "ACK ", 4) == 0) {
+            seq = (uint32_t)strtoul(buf + 4, NULL, 10);
+        } else {
+            if (strncmp(buf, "ERR", 3) == 0) st->errs++;
+            continue;
+        }
+        if (seq_after(seq, st->acked) && !seq_after(seq, st->seq)) {
+            st->acked = seq;
+            st->tries = 0;
+        }
+    }
+}
+
+/**
+ * @brief Publica una línea de entrada (sin '\n') en un datagrama.
+ */
+static void stream_send(stream_t *st, char *line) {
+    static char out[UDP_MAX_DGRAM];
+    const char *topic = st->topic, *msg = line;
+    if (!topic) {
+        char *sp = strchr(line, ' ');
+        if (!sp) { st->skipped++; return; }
+        *sp = '\0';
+        topic = line;
+        msg   = sp + 1;
+    }
+    int tlen = (int)strlen(topic), mlen = (int)strlen(msg), n;
+    if (tlen == 0 || tlen >= MAX_TOPIC) { st->skipped++; return; }
+
+    if (st->window > 0 && (long)(uint32_t)(st->seq - st->acked) >= st->window)
+        stream_wait(st, st->window - 1);
+
+    uint32_t seq = st->seq + 1;
+    if (st->binary) {
+        int slen = st->window > 0 ? FRAME_SEQ_LEN : 0;
+        if (frame_size(tlen, slen + mlen) > UDP_MAX_DGRAM) { st->skipped++; return; }
+        n = frame_encode_head(out, slen ? FRAME_SPUB : FRAME_PUB, FRAME_NO_TOPIC,
+                              topic, tlen, (uint32_t)(slen + mlen));
+        if (slen) frame_put32((unsigned char*)out + n, seq);
+        memcpy(out + n + slen, msg, mlen);
+        n += slen + mlen;
+    } else if (st->window > 0) {
+        n = snprintf(out, MAX_LINE, "SPUB %u %s %s\n", seq, topic, msg);
+    } else {
+        n = snprintf(out, MAX_LINE, "PUB %s %s\n", topic, msg);
+    }
+    if (n >= MAX_LINE && !st->binary) { n = MAX_LINE - 1; out[n - 1] = '\n'; }
+    if (st->window > 0) {
+        // Copia para retransmitir hasta que la cubra un ACK
+        long i = (long)(seq % (uint32_t)st->window);
+        char *c = (char*)realloc(st->held[i], (size_t)n);
+        if (!c) { st->skipped++; return; }
+        memcpy(c, out, (size_t)n);
+        st->held[i] = c;
+        st->held_len[i] = n;
+    }
+    if (udp_sendto_buf(st->s, out, n, &st->broker) < 0) { st->skipped++; return; }
+    if (st->window > 0) st->seq = seq;
+    st->sent++;
+}
+
+/**
+ * @brief Modo continuo: un datagrama por línea de in, luego espera los ACK finales.
+ */
+static void publish_stream(stream_t *st, FILE *in) {
+    char line[MAX_LINE];
+    while (fgets(line, sizeof(line), in)) {
+        char *eol = strpbrk(line, "\r\n");
+        if (eol) *eol = '\0';
+        if (line[0]) stream_send(st, line);
+    }
+    if (st->window > 0) stream_wait(st, 0);
+
+    fprintf(stderr, "[publisher-udp] %ld enviados", st->sent);
+    if (st->window > 0)
+        fprintf(stderr, ", %ld confirmados, %ld retransmitidos, %ld sin confirmar (ventana de %ld)",
+                st->sent - st->lost, st->resent, st->lost, st->window);
+    if (st->errs)    fprintf(stderr, ", %ld ERR del broker", st->errs);
+    if (st->skipped) fprintf(stderr, ", %ld líneas ignoradas", st->skipped);
+    fprintf(stderr, "\n");
+}
 
 int main(int argc, char **argv) {
+    int binary = 0;
+    long window = 0;
+    const char *file = NULL;
+
+    // Opciones antes de los argumentos posicionales ("-" solo es el mensaje).
+    while (argc > 1 && argv[1][0] == '-' && argv[1][1] != '\0') {
+        if (strcmp(argv[1], "-B") == 0) binary = 1;
+        else if (strcmp(argv[1], "-f") == 0 && argc > 2) { file = argv[2]; argv++; argc--; }
+        else if (strcmp(argv[1], "-a") == 0 && argc > 2 && atol(argv[2]) > 0
+                 && atol(argv[2]) <= UDP_ACK_WINDOW) {
+            window = atol(argv[2]); argv++; argc--;
+        } else break;
+        argv++; argc--;
+    }
+
     // Verificar que se proporcionen todos los argumentos necesarios.
-    if (argc < 4) {
-        fprintf(stderr, "Uso: %s <host_broker> <topic> <mensaje...>\n", argv[0]);
+    if (file ? argc < 2 || argc > 3 : argc < 4) {
+        fprintf(stderr, "Uso: %s [-B] <host_broker> <topic> <mensaje...|->\n"
+                        "     %s [-B] [-a ventana(1..%d)] -f <archivo|-> <host_broker> [topic]\n",
+                argv[0], argv[0], UDP_ACK_WINDOW);
         return 1;
     }
 
@@ -72,6 +255,48 @@ int main(int argc, char **argv) {
     // Crear socket UDP sin necesidad de bind() explícito (puerto efímero)
     socket_t s = udp_socket_unbound();
 
+    if (file) {
+        FILE *in = strcmp(file, "-") == 0 ? stdin : fopen(file, "r");
+        if (!in) { perror(file); udp_close(s); winsock_cleanup(); return 1; }
+        stream_t st;
+        memset(&st, 0, sizeof(st));
+        st.s      = s;
+        st.broker = broker;
+        st.binary = binary;
+        st.topic  = argc == 3 ? argv[2] : NULL;
+        st.window = window;
+        if (window > 0) {
+            st.held     = (char**)calloc((size_t)window, sizeof(*st.held));
+            st.held_len = (int*)calloc((size_t)window, sizeof(*st.held_len));
+            if (!st.held || !st.held_len) { perror("calloc"); return 1; }
+        }
+        publish_stream(&st, in);
+        for (long i = 0; i < window; i++) free(st.held[i]);
+        free(st.held);
+        free(st.held_len);
+        if (in != stdin) fclose(in);
+        udp_close(s);
+        winsock_cleanup();
+        return 0;
+    }
+
+    if (binary) {
+        // Payload crudo: argv o, con "-", la entrada estándar completa
+        static char data[UDP_MAX_DGRAM];
+        const char *p = payload;
+        int len = (int)strlen(payload);
+        if (argc == 4 && strcmp(argv[3], "-") == 0) {
+            len = (int)fread(data, 1, sizeof(data), stdin);
+            p = data;
+        }
+        if (udp_sendto_frame(s, FRAME_PUB, FRAME_NO_TOPIC, topic, (int)strlen(topic),
+                             p, (uint32_t)len, &broker) < 0)
+            fprintf(stderr, "No se pudo enviar la trama (%d bytes)\n", len);
+        udp_close(s);
+        winsock_cleanup();
+        return 0;
+    }
+
     // Formatear y enviar el datagrama con el comando PUB
     char out[MAX_LINE];
     snprintf(out, sizeof(out), "PUB %s %s\n", topic, payload);
@@ -7,7 +7,8 @@
  *
  * A diferencia de TCP, el suscriptor:
  *  - No mantiene una conexión persistente con el broker.
- *  - Se registra enviando un datagrama "SUB <topic>" al broker.
+ *  - Se registra enviando un datagrama "SUB <topic>" al broker por cada topic pedido
+ *    (todos desde el mismo socket, así el broker los asocia a la misma dirección).
  *  - Luego queda a la espera de datagramas "MSG <topic> <payload>" enviados por el broker.
  *
  * **Protocolo textual:**
@@ -15,9 +16,32 @@
  *  - Confirmación: `OK SUB <topic>\n`
  *  - Mensajes reenviados: `MSG <topic> <mensaje>\n`
  *
+ * Con `-B` se suscribe con tramas binarias (common/frame.h): el broker le
+ * responde y reenvía con tramas, y el payload se escribe tal cual llega.
+ *
+ * Con `-R` la suscripción es confiable (`RSUB`): cada mensaje llega como
+ * `RMSG <seq> <topic> <mensaje>` con el número de su tópico. Un salto en la
+ * numeración es un hueco: se pide de inmediato con `NACK <topic> <desde>
+ * <hasta>` y se reintenta cada NACK_RETRY_MS hasta NACK_TRIES veces; lo que
+ * el broker ya no retiene llega como `LOST` y se da por perdido. Tras
+ * PROBE_MS sin mensajes se sondea con un NACK abierto, para detectar también
+ * la pérdida de los últimos mensajes. Los recuperados se muestran al llegar
+ * (no se reordena) y al salir con Ctrl-C se informan huecos, recuperados,
+ * perdidos y la latencia de recuperación (detección del hueco -> llegada).
+ *
+ * Con `-f <seq>` se suscribe con `SUB <topic> FROM <seq>` (o `RSUB ... FROM`):
+ * el broker reenvía primero lo que retiene del tópico desde ese número y
+ * cierra con `REPLAY <topic> <seq>` (se muestra en stderr). En modo confiable
+ * la numeración arranca en <seq>, así lo ya descartado cuenta como perdido.
+ *
+ * El broker olvida una dirección que pasa un tiempo sin SUB ni PING (lease).
+ * El suscriptor manda `PING` cada -k segundos (15 por defecto, 0 = nunca); si
+ * la respuesta es `PONG 0` (venció el lease o el broker se reinició sin
+ * snapshot), vuelve a mandar el SUB de cada tópico.
+ *
  * **Uso:**
  * @code
- *   subscriber_udp.exe 127.0.0.1 PartidoA
+ *   subscriber_udp.exe [-B] [-R] [-f seq] [-k segundos] 127.0.0.1 PartidoA [PartidoB ...]
  * @endcode
  *
  * **Compilación:**
@@ -35,14 +59,434 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <signal.h>
+#include <time.h>
 
 // Uso:
-//   subscriber_udp.exe 127.0.0.1 PartidoA
+//   subscriber_udp.exe [-B] [-R] [-f seq] [-k segundos] 127.0.0.1 PartidoA [PartidoB ...]
+
+#define REL_TOPICS     64    ///< Tópicos distintos que sigue el modo confiable.
+#define MISS_MAX       4096  ///< Huecos pendientes a la vez (el resto se da por perdido).
+#define NACK_RETRY_MS  20    ///< Espera antes de repetir el NACK de un hueco.
+#define NACK_TRIES     10    ///< NACKs por hueco antes de darlo por perdido.
+#define PROBE_MS       500   ///< Silencio tras el cual se sondea la pérdida del final.
+#define LAT_SAMPLES    65536 ///< Latencias de recuperación guardadas para el percentil.
+#define PING_DEFAULT_S 15    ///< Período por defecto del PING al broker (ver -k).
+
+/** -f: número desde el que se pide el historial (NULL = sin FROM). */
+static const char *from_seq;
+
+/**
+ * @brief Envía SUB o RSUB del tópico, con FROM si se pidió historial (-f).
+ */
+static void send_sub(socket_t s, const struct sockaddr_in *broker, int binary, int reliable,
+                     const char *topic) {
+    if (binary) {
+        unsigned char from[FRAME_SEQ_LEN];
+        if (from_seq) frame_put32(from, (uint32_t)strtoul(from_seq, NULL, 10));
+        (void)udp_sendto_frame(s, reliable ? FRAME_RSUB : FRAME_SUB, FRAME_NO_TOPIC, topic,
+                               (int)strlen(topic), from_seq ? (const char*)from : NULL,
+                               from_seq ? FRAME_SEQ_LEN : 0, broker);
+    } else {
+        char submsg[MAX_LINE];
+        if (from_seq) snprintf(submsg, sizeof(submsg), "%s %s FROM %s\n", reliable ? "RSUB" : "SUB", topic, from_seq);
+        else          snprintf(submsg, sizeof(submsg), "%s %s\n", reliable ? "RSUB" : "SUB", topic);
+        (void)udp_sendto_str(s, submsg, broker);
+    }
+}
+
+/** Reloj monótono en milisegundos. */
+static double now_ms(void) {
+#ifdef _WIN32
+    return (double)GetTickCount64();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+#endif
+}
+
+/**
+ * @brief Lo necesario para mantener viva la suscripción: PING periódico y
+ *        volver a suscribirse si el broker responde que no la tiene.
+ */
+static struct {
+    socket_t s;
+    const struct sockaddr_in *broker;
+    int      binary, reliable;
+    int      ntopics;
+    char   **topics;
+    double   next;          ///< Próximo PING (ms).
+} ka;
+static int ping_ms = PING_DEFAULT_S * 1000;  ///< Período del PING (-k; 0 = sin PING).
+
+static void ka_init(socket_t s, const struct sockaddr_in *broker, int binary, int reliable,
+                    int ntopics, char **topics) {
+    ka.s        = s;
+    ka.broker   = broker;
+    ka.binary   = binary;
+    ka.reliable = reliable;
+    ka.ntopics  = ntopics;
+    ka.topics   = topics;
+    ka.next     = now_ms() + ping_ms;
+}
+
+/**
+ * @brief Manda el PING si ya toca.
+ */
+static void ka_tick(void) {
+    if (ping_ms <= 0) return;
+    double now = now_ms();
+    if (now < ka.next) return;
+    if (ka.binary) (void)udp_sendto_frame(ka.s, FRAME_PING, FRAME_NO_TOPIC, NULL, 0, NULL, 0, ka.broker);
+    else           (void)udp_sendto_str(ka.s, "PING\n", ka.broker);
+    ka.next = now + ping_ms;
+}
+
+/**
+ * @brief Espera el próximo datagrama mandando los PING que toquen mientras tanto.
+ */
+static void ka_wait(void) {
+    if (ping_ms <= 0) return;
+    for (;;) {
+        ka_tick();
+        int ms = (int)(ka.next - now_ms()) + 1;
+        if (udp_wait_readable(ka.s, ms > 0 ? ms : 0) != 0) return;
+    }
+}
+
+/**
+ * @brief PONG con las suscripciones que el broker tiene de esta dirección:
+ *        0 = venció el lease o el broker se reinició sin snapshot.
+ *
+ * Se vuelve a suscribir a todo sin FROM: en modo confiable lo publicado
+ * mientras tanto aparece como un hueco y se pide con NACK.
+ */
+static void ka_pong(uint32_t n) {
+    if (n > 0) return;
+    fprintf(stderr, "PONG 0: el broker no tiene la suscripción, se renueva\n");
+    const char *from = from_seq;
+    from_seq = NULL;
+    for (int i = 0; i < ka.ntopics; i++) send_sub(ka.s, ka.broker, ka.binary, ka.reliable, ka.topics[i]);
+    from_seq = from;
+}
+
+/** Ctrl-C en modo confiable: salir del bucle e informar. */
+static volatile sig_atomic_t stop;
+static void on_sigint(int sig) { (void)sig; stop = 1; }
+
+/**
+ * @brief Modo binario: suscribe con FRAME_SUB y muestra cada FRAME_MSG.
+ */
+static void run_binary(socket_t s, const struct sockaddr_in *broker, int ntopics, char **topics) {
+    static char buf[UDP_MAX_DGRAM + 1];
+    struct sockaddr_in src;
+    frame_t f;
+
+    for (int i = 0; i < ntopics; ++i) {
+        send_sub(s, broker, 1, 0, topics[i]);
+        int n = udp_recvfrom_raw(s, buf, sizeof(buf), &src);
+        if (n <= 0 || frame_decode(buf, n, &f) != n) continue;
+        if (f.op == FRAME_OK)
+            fprintf(stderr, "OK SUB %.*s (id %u)\n", (int)f.name_len, f.name, f.topic);
+        else
+            fprintf(stderr, "ERR %.*s\n", (int)f.len, f.payload);
+    }
+
+    ka_init(s, broker, 1, 0, ntopics, topics);
+    while (1) {
+        ka_wait();
+        int n = udp_recvfrom_raw(s, buf, sizeof(buf), &src);
+        if (n <= 0 || frame_decode(buf, n, &f) != n) continue;
+        if (f.op == FRAME_PONG && f.len >= FRAME_SEQ_LEN)
+            ka_pong(frame_get32((const unsigned char*)f.payload));
+        if (f.op == FRAME_REPLAY && f.len >= FRAME_SEQ_LEN)
+            fprintf(stderr, "REPLAY %.*s %u\n", (int)f.name_len, f.name,
+                    frame_get32((const unsigned char*)f.payload));
+        if (f.op != FRAME_MSG) continue;
+
+        // "MSG <topic> " seguido del payload crudo
+        printf("MSG %.*s ", (int)f.name_len, f.name);
+        fwrite(f.payload, 1, f.len, stdout);
+        putchar('\n');
+        fflush(stdout);
+    }
+}
+
+/**
+ * @brief Numeración recibida de un tópico.
+ */
+typedef struct {
+    char     name[MAX_TOPIC];
+    uint32_t expected;   ///< Próximo número esperado.
+    int      started;    ///< 0 hasta el primer RMSG (se empieza donde se entra).
+} rtopic_t;
+
+/**
+ * @brief Mensaje faltante a la espera de su retransmisión.
+ */
+typedef struct {
+    int      topic;      ///< Posición en el arreglo de rtopic_t.
+    uint32_t seq;
+    double   t0;         ///< Detección del hueco (ms).
+    double   tlast;      ///< Último NACK enviado (ms).
+    int      tries;
+} miss_t;
+
+/**
+ * @brief Estado del modo confiable (-R).
+ */
+typedef struct {
+    socket_t s;
+    const struct sockaddr_in *broker;
+    int      binary;
+    rtopic_t topics[REL_TOPICS];
+    int      ntopics;
+    miss_t   miss[MISS_MAX];
+    int      nmiss;
+    long     received, dups, gaps, recovered, lost;
+    double   lat_sum, lat_max;
+    float   *lat;        ///< Muestras de latencia (ms) para el p99.
+    int      nlat;
+} rel_t;
+
+/** Tópico por nombre; lo agrega si es nuevo. @return Posición, o -1 si no hay lugar. */
+static int rel_topic(rel_t *r, const char *name, int len) {
+    if (len >= MAX_TOPIC) return -1;
+    for (int i = 0; i < r->ntopics; i++)
+        if ((int)strlen(r->topics[i].name) == len && memcmp(r->topics[i].name, name, len) == 0)
+            return i;
+    if (r->ntopics == REL_TOPICS) return -1;
+    rtopic_t *t = &r->topics[r->ntopics];
+    memcpy(t->name, name, len);
+    t->name[len] = '\0';
+    t->started = 0;
+    return r->ntopics++;
+}
+
+/** Pide al broker retransmitir [from, to] del tópico t (to = 0: hasta el último). */
+static void rel_nack(rel_t *r, int t, uint32_t from, uint32_t to) {
+    const char *name = r->topics[t].name;
+    if (r->binary) {
+        unsigned char range[2 * FRAME_SEQ_LEN];
+        frame_put32(range, from);
+        frame_put32(range + FRAME_SEQ_LEN, to);
+        (void)udp_sendto_frame(r->s, FRAME_NACK, FRAME_NO_TOPIC, name, (int)strlen(name),
+                               (const char*)range, sizeof(range), r->broker);
+    } else {
+        char out[MAX_LINE];
+        snprintf(out, sizeof(out), "NACK %s %u %u\n", name, from, to);
+        (void)udp_sendto_str(r->s, out, r->broker);
+    }
+}
+
+/** Quita el hueco i (el último ocupa su lugar). */
+static void rel_drop_miss(rel_t *r, int i) {
+    r->miss[i] = r->miss[--r->nmiss];
+}
+
+/** Muestra un mensaje con el mismo formato que los modos no confiables. */
+static void rel_print(const char *topic, int tlen, const char *payload, int plen) {
+    printf("MSG %.*s ", tlen, topic);
+    fwrite(payload, 1, plen, stdout);
+    putchar('\n');
+}
+
+/**
+ * @brief Procesa un RMSG: entrega, detecta huecos o completa uno pendiente.
+ */
+static void rel_message(rel_t *r, const char *topic, int tlen, uint32_t seq,
+                        const char *payload, int plen) {
+    int t = rel_topic(r, topic, tlen);
+    if (t < 0) return;
+    rtopic_t *tp = &r->topics[t];
+    double now = now_ms();
+
+    if (!tp->started) {
+        tp->started  = 1;
+        tp->expected = seq + 1;
+    } else if (seq == tp->expected) {
+        tp->expected++;
+    } else if (seq_after(seq, tp->expected)) {
+        // Hueco [expected, seq - 1]: se anota y se pide enseguida, sin frenar la entrega.
+        for (uint32_t k = tp->expected; k != seq; k++) {
+            r->gaps++;
+            if (r->nmiss == MISS_MAX) { r->lost++; continue; }
+            miss_t *m = &r->miss[r->nmiss++];
+            m->topic = t; m->seq = k; m->t0 = m->tlast = now; m->tries = 1;
+        }
+        rel_nack(r, t, tp->expected, seq - 1);
+        tp->expected = seq + 1;
+    } else {
+        int i;
+        for (i = 0; i < r->nmiss; i++)
+            if (r->miss[i].topic == t && r->miss[i].seq == seq) break;
+        if (i == r->nmiss) { r->dups++; return; }
+        double lat = now - r->miss[i].t0;
+        r->recovered++;
+        r->lat_sum += lat;
+        if (lat > r->lat_max) r->lat_max = lat;
+        if (r->lat && r->nlat < LAT_SAMPLES) r->lat[r->nlat++] = (float)lat;
+        rel_drop_miss(r, i);
+    }
+    r->received++;
+    rel_print(topic, tlen, payload, plen);
+}
+
+/**
+ * @brief Procesa un LOST: el rango [from, to] ya no se puede recuperar.
+ */
+static void rel_lost(rel_t *r, const char *topic, int tlen, uint32_t from, uint32_t to) {
+    int t = rel_topic(r, topic, tlen);
+    if (t < 0) return;
+    for (int i = 0; i < r->nmiss; ) {
+        miss_t *m = &r->miss[i];
+        if (m->topic == t && !seq_after(from, m->seq) && !seq_after(m->seq, to)) {
+            r->lost++;
+            rel_drop_miss(r, i);
+        } else {
+            i++;
+        }
+    }
+    rtopic_t *tp = &r->topics[t];
+    if (tp->started && !seq_after(tp->expected, to)) {  // pérdida del final (sondeo)
+        r->lost += (long)(to - tp->expected + 1);
+        tp->expected = to + 1;
+    }
+}
+
+/** Repite los NACK vencidos y da por perdidos los que agotaron los intentos. */
+static void rel_retry(rel_t *r, double now) {
+    for (int i = 0; i < r->nmiss; ) {
+        miss_t *m = &r->miss[i];
+        if (now - m->tlast < NACK_RETRY_MS) { i++; continue; }
+        if (m->tries >= NACK_TRIES) { r->lost++; rel_drop_miss(r, i); continue; }
+        m->tries++;
+        m->tlast = now;
+        rel_nack(r, m->topic, m->seq, m->seq);
+        i++;
+    }
+}
+
+static int cmp_float(const void *a, const void *b) {
+    float x = *(const float*)a, y = *(const float*)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Modo confiable: RSUB a cada tópico y recepción con recuperación de huecos.
+ */
+static void run_reliable(socket_t s, const struct sockaddr_in *broker, int binary,
+                         int ntopics, char **topics) {
+    static char buf[UDP_MAX_DGRAM + 1];
+    static rel_t r;
+    struct sockaddr_in src;
+    frame_t f;
+
+    r.s = s;
+    r.broker = broker;
+    r.binary = binary;
+    r.lat = (float*)malloc(LAT_SAMPLES * sizeof(float));
+
+    for (int i = 0; i < ntopics; ++i) {
+        send_sub(s, broker, binary, 1, topics[i]);
+        // Con -f la numeración empieza donde se pidió: un hueco inicial se recupera o se pierde
+        int t = from_seq ? rel_topic(&r, topics[i], (int)strlen(topics[i])) : -1;
+        if (t >= 0) {
+            r.topics[t].started  = 1;
+            r.topics[t].expected = (uint32_t)strtoul(from_seq, NULL, 10);
+        }
+    }
+
+    signal(SIGINT, on_sigint);
+    ka_init(s, broker, binary, 1, ntopics, topics);
+    double last_rx = now_ms(), last_probe = 0;
+    while (!stop) {
+        double now = now_ms();
+        ka_tick();
+        rel_retry(&r, now);
+        if (now - last_rx >= PROBE_MS && now - last_probe >= PROBE_MS) {
+            for (int t = 0; t < r.ntopics; t++)
+                if (r.topics[t].started) rel_nack(&r, t, r.topics[t].expected, 0);
+            last_probe = now;
+        }
+        if (!udp_wait_readable(s, r.nmiss ? NACK_RETRY_MS / 2 : 100)) continue;
+
+        int n = udp_recvfrom_raw(s, buf, sizeof(buf), &src);
+        if (n <= 0) continue;
+        last_rx = now_ms();
+
+        if ((unsigned char)buf[0] == FRAME_MAGIC) {
+            if (frame_decode(buf, n, &f) != n) continue;
+            if (f.op == FRAME_RMSG && f.len >= FRAME_SEQ_LEN) {
+                rel_message(&r, f.name, (int)f.name_len, frame_get32((const unsigned char*)f.payload),
+                            f.payload + FRAME_SEQ_LEN, (int)f.len - FRAME_SEQ_LEN);
+            } else if (f.op == FRAME_LOST && f.len >= 2 * FRAME_SEQ_LEN) {
+                rel_lost(&r, f.name, (int)f.name_len, frame_get32((const unsigned char*)f.payload),
+                         frame_get32((const unsigned char*)f.payload + FRAME_SEQ_LEN));
+            } else if (f.op == FRAME_OK) {
+                fprintf(stderr, "OK RSUB %.*s (id %u)\n", (int)f.name_len, f.name, f.topic);
+            } else if (f.op == FRAME_REPLAY && f.len >= FRAME_SEQ_LEN) {
+                fprintf(stderr, "REPLAY %.*s %u\n", (int)f.name_len, f.name,
+                        frame_get32((const unsigned char*)f.payload));
+            } else if (f.op == FRAME_PONG && f.len >= FRAME_SEQ_LEN) {
+                ka_pong(frame_get32((const unsigned char*)f.payload));
+            } else if (f.op == FRAME_ERR) {
+                fprintf(stderr, "ERR %.*s\n", (int)f.len, f.payload);
+            }
+            continue;
+        }
+
+        char *eol = strpbrk(buf, "\r\n");
+        if (eol) *eol = '\0';
+        if (strncmp(buf, "RMSG ", 5) == 0) {
+            // RMSG <seq> <topic> <payload>
+            char *end, *topic, *sp;
+            uint32_t seq = (uint32_t)strtoul(buf + 5, &end, 10);
+            if (*end != ' ') continue;
+            topic = end + 1;
+            if (!(sp = strchr(topic, ' '))) continue;
+            rel_message(&r, topic, (int)(sp - topic), seq, sp + 1, (int)strlen(sp + 1));
+        } else if (strncmp(buf, "LOST ", 5) == 0) {
+            // LOST <topic> <desde> <hasta>
+            char *topic = buf + 5, *sp = strchr(topic, ' '), *end;
+            if (!sp) continue;
+            uint32_t from = (uint32_t)strtoul(sp + 1, &end, 10);
+            rel_lost(&r, topic, (int)(sp - topic), from, (uint32_t)strtoul(end, NULL, 10));
+        } else if (strncmp(buf, "PONG ", 5) == 0) {
+            ka_pong((uint32_t)strtoul(buf + 5, NULL, 10));
+        } else {
+            fprintf(stderr, "%s\n", buf);  // OK RSUB / REPLAY / ERR
+        }
+    }
+    fflush(stdout);
+
+    double p99 = 0;
+    if (r.nlat > 0) {
+        qsort(r.lat, r.nlat, sizeof(float), cmp_float);
+        p99 = r.lat[(int)(r.nlat * 0.99)];
+    }
+    fprintf(stderr, "[subscriber-udp] %ld recibidos (%ld duplicados), %ld huecos: %ld recuperados, "
+                    "%ld perdidos, %d pendientes; recuperación media %.2f ms, p99 %.2f ms, máx %.2f ms\n",
+            r.received, r.dups, r.gaps, r.recovered, r.lost, r.nmiss,
+            r.recovered ? r.lat_sum / r.recovered : 0.0, p99, r.lat_max);
+    free(r.lat);
+}
 
 int main(int argc, char **argv) {
+    int binary = 0, reliable = 0;
+    while (argc > 1 && argv[1][0] == '-') {
+        if      (strcmp(argv[1], "-B") == 0) binary = 1;
+        else if (strcmp(argv[1], "-R") == 0) reliable = 1;
+        else if (strcmp(argv[1], "-f") == 0 && argc > 2) { from_seq = argv[2]; argv++; argc--; }
+        else if (strcmp(argv[1], "-k") == 0 && argc > 2) { ping_ms = atoi(argv[2]) * 1000; argv++; argc--; }
+        else break;
+        argv++; argc--;
+    }
+
     // Validación de argumentos
     if (argc < 3) {
-        fprintf(stderr, "Uso: %s <host_broker> <topic>\n", argv[0]);
+        fprintf(stderr, "Uso: %s [-B] [-R] [-f seq] [-k segundos] <host_broker> <topic> [topic...]\n", argv[0]);
         return 1;
     }
 
@@ -50,7 +494,6 @@ int main(int argc, char **argv) {
     if (winsock_init() != 0) return 1;
 
     const char *host  = argv[1];  // Dirección IP o hostname del broker
-    const char *topic = argv[2];  // Tópico a suscribirse
 
     // Resolver la dirección IP y puerto del broker
     struct sockaddr_in broker;
@@ -62,27 +505,41 @@ int main(int argc, char **argv) {
     // Crear socket UDP sin necesidad de bind (el SO asigna un puerto efímero)
     socket_t s = udp_socket_unbound();
 
-    // Enviar comando SUB para registrar la suscripción (nuestro IP:puerto)
-    char submsg[MAX_LINE];
-    snprintf(submsg, sizeof(submsg), "SUB %s\n", topic);
-    (void)udp_sendto_str(s, submsg, &broker);
+    if (reliable) {
+        run_reliable(s, &broker, binary, argc - 2, argv + 2);
+        udp_close(s);
+        winsock_cleanup();
+        return 0;
+    }
+    if (binary) run_binary(s, &broker, argc - 2, argv + 2);
 
     // Variables para recibir mensajes
     char buf[MAX_LINE];
     struct sockaddr_in src;
 
-    // Leer confirmación inicial (opcional): "OK SUB <topic>"
-    udp_recvfrom_line(s, buf, sizeof(buf), &src);
-    fprintf(stderr, "%s\n", buf);
+    // Enviar un comando SUB por topic (argv[2..]) para registrar nuestro IP:puerto
+    for (int i = 2; i < argc; ++i) {
+        send_sub(s, &broker, 0, 0, argv[i]);
+
+        // Leer confirmación (opcional): "OK SUB <topic>"
+        udp_recvfrom_line(s, buf, sizeof(buf), &src);
+        fprintf(stderr, "%s\n", buf);
+    }
 
     // Bucle principal de recepción de mensajes
+    ka_init(s, &broker, 0, 0, argc - 2, argv + 2);
     while (1) {
+        ka_wait();
         int n = udp_recvfrom_line(s, buf, sizeof(buf), &src);
         if (n <= 0) continue;
 
         // (Opcional) Validar que los mensajes provengan del broker
         // if (!same_addr(&src, &broker)) continue;
 
+        // El fin del historial es informativo, como la confirmación
+        if (strncmp(buf, "REPLAY ", 7) == 0) { fprintf(stderr, "%s\n", buf); continue; }
+        if (strncmp(buf, "PONG ", 5) == 0) { ka_pong((uint32_t)strtoul(buf + 5, NULL, 10)); continue; }
+
         // Imprimir mensajes: "MSG <topic> <payload>"
         printf("%s\n", buf);
         fflush(stdout);
@@ -1,39 +1,52 @@
 /**
  * @file udp_utils.c
- * @brief Utilidades para sockets UDP en Windows (Winsock2).
+ * @brief Utilidades para sockets UDP en Windows (Winsock2) y Linux (POSIX).
  *
  * Proporciona funciones de apoyo para:
  *  - Inicializar / limpiar Winsock (WSAStartup / WSACleanup).
  *  - Crear socket UDP ligado a cualquier interfaz local (broker).
  *  - Crear socket UDP sin bind (puerto efímero) para clientes.
  *  - Enviar cadenas (sendto) y recibir datagramas como líneas (recvfrom).
+ *  - Enviar y recibir datagramas crudos (tramas binarias de common/frame.h).
+ *  - Recibir y enviar por lotes (recvmmsg / sendmmsg en Linux).
  *  - Resolver IPv4 por IP literal o DNS.
  *
  * Compilación (GCC / MinGW-w64):
  *   gcc <archivos>.c udp_utils.c -o salida.exe -lws2_32
  *
  * Notas:
- *  - Este módulo es específico de Windows (Winsock2).
+ *  - Escrito contra Winsock2; en POSIX udp_utils.h mapea esos nombres a sus
+ *    equivalentes (errno, close()).
  *  - Los helpers devuelven errores básicos; en caso crítico finalizan el proceso.
  */
 
 #define _CRT_SECURE_NO_WARNINGS
+#ifdef __linux__
+  #define _GNU_SOURCE       // recvmmsg() / sendmmsg()
+#endif
 #include "udp_utils.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#ifdef __linux__
+  #include <sys/uio.h>
+  #define HAVE_MMSG 1
+#endif
+
 /**
  * @brief Inicializa la librería Winsock.
  * @return 0 si ok, -1 si falla.
  */
 int winsock_init(void) {
+#ifdef _WIN32
     WSADATA wsa;
     int r = WSAStartup(MAKEWORD(2,2), &wsa);
     if (r != 0) {
         fprintf(stderr, "WSAStartup failed: %d\n", r);
         return -1;
     }
+#endif
     return 0;
 }
 
@@ -41,16 +54,13 @@ int winsock_init(void) {
  * @brief Libera los recursos de Winsock.
  */
 void winsock_cleanup(void) {
+#ifdef _WIN32
     WSACleanup();
+#endif
 }
 
-/**
- * @brief Crea y liga un socket UDP a INADDR_ANY:port (modo servidor/broker).
- *
- * @param port Puerto local (host order) al que se ligará el socket.
- * @return SOCKET válido listo para recvfrom(); aborta el proceso si hay error.
- */
-socket_t udp_bind_any(uint16_t port) {
+/* Crea y liga el socket del broker; con shared también activa SO_REUSEPORT. */
+static socket_t bind_on(uint16_t port, int shared) {
     socket_t s = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
     if (s == INVALID_SOCKET) {
         fprintf(stderr, "socket() failed: %d\n", WSAGetLastError());
@@ -60,6 +70,14 @@ socket_t udp_bind_any(uint16_t port) {
     // Permitir reusar la dirección al reiniciar rápidamente el broker.
     BOOL yes = 1;
     setsockopt(s, SOL_SOCKET, SO_REUSEADDR, (const char*)&yes, sizeof(yes));
+#ifdef SO_REUSEPORT
+    if (shared && setsockopt(s, SOL_SOCKET, SO_REUSEPORT, (const char*)&yes, sizeof(yes)) != 0) {
+        fprintf(stderr, "SO_REUSEPORT failed: %d\n", WSAGetLastError());
+        CLOSESOCK(s); exit(1);
+    }
+#else
+    (void)shared;
+#endif
 
     struct sockaddr_in addr; memset(&addr, 0, sizeof(addr));
     addr.sin_family      = AF_INET;
@@ -73,6 +91,25 @@ socket_t udp_bind_any(uint16_t port) {
     return s;
 }
 
+/**
+ * @brief Crea y liga un socket UDP a INADDR_ANY:port (modo servidor/broker).
+ *
+ * @param port Puerto local (host order) al que se ligará el socket.
+ * @return SOCKET válido listo para recvfrom(); aborta el proceso si hay error.
+ */
+socket_t udp_bind_any(uint16_t port) {
+    return bind_on(port, 0);
+}
+
+/**
+ * @brief Como udp_bind_any() pero con SO_REUSEPORT (un socket por worker).
+ *
+ * @return SOCKET válido listo para recvfrom(); aborta el proceso si hay error.
+ */
+socket_t udp_bind_shared(uint16_t port) {
+    return bind_on(port, 1);
+}
+
 /**
  * @brief Crea un socket UDP sin bind explícito (cliente con puerto efímero).
  *
@@ -111,6 +148,85 @@ int udp_sendto_str(socket_t s, const char *str, const struct sockaddr_in *dst) {
     return sent;
 }
 
+/**
+ * @brief Envía un buffer arbitrario en un datagrama (sendto).
+ *
+ * @return Bytes enviados o -1 si error.
+ */
+int udp_sendto_buf(socket_t s, const char *buf, int len, const struct sockaddr_in *dst) {
+    int sent = sendto(s, buf, len, 0, (const struct sockaddr*)dst, sizeof(*dst));
+    if (sent == SOCKET_ERROR) return -1;
+    return sent;
+}
+
+/**
+ * @brief Codifica una trama y la envía en un único datagrama.
+ *
+ * Las tramas pequeñas se arman en la pila; las grandes en memoria dinámica.
+ *
+ * @return Bytes enviados, o -1 si error o la trama no cabe en un datagrama.
+ */
+int udp_sendto_frame(socket_t s, int op, uint32_t topic, const char *name, int name_len,
+                     const char *payload, uint32_t len, const struct sockaddr_in *dst) {
+    uint32_t total = frame_size(name_len, len);
+    if (total > UDP_MAX_DGRAM) return -1;
+
+    char small[FRAME_HDR + MAX_LINE];
+    char *buf = total <= sizeof(small) ? small : (char*)malloc(total);
+    if (!buf) return -1;
+    int n = frame_encode(buf, op, topic, name, name_len, payload, len);
+    int r = udp_sendto_buf(s, buf, n, dst);
+    if (buf != small) free(buf);
+    return r;
+}
+
+/**
+ * @brief Recibe un datagrama tal cual, terminado en '\0' por comodidad.
+ *
+ * @param s      Socket UDP.
+ * @param buf    Buffer de salida (maxlen-1 bytes útiles).
+ * @param maxlen Tamaño de buf.
+ * @param src    Salida con dirección del emisor (IP:puerto).
+ * @return Bytes recibidos (>=0), -1 si error.
+ */
+int udp_recvfrom_raw(socket_t s, char *buf, int maxlen, struct sockaddr_in *src) {
+    socklen_t srclen = sizeof(*src);
+    int n = recvfrom(s, buf, maxlen - 1, 0, (struct sockaddr*)src, &srclen);
+    if (n == SOCKET_ERROR) return -1;
+    if (n < 0) n = 0;
+    buf[n] = '\0';
+    return n;
+}
+
+/**
+ * @brief Espera con select() hasta ms milisegundos a que s tenga datos.
+ */
+int udp_wait_readable(socket_t s, int ms) {
+    fd_set rd;
+    struct timeval tv;
+    tv.tv_sec  = ms / 1000;
+    tv.tv_usec = (ms % 1000) * 1000;
+    FD_ZERO(&rd);
+    FD_SET(s, &rd);
+    return select((int)s + 1, &rd, NULL, NULL, &tv) > 0;
+}
+
+/**
+ * @brief Fija cuánto puede bloquear una recepción en s (0 o menos = sin límite).
+ * @return 0 si ok, -1 si error.
+ */
+int udp_set_recv_timeout(socket_t s, int ms) {
+    if (ms < 0) ms = 0;
+#ifdef _WIN32
+    DWORD tv = (DWORD)ms;
+#else
+    struct timeval tv;
+    tv.tv_sec  = ms / 1000;
+    tv.tv_usec = (ms % 1000) * 1000;
+#endif
+    return setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, (const char*)&tv, sizeof(tv)) == 0 ? 0 : -1;
+}
+
 /**
  * @brief Recibe un datagrama UDP y lo normaliza a "línea" terminada en '\0'.
  *
@@ -124,11 +240,8 @@ int udp_sendto_str(socket_t s, const char *str, const struct sockaddr_in *dst) {
  * @return Bytes recibidos (>=0), -1 si error.
  */
 int udp_recvfrom_line(socket_t s, char *buf, int maxlen, struct sockaddr_in *src) {
-    int srclen = sizeof(*src);
-    int n = recvfrom(s, buf, maxlen - 1, 0, (struct sockaddr*)src, &srclen);
-    if (n == SOCKET_ERROR) return -1;
-    if (n < 0) n = 0;
-    buf[n] = '\0';
+    int n = udp_recvfrom_raw(s, buf, maxlen, src);
+    if (n < 0) return -1;
 
     // Normaliza fin de línea por si el emisor mandó \n o \r\n
     char *p = strpbrk(buf, "\r\n");
@@ -136,6 +249,166 @@ int udp_recvfrom_line(socket_t s, char *buf, int maxlen, struct sockaddr_in *src
     return n;
 }
 
+/* recvmmsg()/sendmmsg() existen desde Linux 2.6.33 / 3.0; con un kernel o libc
+ * sin ellas (ENOSYS) se pasa al camino de un datagrama por llamada. */
+#ifdef HAVE_MMSG
+static int mmsg_unavailable;
+#endif
+
+/**
+ * @brief Reserva los buffers y cabeceras de un lote de recepción.
+ *
+ * @return 0 si ok, -1 si no hay memoria.
+ */
+int udp_batch_init(udp_batch_t *b, int cap) {
+    memset(b, 0, sizeof(*b));
+    if (cap < 1) cap = 1;
+    if (cap > UDP_BATCH_MAX) cap = UDP_BATCH_MAX;
+    b->cap  = cap;
+    b->data = (char*)malloc((size_t)cap * (UDP_MAX_DGRAM + 1));
+    b->len  = (int*)calloc(cap, sizeof(int));
+    b->src  = (struct sockaddr_in*)calloc(cap, sizeof(struct sockaddr_in));
+    if (!b->data || !b->len || !b->src) { udp_batch_free(b); return -1; }
+
+#ifdef HAVE_MMSG
+    // Cabeceras fijas: cada posición apunta siempre a su buffer y su dirección.
+    struct mmsghdr *h = (struct mmsghdr*)calloc(cap, sizeof(*h) + sizeof(struct iovec));
+    if (!h) { udp_batch_free(b); return -1; }
+    struct iovec *iov = (struct iovec*)(h + cap);
+    for (int i=0; i<cap; i++) {
+        iov[i].iov_base = udp_batch_buf(b, i);
+        iov[i].iov_len  = UDP_MAX_DGRAM;
+        h[i].msg_hdr.msg_iov  = &iov[i];
+        h[i].msg_hdr.msg_iovlen = 1;
+        h[i].msg_hdr.msg_name = &b->src[i];
+    }
+    b->sys = h;
+#endif
+    return 0;
+}
+
+/**
+ * @brief Libera la memoria del lote.
+ */
+void udp_batch_free(udp_batch_t *b) {
+    free(b->data);
+    free(b->len);
+    free(b->src);
+    free(b->sys);
+    memset(b, 0, sizeof(*b));
+}
+
+/**
+ * @brief Recibe hasta cap datagramas con una llamada (bloquea solo por el primero).
+ *
+ * @return Datagramas recibidos, o -1 si error.
+ */
+int udp_recv_batch(socket_t s, udp_batch_t *b) {
+    b->count = 0;
+#ifdef HAVE_MMSG
+    if (!mmsg_unavailable) {
+        struct mmsghdr *h = (struct mmsghdr*)b->sys;
+        for (int i=0; i<b->cap; i++) h[i].msg_hdr.msg_namelen = sizeof(b->src[i]);
+
+        int n = recvmmsg(s, h, b->cap, MSG_WAITFORONE, NULL);
+        if (n < 0) {
+            if (errno != ENOSYS) return -1;
+            mmsg_unavailable = 1;
+        } else {
+            for (int i=0; i<n; i++) {
+                b->len[i] = (int)h[i].msg_len;
+                udp_batch_buf(b, i)[b->len[i]] = '\0';
+            }
+            return b->count = n;
+        }
+    }
+#endif
+    int n = udp_recvfrom_raw(s, udp_batch_buf(b, 0), UDP_MAX_DGRAM + 1, &b->src[0]);
+    if (n < 0) return -1;
+    b->len[0] = n;
+    return b->count = 1;
+}
+
+/**
+ * @brief Reserva una cola de envío de cap datagramas.
+ *
+ * @return 0 si ok, -1 si no hay memoria.
+ */
+int udp_sendq_init(udp_sendq_t *q, int cap) {
+    memset(q, 0, sizeof(*q));
+    if (cap < 1) cap = 1;
+    if (cap > UDP_BATCH_MAX) cap = UDP_BATCH_MAX;
+    q->cap = cap;
+    q->buf = (const char**)calloc(cap, sizeof(*q->buf));
+    q->len = (int*)calloc(cap, sizeof(int));
+    q->dst = (const struct sockaddr_in**)calloc(cap, sizeof(*q->dst));
+#ifdef HAVE_MMSG
+    q->sys = calloc(cap, sizeof(struct mmsghdr) + sizeof(struct iovec));
+    if (!q->sys) { udp_sendq_free(q); return -1; }
+#endif
+    if (!q->buf || !q->len || !q->dst) { udp_sendq_free(q); return -1; }
+    return 0;
+}
+
+/**
+ * @brief Libera la memoria de la cola.
+ */
+void udp_sendq_free(udp_sendq_t *q) {
+    free((void*)q->buf);
+    free(q->len);
+    free((void*)q->dst);
+    free(q->sys);
+    memset(q, 0, sizeof(*q));
+}
+
+/**
+ * @brief Encola un datagrama, enviando la cola primero si está llena.
+ */
+void udp_sendq_add(socket_t s, udp_sendq_t *q, const char *buf, int len,
+                   const struct sockaddr_in *dst) {
+    if (q->count == q->cap) (void)udp_sendq_flush(s, q);
+    q->buf[q->count] = buf;
+    q->len[q->count] = len;
+    q->dst[q->count] = dst;
+    q->count++;
+}
+
+/**
+ * @brief Envía lo encolado (sendmmsg en Linux, sendto en el resto).
+ *
+ * @return Datagramas enviados.
+ */
+int udp_sendq_flush(socket_t s, udp_sendq_t *q) {
+    int sent = 0, i = 0;
+#ifdef HAVE_MMSG
+    if (!mmsg_unavailable && q->count > 1) {
+        struct mmsghdr *h = (struct mmsghdr*)q->sys;
+        struct iovec *iov = (struct iovec*)(h + q->cap);
+        memset(h, 0, (size_t)q->count * sizeof(*h));
+        for (int k=0; k<q->count; k++) {
+            iov[k].iov_base = (void*)q->buf[k];
+            iov[k].iov_len  = (size_t)q->len[k];
+            h[k].msg_hdr.msg_iov     = &iov[k];
+            h[k].msg_hdr.msg_iovlen  = 1;
+            h[k].msg_hdr.msg_name    = (void*)q->dst[k];
+            h[k].msg_hdr.msg_namelen = sizeof(*q->dst[k]);
+        }
+        while (i < q->count) {
+            int n = sendmmsg(s, h + i, q->count - i, 0);
+            if (n > 0) { sent += n; i += n; continue; }
+            if (errno == EINTR) continue;
+            if (errno == ENOSYS) { mmsg_unavailable = 1; break; }
+            i++;  // el datagrama i falló: se descarta, como haría sendto()
+        }
+    }
+#endif
+    for (; i < q->count; i++) {
+        if (udp_sendto_buf(s, q->buf[i], q->len[i], q->dst[i]) >= 0) sent++;
+    }
+    q->count = 0;
+    return sent;
+}
+
 /**
  * @brief Resuelve una dirección IPv4 para host:port (IP literal o DNS).
  *
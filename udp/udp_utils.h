@@ -1,19 +1,23 @@
 /**
  * @file udp_utils.h
- * @brief Definiciones y prototipos de utilidades para sockets UDP (Winsock2 / Windows).
+ * @brief Definiciones y prototipos de utilidades para sockets UDP (Winsock2 / POSIX).
  *
- * Este módulo encapsula funciones básicas para trabajar con **UDP** en Windows:
+ * Este módulo encapsula funciones básicas para trabajar con **UDP** en Windows y Linux:
  *  - Inicialización y limpieza de Winsock.
  *  - Creación de sockets UDP (ligado a puerto o efímero).
  *  - Envío de cadenas con `sendto()` y recepción “por línea” con `recvfrom()`.
+ *  - Envío y recepción de datagramas crudos (tramas binarias, ver common/frame.h).
+ *  - Recepción y envío por lotes (recvmmsg / sendmmsg en Linux, un datagrama
+ *    por llamada en el resto).
  *  - Resolución IPv4 por IP literal o DNS.
  *
  * Compilación (GCC / MinGW-w64):
  * @code
- * gcc <archivos>.c udp_utils.c -o salida.exe -lws2_32
+ * gcc <archivos>.c udp_utils.c -o salida.exe -lws2_32     (Windows)
+ * gcc <archivos>.c udp_utils.c -o salida                  (Linux)
  * @endcode
  *
- * Compatibilidad: **solo Windows** (Winsock2).
+ * Compatibilidad: Windows (Winsock2) y Linux (POSIX).
  */
 
 #ifndef UDP_UTILS_H
@@ -26,10 +30,31 @@
   typedef SOCKET socket_t;
   #define CLOSESOCK(s) closesocket(s)
 #else
-  #error "Este build es solo para Windows/Winsock2"
+  #if defined(__STRICT_ANSI__) && !defined(_POSIX_C_SOURCE) && !defined(_XOPEN_SOURCE) \
+      && !defined(_GNU_SOURCE)
+    #define _POSIX_C_SOURCE 200809L  // -std=c11: ver common/threads.h
+    #define _DEFAULT_SOURCE
+  #endif
+  #include <sys/types.h>
+  #include <sys/socket.h>
+  #include <sys/select.h>
+  #include <netinet/in.h>
+  #include <arpa/inet.h>
+  #include <netdb.h>
+  #include <unistd.h>
+  #include <errno.h>
+  typedef int socket_t;
+  typedef int BOOL;
+  #define INVALID_SOCKET     (-1)
+  #define SOCKET_ERROR       (-1)
+  #define CLOSESOCK(s)       close(s)
+  /* Equivalencias mínimas para que el código escrito contra Winsock compile en POSIX. */
+  #define WSAGetLastError()  (errno)
+  #define WSAEINTR           EINTR
 #endif
 
 #include <stdint.h>
+#include "../common/frame.h"
 
 /** Puerto por defecto del broker UDP (evita colisión con TCP 8080). */
 #define BROKER_UDP_PORT 8081
@@ -37,6 +62,15 @@
 #define MAX_LINE        1024
 /** Longitud máxima permitida para nombres de tópicos. */
 #define MAX_TOPIC       64
+/** Tamaño máximo de un datagrama UDP sobre IPv4 (límite de una trama binaria). */
+#define UDP_MAX_DGRAM   65507
+/** Datagramas por lote de recepción / envío (por defecto). */
+#define UDP_BATCH       64
+/** Tope de datagramas por lote (límite de -m en el broker). */
+#define UDP_BATCH_MAX   1024
+/** SPUB sin confirmar como máximo por publicador (-a de publisher_udp): es
+ *  lo que el broker sigue por encima del último ACK para confirmar en orden. */
+#define UDP_ACK_WINDOW  1024
 
 /**
  * @brief Inicializa la pila de sockets de Windows (WSAStartup).
@@ -56,6 +90,24 @@ void winsock_cleanup(void);
  */
 socket_t udp_bind_any(uint16_t port);
 
+/**
+ * @brief Como udp_bind_any() pero con SO_REUSEPORT.
+ *
+ * Varios sockets (uno por worker) comparten el puerto y el kernel reparte los
+ * datagramas por dirección de origen: los de un mismo cliente llegan siempre
+ * al mismo socket. Solo existe donde UDP_HAVE_REUSEPORT vale 1.
+ *
+ * @return Socket válido listo para `recvfrom()`.
+ */
+socket_t udp_bind_shared(uint16_t port);
+
+/** 1 si la plataforma reparte datagramas entre sockets con SO_REUSEPORT (Linux). */
+#if defined(SO_REUSEPORT) && defined(__linux__)
+  #define UDP_HAVE_REUSEPORT 1
+#else
+  #define UDP_HAVE_REUSEPORT 0
+#endif
+
 /**
  * @brief Crea un socket UDP sin bind explícito (cliente con puerto efímero).
  * @return Socket válido listo para `sendto()` / `recvfrom()`.
@@ -93,6 +145,126 @@ int  udp_sendto_str(socket_t s, const char *str,
 int  udp_recvfrom_line(socket_t s, char *buf, int maxlen,
                        struct sockaddr_in *src);
 
+/**
+ * @brief Envía un buffer arbitrario (p.ej. una trama binaria) en un datagrama.
+ * @return Bytes enviados o -1 en error.
+ */
+int  udp_sendto_buf(socket_t s, const char *buf, int len,
+                    const struct sockaddr_in *dst);
+
+/**
+ * @brief Envía una trama binaria completa en un datagrama.
+ * @return Bytes enviados, o -1 en error o si la trama excede UDP_MAX_DGRAM.
+ */
+int  udp_sendto_frame(socket_t s, int op, uint32_t topic, const char *name, int name_len,
+                      const char *payload, uint32_t len, const struct sockaddr_in *dst);
+
+/**
+ * @brief Recibe un datagrama sin interpretarlo (no corta en `\r` / `\n`).
+ *
+ * Agrega un `'\0'` después de los datos por comodidad (no cuenta en el resultado).
+ *
+ * @return Bytes recibidos (>=0), -1 en error.
+ */
+int  udp_recvfrom_raw(socket_t s, char *buf, int maxlen,
+                      struct sockaddr_in *src);
+
+/**
+ * @brief Espera hasta ms milisegundos a que haya un datagrama para leer.
+ * @return 1 si hay, 0 si venció el plazo (o fue interrumpida por una señal).
+ */
+int  udp_wait_readable(socket_t s, int ms);
+
+/**
+ * @brief Fija cuánto puede bloquear una recepción en s (SO_RCVTIMEO).
+ *
+ * Vencido el plazo, la recepción devuelve -1 (EAGAIN / WSAETIMEDOUT).
+ *
+ * @param ms Milisegundos; 0 o negativo = sin límite.
+ * @return 0 si ok, -1 si error.
+ */
+int  udp_set_recv_timeout(socket_t s, int ms);
+
+/**
+ * @brief Lote de datagramas recibidos con una sola llamada (udp_recv_batch()).
+ *
+ * Cada posición tiene su propio buffer de UDP_MAX_DGRAM + 1 bytes, así los
+ * datagramas del lote siguen válidos hasta la próxima recepción.
+ */
+typedef struct {
+    int   cap;                  ///< Datagramas por lote.
+    int   count;                ///< Recibidos en la última llamada.
+    char *data;                 ///< cap buffers contiguos (ver udp_batch_buf()).
+    int  *len;                  ///< Longitud de cada datagrama recibido.
+    struct sockaddr_in *src;    ///< Emisor de cada datagrama.
+    void *sys;                  ///< Cabeceras de recvmmsg() (solo Linux).
+} udp_batch_t;
+
+/**
+ * @brief Reserva un lote de cap datagramas (1..UDP_BATCH_MAX).
+ * @return 0 si ok, -1 si no hay memoria.
+ */
+int  udp_batch_init(udp_batch_t *b, int cap);
+
+/**
+ * @brief Libera la memoria del lote.
+ */
+void udp_batch_free(udp_batch_t *b);
+
+/** Buffer del datagrama i del lote (terminado en '\0' tras len[i] bytes). */
+#define udp_batch_buf(b, i) ((b)->data + (size_t)(i) * (UDP_MAX_DGRAM + 1))
+
+/**
+ * @brief Espera al menos un datagrama y recibe los que ya estén en cola, hasta cap.
+ *
+ * En Linux usa una sola llamada recvmmsg(MSG_WAITFORONE); donde no existe (o
+ * el kernel devuelve ENOSYS) recibe un único datagrama con recvfrom().
+ *
+ * @return Datagramas recibidos (también en b->count), o -1 en error.
+ */
+int  udp_recv_batch(socket_t s, udp_batch_t *b);
+
+/**
+ * @brief Cola de datagramas salientes que se envían juntos con udp_sendq_flush().
+ *
+ * Solo guarda punteros: buffers y direcciones deben seguir vivos hasta el flush.
+ */
+typedef struct {
+    int   cap;                          ///< Datagramas por envío.
+    int   count;                        ///< Datagramas encolados.
+    const char **buf;                   ///< Datos de cada datagrama.
+    int  *len;                          ///< Longitud de cada datagrama.
+    const struct sockaddr_in **dst;     ///< Destino de cada datagrama.
+    void *sys;                          ///< Cabeceras de sendmmsg() (solo Linux).
+} udp_sendq_t;
+
+/**
+ * @brief Reserva una cola de envío de cap datagramas (1..UDP_BATCH_MAX).
+ * @return 0 si ok, -1 si no hay memoria.
+ */
+int  udp_sendq_init(udp_sendq_t *q, int cap);
+
+/**
+ * @brief Libera la memoria de la cola (no envía lo pendiente).
+ */
+void udp_sendq_free(udp_sendq_t *q);
+
+/**
+ * @brief Encola un datagrama; si la cola se llena la envía antes de seguir.
+ */
+void udp_sendq_add(socket_t s, udp_sendq_t *q, const char *buf, int len,
+                   const struct sockaddr_in *dst);
+
+/**
+ * @brief Envía todo lo encolado y vacía la cola.
+ *
+ * En Linux usa sendmmsg() (una llamada por lote); en el resto un sendto() por
+ * datagrama. Un datagrama que falla se descarta, igual que con sendto().
+ *
+ * @return Datagramas enviados.
+ */
+int  udp_sendq_flush(socket_t s, udp_sendq_t *q);
+
 /**
  * @brief Resuelve una dirección IPv4 para `host:port` (IP literal o DNS).
  * @param host Cadena con IP (p.ej. "127.0.0.1") o nombre DNS.